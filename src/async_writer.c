@@ -0,0 +1,507 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* O_DIRECT is a GNU extension */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define THIS_FILE	"async_writer.c"
+
+#define SIGNATURE	PJMEDIA_SIG_CLASS_PORT_AUD('A','W')
+
+/* Default size of the ring, in ms of audio */
+#define DEFAULT_BUF_MS	5000
+
+/* Size of a full batch, and the block size writes are made of. With
+ * O_DIRECT the buffer, the length and the file offset of every write
+ * must be multiples of the block size.
+ */
+#define BATCH_SIZE	(64 * 1024)
+#define BLOCK_SIZE	4096
+
+/* How often the thread looks at the ring, and how long samples may wait
+ * there for a full batch before they are written in a smaller one, in ms.
+ */
+#define POLL_MS		10
+#define MAX_WAIT_MS	1000
+
+/* Ring positions, written by one side and read by the other */
+#if defined(__GNUC__)
+#   define RING_LOAD(p)		    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#   define RING_STORE(p, v)	    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#   include <windows.h>
+#   define RING_LOAD(p)		    ((unsigned)InterlockedCompareExchange( \
+					(LONG volatile*)(p), 0, 0))
+#   define RING_STORE(p, v)	    InterlockedExchange((LONG volatile*)(p), \
+						(LONG)(v))
+#else
+#   error "Atomic operations are not available for this compiler"
+#endif
+
+
+/* The thread writing the files, shared by any number of ports */
+struct async_writer_io
+{
+    pj_thread_t		*thread;
+    pj_mutex_t		*mutex;		/**< Guards the list of ports, never
+					     taken by put_frame().	    */
+    struct async_writer	*writers;	/**< The ports.			    */
+    unsigned		 quit;
+};
+
+struct async_writer
+{
+    pjmedia_port	 base;
+    struct async_writer	*next;		/**< Next port of the thread.	    */
+    async_writer_io	*io;
+    pj_bool_t		 own_io;	/**< The thread is the port's own.  */
+    pj_str_t		 filename;
+    int			 fd;
+    pj_bool_t		 o_direct;	/**< Opened with O_DIRECT.	    */
+    pj_bool_t		 direct;	/**< Page cache bypassed.	    */
+    pj_uint8_t		*ring;
+    unsigned		 mask;		/**< Ring size - 1, the size is a
+					     power of two.		    */
+
+    /* Written by put_frame() only */
+    unsigned		 write_pos;	/**< Bytes put.			    */
+    pj_uint32_t		 frames;
+    pj_uint32_t		 overruns;
+    unsigned		 max_level;
+
+    /* Written by the thread only, or once it has stopped */
+    unsigned		 read_pos;	/**< Bytes taken from the ring.	    */
+    pj_uint8_t		*batch;		/**< Aligned, BATCH_SIZE bytes.	    */
+    unsigned		 batch_len;	/**< Bytes in it.		    */
+    pj_off_t		 file_pos;	/**< Where the batch goes.	    */
+    pj_time_val		 last_write;
+    pj_uint32_t		 batches;
+    pj_uint32_t		 write_errors;
+    pj_uint32_t		 max_write_usec;
+};
+
+
+static void init_header(pjmedia_wave_hdr *hdr, unsigned clock_rate,
+			unsigned channel_count, pj_uint32_t data_len)
+{
+    pj_bzero(hdr, sizeof(*hdr));
+    hdr->riff_hdr.riff = PJMEDIA_RIFF_TAG;
+    hdr->riff_hdr.file_len = data_len + sizeof(pjmedia_wave_hdr) - 8;
+    hdr->riff_hdr.wave = PJMEDIA_WAVE_TAG;
+    hdr->fmt_hdr.fmt = PJMEDIA_FMT_TAG;
+    hdr->fmt_hdr.len = 16;
+    hdr->fmt_hdr.fmt_tag = (pj_uint16_t)PJMEDIA_WAVE_FMT_TAG_PCM;
+    hdr->fmt_hdr.nchan = (pj_int16_t)channel_count;
+    hdr->fmt_hdr.sample_rate = clock_rate;
+    hdr->fmt_hdr.bytes_per_sec = clock_rate * channel_count * 2;
+    hdr->fmt_hdr.block_align = (pj_uint16_t)(channel_count * 2);
+    hdr->fmt_hdr.bits_per_sample = 16;
+    hdr->data_hdr.data = PJMEDIA_DATA_TAG;
+    hdr->data_hdr.len = data_len;
+
+    pjmedia_wave_hdr_host_to_file(hdr);
+}
+
+/* Move what the ring holds into the batch, as much as fits */
+static void fill_batch(struct async_writer *aw)
+{
+    unsigned avail = RING_LOAD(&aw->write_pos) - aw->read_pos;
+    unsigned cnt = PJ_MIN(avail, BATCH_SIZE - aw->batch_len);
+    unsigned off = aw->read_pos & aw->mask;
+    unsigned part = PJ_MIN(cnt, aw->mask + 1 - off);
+    pj_uint8_t *dst = aw->batch + aw->batch_len;
+
+    pj_memcpy(dst, aw->ring + off, part);
+    pj_memcpy(dst + part, aw->ring, cnt - part);
+
+#if defined(PJ_IS_BIG_ENDIAN) && PJ_IS_BIG_ENDIAN != 0
+    {
+	unsigned i;
+
+	for (i = 0; i < cnt; i += 2) {
+	    pj_uint8_t t = dst[i];
+	    dst[i] = dst[i + 1];
+	    dst[i + 1] = t;
+	}
+    }
+#endif
+
+    aw->batch_len += cnt;
+    RING_STORE(&aw->read_pos, aw->read_pos + cnt);
+}
+
+/* Write the first len bytes of the batch and keep the rest */
+static void write_batch(struct async_writer *aw, unsigned len)
+{
+    pj_timestamp t0, t1;
+    pj_uint32_t usec;
+    unsigned done = 0;
+
+    pj_get_timestamp(&t0);
+    while (done < len) {
+	ssize_t n = pwrite(aw->fd, aw->batch + done, len - done,
+			   (off_t)(aw->file_pos + done));
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0) {
+	    if (aw->write_errors++ == 0) {
+		char errmsg[PJ_ERR_MSG_SIZE];
+
+		pj_strerror(n < 0 ? PJ_RETURN_OS_ERROR(errno) : PJ_EUNKNOWN,
+			    errmsg, sizeof(errmsg));
+		PJ_LOG(2,(THIS_FILE, "Error writing %s: %s",
+			  aw->filename.ptr, errmsg));
+	    }
+	    break;
+	}
+	done += (unsigned)n;
+    }
+    pj_get_timestamp(&t1);
+
+    usec = pj_elapsed_usec(&t0, &t1);
+    if (usec > aw->max_write_usec)
+	aw->max_write_usec = usec;
+    ++aw->batches;
+    pj_gettickcount(&aw->last_write);
+
+    /* A failed write leaves a hole, not the rest of the file shifted */
+    aw->file_pos += len;
+    aw->batch_len -= len;
+    pj_memmove(aw->batch, aw->batch + len, aw->batch_len);
+}
+
+/* Write the full batches the ring holds. What's left is written in whole
+ * blocks once it has waited long enough, or at once to drain.
+ */
+static void flush(struct async_writer *aw, pj_bool_t drain)
+{
+    pj_time_val now;
+
+    for (fill_batch(aw); aw->batch_len == BATCH_SIZE; fill_batch(aw))
+	write_batch(aw, BATCH_SIZE);
+
+    if (aw->batch_len < BLOCK_SIZE)
+	return;
+
+    pj_gettickcount(&now);
+    PJ_TIME_VAL_SUB(now, aw->last_write);
+    if (drain || PJ_TIME_VAL_MSEC(now) >= MAX_WAIT_MS)
+	write_batch(aw, aw->batch_len & ~(BLOCK_SIZE - 1));
+}
+
+static int PJ_THREAD_FUNC io_thread(void *arg)
+{
+    async_writer_io *io = (async_writer_io*)arg;
+    struct async_writer *aw;
+
+    while (!RING_LOAD(&io->quit)) {
+	pj_mutex_lock(io->mutex);
+	for (aw = io->writers; aw; aw = aw->next)
+	    flush(aw, PJ_FALSE);
+	pj_mutex_unlock(io->mutex);
+
+	pj_thread_sleep(POLL_MS);
+    }
+
+    return 0;
+}
+
+
+static pj_status_t aw_put_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame)
+{
+    struct async_writer *aw = (struct async_writer*)this_port;
+    unsigned size = (unsigned)frame->size & ~1U;
+    unsigned used, off, part;
+
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO || size == 0)
+	return PJ_SUCCESS;
+
+    ++aw->frames;
+
+    /* Never wait for the disk */
+    used = aw->write_pos - RING_LOAD(&aw->read_pos);
+    if (size > aw->mask + 1 - used) {
+	++aw->overruns;
+	return PJ_SUCCESS;
+    }
+
+    off = aw->write_pos & aw->mask;
+    part = PJ_MIN(size, aw->mask + 1 - off);
+    pj_memcpy(aw->ring + off, frame->buf, part);
+    pj_memcpy(aw->ring, (const pj_uint8_t*)frame->buf + part, size - part);
+    RING_STORE(&aw->write_pos, aw->write_pos + size);
+
+    if (used + size > aw->max_level)
+	aw->max_level = used + size;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t aw_on_destroy(pjmedia_port *this_port)
+{
+    struct async_writer *aw = (struct async_writer*)this_port;
+    struct async_writer **pp;
+    pjmedia_wave_hdr hdr;
+
+    if (aw->fd < 0)
+	return PJ_SUCCESS;
+
+    /* The thread leaves the port alone from then on */
+    pj_mutex_lock(aw->io->mutex);
+    for (pp = &aw->io->writers; *pp != aw; pp = &(*pp)->next)
+	;
+    *pp = aw->next;
+    pj_mutex_unlock(aw->io->mutex);
+
+    if (aw->own_io)
+	async_writer_io_destroy(aw->io);
+    aw->io = NULL;
+
+    flush(aw, PJ_TRUE);
+
+    /* The tail is shorter than a block, O_DIRECT can't write it */
+    if (aw->o_direct) {
+	close(aw->fd);
+	aw->fd = open(aw->filename.ptr, O_WRONLY);
+	aw->o_direct = PJ_FALSE;
+	if (aw->fd < 0) {
+	    PJ_LOG(2,(THIS_FILE, "Error reopening %s, the file is truncated",
+		      aw->filename.ptr));
+	    return PJ_RETURN_OS_ERROR(errno);
+	}
+    }
+    if (aw->batch_len)
+	write_batch(aw, aw->batch_len);
+
+    /* Now that the length is known */
+    init_header(&hdr, PJMEDIA_PIA_SRATE(&aw->base.info),
+		PJMEDIA_PIA_CCNT(&aw->base.info),
+		(pj_uint32_t)(aw->file_pos - sizeof(hdr)));
+    if (pwrite(aw->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+	++aw->write_errors;
+
+    close(aw->fd);
+    aw->fd = -1;
+
+    PJ_LOG(5,(THIS_FILE, "%s closed: %u frames, %u overruns, %u writes, "
+	      "%u errors, longest write %u usec", aw->filename.ptr,
+	      aw->frames, aw->overruns, aw->batches, aw->write_errors,
+	      aw->max_write_usec));
+
+    return PJ_SUCCESS;
+}
+
+
+/* Open the file, with O_DIRECT or F_NOCACHE when asked and available */
+static pj_status_t open_file(struct async_writer *aw, pj_bool_t direct)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    aw->fd = -1;
+#if defined(O_DIRECT)
+    if (direct) {
+	aw->fd = open(aw->filename.ptr, flags | O_DIRECT, 0644);
+	aw->o_direct = aw->direct = (aw->fd >= 0);
+    }
+#endif
+    if (aw->fd < 0)
+	aw->fd = open(aw->filename.ptr, flags, 0644);
+    if (aw->fd < 0)
+	return PJ_RETURN_OS_ERROR(errno);
+
+#if defined(F_NOCACHE)
+    if (direct && fcntl(aw->fd, F_NOCACHE, 1) == 0)
+	aw->direct = PJ_TRUE;
+#endif
+
+    return PJ_SUCCESS;
+}
+
+pj_status_t async_writer_io_create(pj_pool_t *pool, async_writer_io **p_io)
+{
+    async_writer_io *io;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && p_io, PJ_EINVAL);
+
+    io = PJ_POOL_ZALLOC_T(pool, async_writer_io);
+
+    status = pj_mutex_create_simple(pool, "asyncio", &io->mutex);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pj_thread_create(pool, "asyncio", &io_thread, io, 0, 0,
+			      &io->thread);
+    if (status != PJ_SUCCESS) {
+	pj_mutex_destroy(io->mutex);
+	return status;
+    }
+
+    *p_io = io;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t async_writer_io_destroy(async_writer_io *io)
+{
+    PJ_ASSERT_RETURN(io, PJ_EINVAL);
+    PJ_ASSERT_RETURN(io->writers == NULL, PJ_EBUSY);
+
+    RING_STORE(&io->quit, 1);
+    pj_thread_join(io->thread);
+    pj_thread_destroy(io->thread);
+    pj_mutex_destroy(io->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t async_writer_create(pj_pool_t *pool,
+				const char *filename,
+				unsigned clock_rate,
+				unsigned channel_count,
+				unsigned samples_per_frame,
+				unsigned bits_per_sample,
+				unsigned options,
+				pj_ssize_t buff_size,
+				pjmedia_port **p_port)
+{
+    async_writer_io *io;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && p_port, PJ_EINVAL);
+
+    status = async_writer_io_create(pool, &io);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = async_writer_create_shared(io, pool, filename, clock_rate,
+					channel_count, samples_per_frame,
+					bits_per_sample, options, buff_size,
+					p_port);
+    if (status != PJ_SUCCESS) {
+	async_writer_io_destroy(io);
+	return status;
+    }
+
+    ((struct async_writer*)*p_port)->own_io = PJ_TRUE;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t async_writer_create_shared(async_writer_io *io,
+				       pj_pool_t *pool,
+				       const char *filename,
+				       unsigned clock_rate,
+				       unsigned channel_count,
+				       unsigned samples_per_frame,
+				       unsigned bits_per_sample,
+				       unsigned options,
+				       pj_ssize_t buff_size,
+				       pjmedia_port **p_port)
+{
+    struct async_writer *aw;
+    pj_uint64_t size;
+    unsigned cap;
+    pj_uint8_t *p;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(io && pool && filename && clock_rate && channel_count &&
+		     samples_per_frame && p_port, PJ_EINVAL);
+    PJ_ASSERT_RETURN(bits_per_sample == 16, PJMEDIA_ENCBITS);
+
+    aw = PJ_POOL_ZALLOC_T(pool, struct async_writer);
+    pj_strdup2_with_null(pool, &aw->filename, filename);
+
+    /* Room for two batches and two frames at least */
+    size = buff_size > 0 ? (pj_uint64_t)buff_size :
+	   (pj_uint64_t)clock_rate * channel_count * 2 * DEFAULT_BUF_MS / 1000;
+    size = PJ_MAX(size, 2 * BATCH_SIZE);
+    size = PJ_MAX(size, (pj_uint64_t)samples_per_frame * 4);
+    for (cap = BLOCK_SIZE; cap < size && cap < 0x40000000; cap <<= 1)
+	;
+    aw->mask = cap - 1;
+    aw->ring = (pj_uint8_t*) pj_pool_alloc(pool, cap);
+
+    p = (pj_uint8_t*) pj_pool_alloc(pool, BATCH_SIZE + BLOCK_SIZE);
+    aw->batch = (pj_uint8_t*)(((pj_size_t)p + BLOCK_SIZE - 1) &
+			      ~(pj_size_t)(BLOCK_SIZE - 1));
+    if (!aw->ring || !p)
+	return PJ_ENOMEM;
+
+    status = open_file(aw, (options & ASYNC_WRITER_DIRECT) != 0);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* The header goes with the first batch, to keep the writes aligned.
+     * It's written again with the lengths on close.
+     */
+    init_header((pjmedia_wave_hdr*)aw->batch, clock_rate, channel_count, 0);
+    aw->batch_len = sizeof(pjmedia_wave_hdr);
+    pj_gettickcount(&aw->last_write);
+
+    pjmedia_port_info_init(&aw->base.info, &aw->filename, SIGNATURE,
+			   clock_rate, channel_count, 16, samples_per_frame);
+    aw->base.put_frame = &aw_put_frame;
+    aw->base.on_destroy = &aw_on_destroy;
+
+    aw->io = io;
+    pj_mutex_lock(io->mutex);
+    aw->next = io->writers;
+    io->writers = aw;
+    pj_mutex_unlock(io->mutex);
+
+    PJ_LOG(5,(THIS_FILE, "%s opened, %u bytes ring%s", filename, cap,
+	      aw->direct ? ", page cache bypassed" : ""));
+
+    *p_port = &aw->base;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t async_writer_get_stat(pjmedia_port *port,
+				  async_writer_stat *stat)
+{
+    struct async_writer *aw = (struct async_writer*)port;
+
+    PJ_ASSERT_RETURN(port && stat && port->info.signature == SIGNATURE,
+		     PJ_EINVAL);
+
+    pj_bzero(stat, sizeof(*stat));
+    stat->frames = aw->frames;
+    stat->overruns = aw->overruns;
+    stat->buf_size = aw->mask + 1;
+    stat->max_level = aw->max_level;
+    stat->batches = aw->batches;
+    stat->write_errors = aw->write_errors;
+    stat->max_write_usec = aw->max_write_usec;
+    stat->direct = aw->direct;
+
+    return PJ_SUCCESS;
+}
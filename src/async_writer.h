@@ -0,0 +1,158 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __ASYNC_WRITER_H__
+#define __ASYNC_WRITER_H__
+
+/**
+ * @file async_writer.h
+ * @brief WAV writer port writing from a background thread.
+ *
+ * pjmedia_wav_writer_port_create() writes the file from put_frame(), on
+ * the audio callback or the bridge clock thread, so a slow disk stalls
+ * the media. This port's put_frame() only copies the frame into a
+ * lock-free ring. A thread of its own takes the samples out and writes
+ * them in large batches, optionally bypassing the page cache. When the
+ * disk is slower than the audio for longer than the ring holds, frames
+ * are dropped and counted, put_frame() never waits.
+ *
+ * Ports may also share one thread, see async_writer_io_create(), so that
+ * many files recorded together are written by a single pipeline.
+ *
+ * Only 16 bit linear PCM is written.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque declaration of a writing thread.
+ */
+typedef struct async_writer_io async_writer_io;
+
+/**
+ * Writer options.
+ */
+typedef enum async_writer_option
+{
+    /**
+     * Bypass the page cache: O_DIRECT on Linux, F_NOCACHE on macOS.
+     * Ignored where the file system does not support it.
+     */
+    ASYNC_WRITER_DIRECT = 1
+
+} async_writer_option;
+
+/**
+ * Writer statistics.
+ */
+typedef struct async_writer_stat
+{
+    pj_uint32_t	    frames;	    /**< Frames put.			    */
+    pj_uint32_t	    overruns;	    /**< Frames dropped, the ring was
+					 full.				    */
+    unsigned	    buf_size;	    /**< Size of the ring, in bytes.	    */
+    unsigned	    max_level;	    /**< Most bytes waiting in the ring.    */
+    pj_uint32_t	    batches;	    /**< Writes to the file.		    */
+    pj_uint32_t	    write_errors;   /**< Writes that failed.		    */
+    pj_uint32_t	    max_write_usec; /**< Longest write.			    */
+    pj_bool_t	    direct;	    /**< The page cache is bypassed.	    */
+} async_writer_stat;
+
+
+/**
+ * Create a thread to be shared by writer ports, see
+ * async_writer_create_shared().
+ *
+ * @param pool		    Pool to allocate the thread.
+ * @param p_io		    Pointer to receive the thread.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t async_writer_io_create(pj_pool_t *pool, async_writer_io **p_io);
+
+/**
+ * Stop and destroy the thread. Its ports must have been destroyed.
+ *
+ * @param io		    The thread.
+ *
+ * @return		    PJ_SUCCESS on success, PJ_EBUSY if a port is
+ *			    left.
+ */
+pj_status_t async_writer_io_destroy(async_writer_io *io);
+
+/**
+ * Create a writer port with a thread of its own, as
+ * pjmedia_wav_writer_port_create().
+ *
+ * @param pool		    Pool to allocate the port and its buffers.
+ * @param filename	    The WAV file to create.
+ * @param clock_rate	    Clock rate.
+ * @param channel_count	    Number of channels.
+ * @param samples_per_frame Samples per frame, of all channels.
+ * @param bits_per_sample   Must be 16.
+ * @param options	    Bitmask of #async_writer_option.
+ * @param buff_size	    Size of the ring in bytes, rounded up to a power
+ *			    of two, or zero for five seconds of audio.
+ * @param p_port	    Pointer to receive the port.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t async_writer_create(pj_pool_t *pool,
+				const char *filename,
+				unsigned clock_rate,
+				unsigned channel_count,
+				unsigned samples_per_frame,
+				unsigned bits_per_sample,
+				unsigned options,
+				pj_ssize_t buff_size,
+				pjmedia_port **p_port);
+
+/**
+ * Create a writer port written by a shared thread. The parameters are
+ * those of async_writer_create().
+ *
+ * @param io		    The thread.
+ */
+pj_status_t async_writer_create_shared(async_writer_io *io,
+				       pj_pool_t *pool,
+				       const char *filename,
+				       unsigned clock_rate,
+				       unsigned channel_count,
+				       unsigned samples_per_frame,
+				       unsigned bits_per_sample,
+				       unsigned options,
+				       pj_ssize_t buff_size,
+				       pjmedia_port **p_port);
+
+/**
+ * Get the statistics.
+ *
+ * @param port		    The writer port.
+ * @param stat		    The statistics.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t async_writer_get_stat(pjmedia_port *port,
+				  async_writer_stat *stat);
+
+
+PJ_END_DECL
+
+#endif	/* __ASYNC_WRITER_H__ */
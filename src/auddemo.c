@@ -23,9 +23,21 @@
 #include <pjlib.h>
 #include <pjlib-util.h>
 
+#include "async_writer.h"
+#include "mmap_player.h"
+#include "virtual_dev.h"
+
+#include <stdlib.h>	/* calloc() */
+#include <math.h>	/* sqrt() */
+#include <time.h>	/* clock_gettime() */
+#include <fcntl.h>	/* open() */
+#include <unistd.h>	/* write(), fsync() */
+
 #define THIS_FILE	"auddemo.c"
 #define MAX_DEVICES	64
 #define WAV_FILE	"auddemo.wav"
+#define BENCH_FILE	"auddemo_bench.csv"
+#define WBENCH_FILE	"auddemo_wbench.wav"
 
 
 static unsigned dev_count;
@@ -242,6 +254,320 @@ static void test_device(pjmedia_dir dir, unsigned rec_id, unsigned play_id,
 }
 
 
+/*
+ * Device benchmark: runs the device over a matrix of clock rates, ptimes
+ * and channel counts, timing every callback, and writes the results as
+ * CSV, or as JSON when the file name ends with ".json".
+ */
+#define BENCH_BUCKET_USEC   250	    /* Width of a histogram bucket.	*/
+#define BENCH_BUCKETS	    400	    /* Up to 100 ms, and one more for
+				       the intervals over it.		*/
+#define BENCH_WARMUP	    5	    /* Callbacks not to count.		*/
+
+static const unsigned bench_rates[] = { 8000, 16000, 32000, 44100, 48000 };
+static const unsigned bench_ptimes[] = { 10, 20, 40 };
+static const unsigned bench_chnums[] = { 1, 2 };
+
+typedef struct bench_dir
+{
+    unsigned	    cnt;	    /* Callbacks seen.			*/
+    pj_timestamp    last;	    /* Time of the last one.		*/
+    pj_uint64_t	    samples;	    /* Samples of a channel, counted.	*/
+    pj_timestamp    first;	    /* Time of the first counted one.	*/
+
+    unsigned	    frames;	    /* Intervals counted.		*/
+    pj_uint32_t	    min_usec;
+    pj_uint32_t	    max_usec;
+    pj_uint64_t	    sum_usec;
+    pj_uint64_t	    sum2_usec;
+    unsigned	    late;	    /* Intervals over 1.5 ptime.	*/
+    unsigned	    burst;	    /* Current run under half a ptime.	*/
+    unsigned	    max_burst;
+    pj_uint64_t	    cpu_sum_nsec;   /* CPU time spent in the callback.	*/
+    pj_uint64_t	    cpu_max_nsec;
+    unsigned	    hist[BENCH_BUCKETS + 1];
+} bench_dir;
+
+typedef struct bench_state
+{
+    unsigned	    ptime_usec;
+    unsigned	    chnum;
+    bench_dir	    rec;
+    bench_dir	    play;
+} bench_state;
+
+/* CPU time of the calling thread, in ns, or zero if unknown */
+static pj_uint64_t thread_cpu_nsec(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+	return (pj_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return 0;
+}
+
+/* Count a callback. cpu_start is the thread CPU time on entering it: the
+ * CPU time charged is the callback's own, not the driver's work between
+ * callbacks, which a full duplex thread would charge to both directions.
+ */
+static void bench_update(bench_state *st, bench_dir *d,
+			 const pjmedia_frame *frame, pj_uint64_t cpu_start)
+{
+    pj_timestamp now;
+
+    pj_get_timestamp(&now);
+
+    if (++d->cnt > BENCH_WARMUP) {
+	pj_uint32_t usec = pj_elapsed_usec(&d->last, &now);
+	pj_uint64_t cpu_nsec;
+
+	if (d->frames++ == 0) {
+	    d->first = d->last;
+	    d->min_usec = usec;
+	}
+	d->samples += frame->size / 2 / st->chnum;
+	d->min_usec = PJ_MIN(d->min_usec, usec);
+	d->max_usec = PJ_MAX(d->max_usec, usec);
+	d->sum_usec += usec;
+	d->sum2_usec += (pj_uint64_t)usec * usec;
+	d->hist[PJ_MIN(usec / BENCH_BUCKET_USEC, BENCH_BUCKETS)]++;
+
+	if (usec * 2 > st->ptime_usec * 3)
+	    ++d->late;
+	if (usec * 2 < st->ptime_usec) {
+	    d->max_burst = PJ_MAX(d->max_burst, ++d->burst);
+	} else {
+	    d->burst = 0;
+	}
+
+	cpu_nsec = thread_cpu_nsec() - cpu_start;
+	d->cpu_sum_nsec += cpu_nsec;
+	d->cpu_max_nsec = PJ_MAX(d->cpu_max_nsec, cpu_nsec);
+    }
+
+    d->last = now;
+}
+
+static pj_status_t bench_rec_cb(void *user_data, pjmedia_frame *frame)
+{
+    bench_state *st = (bench_state*)user_data;
+    pj_uint64_t cpu_start = thread_cpu_nsec();
+
+    bench_update(st, &st->rec, frame, cpu_start);
+    return PJ_SUCCESS;
+}
+
+static pj_status_t bench_play_cb(void *user_data, pjmedia_frame *frame)
+{
+    bench_state *st = (bench_state*)user_data;
+    pj_uint64_t cpu_start = thread_cpu_nsec();
+
+    pj_bzero(frame->buf, frame->size);
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    bench_update(st, &st->play, frame, cpu_start);
+    return PJ_SUCCESS;
+}
+
+/* Upper bound of the bucket holding the given fraction, in permille */
+static unsigned bench_percentile(const bench_dir *d, unsigned permille)
+{
+    unsigned i, sum = 0, limit = (d->frames * permille + 999) / 1000;
+
+    for (i = 0; i <= BENCH_BUCKETS; ++i) {
+	sum += d->hist[i];
+	if (sum >= limit)
+	    break;
+    }
+    return i < BENCH_BUCKETS ? (i + 1) * BENCH_BUCKET_USEC : d->max_usec;
+}
+
+/* Samples per second the capture runs faster than the playback, each
+ * counted over the time it ran.
+ */
+static int bench_drift(const bench_state *st)
+{
+    unsigned rec_msec, play_msec;
+
+    if (!st->rec.frames || !st->play.frames)
+	return 0;
+
+    rec_msec = pj_elapsed_msec(&st->rec.first, &st->rec.last);
+    play_msec = pj_elapsed_msec(&st->play.first, &st->play.last);
+    if (rec_msec == 0 || play_msec == 0)
+	return 0;
+
+    return (int)((double)st->rec.samples * 1000 / rec_msec -
+		 (double)st->play.samples * 1000 / play_msec);
+}
+
+static void bench_write_dir(FILE *f, pj_bool_t json, const char *name,
+			    const bench_dir *d)
+{
+    unsigned avg = 0, dev = 0, cpu_avg = 0, i, last;
+
+    if (d->frames) {
+	double mean = (double)d->sum_usec / d->frames;
+	double var = (double)d->sum2_usec / d->frames - mean * mean;
+
+	avg = (unsigned)mean;
+	dev = (unsigned)(var > 0 ? sqrt(var) : 0);
+	cpu_avg = (unsigned)(d->cpu_sum_nsec / d->frames / 1000);
+    }
+
+    /* The histogram up to its last non-empty bucket */
+    for (last = BENCH_BUCKETS + 1; last > 0 && d->hist[last - 1] == 0;
+	 --last)
+	;
+
+    if (json) {
+	fprintf(f, ", \"%s\": {\"frames\": %u, \"min\": %u, \"max\": %u, "
+		"\"avg\": %u, \"dev\": %u, \"p50\": %u, \"p99\": %u, "
+		"\"late\": %u, \"max_burst\": %u, \"cpu_avg\": %u, "
+		"\"cpu_max\": %u, \"hist\": [", name, d->frames, d->min_usec,
+		d->max_usec, avg, dev, bench_percentile(d, 500),
+		bench_percentile(d, 990), d->late, d->max_burst, cpu_avg,
+		(unsigned)(d->cpu_max_nsec / 1000));
+	for (i = 0; i < last; ++i)
+	    fprintf(f, i ? ", %u" : "%u", d->hist[i]);
+	fprintf(f, "]}");
+    } else {
+	fprintf(f, ",%s,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,", name, d->frames,
+		d->min_usec, d->max_usec, avg, dev, bench_percentile(d, 500),
+		bench_percentile(d, 990), d->late, d->max_burst, cpu_avg,
+		(unsigned)(d->cpu_max_nsec / 1000));
+	for (i = 0; i < last; ++i)
+	    fprintf(f, i ? ";%u" : "%u", d->hist[i]);
+    }
+}
+
+/* Run one point of the matrix and write its record */
+static void bench_one(FILE *f, pj_bool_t json, pj_bool_t first,
+		      pjmedia_dir dir, int rec_id, int play_id,
+		      unsigned clock_rate, unsigned ptime, unsigned chnum,
+		      unsigned secs)
+{
+    pjmedia_aud_param param;
+    pjmedia_aud_stream *strm = NULL;
+    bench_state *st;
+    pj_status_t status;
+
+    st = (bench_state*) calloc(1, sizeof(bench_state));
+    if (!st)
+	return;
+    st->ptime_usec = ptime * 1000;
+    st->chnum = chnum;
+
+    status = pjmedia_aud_dev_default_param((dir & PJMEDIA_DIR_CAPTURE) ?
+					   rec_id : play_id, &param);
+    if (status == PJ_SUCCESS) {
+	param.dir = dir;
+	param.rec_id = rec_id;
+	param.play_id = play_id;
+	param.clock_rate = clock_rate;
+	param.channel_count = chnum;
+	param.samples_per_frame = clock_rate * chnum * ptime / 1000;
+	param.flags |= (PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY |
+			PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY);
+	param.input_latency_ms = capture_lat;
+	param.output_latency_ms = playback_lat;
+
+	status = pjmedia_aud_stream_create(&param, &bench_rec_cb,
+					   &bench_play_cb, st, &strm);
+    }
+    if (status == PJ_SUCCESS)
+	status = pjmedia_aud_stream_start(strm);
+    if (status == PJ_SUCCESS)
+	pj_thread_sleep(secs * 1000);
+    if (strm) {
+	pjmedia_aud_stream_stop(strm);
+	pjmedia_aud_stream_destroy(strm);
+    }
+
+    PJ_LOG(3,(THIS_FILE, "  %5u Hz %3u ms %u ch: %s, late rec/play=%u/%u",
+	      clock_rate, ptime, chnum,
+	      status == PJ_SUCCESS ? "done" : "failed",
+	      st->rec.late, st->play.late));
+
+    if (json) {
+	fprintf(f, "%s\n  {\"rate\": %u, \"ptime\": %u, \"channels\": %u, "
+		"\"status\": %d, \"drift\": %d", first ? "" : ",",
+		clock_rate, ptime, chnum, status, bench_drift(st));
+    } else {
+	fprintf(f, "%u,%u,%u,%d,%d", clock_rate, ptime, chnum, status,
+		bench_drift(st));
+    }
+    bench_write_dir(f, json, "rec", &st->rec);
+    bench_write_dir(f, json, "play", &st->play);
+    fprintf(f, json ? "}" : "\n");
+    fflush(f);
+
+    free(st);
+}
+
+static void bench_device(pjmedia_dir dir, int rec_id, int play_id,
+			 unsigned secs, const char *filename)
+{
+    pjmedia_aud_dev_info rec_info, play_info;
+    pj_bool_t json, first = PJ_TRUE;
+    unsigned i, j, k, max_ch = 2;
+    FILE *f;
+
+    if (dir & PJMEDIA_DIR_CAPTURE) {
+	if (pjmedia_aud_dev_get_info(rec_id, &rec_info) != PJ_SUCCESS)
+	    return;
+	max_ch = PJ_MIN(max_ch, rec_info.input_count);
+    }
+    if (dir & PJMEDIA_DIR_PLAYBACK) {
+	if (pjmedia_aud_dev_get_info(play_id, &play_info) != PJ_SUCCESS)
+	    return;
+	max_ch = PJ_MIN(max_ch, play_info.output_count);
+    }
+
+    f = fopen(filename, "w");
+    if (!f) {
+	PJ_LOG(1,(THIS_FILE, "Error: unable to open %s", filename));
+	return;
+    }
+    json = (strlen(filename) > 5 &&
+	    pj_ansi_stricmp(filename + strlen(filename) - 5, ".json") == 0);
+
+    /* The columns of each direction, histogram buckets separated by ';' */
+    if (json) {
+	fprintf(f, "{\"bucket_usec\": %u, \"results\": [", BENCH_BUCKET_USEC);
+    } else {
+	fprintf(f, "rate,ptime,channels,status,drift");
+	for (i = 0; i < 2; ++i) {
+	    fprintf(f, ",dir,frames,min,max,avg,dev,p50,p99,late,max_burst,"
+		    "cpu_avg,cpu_max,hist");
+	}
+	fprintf(f, "\n");
+    }
+
+    PJ_LOG(3,(THIS_FILE, "Running the benchmark, %u s per point..", secs));
+
+    for (i = 0; i < PJ_ARRAY_SIZE(bench_rates); ++i) {
+	for (j = 0; j < PJ_ARRAY_SIZE(bench_ptimes); ++j) {
+	    for (k = 0; k < PJ_ARRAY_SIZE(bench_chnums); ++k) {
+		if (bench_chnums[k] > max_ch)
+		    continue;
+		bench_one(f, json, first, dir, rec_id, play_id,
+			  bench_rates[i], bench_ptimes[j], bench_chnums[k],
+			  secs);
+		first = PJ_FALSE;
+	    }
+	}
+    }
+
+    if (json)
+	fprintf(f, "\n]}\n");
+    fclose(f);
+
+    PJ_LOG(3,(THIS_FILE, "Results written to %s (intervals in usec)",
+	      filename));
+}
+
 static pj_status_t wav_rec_cb(void *user_data, pjmedia_frame *frame)
 {
     return pjmedia_port_put_frame((pjmedia_port*)user_data, frame);
@@ -262,8 +588,9 @@ static void record(unsigned rec_index, const char *filename)
     pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "wav",
 			  1000, 1000, NULL);
 
-    status = pjmedia_wav_writer_port_create(pool, filename, 16000, 
-					    1, 320, 16, 0, 0, &wav);
+    /* Written from a thread of its own, not from the audio callback */
+    status = async_writer_create(pool, filename, 16000, 1, 320, 16, 0, 0,
+				 &wav);
     if (status != PJ_SUCCESS) {
 	app_perror("Error creating WAV file", status);
 	goto on_return;
@@ -303,8 +630,16 @@ on_return:
 	pjmedia_aud_stream_stop(strm);
 	pjmedia_aud_stream_destroy(strm);
     }
-    if (wav)
+    if (wav) {
+	async_writer_stat stat;
+
+	async_writer_get_stat(wav, &stat);
+	if (stat.overruns) {
+	    PJ_LOG(2,(THIS_FILE, "Warning: the disk was too slow, %u of %u "
+		      "frames were dropped", stat.overruns, stat.frames));
+	}
 	pjmedia_port_destroy(wav);
+    }
     if (pool)
 	pj_pool_release(pool);
 }
@@ -331,7 +666,10 @@ static void play_file(unsigned play_index, const char *filename)
     pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "wav",
 			  1000, 1000, NULL);
 
-    status = pjmedia_wav_player_port_create(pool, filename, 20, 0, 0, &wav);
+    /* Mapped, or read by the pjmedia player if it's not 16 bit PCM */
+    status = mmap_player_create(pool, filename, 20, 0, &wav);
+    if (status == PJMEDIA_EWAVEUNSUPP)
+	status = pjmedia_wav_player_port_create(pool, filename, 20, 0, 0, &wav);
     if (status != PJ_SUCCESS) {
 	app_perror("Error opening WAV file", status);
 	goto on_return;
@@ -378,6 +716,190 @@ on_return:
 }
 
 
+/*
+ * WAV writer benchmark: a clock thread puts a frame every ptime into the
+ * pjmedia WAV writer and into the async writer, first alone and then
+ * with another thread writing and syncing big chunks to stall the disk,
+ * and the time every put_frame() takes is reported.
+ */
+#define WBENCH_RATE	    48000
+#define WBENCH_CHNUM	    2
+#define WBENCH_PTIME	    10
+#define WBENCH_HOG_CHUNK    (8 * 1024 * 1024)
+#define WBENCH_HOG_CHUNKS   32	    /* Size of the hog file, in chunks. */
+
+typedef struct wbench_hog
+{
+    char	    filename[100];
+    volatile int    quit;
+    unsigned	    chunks;	    /* Chunks written and synced.	*/
+} wbench_hog;
+
+static int PJ_THREAD_FUNC wbench_hog_thread(void *arg)
+{
+    wbench_hog *hog = (wbench_hog*)arg;
+    char *buf;
+    int fd;
+
+    buf = (char*) malloc(WBENCH_HOG_CHUNK);
+    fd = open(hog->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!buf || fd < 0) {
+	PJ_LOG(1,(THIS_FILE, "Error: unable to load the disk"));
+	free(buf);
+	if (fd >= 0)
+	    close(fd);
+	return 1;
+    }
+    memset(buf, 0x55, WBENCH_HOG_CHUNK);
+
+    /* Over the same file again and again, not to fill the disk */
+    while (!hog->quit) {
+	if (hog->chunks % WBENCH_HOG_CHUNKS == 0)
+	    lseek(fd, 0, SEEK_SET);
+	if (write(fd, buf, WBENCH_HOG_CHUNK) != WBENCH_HOG_CHUNK)
+	    break;
+	fsync(fd);
+	++hog->chunks;
+    }
+
+    close(fd);
+    unlink(hog->filename);
+    free(buf);
+    return 0;
+}
+
+static int wbench_cmp(const void *a, const void *b)
+{
+    pj_uint32_t x = *(const pj_uint32_t*)a, y = *(const pj_uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void wbench_run(pj_pool_t *pool, int kind, pj_bool_t load,
+		       unsigned secs, const char *filename)
+{
+    static const char *names[] = { "pjmedia", "async", "async direct" };
+    unsigned spf = WBENCH_RATE * WBENCH_CHNUM * WBENCH_PTIME / 1000;
+    unsigned frames = secs * 1000 / WBENCH_PTIME, i, j;
+    pjmedia_port *port = NULL;
+    pj_thread_t *thread = NULL;
+    wbench_hog hog;
+    pj_int16_t *buf;
+    pj_uint32_t *usec;
+    pj_uint64_t sum = 0;
+    pjmedia_frame frame;
+    pj_timestamp freq, next, t0, t1;
+    pj_status_t status;
+
+    buf = (pj_int16_t*) pj_pool_alloc(pool, spf * sizeof(pj_int16_t));
+    usec = (pj_uint32_t*) calloc(frames, sizeof(pj_uint32_t));
+    if (!usec)
+	return;
+
+    if (kind == 0) {
+	status = pjmedia_wav_writer_port_create(pool, filename, WBENCH_RATE,
+						WBENCH_CHNUM, spf, 16, 0, 0,
+						&port);
+    } else {
+	status = async_writer_create(pool, filename, WBENCH_RATE,
+				     WBENCH_CHNUM, spf, 16,
+				     kind == 2 ? ASYNC_WRITER_DIRECT : 0, 0,
+				     &port);
+    }
+    if (status != PJ_SUCCESS) {
+	app_perror("Error creating WAV file", status);
+	free(usec);
+	return;
+    }
+
+    pj_bzero(&hog, sizeof(hog));
+    if (load) {
+	pj_ansi_snprintf(hog.filename, sizeof(hog.filename), "%s.load",
+			 filename);
+	status = pj_thread_create(pool, "wbenchld", &wbench_hog_thread, &hog,
+				  0, 0, &thread);
+	if (status != PJ_SUCCESS)
+	    app_perror("pj_thread_create()", status);
+	/* Let the writeback get going */
+	pj_thread_sleep(500);
+    }
+
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame.buf = buf;
+    frame.size = spf * 2;
+    frame.bit_info = 0;
+
+    pj_get_timestamp_freq(&freq);
+    pj_get_timestamp(&next);
+    for (i = 0; i < frames; ++i) {
+	/* Wait for the frame's time like the clock thread */
+	next.u64 += freq.u64 * WBENCH_PTIME / 1000;
+	pj_get_timestamp(&t0);
+	if (t0.u64 < next.u64)
+	    pj_thread_sleep((unsigned)((next.u64 - t0.u64) * 1000 /
+				       freq.u64));
+
+	for (j = 0; j < spf; ++j)
+	    buf[j] = (pj_int16_t)(((i * spf + j) % 64) * 256 - 8192);
+
+	pj_get_timestamp(&t0);
+	pjmedia_port_put_frame(port, &frame);
+	pj_get_timestamp(&t1);
+	usec[i] = pj_elapsed_usec(&t0, &t1);
+	sum += usec[i];
+    }
+
+    if (thread) {
+	hog.quit = 1;
+	pj_thread_join(thread);
+	pj_thread_destroy(thread);
+    }
+
+    qsort(usec, frames, sizeof(pj_uint32_t), &wbench_cmp);
+    printf("%-13s %-5s %7u %7u %7u %7u %8u", names[kind],
+	   load ? "yes" : "no", (unsigned)(sum / frames), usec[frames / 2],
+	   usec[frames * 99 / 100], usec[frames * 999 / 1000],
+	   usec[frames - 1]);
+    if (kind != 0) {
+	async_writer_stat stat;
+
+	async_writer_get_stat(port, &stat);
+	printf(" %8u %8u %9u", stat.overruns, stat.batches,
+	       stat.max_write_usec);
+    }
+    if (load)
+	printf("  (load: %u MB synced)",
+	       hog.chunks * (WBENCH_HOG_CHUNK >> 20));
+    printf("\n");
+
+    pjmedia_port_destroy(port);
+    free(usec);
+}
+
+static void bench_writers(unsigned secs, const char *filename)
+{
+    pj_pool_t *pool;
+    int kind;
+
+    pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "wbench",
+			  4000, 4000, NULL);
+
+    PJ_LOG(3,(THIS_FILE, "Writing %u s of %u Hz %u channel audio, %u ms "
+	      "frames, to %s..", secs, WBENCH_RATE, WBENCH_CHNUM,
+	      WBENCH_PTIME, filename));
+    printf("%-13s %-5s %7s %7s %7s %7s %8s %8s %8s %9s\n", "writer", "load",
+	   "avg", "p50", "p99", "p99.9", "max", "overruns", "batches",
+	   "max_write");
+
+    /* Times are in usec */
+    for (kind = 0; kind < 3; ++kind) {
+	wbench_run(pool, kind, PJ_FALSE, secs, filename);
+	wbench_run(pool, kind, PJ_TRUE, secs, filename);
+    }
+
+    pj_pool_release(pool);
+}
+
+
 static void print_menu(void)
 {
     puts("");
@@ -392,6 +914,13 @@ static void print_menu(void)
     puts("                             CR:   clock rate");
     puts("                             PTIM: ptime in ms");
     puts("                             CH:   # of channels");
+    puts("  b RID PID [SECS] [FILE]  Benchmark the device over clock rates, ptimes");
+    puts("                             and channel counts, SECS (default 3) per");
+    puts("                             point, to a CSV file, or JSON for *.json");
+    puts("                             (default " BENCH_FILE ")");
+    puts("  w [SECS] [FILE]          Benchmark put_frame() of the WAV writers,");
+    puts("                             SECS (default 5) per run, with and without");
+    puts("                             disk load (default " WBENCH_FILE ")");
     puts("  r RID [FILE]             Record capture device RID to WAV file");
     puts("  p PID [FILE]             Playback WAV file to device ID PID");
     puts("  d [RLAT PLAT]            Get/set sound device latencies (in ms):");
@@ -405,10 +934,12 @@ static void print_menu(void)
     fflush(stdout);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     pj_caching_pool cp;
     pj_bool_t done = PJ_FALSE;
+    virtual_aud_param vprm;
+    pj_bool_t use_virtual;
     pj_status_t status;
 
     /* Init pjlib */
@@ -417,6 +948,16 @@ int main()
     
     pj_log_set_decor(PJ_LOG_HAS_NEWLINE);
 
+    virtual_aud_param_default(&vprm);
+    if (virtual_aud_get_options(THIS_FILE, argc, argv, &vprm,
+				&use_virtual) != PJ_SUCCESS)
+    {
+	printf("Usage: %s [options]\n\n options:\n%s", argv[0],
+	       VIRTUAL_AUD_USAGE);
+	pj_shutdown();
+	return 1;
+    }
+
     /* Must create a pool factory before we can allocate any memory. */
     pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
 
@@ -428,6 +969,13 @@ int main()
 	return 1;
     }
 
+    /* Without audio hardware, or on top of it */
+    if (use_virtual) {
+	status = virtual_aud_register(&vprm);
+	if (status != PJ_SUCCESS)
+	    app_perror("virtual_aud_register()", status);
+    }
+
     list_devices();
 
     while (!done) {
@@ -506,6 +1054,57 @@ int main()
 	    }
 	    break;
 
+	case 'b':
+	    /* benchmark */
+	    {
+		pjmedia_dir dir;
+		int rec_id, play_id;
+		unsigned secs = 3;
+		char filename[80];
+		int cnt;
+
+		pj_ansi_strcpy(filename, BENCH_FILE);
+		cnt = sscanf(line+2, "%d %d %u %79s", &rec_id, &play_id,
+			     &secs, filename);
+		if (cnt < 2 || secs == 0) {
+		    puts("error: invalid command syntax");
+		    break;
+		}
+
+		if (rec_id >= 0 && rec_id < (int)dev_count) {
+		    if (play_id >= 0 && play_id < (int)dev_count)
+			dir = PJMEDIA_DIR_CAPTURE_PLAYBACK;
+		    else
+			dir = PJMEDIA_DIR_CAPTURE;
+		} else if (play_id >= 0 && play_id < (int)dev_count) {
+		    dir = PJMEDIA_DIR_PLAYBACK;
+		} else {
+		    puts("error: at least one valid device index required");
+		    break;
+		}
+
+		bench_device(dir, rec_id, play_id, secs, filename);
+	    }
+	    break;
+
+	case 'w':
+	    /* WAV writer benchmark */
+	    {
+		unsigned secs = 5;
+		char filename[80];
+
+		pj_ansi_strcpy(filename, WBENCH_FILE);
+		if (sscanf(line+2, "%u %79s", &secs, filename) >= 1 &&
+		    secs == 0)
+		{
+		    puts("error: invalid command syntax");
+		    break;
+		}
+
+		bench_writers(secs, filename);
+	    }
+	    break;
+
 	case 'r':
 	    /* record */
 	    {
@@ -3,6 +3,11 @@
 #include <pjmedia.h>
 #include <pjlib.h>
 #include <pjlib-util.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "spsc_delaybuf.h"
+#include "virtual_dev.h"
 
 #define THIS_FILE "auddemo_w.c"
 #define MAX_DEVICES 64
@@ -23,11 +28,15 @@ static unsigned int bits_per_sample = 16;
 struct myport 
 {
     pjmedia_port base;
-    pjmedia_delay_buf *delay_buf;
+    pjmedia_delay_buf *delay_buf;   /* When created with pjmedia_delay_buf */
+    spsc_delay_buf *spsc_buf;	    /* Otherwise, the lock-free one */
 };
 
 typedef struct myport myport;
 
+/* Use pjmedia_delay_buf instead of the lock-free buffer, toggled with 'd' */
+static pj_bool_t use_pj_delay_buf = PJ_FALSE;
+
 pj_status_t get_frame(void* data, pjmedia_frame *frame)
 {
     if (NULL == data || NULL == frame)
@@ -39,11 +48,15 @@ pj_status_t get_frame(void* data, pjmedia_frame *frame)
     pj_status_t status;
 
     myport *port = (myport *)data;
-    PJ_ASSERT_RETURN(port->delay_buf != NULL, -1);
-
 
-    status = pjmedia_delay_buf_get(port->delay_buf,
-				  (pj_int16_t*)frame->buf);
+    if (port->spsc_buf)
+        status = spsc_delay_buf_get(port->spsc_buf, (pj_int16_t*)frame->buf);
+    else
+    {
+        PJ_ASSERT_RETURN(port->delay_buf != NULL, -1);
+        status = pjmedia_delay_buf_get(port->delay_buf,
+                                       (pj_int16_t*)frame->buf);
+    }
     
     return status;
 }
@@ -59,9 +72,22 @@ pj_status_t put_frame(void* data, pjmedia_frame *frame)
 
     pj_status_t status;
     myport *port = (myport *)data;
-    PJ_ASSERT_RETURN(port->delay_buf != NULL, -1);
 
-    status = pjmedia_delay_buf_put(port->delay_buf, (pj_int16_t*)frame->buf);
+    if (port->spsc_buf)
+    {
+        /* A full ring drops the frame and counts it, it's not an error
+         * for the capture callback, as with pjmedia_delay_buf.
+         */
+        status = spsc_delay_buf_put(port->spsc_buf, (pj_int16_t*)frame->buf);
+        if (status == PJ_ETOOMANY)
+            status = PJ_SUCCESS;
+    }
+    else
+    {
+        PJ_ASSERT_RETURN(port->delay_buf != NULL, -1);
+        status = pjmedia_delay_buf_put(port->delay_buf,
+                                       (pj_int16_t*)frame->buf);
+    }
 
     return status;
 
@@ -75,37 +101,59 @@ pj_status_t my_on_destory(void* data)
         return PJ_SUCCESS;
     }
     
-    pj_status_t status;
+    pj_status_t status = PJ_SUCCESS;
     myport *port = (myport *)data;
 
-    status = pjmedia_delay_buf_destroy(port->delay_buf);
+    if (port->spsc_buf)
+        status = spsc_delay_buf_destroy(port->spsc_buf);
+    if (port->delay_buf)
+        status = pjmedia_delay_buf_destroy(port->delay_buf);
     
     return status;
 }
 
-pj_status_t create_myport(pj_pool_t *pool, myport **port)
+/*
+ * Create the port with frames of spf samples and a maximum delay of
+ * max_delay ms, over pjmedia_delay_buf when use_pj is set and over
+ * spsc_delay_buf otherwise. With simple_fifo the buffer pads and drops
+ * instead of using WSOLA.
+ */
+pj_status_t create_myport(pj_pool_t *pool, pj_bool_t use_pj, unsigned spf,
+                          unsigned max_delay, pj_bool_t simple_fifo,
+                          myport **port)
 {
     const pj_str_t MYPORT = { "MYPORT", 6 };
     pj_status_t status;
     myport *mport;
-    unsigned int ptime;
 
     // create the port and the AEC itself 
     mport = PJ_POOL_ZALLOC_T(pool, myport);
 
     pjmedia_port_info_init(&mport->base.info, &MYPORT, SIGNATURE, 
-        clock_rate, channel_count, bits_per_sample, samples_per_frame);
-
-    /* Passive port has delay buf. */
-    ptime = samples_per_frame * 1000 / clock_rate / 
-	    channel_count;
+        clock_rate, channel_count, bits_per_sample, spf);
 
-    status = pjmedia_delay_buf_create(pool, MYPORT.ptr, clock_rate, samples_per_frame, 
-        channel_count, ptime * 2, 0, &mport->delay_buf);
+    /* Passive port has delay buf. The capture and playback callbacks run
+     * on their own threads, one putting and the other getting, which is
+     * what the lock-free buffer is for.
+     */
+    if (use_pj)
+    {
+        status = pjmedia_delay_buf_create(pool, MYPORT.ptr, clock_rate, spf,
+            channel_count, max_delay,
+            simple_fifo ? PJMEDIA_DELAY_BUF_SIMPLE_FIFO : 0,
+            &mport->delay_buf);
+    }
+    else
+    {
+        status = spsc_delay_buf_create(pool, MYPORT.ptr, clock_rate, spf,
+            channel_count, max_delay,
+            simple_fifo ? SPSC_DELAY_BUF_SIMPLE_FIFO : 0,
+            &mport->spsc_buf);
+    }
 
     if(status != PJ_SUCCESS)
     {
-        PJ_LOG(3, (THIS_FILE, "faied to pjmedia_delay_buf_create"));
+        PJ_LOG(3, (THIS_FILE, "faied to create the delay buffer"));
         return status;
     }
 
@@ -244,12 +292,6 @@ static void show_dev_info(unsigned index)
 #undef H
 }
 
-static void test_device(pjmedia_dir dir, unsigned rec_id, unsigned play_id, 
-        unsigned clock_rate, unsigned ptime, unsigned chnum)
-{
-    pjmedia_aud_param param;
-}
-
 static pj_status_t rec_cb(void *user_data, pjmedia_frame *frame)
 {
     pjmedia_port *port = (pjmedia_port *)user_data;
@@ -262,21 +304,119 @@ static pj_status_t play_cb(void *user_data, pjmedia_frame *frame)
     return pjmedia_port_get_frame(port, frame);
 }
 
-static void test_rec_play(int rec_id, int play_id)
+/*
+ * Adaptive latency: the loopback starts with the device's lowest latency
+ * and no extra buffering, and the delay buffer is let to grow by a frame
+ * on each underrun it sees. After ADAPT_STABLE_MS without one, a frame
+ * of it may be shrunk away again.
+ */
+#define ADAPT_POLL_MS	    500
+#define ADAPT_STABLE_MS	    10000
+#define ADAPT_WARMUP_MS	    1000
+
+typedef struct adapt_state
+{
+    myport	    *port;
+    pj_bool_t	     adaptive;
+    unsigned	     rec_lat;	    /* Device latencies, in ms.	    */
+    unsigned	     play_lat;
+    volatile pj_bool_t quit;
+
+    unsigned	     underruns;
+    unsigned	     min_delay;	    /* Current minimum, in samples. */
+    unsigned	     peak_delay;    /* Highest minimum reached.	    */
+    unsigned	     peak_m2e;	    /* Highest estimate, in ms.	    */
+} adapt_state;
+
+static unsigned samples_to_ms(unsigned cnt)
+{
+    return cnt * 1000 / clock_rate / channel_count;
+}
+
+static int PJ_THREAD_FUNC adapt_thread(void *p)
+{
+    adapt_state *st = (adapt_state*)p;
+    spsc_delay_buf *b = st->port->spsc_buf;
+    spsc_delay_buf_stat stat;
+    pj_uint32_t last_expanded;
+    unsigned stable_ms = 0, m2e;
+
+    /* The first frames run out while the two directions start */
+    pj_thread_sleep(ADAPT_WARMUP_MS);
+    spsc_delay_buf_get_stat(b, &stat);
+    last_expanded = stat.frames_expanded;
+
+    while (!st->quit)
+    {
+        pj_thread_sleep(ADAPT_POLL_MS);
+        spsc_delay_buf_get_stat(b, &stat);
+
+        if (st->adaptive)
+        {
+            if (stat.frames_expanded != last_expanded)
+            {
+                /* Keep the frame the underrun added, and another */
+                st->min_delay = PJ_MIN(PJ_MAX(stat.level, st->min_delay) +
+                                       samples_per_frame, stat.max_level);
+                spsc_delay_buf_set_min_delay(b, st->min_delay);
+                st->peak_delay = PJ_MAX(st->peak_delay, st->min_delay);
+                stable_ms = 0;
+            }
+            else if ((stable_ms += ADAPT_POLL_MS) >= ADAPT_STABLE_MS &&
+                     st->min_delay)
+            {
+                st->min_delay -= PJ_MIN(st->min_delay, samples_per_frame);
+                spsc_delay_buf_set_min_delay(b, st->min_delay);
+                stable_ms = 0;
+            }
+        }
+        st->underruns += stat.frames_expanded - last_expanded;
+        last_expanded = stat.frames_expanded;
+
+        m2e = st->rec_lat + st->play_lat + samples_to_ms(stat.level);
+        st->peak_m2e = PJ_MAX(st->peak_m2e, m2e);
+
+        PJ_LOG(3, (THIS_FILE, "mouth-to-ear ~%3u ms (rec %u + buf %u + play "
+                   "%u), buffer min %u ms, underruns %u", m2e, st->rec_lat,
+                   samples_to_ms(stat.level), st->play_lat,
+                   samples_to_ms(st->min_delay), st->underruns));
+    }
+
+    return 0;
+}
+
+/*
+ * Loop the capture of rec_id to the playback of play_id at the given
+ * clock rate and frame time. In adaptive mode, the lowest latency the
+ * pair sustains is looked for, see adapt_thread().
+ */
+static void test_rec_play(int rec_id, int play_id, unsigned rate,
+                          unsigned ptime, pj_bool_t adaptive)
 {
     PJ_LOG(3, (THIS_FILE, "start test_rec_play"));
     myport *port = NULL;
     pj_pool_t *pool = NULL;
     pjmedia_aud_stream *strm = NULL;
     pjmedia_aud_param param;
+    pjmedia_aud_dev_info rec_info, play_info;
+    pj_thread_t *thread = NULL;
+    adapt_state st;
     pj_status_t status;
 
     char line[10], *dummy; // get stdin for stop
 
+    clock_rate = rate;
+    samples_per_frame = rate * ptime / 1000 * channel_count;
+    pj_bzero(&st, sizeof(st));
+
     pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "wav",
         1000, 1000, NULL);
 
     status = pjmedia_aud_dev_default_param(0, &param);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_aud_dev_get_info(rec_id, &rec_info);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_aud_dev_get_info(play_id, &play_info);
     if (status != PJ_SUCCESS)
     {
         app_perror("pjmedia_aud_dev_default_param()", status);
@@ -285,19 +425,43 @@ static void test_rec_play(int rec_id, int play_id)
     param.rec_id = rec_id;
     param.play_id = play_id;
     param.dir = PJMEDIA_DIR_CAPTURE_PLAYBACK;
-    param.clock_rate = 16000;
-    param.samples_per_frame = 16000 / 1000 * 10;
-    param.channel_count = 1;
-    param.bits_per_sample = 16;
+    param.clock_rate = clock_rate;
+    param.samples_per_frame = samples_per_frame;
+    param.channel_count = channel_count;
+    param.bits_per_sample = bits_per_sample;
+
+    /* Ask the devices for their lowest latency, a frame */
+    st.rec_lat = capture_lat;
+    st.play_lat = playback_lat;
+    if (adaptive && (rec_info.caps & PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY))
+    {
+        param.flags |= PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY;
+        param.input_latency_ms = ptime;
+    }
+    if (adaptive && (play_info.caps & PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY))
+    {
+        param.flags |= PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY;
+        param.output_latency_ms = ptime;
+    }
 
-    status = create_myport(pool, &port);
+    /* Twice the frame time, as the sound port's own delay buffer. The
+     * adaptive mode starts from nothing and grows up to the default
+     * maximum, and needs the lock-free buffer to do so.
+     */
+    if (adaptive && use_pj_delay_buf)
+        PJ_LOG(3, (THIS_FILE, "Adaptive mode uses the lock-free buffer"));
+    status = create_myport(pool, use_pj_delay_buf && !adaptive,
+        samples_per_frame, adaptive ? 0 : ptime * 2, PJ_FALSE, &port);
     if (status != PJ_SUCCESS)
     {
         app_perror("create_myport()", status);
         goto on_return;
     }
 
-    PJ_LOG(3, (THIS_FILE, "pjmedia_aud_stream_create"));
+    PJ_LOG(3, (THIS_FILE, "pjmedia_aud_stream_create, %u Hz, %u ms, %s%s",
+        clock_rate, ptime,
+        port->spsc_buf ? "lock-free delay buffer" : "pjmedia_delay_buf",
+        adaptive ? ", adaptive" : ""));
 
     status = pjmedia_aud_stream_create(&param, &rec_cb, &play_cb, port, &strm);
     if (status != PJ_SUCCESS) 
@@ -313,17 +477,59 @@ static void test_rec_play(int rec_id, int play_id)
         goto on_return;
     }
 
+    /* The latencies the devices actually gave */
+    if (pjmedia_aud_stream_get_param(strm, &param) == PJ_SUCCESS)
+    {
+        if (param.flags & PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY)
+            st.rec_lat = param.input_latency_ms;
+        if (param.flags & PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY)
+            st.play_lat = param.output_latency_ms;
+    }
+
+    if (port->spsc_buf)
+    {
+        st.port = port;
+        st.adaptive = adaptive;
+        status = pj_thread_create(pool, "adapt", &adapt_thread, &st, 0, 0,
+                                  &thread);
+        if (status != PJ_SUCCESS)
+            app_perror("pj_thread_create()", status);
+    }
+
     PJ_LOG(3, (THIS_FILE, "stream started, press ENTER to stop"));
     dummy = fgets(line, sizeof(line), stdin);
     PJ_UNUSED_ARG(dummy);
 
     on_return:
+    if (thread)
+    {
+        st.quit = PJ_TRUE;
+        pj_thread_join(thread);
+        pj_thread_destroy(thread);
+
+        if (adaptive)
+        {
+            PJ_LOG(3, (THIS_FILE, "%u underruns, buffer grew to %u ms, peak "
+                       "mouth-to-ear ~%u ms", st.underruns,
+                       samples_to_ms(st.peak_delay), st.peak_m2e));
+            PJ_LOG(3, (THIS_FILE, "Suggested for this pair: "
+                       "PJMEDIA_SND_DEFAULT_REC_LATENCY %u, "
+                       "PJMEDIA_SND_DEFAULT_PLAY_LATENCY %u", st.rec_lat,
+                       st.play_lat + samples_to_ms(st.peak_delay)));
+        }
+    }
+
     if (strm)
     {
         pjmedia_aud_stream_stop(strm);
         pjmedia_aud_stream_destroy(strm);
     }
 
+    if (port)
+    {
+        pjmedia_port_destroy(&port->base);
+    }
+
     if (pool)
     {
         pj_pool_release(pool);
@@ -331,25 +537,549 @@ static void test_rec_play(int rec_id, int play_id)
 
 }
 
+/*
+ * Delay buffer benchmark: one thread puts frames into a myport and
+ * another gets them, as the capture and playback callbacks do, timing
+ * every call.
+ */
+#define BENCH_FRAME_USEC    2500    /* 2.5 ms frames */
+#define BENCH_MAX_DELAY	    40	    /* ms */
+
+typedef struct bench_thread_arg
+{
+    myport	    *port;
+    pj_bool_t	     is_put;
+    unsigned	     frames;
+    pj_timestamp     start;	    /* First deadline.		    */
+    pj_uint64_t	     period;	    /* Timestamp ticks per frame, zero
+				       to run as fast as possible.  */
+    pj_uint32_t	    *nsec;	    /* Duration of each call.	    */
+    pj_int16_t	    *buf;
+} bench_thread_arg;
+
+static int PJ_THREAD_FUNC bench_thread(void *p)
+{
+    bench_thread_arg *arg = (bench_thread_arg*)p;
+    unsigned n = PJMEDIA_PIA_SPF(&arg->port->base.info);
+    pjmedia_frame frame;
+    pj_timestamp deadline = arg->start, t0, t1;
+    unsigned i, j;
+
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame.buf = arg->buf;
+    frame.size = n * 2;
+    frame.bit_info = 0;
+
+    for (i = 0; i < arg->frames; ++i)
+    {
+        /* Wait for the frame's time like a device thread, spinning since
+         * sleeps are too coarse for 2.5 ms.
+         */
+        do {
+            pj_get_timestamp(&t0);
+        } while (arg->period && t0.u64 < deadline.u64);
+        deadline.u64 += arg->period;
+
+        if (arg->is_put)
+        {
+            /* A sawtooth for WSOLA to work on */
+            for (j = 0; j < n; ++j)
+                arg->buf[j] = (pj_int16_t)(((i * n + j) % 64) * 256 - 8192);
+            pj_get_timestamp(&t0);
+            pjmedia_port_put_frame(&arg->port->base, &frame);
+        }
+        else
+        {
+            pj_get_timestamp(&t0);
+            pjmedia_port_get_frame(&arg->port->base, &frame);
+        }
+        pj_get_timestamp(&t1);
+        arg->nsec[i] = pj_elapsed_nanosec(&t0, &t1);
+    }
+
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    pj_uint32_t x = *(const pj_uint32_t*)a, y = *(const pj_uint32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void bench_report(const char *title, pj_uint32_t *nsec, unsigned cnt)
+{
+    pj_uint64_t sum = 0;
+    unsigned i;
+
+    qsort(nsec, cnt, sizeof(pj_uint32_t), &cmp_u32);
+    for (i = 0; i < cnt; ++i)
+        sum += nsec[i];
+
+    PJ_LOG(3, (THIS_FILE, "  %-4s avg %6u  p50 %6u  p99 %6u  p99.9 %6u  "
+               "max %7u ns", title, (unsigned)(sum / cnt), nsec[cnt / 2],
+               nsec[cnt * 99 / 100], nsec[cnt * 999 / 1000], nsec[cnt - 1]));
+}
+
+static void bench_run(pj_pool_t *pool, pj_bool_t use_pj, pj_bool_t paced,
+                      unsigned frames)
+{
+    unsigned spf = clock_rate * channel_count / 1000 * BENCH_FRAME_USEC /
+                   1000;
+    bench_thread_arg arg[2];
+    pj_thread_t *thread[2] = { NULL, NULL };
+    pj_timestamp freq, now;
+    myport *port;
+    unsigned i;
+    pj_status_t status;
+
+    /* Paced runs measure the tail latency with WSOLA at work. Unpaced
+     * runs measure the contention between the two threads, with a simple
+     * FIFO so that the cost of shrinking does not hide it.
+     */
+    status = create_myport(pool, use_pj, spf, BENCH_MAX_DELAY, !paced,
+                           &port);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror("create_myport()", status);
+        return;
+    }
+
+    pj_get_timestamp_freq(&freq);
+    pj_get_timestamp(&now);
+    now.u64 += freq.u64 / 100;
+
+    for (i = 0; i < 2; ++i)
+    {
+        arg[i].port = port;
+        arg[i].is_put = (i == 0);
+        arg[i].frames = frames;
+        arg[i].start = now;
+        arg[i].period = paced ? freq.u64 * BENCH_FRAME_USEC / 1000000 : 0;
+        arg[i].nsec = (pj_uint32_t*)
+                      pj_pool_alloc(pool, frames * sizeof(pj_uint32_t));
+        arg[i].buf = (pj_int16_t*)
+                     pj_pool_zalloc(pool, spf * sizeof(pj_int16_t));
+    }
+    /* The consumer runs half a frame behind the producer */
+    arg[1].start.u64 += arg[1].period / 2;
+
+    for (i = 0; i < 2 && status == PJ_SUCCESS; ++i)
+    {
+        status = pj_thread_create(pool, i == 0 ? "benchput" : "benchget",
+                                  &bench_thread, &arg[i], 0, 0, &thread[i]);
+    }
+    for (i = 0; i < 2; ++i)
+    {
+        if (thread[i])
+        {
+            pj_thread_join(thread[i]);
+            pj_thread_destroy(thread[i]);
+        }
+    }
+    if (status != PJ_SUCCESS)
+        app_perror("pj_thread_create()", status);
+
+    PJ_LOG(3, (THIS_FILE, "%s, %s, %u frames of %u samples:",
+               use_pj ? "pjmedia_delay_buf" : "spsc_delay_buf",
+               paced ? "paced" : "unpaced", frames, spf));
+    if (status == PJ_SUCCESS)
+    {
+        bench_report("put", arg[0].nsec, frames);
+        bench_report("get", arg[1].nsec, frames);
+    }
+    if (!use_pj)
+    {
+        spsc_delay_buf_stat stat;
+
+        spsc_delay_buf_get_stat(port->spsc_buf, &stat);
+        PJ_LOG(3, (THIS_FILE, "  expanded %u frames, shrunk %u, dropped %u "
+                   "samples", stat.frames_expanded, stat.shrunk,
+                   stat.dropped));
+    }
+
+    pjmedia_port_destroy(&port->base);
+}
+
+static void bench_delay_buf(unsigned frames)
+{
+    pj_pool_t *pool;
+    unsigned i;
+
+    pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "bench",
+        4000, 4000, NULL);
+
+    /* Paced for the given number of frames, then unpaced for ten times
+     * as many, since those take no time at all.
+     */
+    for (i = 0; i < 4; ++i)
+    {
+        pj_bool_t paced = (i < 2);
+        bench_run(pool, (i & 1) != 0, paced, paced ? frames : frames * 10);
+    }
+
+    pj_pool_release(pool);
+}
+
+/*
+ * Round-trip latency measurement: a chirp is played at the start of every
+ * LAT_PERIOD_MS, the capture is kept whole, and the delay of each chirp
+ * is found afterwards by cross-correlating it with the capture. The delay
+ * is the one the application sees, from the sample given to play_cb to
+ * the same sample coming out of rec_cb.
+ */
+#define LAT_PERIOD_MS	    1000
+#define LAT_CHIRP_MS	    100
+#define LAT_MAX_ROUNDS	    100
+#define LAT_MIN_CORR	    0.2	    /* Normalized correlation to detect
+				       the chirp with.		    */
+
+typedef struct lat_state
+{
+    unsigned	     clock_rate;
+    unsigned	     chnum;
+    unsigned	     spf;	    /* Samples per frame, of a channel. */
+    unsigned	     period;	    /* Samples per round, of a channel. */
+    unsigned	     chirp_len;
+    unsigned	     rounds;
+    pj_int16_t	    *chirp;
+    pj_int16_t	    *capture;	    /* First channel of the capture. */
+    unsigned	     cap_len;	    /* rounds * period.		    */
+    unsigned	     play_pos;	    /* Samples played, of a channel. */
+    volatile unsigned rec_pos;	    /* Samples captured.	    */
+} lat_state;
+
+static pj_status_t lat_init(pj_pool_t *pool, lat_state *st, unsigned rate,
+                            unsigned chnum, unsigned rounds)
+{
+    const double PI = 3.14159265358979323846;
+    double f0 = 300, f1 = PJ_MIN(rate * 0.4, 6000.0), T;
+    unsigned i, fade;
+
+    pj_bzero(st, sizeof(*st));
+    st->clock_rate = rate;
+    st->chnum = chnum;
+    st->period = rate * LAT_PERIOD_MS / 1000;
+    st->chirp_len = rate * LAT_CHIRP_MS / 1000;
+    st->rounds = rounds;
+    st->cap_len = rounds * st->period;
+    st->chirp = (pj_int16_t*)
+                pj_pool_alloc(pool, st->chirp_len * sizeof(pj_int16_t));
+    st->capture = (pj_int16_t*)
+                  pj_pool_zalloc(pool, st->cap_len * sizeof(pj_int16_t));
+    if (!st->chirp || !st->capture)
+        return PJ_ENOMEM;
+
+    /* Linear sweep from f0 to f1, faded in and out over 5 ms so that it
+     * does not click.
+     */
+    T = (double)st->chirp_len / rate;
+    fade = rate / 200;
+    for (i = 0; i < st->chirp_len; ++i)
+    {
+        double t = (double)i / rate, a = 16384;
+        if (i < fade)
+            a = a * i / fade;
+        else if (st->chirp_len - i < fade)
+            a = a * (st->chirp_len - i) / fade;
+        st->chirp[i] = (pj_int16_t)(a * sin(2 * PI * (f0 * t +
+                                    (f1 - f0) * t * t / (2 * T))));
+    }
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t lat_play_cb(void *user_data, pjmedia_frame *frame)
+{
+    lat_state *st = (lat_state*)user_data;
+    pj_int16_t *buf = (pj_int16_t*)frame->buf;
+    unsigned cnt = (unsigned)(frame->size / 2 / st->chnum), i, c;
+
+    for (i = 0; i < cnt; ++i, ++st->play_pos)
+    {
+        unsigned off = st->play_pos % st->period;
+        pj_int16_t v = 0;
+
+        if (off < st->chirp_len && st->play_pos < st->cap_len)
+            v = st->chirp[off];
+        for (c = 0; c < st->chnum; ++c)
+            buf[i * st->chnum + c] = v;
+    }
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t lat_rec_cb(void *user_data, pjmedia_frame *frame)
+{
+    lat_state *st = (lat_state*)user_data;
+    const pj_int16_t *buf = (const pj_int16_t*)frame->buf;
+    unsigned cnt = (unsigned)(frame->size / 2 / st->chnum), i;
+    unsigned pos = st->rec_pos;
+
+    /* A frame without audio still took its time: keep it as silence so
+     * that the rest of the capture stays aligned with the chirps.
+     */
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+    {
+        if (cnt == 0)
+            cnt = st->spf;
+        for (i = 0; i < cnt && pos < st->cap_len; ++i)
+            st->capture[pos++] = 0;
+        st->rec_pos = pos;
+        return PJ_SUCCESS;
+    }
+
+    for (i = 0; i < cnt && pos < st->cap_len; ++i)
+        st->capture[pos++] = buf[i * st->chnum];
+    st->rec_pos = pos;
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * Find the chirp of the given round in the capture. Returns the delay in
+ * samples, or -1 if the capture doesn't correlate with the chirp well
+ * enough. The loop may invert the signal (many analog loopbacks do), so
+ * the correlation is compared by magnitude; it is given negative when
+ * the chirp came back inverted.
+ */
+static int lat_find_delay(const lat_state *st, unsigned round, double *corr)
+{
+    const pj_int16_t *cap = st->capture + round * st->period;
+    unsigned n = st->chirp_len, lags = st->period - n, lag, i;
+    double e_chirp = 0, e_win = 0, best = 0;
+    int best_lag = -1;
+
+    for (i = 0; i < n; ++i)
+    {
+        e_chirp += (double)st->chirp[i] * st->chirp[i];
+        e_win += (double)cap[i] * cap[i];
+    }
+
+    for (lag = 0; lag < lags; ++lag)
+    {
+        double sum = 0, c;
+
+        for (i = 0; i < n; ++i)
+            sum += (double)st->chirp[i] * cap[lag + i];
+
+        c = e_win > 0 ? sum / sqrt(e_chirp * e_win) : 0;
+        if (fabs(c) > fabs(best))
+        {
+            best = c;
+            best_lag = (int)lag;
+        }
+
+        /* Slide the window's energy by a sample */
+        e_win += (double)cap[lag + n] * cap[lag + n] -
+                 (double)cap[lag] * cap[lag];
+    }
+
+    *corr = best;
+    return fabs(best) >= LAT_MIN_CORR ? best_lag : -1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Find every round's delay and log them and their distribution */
+static void lat_report(const lat_state *st)
+{
+    double ms[LAT_MAX_ROUNDS], sum = 0, sum2 = 0, avg, corr;
+    unsigned i, cnt = 0;
+
+    for (i = 0; i < st->rounds; ++i)
+    {
+        int d = lat_find_delay(st, i, &corr);
+        if (d < 0)
+        {
+            PJ_LOG(3, (THIS_FILE, "  round %2u: not found (corr %.2f)",
+                       i, corr));
+            continue;
+        }
+        ms[cnt] = d * 1000.0 / st->clock_rate;
+        PJ_LOG(3, (THIS_FILE, "  round %2u: %6d samples, %7.2f ms "
+                   "(corr %.2f%s)", i, d, ms[cnt], fabs(corr),
+                   corr < 0 ? ", inverted" : ""));
+        sum += ms[cnt];
+        sum2 += ms[cnt] * ms[cnt];
+        ++cnt;
+    }
+
+    if (cnt == 0)
+    {
+        PJ_LOG(3, (THIS_FILE, "No chirp found, is the speaker heard by "
+                   "the mic?"));
+        return;
+    }
+
+    qsort(ms, cnt, sizeof(double), &cmp_double);
+    avg = sum / cnt;
+    PJ_LOG(3, (THIS_FILE, "Round trip over %u of %u rounds: min %.2f, "
+               "median %.2f, avg %.2f, max %.2f, dev %.2f ms", cnt,
+               st->rounds, ms[0], ms[cnt / 2], avg, ms[cnt - 1],
+               sqrt(PJ_MAX(sum2 / cnt - avg * avg, 0))));
+}
+
+/*
+ * Measure the round trip from play_id to rec_id, which have to hear each
+ * other, over the given number of rounds.
+ */
+static void test_latency(unsigned rec_id, unsigned play_id,
+                         unsigned clock_rate, unsigned ptime, unsigned chnum,
+                         unsigned rounds)
+{
+    pj_pool_t *pool;
+    pjmedia_aud_stream *strm = NULL;
+    pjmedia_aud_param param;
+    lat_state st;
+    unsigned i;
+    pj_status_t status;
+
+    pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "lat",
+        4000, 4000, NULL);
+
+    status = lat_init(pool, &st, clock_rate, chnum, rounds);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_aud_dev_default_param(rec_id, &param);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror("pjmedia_aud_dev_default_param()", status);
+        goto on_return;
+    }
+    param.rec_id = rec_id;
+    param.play_id = play_id;
+    param.dir = PJMEDIA_DIR_CAPTURE_PLAYBACK;
+    param.clock_rate = clock_rate;
+    param.samples_per_frame = clock_rate * ptime / 1000 * chnum;
+    param.channel_count = chnum;
+    param.bits_per_sample = 16;
+    st.spf = clock_rate * ptime / 1000;
+
+    status = pjmedia_aud_stream_create(&param, &lat_rec_cb, &lat_play_cb,
+                                       &st, &strm);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_aud_stream_start(strm);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror("Error starting the sound device", status);
+        goto on_return;
+    }
+
+    PJ_LOG(3, (THIS_FILE, "Measuring %u rounds of %u ms, please wait..",
+               rounds, LAT_PERIOD_MS));
+    for (i = 0; st.rec_pos < st.cap_len &&
+                i < (rounds * LAT_PERIOD_MS + 5000) / 100; ++i)
+    {
+        pj_thread_sleep(100);
+    }
+    if (st.rec_pos < st.cap_len)
+        PJ_LOG(3, (THIS_FILE, "Capture stalled, measuring what came"));
+    st.rounds = st.rec_pos / st.period;
+
+    pjmedia_aud_stream_stop(strm);
+    lat_report(&st);
+
+on_return:
+    if (strm)
+        pjmedia_aud_stream_destroy(strm);
+    pj_pool_release(pool);
+}
+
+/*
+ * Check the measurement without devices: play_cb and rec_cb are called in
+ * turn, as fast as possible, over a loopback that delays by delay_ms and
+ * adds some noise at half the level.
+ */
+static void test_latency_virtual(unsigned delay_ms, unsigned ptime,
+                                 unsigned rounds)
+{
+    unsigned spf = clock_rate * ptime / 1000, delay, i;
+    pj_pool_t *pool;
+    pj_int16_t *line, *buf;
+    pjmedia_frame frame;
+    pj_uint32_t seed = 1;
+    lat_state st;
+    pj_status_t status;
+
+    pool = pj_pool_create(pjmedia_aud_subsys_get_pool_factory(), "lat",
+        4000, 4000, NULL);
+
+    status = lat_init(pool, &st, clock_rate, 1, rounds);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror("lat_init()", status);
+        pj_pool_release(pool);
+        return;
+    }
+
+    /* Everything played, to be captured delay samples later */
+    delay = clock_rate * delay_ms / 1000;
+    line = (pj_int16_t*)
+           pj_pool_zalloc(pool, (st.cap_len + spf) * sizeof(pj_int16_t));
+    buf = (pj_int16_t*) pj_pool_alloc(pool, spf * sizeof(pj_int16_t));
+
+    frame.buf = buf;
+    frame.size = spf * 2;
+    frame.bit_info = 0;
+
+    while (st.rec_pos < st.cap_len)
+    {
+        unsigned pos = st.play_pos;
+
+        frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+        lat_play_cb(&st, &frame);
+        pj_memcpy(line + pos, buf, spf * sizeof(pj_int16_t));
+
+        for (i = 0; i < spf; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            buf[i] = (pj_int16_t)((pos + i >= delay ? line[pos + i - delay] /
+                                   2 : 0) + (int)((seed >> 16) % 2000) -
+                                  1000);
+        }
+        lat_rec_cb(&st, &frame);
+    }
+
+    PJ_LOG(3, (THIS_FILE, "Virtual loopback of %u ms (%u samples):",
+               delay_ms, delay));
+    lat_report(&st);
+    pj_pool_release(pool);
+}
+
 static void print_menu(void)
 {
     puts("");
     puts("Audio demo menu:");
     puts("-------------------------------");
     puts("  l                        List devices");
-    puts("  t mic_id play_id         Perform test on the device: get mic and put to speaker ");
+    puts("  t mic_id play_id [rate] [ptime]");
+    puts("                           Perform test on the device: get mic and put to speaker ");
+    puts("  a mic_id play_id [rate] [ptime]");
+    puts("                           Same, looking for the lowest latency the pair sustains");
+    puts("  m mic_id play_id [rounds]");
+    puts("                           Measure the round trip latency of the pair");
+    puts("  v delay_ms [rounds]      Measure it over a virtual loopback");
     puts("  i ID                     Show device info for device ID");
+    printf("  d                        Toggle the test's delay buffer (now %s)\n",
+         use_pj_delay_buf ? "pjmedia_delay_buf" : "lock-free");
+    puts("  b [frames]               Benchmark the delay buffers with 2.5 ms frames");
     puts("  q                        Quit");
     puts("");
     printf("Enter selection: ");
     fflush(stdout);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     pj_caching_pool cp;
     pj_bool_t done = PJ_FALSE;
     pj_pool_t *pool = NULL;
+    virtual_aud_param vprm;
+    pj_bool_t use_virtual;
     pj_status_t status;
     char line[10], *dummy; // get stdin for stop
 
@@ -357,6 +1087,16 @@ int main()
     status = pj_init();
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
+    virtual_aud_param_default(&vprm);
+    if (virtual_aud_get_options(THIS_FILE, argc, argv, &vprm, &use_virtual)
+        != PJ_SUCCESS)
+    {
+        printf("Usage: %s [options]\n\n options:\n%s", argv[0],
+               VIRTUAL_AUD_USAGE);
+        pj_shutdown();
+        return 1;
+    }
+
     // Must create a pool factory before we can allocate any memory
     pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
 
@@ -369,6 +1109,16 @@ int main()
         return 1;
     }
 
+    // Without audio hardware, or on top of it
+    if (use_virtual)
+    {
+        status = virtual_aud_register(&vprm);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror("virtual_aud_register()", status);
+        }
+    }
+
     list_devices();
 
     while (!done)
@@ -389,17 +1139,48 @@ int main()
             done = PJ_TRUE;
             break;
         case 't':
+        case 'a':
             {
                 int mic_id = -1, play_id = -1;
+                unsigned rate = 16000, ptime = 10;
                 int count;
-                count = sscanf(line+2, "%d %d", &mic_id, &play_id);
-                if (count != 2)
+                count = sscanf(line+2, "%d %d %u %u", &mic_id, &play_id,
+                               &rate, &ptime);
+                if (count < 2 || !rate || !ptime)
                 {
                     PJ_LOG(3, (THIS_FILE, "invalid param, we need 2 int"));
                     PJ_LOG(3, (THIS_FILE, "mic_id: %d, play_id: %d, count: %d", mic_id, play_id, count));
                     break;
                 }
-                test_rec_play(mic_id, play_id);
+                test_rec_play(mic_id, play_id, rate, ptime, line[0] == 'a');
+            }
+            break;
+        case 'm':
+            {
+                unsigned mic_id, play_id, rounds = 10;
+                if (sscanf(line+2, "%u %u %u", &mic_id, &play_id,
+                           &rounds) < 2)
+                {
+                    PJ_LOG(3, (THIS_FILE, "invalid param, we need 2 int"));
+                    break;
+                }
+                rounds = PJ_MAX(1, PJ_MIN(rounds, LAT_MAX_ROUNDS));
+                test_latency(mic_id, play_id, clock_rate, 10, channel_count,
+                             rounds);
+            }
+            break;
+        case 'v':
+            {
+                unsigned delay_ms, rounds = 10;
+                if (sscanf(line+2, "%u %u", &delay_ms, &rounds) < 1 ||
+                    delay_ms >= LAT_PERIOD_MS - LAT_CHIRP_MS)
+                {
+                    PJ_LOG(3, (THIS_FILE, "invalid param, we need a delay "
+                               "under %u ms", LAT_PERIOD_MS - LAT_CHIRP_MS));
+                    break;
+                }
+                rounds = PJ_MAX(1, PJ_MIN(rounds, LAT_MAX_ROUNDS));
+                test_latency_virtual(delay_ms, 10, rounds);
             }
             break;
         case 'i':
@@ -413,6 +1194,19 @@ int main()
                 show_dev_info(dev_index);
             }
             break;
+        case 'd':
+            use_pj_delay_buf = !use_pj_delay_buf;
+            PJ_LOG(3, (THIS_FILE, "Using %s", use_pj_delay_buf ?
+                "pjmedia_delay_buf" : "the lock-free delay buffer"));
+            break;
+        case 'b':
+            {
+                unsigned frames;
+                if (sscanf(line+2, "%u", &frames) != 1 || frames == 0)
+                    frames = 4000;
+                bench_delay_buf(frames);
+            }
+            break;
         case 'R':
             pjmedia_aud_dev_refresh();
             PJ_LOG(3, (THIS_FILE, "Audio device list refreshed."));
@@ -0,0 +1,550 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "conf_device.h"
+#include <pjmedia-audiodev/audiodev.h>
+
+#define THIS_FILE	"conf_device.c"
+
+#define SIGNATURE	PJMEDIA_SIG_CLASS_PORT_AUD('C','D')
+
+/* Rate correction per sample of level error, in ppm, and its limit. A
+ * level off by a 20ms frame at 16KHz gives about the maximum correction.
+ */
+#define PPM_PER_SAMPLE	3
+#define MAX_PPM		1000
+
+/* Integral of the level error, per sample read, as 1/2^INTEG_SHIFT ppm
+ * per sample of error (in Q16 ppm per Q8 sample). It settles in about a
+ * minute to the drift itself, so the level comes back to the target
+ * instead of staying off by ppm/PPM_PER_SAMPLE.
+ */
+#define INTEG_SHIFT	10
+
+/* Level error smoothing, the average moves by 1/2^AVG_SHIFT of the
+ * error per read.
+ */
+#define AVG_SHIFT	4
+
+/* Ring positions, written by one side and read by the other */
+#if defined(__GNUC__)
+#   define RING_LOAD(p)		    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#   define RING_STORE(p, v)	    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#   include <windows.h>
+#   define RING_LOAD(p)		    ((unsigned)InterlockedCompareExchange( \
+					(LONG volatile*)(p), 0, 0))
+#   define RING_STORE(p, v)	    InterlockedExchange((LONG volatile*)(p), \
+						(LONG)(v))
+#else
+#   error "Atomic operations are not available for this compiler"
+#endif
+
+
+/* One direction: a ring of interleaved samples, written by one thread
+ * and read by another. Counts are in samples per channel.
+ */
+typedef struct dev_ring
+{
+    unsigned		 channel_count;	/**< Number of channels.	    */
+    unsigned		 base_target;	/**< Level to keep, as set.	    */
+    unsigned		 mask;		/**< Capacity - 1, the capacity is
+					     a power of two.		    */
+    int			 sign;		/**< Drift sign, -1 when the device
+					     is the reader.		    */
+    unsigned		 clock_rate;	/**< Clock rate.		    */
+    pj_int16_t		*buf;		/**< Interleaved samples.	    */
+    pj_uint32_t		 frames;	/**< Frames exchanged with the
+					     bridge.			    */
+
+    /* Written by the writer only */
+    unsigned		 write_pos;	/**< Samples written.		    */
+    unsigned		 write_chunk;	/**< Largest write.		    */
+    pj_uint32_t		 overflows;	/**< Writes dropped.		    */
+
+    /* Written by the reader only */
+    unsigned		 read_pos;	/**< Samples taken.		    */
+    unsigned		 target;	/**< Level to keep, for the chunk
+					     sizes seen.		    */
+    pj_uint32_t		 frac;		/**< Position between read_pos and
+					     the next sample, Q32.	    */
+    pj_bool_t		 running;	/**< Level reached the target since
+					     the last underrun.		    */
+    int			 err_avg;	/**< Smoothed level error, Q8.	    */
+    pj_int32_t		 integ;		/**< Integral part of the
+					     correction, Q16 ppm. Kept over
+					     underruns.			    */
+    int			 ppm;		/**< Rate correction.		    */
+    unsigned		 level;		/**< Level at the last read.	    */
+    unsigned		 level_min;	/**< Level range since running.	    */
+    unsigned		 level_max;
+    unsigned		 last_write;	/**< write_pos at the last read.    */
+    pj_uint64_t		 in_cnt;	/**< Samples written since running. */
+    pj_uint64_t		 out_cnt;	/**< Samples read since running.    */
+    pj_uint32_t		 underruns;	/**< Reads out of audio.	    */
+    pj_uint32_t		 last_overflows;/**< overflows at the last read.    */
+} dev_ring;
+
+
+struct conf_device
+{
+    pjmedia_port	 base;
+    pjmedia_aud_stream	*strm;		/**< Device stream.		    */
+    pjmedia_dir		 dir;		/**< Directions opened.		    */
+    unsigned		 frame;		/**< Bridge frame, in samples per
+					     channel.			    */
+    dev_ring		 rec;		/**< Device to bridge.		    */
+    dev_ring		 play;		/**< Bridge to device.		    */
+};
+
+
+static void ring_init(pj_pool_t *pool, dev_ring *ring,
+		      const conf_device_param *param, unsigned frame,
+		      int sign)
+{
+    unsigned cap;
+
+    ring->channel_count = param->channel_count;
+    ring->clock_rate = param->clock_rate;
+    ring->base_target = ring->target = param->target_frames * frame;
+    ring->sign = sign;
+
+    for (cap=1; cap < param->buffer_frames * frame; cap <<= 1)
+	;
+    ring->mask = cap - 1;
+    ring->buf = (pj_int16_t*)
+		pj_pool_zalloc(pool, cap * ring->channel_count *
+				     sizeof(pj_int16_t));
+}
+
+
+/*
+ * Writer side: append n samples, or silence when src is NULL. Samples
+ * which don't fit are dropped, all of them.
+ */
+static void ring_write(dev_ring *ring, const pj_int16_t *src, unsigned n)
+{
+    unsigned ch = ring->channel_count;
+    unsigned w = ring->write_pos, pos, cnt;
+
+    if (n > ring->write_chunk)
+	ring->write_chunk = n;
+
+    if (ring->mask + 1 - (w - RING_LOAD(&ring->read_pos)) < n) {
+	RING_STORE(&ring->overflows, ring->overflows + 1);
+	return;
+    }
+
+    /* Copy in up to two parts around the end of the ring */
+    pos = w & ring->mask;
+    cnt = PJ_MIN(n, ring->mask + 1 - pos);
+    if (src) {
+	pj_memcpy(ring->buf + pos * ch, src, cnt * ch * sizeof(pj_int16_t));
+	pj_memcpy(ring->buf, src + cnt * ch,
+		  (n - cnt) * ch * sizeof(pj_int16_t));
+    } else {
+	pj_bzero(ring->buf + pos * ch, cnt * ch * sizeof(pj_int16_t));
+	pj_bzero(ring->buf, (n - cnt) * ch * sizeof(pj_int16_t));
+    }
+
+    RING_STORE(&ring->write_pos, w + n);
+}
+
+
+/*
+ * Adjust the target level to the chunk sizes. The level seen by the
+ * reader swings by about a write chunk around the level the controller
+ * keeps, and the low end must still hold a read chunk plus the next
+ * sample to interpolate with. A device working in other chunks than the
+ * bridge's frames may need more than the target set.
+ */
+static void update_target(dev_ring *ring, unsigned read_chunk)
+{
+    unsigned need;
+
+    need = read_chunk + ring->write_chunk / 2 +
+	   (read_chunk + ring->write_chunk) / 4;
+    need = PJ_MAX(need, ring->base_target);
+    need = PJ_MIN(need, (ring->mask + 1) / 2);
+
+    if (need > ring->target)
+	ring->target = need;
+}
+
+
+/*
+ * Update the rate correction from the ring level, as the reader is
+ * about to take n samples.
+ */
+static void update_drift(dev_ring *ring, unsigned level, unsigned n)
+{
+    int err = (int)level - (int)ring->target;
+    pj_int64_t integ;
+    int ppm;
+
+    ring->err_avg += (err * 256 - ring->err_avg) >> AVG_SHIFT;
+
+    integ = ring->integ + (((pj_int64_t)ring->err_avg * n) >> INTEG_SHIFT);
+    if (integ > (MAX_PPM << 16))
+	integ = MAX_PPM << 16;
+    else if (integ < -(MAX_PPM << 16))
+	integ = -(MAX_PPM << 16);
+    ring->integ = (pj_int32_t)integ;
+
+    ppm = ring->err_avg * PPM_PER_SAMPLE / 256 + (ring->integ >> 16);
+    if (ppm > MAX_PPM)
+	ppm = MAX_PPM;
+    else if (ppm < -MAX_PPM)
+	ppm = -MAX_PPM;
+    ring->ppm = ppm;
+}
+
+
+/*
+ * Reader side: take n samples out of the ring, stepping through it at
+ * 1 + ppm/1e6 samples per output sample with linear interpolation.
+ * Without correction the samples are copied unchanged. Returns
+ * PJ_FALSE when the ring is still filling up and out is silence.
+ */
+static pj_bool_t ring_read(dev_ring *ring, pj_int16_t *out, unsigned n)
+{
+    unsigned ch = ring->channel_count;
+    unsigned w = RING_LOAD(&ring->write_pos);
+    unsigned r = ring->read_pos;
+    pj_uint32_t overflows = RING_LOAD(&ring->overflows);
+    pj_uint64_t step;
+    unsigned i, c;
+
+    ring->level = w - r;
+    update_target(ring, n);
+
+    /* Start over when the reader fell far behind, e.g. the bridge didn't
+     * read a port nobody listened to while the device kept writing: the
+     * correction would take minutes to drain the excess. The integral
+     * wound up meanwhile, drop it too.
+     */
+    if (ring->running &&
+	(overflows != ring->last_overflows ||
+	 w - r > ring->target + ring->write_chunk + n))
+    {
+	ring->running = PJ_FALSE;
+	ring->integ = 0;
+    }
+    ring->last_overflows = overflows;
+
+    /* After start and after an underrun, wait for the target level */
+    if (!ring->running) {
+	if (w - r < ring->target) {
+	    pj_bzero(out, n * ch * sizeof(pj_int16_t));
+	    return PJ_FALSE;
+	}
+	/* Start with the target as the average level. Just after a write
+	 * the level is at the top of its swing, half a chunk above.
+	 */
+	if (w - r > ring->target + ring->write_chunk / 2)
+	    r = w - ring->target - ring->write_chunk / 2;
+	ring->frac = 0;
+	ring->running = PJ_TRUE;
+	ring->err_avg = 0;
+	ring->level_min = ring->level_max = w - r;
+	ring->last_write = w;
+	ring->in_cnt = ring->out_cnt = 0;
+    }
+
+    if (w - r < ring->level_min)
+	ring->level_min = w - r;
+    if (w - r > ring->level_max)
+	ring->level_max = w - r;
+    ring->in_cnt += w - ring->last_write;
+    ring->last_write = w;
+
+    update_drift(ring, w - r, n);
+    step = ((pj_uint64_t)1 << 32) + (pj_int64_t)ring->ppm * 4295;
+
+    for (i=0; i<n; ++i) {
+	const pj_int16_t *x0, *x1;
+	pj_uint64_t acc;
+
+	if (w - r < 2) {
+	    pj_bzero(out + i * ch, (n - i) * ch * sizeof(pj_int16_t));
+	    ++ring->underruns;
+	    ring->running = PJ_FALSE;
+	    ring->frac = 0;
+	    break;
+	}
+
+	x0 = ring->buf + (r & ring->mask) * ch;
+	x1 = ring->buf + ((r + 1) & ring->mask) * ch;
+	for (c=0; c<ch; ++c) {
+	    out[i * ch + c] = (pj_int16_t)
+		(x0[c] + (((pj_int64_t)(x1[c] - x0[c]) * ring->frac) >> 32));
+	}
+
+	acc = (pj_uint64_t)ring->frac + step;
+	r += (unsigned)(acc >> 32);
+	ring->frac = (pj_uint32_t)acc;
+    }
+
+    ring->out_cnt += i;
+    RING_STORE(&ring->read_pos, r);
+    return PJ_TRUE;
+}
+
+
+static void ring_get_stat(const dev_ring *ring, conf_device_dir_stat *stat)
+{
+    pj_uint64_t in_cnt = ring->in_cnt, out_cnt = ring->out_cnt;
+
+    /* Figures of the other threads may be one frame old */
+    stat->level = ring->level;
+    stat->level_min = ring->level_min;
+    stat->level_max = ring->level_max;
+    stat->target = ring->target;
+    stat->drift_ppm = ring->sign * ring->ppm;
+    stat->measured_ppm = 0;
+    if (out_cnt) {
+	stat->measured_ppm = ring->sign * (int)
+	    (((pj_int64_t)(in_cnt - out_cnt) * 1000000) / (pj_int64_t)out_cnt);
+    }
+    stat->measured_sec = (pj_uint32_t)(out_cnt / ring->clock_rate);
+    stat->frames = ring->frames;
+    stat->underruns = ring->underruns;
+    stat->overflows = ring->overflows;
+}
+
+
+/*
+ * Bridge side of playback. Frames without audio are put as silence, the
+ * device keeps playing at the bridge's pace.
+ */
+static pj_status_t dev_put_frame(pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    conf_device *dev = (conf_device*) this_port;
+    const pj_int16_t *src = NULL;
+
+    if ((dev->dir & PJMEDIA_DIR_PLAYBACK) == 0)
+	return PJ_SUCCESS;
+
+    if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO &&
+	frame->size >= dev->frame * dev->play.channel_count *
+		       sizeof(pj_int16_t))
+    {
+	src = (const pj_int16_t*) frame->buf;
+    }
+
+    ring_write(&dev->play, src, dev->frame);
+    ++dev->play.frames;
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Bridge side of capture.
+ */
+static pj_status_t dev_get_frame(pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    conf_device *dev = (conf_device*) this_port;
+
+    if ((dev->dir & PJMEDIA_DIR_CAPTURE) == 0 ||
+	!ring_read(&dev->rec, (pj_int16_t*)frame->buf, dev->frame))
+    {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_SUCCESS;
+    }
+
+    ++dev->rec.frames;
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = dev->frame * dev->rec.channel_count * sizeof(pj_int16_t);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t dev_on_destroy(pjmedia_port *this_port)
+{
+    return conf_device_destroy((conf_device*) this_port);
+}
+
+
+/*
+ * Device side of capture.
+ */
+static pj_status_t dev_rec_cb(void *user_data, pjmedia_frame *frame)
+{
+    conf_device *dev = (conf_device*) user_data;
+    unsigned n = (unsigned)(frame->size / sizeof(pj_int16_t) /
+			    dev->rec.channel_count);
+
+    if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO)
+	ring_write(&dev->rec, (const pj_int16_t*)frame->buf, n);
+    else
+	ring_write(&dev->rec, NULL, n);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Device side of playback.
+ */
+static pj_status_t dev_play_cb(void *user_data, pjmedia_frame *frame)
+{
+    conf_device *dev = (conf_device*) user_data;
+    unsigned n = (unsigned)(frame->size / sizeof(pj_int16_t) /
+			    dev->play.channel_count);
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    ring_read(&dev->play, (pj_int16_t*)frame->buf, n);
+    return PJ_SUCCESS;
+}
+
+
+void conf_device_param_default(conf_device_param *param,
+			       pjmedia_dir dir,
+			       int dev_id,
+			       unsigned clock_rate,
+			       unsigned channel_count,
+			       unsigned samples_per_frame)
+{
+    pj_bzero(param, sizeof(*param));
+    param->dir = dir;
+    param->rec_id = dev_id;
+    param->play_id = dev_id;
+    param->clock_rate = clock_rate;
+    param->channel_count = channel_count;
+    param->samples_per_frame = samples_per_frame;
+    param->bits_per_sample = 16;
+    param->buffer_frames = 8;
+    param->target_frames = 2;
+}
+
+
+pj_status_t conf_device_create(pj_pool_t *pool,
+			       const char *name,
+			       const conf_device_param *param,
+			       conf_device **p_dev)
+{
+    conf_device *dev;
+    pjmedia_aud_param aud_param;
+    pj_str_t port_name;
+    pjmedia_aud_dev_index rec_id, play_id;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && param && p_dev, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->dir & PJMEDIA_DIR_CAPTURE_PLAYBACK, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->clock_rate && param->channel_count &&
+		     param->samples_per_frame &&
+		     param->samples_per_frame % param->channel_count == 0,
+		     PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->bits_per_sample == 16, PJMEDIA_ENCBITS);
+    PJ_ASSERT_RETURN(param->target_frames >= 1 &&
+		     param->buffer_frames > param->target_frames, PJ_EINVAL);
+
+    dev = PJ_POOL_ZALLOC_T(pool, conf_device);
+    dev->dir = param->dir;
+    dev->frame = param->samples_per_frame / param->channel_count;
+    if (dev->dir & PJMEDIA_DIR_CAPTURE)
+	ring_init(pool, &dev->rec, param, dev->frame, 1);
+    if (dev->dir & PJMEDIA_DIR_PLAYBACK)
+	ring_init(pool, &dev->play, param, dev->frame, -1);
+
+    port_name = pj_str((char*)(name ? name : "device"));
+    pjmedia_port_info_init(&dev->base.info, &port_name, SIGNATURE,
+			   param->clock_rate, param->channel_count,
+			   param->bits_per_sample, param->samples_per_frame);
+    dev->base.put_frame = &dev_put_frame;
+    dev->base.get_frame = &dev_get_frame;
+    dev->base.on_destroy = &dev_on_destroy;
+
+    rec_id = (param->rec_id < 0) ? PJMEDIA_AUD_DEFAULT_CAPTURE_DEV :
+				   param->rec_id;
+    play_id = (param->play_id < 0) ? PJMEDIA_AUD_DEFAULT_PLAYBACK_DEV :
+				     param->play_id;
+    status = pjmedia_aud_dev_default_param((dev->dir & PJMEDIA_DIR_CAPTURE) ?
+					   rec_id : play_id, &aud_param);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    aud_param.dir = dev->dir;
+    aud_param.rec_id = rec_id;
+    aud_param.play_id = play_id;
+    aud_param.clock_rate = param->clock_rate;
+    aud_param.channel_count = param->channel_count;
+    aud_param.samples_per_frame = param->samples_per_frame;
+    aud_param.bits_per_sample = param->bits_per_sample;
+
+    status = pjmedia_aud_stream_create(&aud_param, &dev_rec_cb, &dev_play_cb,
+				       dev, &dev->strm);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pjmedia_aud_stream_start(dev->strm);
+    if (status != PJ_SUCCESS) {
+	pjmedia_aud_stream_destroy(dev->strm);
+	return status;
+    }
+
+    PJ_LOG(4,(THIS_FILE, "Device port %.*s started (capture %d, playback "
+	      "%d), %u samples buffered", (int)port_name.slen, port_name.ptr,
+	      (dev->dir & PJMEDIA_DIR_CAPTURE) ? rec_id : -1,
+	      (dev->dir & PJMEDIA_DIR_PLAYBACK) ? play_id : -1,
+	      param->target_frames * dev->frame));
+
+    *p_dev = dev;
+    return PJ_SUCCESS;
+}
+
+
+pjmedia_port* conf_device_get_port(conf_device *dev)
+{
+    PJ_ASSERT_RETURN(dev, NULL);
+    return &dev->base;
+}
+
+
+pj_status_t conf_device_get_stat(conf_device *dev,
+				 conf_device_stat *stat)
+{
+    PJ_ASSERT_RETURN(dev && stat, PJ_EINVAL);
+
+    pj_bzero(stat, sizeof(*stat));
+    if (dev->dir & PJMEDIA_DIR_CAPTURE)
+	ring_get_stat(&dev->rec, &stat->rec);
+    if (dev->dir & PJMEDIA_DIR_PLAYBACK)
+	ring_get_stat(&dev->play, &stat->play);
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_device_destroy(conf_device *dev)
+{
+    PJ_ASSERT_RETURN(dev, PJ_EINVAL);
+
+    if (dev->strm) {
+	pjmedia_aud_stream_stop(dev->strm);
+	pjmedia_aud_stream_destroy(dev->strm);
+	dev->strm = NULL;
+    }
+
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __CONF_DEVICE_H__
+#define __CONF_DEVICE_H__
+
+/**
+ * @file conf_device.h
+ * @brief Sound device as a passive conference port.
+ *
+ * A conference bridge runs by the clock of its own sound device (or of
+ * whatever calls its master port's get_frame()). Any other sound device
+ * has a clock of its own, slightly faster or slower, and calls for (or
+ * delivers) audio from its own thread. This adapter is a passive port to
+ * add to the bridge, for capture, playback or both: each direction goes
+ * through a lock-free single producer, single consumer ring between the
+ * bridge and the device callback. Neither side ever waits for the other.
+ *
+ * The consumer of each ring (the device callback for playback, the
+ * bridge's get_frame() for capture) keeps the ring at a target level by
+ * resampling by a tiny amount (linear interpolation, 1000 ppm at most),
+ * so the drift between the clocks is absorbed without dropping or
+ * repeating frames. Each adapter runs its own compensation, so any
+ * number of devices can join the same bridge.
+ *
+ * The drift is also measured from the sample counts of both sides since
+ * the ring last started, the way pjmedia_aud_test() reports
+ * rec_drift_per_sec, together with the range the level moved in, so long
+ * runs can show that the buffering stays bounded.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque declaration of the adapter.
+ */
+typedef struct conf_device conf_device;
+
+/**
+ * Adapter settings.
+ */
+typedef struct conf_device_param
+{
+    pjmedia_dir		dir;		    /**< PJMEDIA_DIR_CAPTURE,
+						 PJMEDIA_DIR_PLAYBACK or
+						 both.			    */
+    int			rec_id;		    /**< Capture device, -1 for the
+						 default one.		    */
+    int			play_id;	    /**< Playback device, -1 for
+						 the default one.	    */
+    unsigned		clock_rate;	    /**< Clock rate, the bridge's.  */
+    unsigned		channel_count;	    /**< Number of channels.	    */
+    unsigned		samples_per_frame;  /**< Samples per frame (of all
+						 channels), the bridge's.   */
+    unsigned		bits_per_sample;    /**< Must be 16.		    */
+    unsigned		buffer_frames;	    /**< Ring capacity in frames,
+						 must hold twice the device's
+						 chunks too. Default 8.	    */
+    unsigned		target_frames;	    /**< Level kept in the ring, in
+						 frames. This is the latency
+						 added by the adapter; it is
+						 raised when the device works
+						 in larger chunks than the
+						 bridge's frames. Default 2. */
+} conf_device_param;
+
+/**
+ * Statistics of one direction.
+ */
+typedef struct conf_device_dir_stat
+{
+    unsigned		level;		    /**< Samples (per channel) in
+						 the ring at the last read. */
+    unsigned		level_min;	    /**< Lowest level since the
+						 ring last started.	    */
+    unsigned		level_max;	    /**< Highest level since the
+						 ring last started.	    */
+    unsigned		target;		    /**< Target level, in samples
+						 per channel.		    */
+    int			drift_ppm;	    /**< Clock drift being corrected,
+						 positive when the device's
+						 clock is faster than the
+						 bridge's.		    */
+    int			measured_ppm;	    /**< Clock drift measured from
+						 the sample counts since the
+						 ring last started, same
+						 sign.			    */
+    pj_uint32_t		measured_sec;	    /**< Duration of the measure,
+						 in seconds.		    */
+    pj_uint32_t		frames;		    /**< Frames exchanged with the
+						 bridge.		    */
+    pj_uint32_t		underruns;	    /**< Reads which ran out of
+						 audio (the rest is
+						 silence); the ring starts
+						 again after them.	    */
+    pj_uint32_t		overflows;	    /**< Writes which didn't fit in
+						 the ring and were dropped. */
+} conf_device_dir_stat;
+
+/**
+ * Adapter statistics.
+ */
+typedef struct conf_device_stat
+{
+    conf_device_dir_stat rec;		    /**< Capture direction.	    */
+    conf_device_dir_stat play;		    /**< Playback direction.	    */
+} conf_device_stat;
+
+
+/**
+ * Initialize the settings with default values for a bridge.
+ *
+ * @param param		The settings.
+ * @param dir		Direction(s) to open.
+ * @param dev_id	Device for both directions, -1 for the default
+ *			ones.
+ * @param clock_rate	Clock rate.
+ * @param channel_count	Number of channels.
+ * @param samples_per_frame Samples per frame.
+ */
+void conf_device_param_default(conf_device_param *param,
+			       pjmedia_dir dir,
+			       int dev_id,
+			       unsigned clock_rate,
+			       unsigned channel_count,
+			       unsigned samples_per_frame);
+
+/**
+ * Open and start the sound device, and create the port to add to the
+ * bridge.
+ *
+ * @param pool		Pool to allocate the adapter and its rings.
+ * @param name		Optional port name.
+ * @param param		The settings.
+ * @param p_dev		Pointer to receive the adapter.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_device_create(pj_pool_t *pool,
+			       const char *name,
+			       const conf_device_param *param,
+			       conf_device **p_dev);
+
+/**
+ * Get the port to add to the bridge. The port's get_frame() returns the
+ * captured audio and its put_frame() plays it; each must be called from
+ * one thread at a time. A direction not opened returns (or takes) no
+ * audio.
+ *
+ * @param dev		The adapter.
+ *
+ * @return		The port.
+ */
+pjmedia_port* conf_device_get_port(conf_device *dev);
+
+/**
+ * Get the statistics.
+ *
+ * @param dev		The adapter.
+ * @param stat		The statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_device_get_stat(conf_device *dev,
+				 conf_device_stat *stat);
+
+/**
+ * Stop and close the device. The port must have been removed from the
+ * bridge first. Destroying the port with pjmedia_port_destroy() does
+ * the same.
+ *
+ * @param dev		The adapter.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_device_destroy(conf_device *dev);
+
+
+PJ_END_DECL
+
+#endif	/* __CONF_DEVICE_H__ */
@@ -0,0 +1,849 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "conf_mix.h"
+
+#define THIS_FILE   "conf_mix.c"
+
+#if CONF_MIX_USE_SIMD && defined(__x86_64__) && defined(__GNUC__)
+#   define HAS_X86_SIMD	1
+#   include <immintrin.h>
+#else
+#   define HAS_X86_SIMD	0
+#endif
+
+/*
+ * Level adjustment is computed in single precision float, and converted
+ * back with truncation toward zero. The SIMD implementations perform the
+ * very same operations (cvtdq2ps, mulps, minps/maxps, cvttps2dq) so the
+ * results are bit-exact. The unity level is handled with integer
+ * saturation only.
+ */
+#define GAIN(adj_level)	((float)(adj_level) / CONF_MIX_NORMAL_LEVEL)
+
+
+/*****************************************************************************
+ * Scalar implementation.
+ */
+static pj_int16_t scale_sample(pj_int32_t sample, float gain)
+{
+    float f = (float)sample * gain;
+
+    if (f > 32767.0f)
+	return 32767;
+    if (f < -32768.0f)
+	return -32768;
+    return (pj_int16_t)(pj_int32_t)f;
+}
+
+static pj_int16_t clip_sample(pj_int32_t sample)
+{
+    if (sample > 32767)
+	return 32767;
+    if (sample < -32768)
+	return -32768;
+    return (pj_int16_t)sample;
+}
+
+static void level_reset(conf_mix_level *level)
+{
+    level->abs_sum = level->peak = 0;
+    level->sq_sum = 0;
+}
+
+static void level_add(conf_mix_level *level, pj_int16_t sample)
+{
+    pj_uint32_t a = (sample < 0) ? (sample == -32768 ? 32767 : -sample) :
+				   sample;
+
+    level->abs_sum += a;
+    level->sq_sum += (pj_uint64_t)a * a;
+    if (a > level->peak)
+	level->peak = a;
+}
+
+static void scalar_accum(pj_int32_t *mix, const pj_int16_t *in,
+			 unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	mix[i] += in[i];
+}
+
+static void scalar_level(const pj_int16_t *buf, unsigned count,
+			 conf_mix_level *level)
+{
+    unsigned i;
+
+    level_reset(level);
+    for (i=0; i<count; ++i)
+	level_add(level, buf[i]);
+}
+
+static void scalar_adjust(pj_int16_t *buf, unsigned count,
+			  unsigned adj_level, conf_mix_level *level)
+{
+    float gain = GAIN(adj_level);
+    unsigned i;
+
+    if (adj_level == CONF_MIX_NORMAL_LEVEL) {
+	scalar_level(buf, count, level);
+	return;
+    }
+
+    level_reset(level);
+    for (i=0; i<count; ++i) {
+	buf[i] = scale_sample(buf[i], gain);
+	level_add(level, buf[i]);
+    }
+}
+
+static void scalar_accum32(pj_int32_t *mix, const pj_int32_t *in,
+			   unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	mix[i] += in[i];
+}
+
+/* Clip (mix - sub) to 16bit, sub may be NULL */
+static void scalar_clip_impl(pj_int16_t *out, const pj_int32_t *mix,
+			     const pj_int16_t *sub, unsigned count,
+			     unsigned adj_level, conf_mix_level *level)
+{
+    float gain = GAIN(adj_level);
+    unsigned i;
+
+    level_reset(level);
+
+    for (i=0; i<count; ++i) {
+	pj_int32_t v = sub ? mix[i] - sub[i] : mix[i];
+
+	out[i] = (adj_level == CONF_MIX_NORMAL_LEVEL) ? clip_sample(v) :
+							scale_sample(v, gain);
+	level_add(level, out[i]);
+    }
+}
+
+static void scalar_clip(pj_int16_t *out, const pj_int32_t *mix,
+			unsigned count, unsigned adj_level,
+			conf_mix_level *level)
+{
+    scalar_clip_impl(out, mix, NULL, count, adj_level, level);
+}
+
+static void scalar_clip_sub(pj_int16_t *out, const pj_int32_t *mix,
+			    const pj_int16_t *sub, unsigned count,
+			    unsigned adj_level, conf_mix_level *level)
+{
+    scalar_clip_impl(out, mix, sub, count, adj_level, level);
+}
+
+/* Products are summed as unsigned so the wrap-around is defined */
+static pj_int32_t scalar_dot(const pj_int16_t *a, const pj_int16_t *b,
+			     unsigned count)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	sum += (pj_uint32_t)((pj_int32_t)a[i] * b[i]);
+    return (pj_int32_t)sum;
+}
+
+static const conf_mix_ops scalar_ops =
+{
+    "scalar",
+    &scalar_accum,
+    &scalar_accum32,
+    &scalar_adjust,
+    &scalar_clip,
+    &scalar_clip_sub,
+    &scalar_level,
+    &scalar_dot
+};
+
+
+#if HAS_X86_SIMD
+/*****************************************************************************
+ * SSE2 implementation, 8 samples per iteration.
+ */
+
+/* Absolute value of 16bit samples, saturating -32768 to 32767 */
+#define SSE2_ABS16(x)	_mm_max_epi16(x, _mm_subs_epi16(_mm_setzero_si128(), x))
+
+static void sse2_level_finish(__m128i sum, __m128i sq, __m128i peak,
+			      conf_mix_level *level)
+{
+    pj_int32_t s[4];
+    pj_uint64_t q[2];
+    pj_int16_t p[8];
+    unsigned i;
+
+    _mm_storeu_si128((__m128i*)s, sum);
+    _mm_storeu_si128((__m128i*)q, sq);
+    _mm_storeu_si128((__m128i*)p, peak);
+
+    level->abs_sum += (pj_uint32_t)s[0] + s[1] + s[2] + s[3];
+    level->sq_sum += q[0] + q[1];
+    for (i=0; i<8; ++i) {
+	if ((pj_uint32_t)p[i] > level->peak)
+	    level->peak = p[i];
+    }
+}
+
+/* Accumulate level of 8 samples. Pairs of squares of the saturated
+ * absolute values fit in 31 bits, they are summed in 64bit lanes.
+ */
+#define SSE2_LEVEL(x, sum, sq, peak)					    \
+    do {								    \
+	__m128i a_ = SSE2_ABS16(x);					    \
+	__m128i q_ = _mm_madd_epi16(a_, a_);				    \
+	peak = _mm_max_epi16(peak, a_);					    \
+	sum = _mm_add_epi32(sum, _mm_madd_epi16(a_, _mm_set1_epi16(1)));    \
+	sq = _mm_add_epi64(sq, _mm_unpacklo_epi32(q_, _mm_setzero_si128()));\
+	sq = _mm_add_epi64(sq, _mm_unpackhi_epi32(q_, _mm_setzero_si128()));\
+    } while (0)
+
+/* Scale four 32bit samples by gain, return clipped 32bit result */
+static __m128i sse2_scale(__m128i v, __m128 gain)
+{
+    __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(v), gain);
+
+    f = _mm_min_ps(f, _mm_set1_ps(32767.0f));
+    f = _mm_max_ps(f, _mm_set1_ps(-32768.0f));
+    return _mm_cvttps_epi32(f);
+}
+
+static void sse2_accum(pj_int32_t *mix, const pj_int16_t *in, unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i x = _mm_loadu_si128((const __m128i*)(in+i));
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+	__m128i m0 = _mm_loadu_si128((const __m128i*)(mix+i));
+	__m128i m1 = _mm_loadu_si128((const __m128i*)(mix+i+4));
+
+	_mm_storeu_si128((__m128i*)(mix+i), _mm_add_epi32(m0, lo));
+	_mm_storeu_si128((__m128i*)(mix+i+4), _mm_add_epi32(m1, hi));
+    }
+    scalar_accum(mix+i, in+i, count-i);
+}
+
+static void sse2_level(const pj_int16_t *buf, unsigned count,
+		       conf_mix_level *level)
+{
+    __m128i sum = _mm_setzero_si128();
+    __m128i sq = _mm_setzero_si128();
+    __m128i peak = _mm_setzero_si128();
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i x = _mm_loadu_si128((const __m128i*)(buf+i));
+	SSE2_LEVEL(x, sum, sq, peak);
+    }
+
+    level_reset(level);
+    for (; i<count; ++i)
+	level_add(level, buf[i]);
+    sse2_level_finish(sum, sq, peak, level);
+}
+
+static void sse2_adjust(pj_int16_t *buf, unsigned count, unsigned adj_level,
+			conf_mix_level *level)
+{
+    __m128 gain = _mm_set1_ps(GAIN(adj_level));
+    __m128i sum = _mm_setzero_si128();
+    __m128i sq = _mm_setzero_si128();
+    __m128i peak = _mm_setzero_si128();
+    float fgain = GAIN(adj_level);
+    unsigned i;
+
+    if (adj_level == CONF_MIX_NORMAL_LEVEL) {
+	sse2_level(buf, count, level);
+	return;
+    }
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i x = _mm_loadu_si128((const __m128i*)(buf+i));
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+	x = _mm_packs_epi32(sse2_scale(lo, gain), sse2_scale(hi, gain));
+	_mm_storeu_si128((__m128i*)(buf+i), x);
+	SSE2_LEVEL(x, sum, sq, peak);
+    }
+
+    level_reset(level);
+    for (; i<count; ++i) {
+	buf[i] = scale_sample(buf[i], fgain);
+	level_add(level, buf[i]);
+    }
+    sse2_level_finish(sum, sq, peak, level);
+}
+
+static void sse2_accum32(pj_int32_t *mix, const pj_int32_t *in,
+			 unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+4 <= count; i+=4) {
+	__m128i m = _mm_loadu_si128((const __m128i*)(mix+i));
+	__m128i x = _mm_loadu_si128((const __m128i*)(in+i));
+
+	_mm_storeu_si128((__m128i*)(mix+i), _mm_add_epi32(m, x));
+    }
+    scalar_accum32(mix+i, in+i, count-i);
+}
+
+static void sse2_clip_impl(pj_int16_t *out, const pj_int32_t *mix,
+			   const pj_int16_t *sub, unsigned count,
+			   unsigned adj_level, conf_mix_level *level)
+{
+    __m128 gain = _mm_set1_ps(GAIN(adj_level));
+    __m128i sum = _mm_setzero_si128();
+    __m128i sq = _mm_setzero_si128();
+    __m128i peak = _mm_setzero_si128();
+    pj_bool_t normal = (adj_level == CONF_MIX_NORMAL_LEVEL);
+    conf_mix_level tail;
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i m0 = _mm_loadu_si128((const __m128i*)(mix+i));
+	__m128i m1 = _mm_loadu_si128((const __m128i*)(mix+i+4));
+	__m128i x;
+
+	if (sub) {
+	    x = _mm_loadu_si128((const __m128i*)(sub+i));
+	    m0 = _mm_sub_epi32(m0, _mm_srai_epi32(_mm_unpacklo_epi16(x, x),
+						  16));
+	    m1 = _mm_sub_epi32(m1, _mm_srai_epi32(_mm_unpackhi_epi16(x, x),
+						  16));
+	}
+	if (!normal) {
+	    m0 = sse2_scale(m0, gain);
+	    m1 = sse2_scale(m1, gain);
+	}
+	x = _mm_packs_epi32(m0, m1);
+	_mm_storeu_si128((__m128i*)(out+i), x);
+	SSE2_LEVEL(x, sum, sq, peak);
+    }
+
+    scalar_clip_impl(out+i, mix+i, sub ? sub+i : NULL, count-i, adj_level,
+		     &tail);
+    *level = tail;
+    sse2_level_finish(sum, sq, peak, level);
+}
+
+static void sse2_clip(pj_int16_t *out, const pj_int32_t *mix, unsigned count,
+		      unsigned adj_level, conf_mix_level *level)
+{
+    sse2_clip_impl(out, mix, NULL, count, adj_level, level);
+}
+
+static void sse2_clip_sub(pj_int16_t *out, const pj_int32_t *mix,
+			  const pj_int16_t *sub, unsigned count,
+			  unsigned adj_level, conf_mix_level *level)
+{
+    sse2_clip_impl(out, mix, sub, count, adj_level, level);
+}
+
+static pj_int32_t sse2_dot(const pj_int16_t *a, const pj_int16_t *b,
+			   unsigned count)
+{
+    __m128i sum = _mm_setzero_si128();
+    pj_int32_t s[4];
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+	__m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+
+	sum = _mm_add_epi32(sum, _mm_madd_epi16(x, y));
+    }
+
+    _mm_storeu_si128((__m128i*)s, sum);
+    return (pj_int32_t)((pj_uint32_t)s[0] + s[1] + s[2] + s[3] +
+			(pj_uint32_t)scalar_dot(a+i, b+i, count-i));
+}
+
+static const conf_mix_ops sse2_ops =
+{
+    "sse2",
+    &sse2_accum,
+    &sse2_accum32,
+    &sse2_adjust,
+    &sse2_clip,
+    &sse2_clip_sub,
+    &sse2_level,
+    &sse2_dot
+};
+
+
+/*****************************************************************************
+ * AVX2 implementation, 16 samples per iteration. The functions are
+ * compiled for AVX2 individually, so the rest of the program does not
+ * require AVX2 and the kernels are only selected after a CPU check.
+ */
+#define AVX2_FUNC   __attribute__((target("avx2")))
+
+#define AVX2_ABS16(x)							    \
+    _mm256_max_epi16(x, _mm256_subs_epi16(_mm256_setzero_si256(), x))
+
+#define AVX2_LEVEL(x, sum, sq, peak)					    \
+    do {								    \
+	__m256i a_ = AVX2_ABS16(x);					    \
+	__m256i q_ = _mm256_madd_epi16(a_, a_);				    \
+	peak = _mm256_max_epi16(peak, a_);				    \
+	sum = _mm256_add_epi32(sum,					    \
+			       _mm256_madd_epi16(a_, _mm256_set1_epi16(1))); \
+	sq = _mm256_add_epi64(sq, _mm256_unpacklo_epi32(q_,		    \
+						_mm256_setzero_si256()));   \
+	sq = _mm256_add_epi64(sq, _mm256_unpackhi_epi32(q_,		    \
+						_mm256_setzero_si256()));   \
+    } while (0)
+
+/* packs_epi32 works per 128bit lane, restore sample order */
+#define AVX2_PACK(lo, hi)						    \
+    _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8)
+
+static AVX2_FUNC void avx2_level_finish(__m256i sum, __m256i sq,
+					__m256i peak, conf_mix_level *level)
+{
+    pj_int32_t s[8];
+    pj_uint64_t q[4];
+    pj_int16_t p[16];
+    unsigned i;
+
+    _mm256_storeu_si256((__m256i*)s, sum);
+    _mm256_storeu_si256((__m256i*)q, sq);
+    _mm256_storeu_si256((__m256i*)p, peak);
+
+    for (i=0; i<8; ++i)
+	level->abs_sum += (pj_uint32_t)s[i];
+    for (i=0; i<4; ++i)
+	level->sq_sum += q[i];
+    for (i=0; i<16; ++i) {
+	if ((pj_uint32_t)p[i] > level->peak)
+	    level->peak = p[i];
+    }
+}
+
+static AVX2_FUNC __m256i avx2_scale(__m256i v, __m256 gain)
+{
+    __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(v), gain);
+
+    f = _mm256_min_ps(f, _mm256_set1_ps(32767.0f));
+    f = _mm256_max_ps(f, _mm256_set1_ps(-32768.0f));
+    return _mm256_cvttps_epi32(f);
+}
+
+static AVX2_FUNC void avx2_accum(pj_int32_t *mix, const pj_int16_t *in,
+				 unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+16 <= count; i+=16) {
+	__m128i x0 = _mm_loadu_si128((const __m128i*)(in+i));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(in+i+8));
+	__m256i m0 = _mm256_loadu_si256((const __m256i*)(mix+i));
+	__m256i m1 = _mm256_loadu_si256((const __m256i*)(mix+i+8));
+
+	m0 = _mm256_add_epi32(m0, _mm256_cvtepi16_epi32(x0));
+	m1 = _mm256_add_epi32(m1, _mm256_cvtepi16_epi32(x1));
+	_mm256_storeu_si256((__m256i*)(mix+i), m0);
+	_mm256_storeu_si256((__m256i*)(mix+i+8), m1);
+    }
+    sse2_accum(mix+i, in+i, count-i);
+}
+
+static AVX2_FUNC void avx2_level(const pj_int16_t *buf, unsigned count,
+				 conf_mix_level *level)
+{
+    __m256i sum = _mm256_setzero_si256();
+    __m256i sq = _mm256_setzero_si256();
+    __m256i peak = _mm256_setzero_si256();
+    conf_mix_level tail;
+    unsigned i;
+
+    for (i=0; i+16 <= count; i+=16) {
+	__m256i x = _mm256_loadu_si256((const __m256i*)(buf+i));
+	AVX2_LEVEL(x, sum, sq, peak);
+    }
+
+    scalar_level(buf+i, count-i, &tail);
+    *level = tail;
+    avx2_level_finish(sum, sq, peak, level);
+}
+
+static AVX2_FUNC void avx2_adjust(pj_int16_t *buf, unsigned count,
+				  unsigned adj_level, conf_mix_level *level)
+{
+    __m256 gain = _mm256_set1_ps(GAIN(adj_level));
+    __m256i sum = _mm256_setzero_si256();
+    __m256i sq = _mm256_setzero_si256();
+    __m256i peak = _mm256_setzero_si256();
+    conf_mix_level tail;
+    unsigned i;
+
+    if (adj_level == CONF_MIX_NORMAL_LEVEL) {
+	avx2_level(buf, count, level);
+	return;
+    }
+
+    for (i=0; i+16 <= count; i+=16) {
+	__m128i x0 = _mm_loadu_si128((const __m128i*)(buf+i));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(buf+i+8));
+	__m256i lo = avx2_scale(_mm256_cvtepi16_epi32(x0), gain);
+	__m256i hi = avx2_scale(_mm256_cvtepi16_epi32(x1), gain);
+	__m256i x = AVX2_PACK(lo, hi);
+
+	_mm256_storeu_si256((__m256i*)(buf+i), x);
+	AVX2_LEVEL(x, sum, sq, peak);
+    }
+
+    scalar_adjust(buf+i, count-i, adj_level, &tail);
+    *level = tail;
+    avx2_level_finish(sum, sq, peak, level);
+}
+
+static AVX2_FUNC void avx2_accum32(pj_int32_t *mix, const pj_int32_t *in,
+				   unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m256i m = _mm256_loadu_si256((const __m256i*)(mix+i));
+	__m256i x = _mm256_loadu_si256((const __m256i*)(in+i));
+
+	_mm256_storeu_si256((__m256i*)(mix+i), _mm256_add_epi32(m, x));
+    }
+    scalar_accum32(mix+i, in+i, count-i);
+}
+
+static AVX2_FUNC void avx2_clip_impl(pj_int16_t *out, const pj_int32_t *mix,
+				     const pj_int16_t *sub, unsigned count,
+				     unsigned adj_level,
+				     conf_mix_level *level)
+{
+    __m256 gain = _mm256_set1_ps(GAIN(adj_level));
+    __m256i sum = _mm256_setzero_si256();
+    __m256i sq = _mm256_setzero_si256();
+    __m256i peak = _mm256_setzero_si256();
+    pj_bool_t normal = (adj_level == CONF_MIX_NORMAL_LEVEL);
+    conf_mix_level tail;
+    unsigned i;
+
+    for (i=0; i+16 <= count; i+=16) {
+	__m256i m0 = _mm256_loadu_si256((const __m256i*)(mix+i));
+	__m256i m1 = _mm256_loadu_si256((const __m256i*)(mix+i+8));
+	__m256i x;
+
+	if (sub) {
+	    __m128i s0 = _mm_loadu_si128((const __m128i*)(sub+i));
+	    __m128i s1 = _mm_loadu_si128((const __m128i*)(sub+i+8));
+
+	    m0 = _mm256_sub_epi32(m0, _mm256_cvtepi16_epi32(s0));
+	    m1 = _mm256_sub_epi32(m1, _mm256_cvtepi16_epi32(s1));
+	}
+	if (!normal) {
+	    m0 = avx2_scale(m0, gain);
+	    m1 = avx2_scale(m1, gain);
+	}
+	x = AVX2_PACK(m0, m1);
+	_mm256_storeu_si256((__m256i*)(out+i), x);
+	AVX2_LEVEL(x, sum, sq, peak);
+    }
+
+    scalar_clip_impl(out+i, mix+i, sub ? sub+i : NULL, count-i, adj_level,
+		     &tail);
+    *level = tail;
+    avx2_level_finish(sum, sq, peak, level);
+}
+
+static AVX2_FUNC void avx2_clip(pj_int16_t *out, const pj_int32_t *mix,
+				unsigned count, unsigned adj_level,
+				conf_mix_level *level)
+{
+    avx2_clip_impl(out, mix, NULL, count, adj_level, level);
+}
+
+static AVX2_FUNC void avx2_clip_sub(pj_int16_t *out, const pj_int32_t *mix,
+				    const pj_int16_t *sub, unsigned count,
+				    unsigned adj_level,
+				    conf_mix_level *level)
+{
+    avx2_clip_impl(out, mix, sub, count, adj_level, level);
+}
+
+static AVX2_FUNC pj_int32_t avx2_dot(const pj_int16_t *a,
+				     const pj_int16_t *b, unsigned count)
+{
+    __m256i sum = _mm256_setzero_si256();
+    pj_int32_t s[8];
+    pj_uint32_t total;
+    unsigned i;
+
+    for (i=0; i+16 <= count; i+=16) {
+	__m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+	__m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+
+	sum = _mm256_add_epi32(sum, _mm256_madd_epi16(x, y));
+    }
+
+    _mm256_storeu_si256((__m256i*)s, sum);
+    total = (pj_uint32_t)sse2_dot(a+i, b+i, count-i);
+    for (i=0; i<8; ++i)
+	total += (pj_uint32_t)s[i];
+    return (pj_int32_t)total;
+}
+
+static const conf_mix_ops avx2_ops =
+{
+    "avx2",
+    &avx2_accum,
+    &avx2_accum32,
+    &avx2_adjust,
+    &avx2_clip,
+    &avx2_clip_sub,
+    &avx2_level,
+    &avx2_dot
+};
+
+#endif	/* HAS_X86_SIMD */
+
+
+/*****************************************************************************
+ * Run-time dispatch.
+ */
+const conf_mix_ops* conf_mix_get_ops_by_name(const char *name)
+{
+    if (pj_ansi_strcmp(name, "scalar") == 0)
+	return &scalar_ops;
+
+#if HAS_X86_SIMD
+    __builtin_cpu_init();
+
+    if (pj_ansi_strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+	return &sse2_ops;
+    if (pj_ansi_strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+	return &avx2_ops;
+#endif
+
+    return NULL;
+}
+
+const conf_mix_ops* conf_mix_get_ops(void)
+{
+    static const conf_mix_ops *best;
+
+    if (best == NULL) {
+	const conf_mix_ops *ops;
+
+	if ((ops = conf_mix_get_ops_by_name("avx2")) == NULL &&
+	    (ops = conf_mix_get_ops_by_name("sse2")) == NULL)
+	{
+	    ops = &scalar_ops;
+	}
+	best = ops;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+ * Bit-exactness verification against the scalar implementation.
+ */
+#define VERIFY_MAX  1024
+
+static pj_int16_t rand_sample(unsigned i)
+{
+    /* Mix boundary values in with random ones */
+    switch (pj_rand() % 8) {
+    case 0:  return 32767;
+    case 1:  return -32768;
+    case 2:  return (pj_int16_t)(i & 1 ? -1 : 0);
+    default: return (pj_int16_t)(pj_rand() & 0xFFFF);
+    }
+}
+
+static pj_bool_t level_equal(const conf_mix_level *a, const conf_mix_level *b)
+{
+    return a->abs_sum == b->abs_sum && a->peak == b->peak &&
+	   a->sq_sum == b->sq_sum;
+}
+
+static pj_status_t verify_ops(const conf_mix_ops *ops)
+{
+    static const unsigned adj_levels[] = {
+	0, 1, 64, 100, 127, CONF_MIX_NORMAL_LEVEL, 129, 200, 255, 1000
+    };
+    static const unsigned lengths[] = {
+	0, 1, 7, 8, 9, 15, 16, 17, 31, 33, 80, 160, 441, 882, VERIFY_MAX
+    };
+    static pj_int16_t in[VERIFY_MAX], ref16[VERIFY_MAX], out16[VERIFY_MAX];
+    static pj_int32_t mix[VERIFY_MAX], ref32[VERIFY_MAX], out32[VERIFY_MAX];
+    unsigned l, a, i, round;
+
+    for (round=0; round<8; ++round) {
+	for (l=0; l<PJ_ARRAY_SIZE(lengths); ++l) {
+	    unsigned count = lengths[l];
+
+	    for (i=0; i<count; ++i) {
+		in[i] = rand_sample(i);
+		/* Up to 1024 full scale transmitters in the mix */
+		mix[i] = (pj_int32_t)rand_sample(i) * (pj_rand() % 1024);
+	    }
+
+	    /* accum */
+	    pj_memcpy(ref32, mix, count * sizeof(pj_int32_t));
+	    pj_memcpy(out32, mix, count * sizeof(pj_int32_t));
+	    scalar_ops.accum(ref32, in, count);
+	    ops->accum(out32, in, count);
+	    if (pj_memcmp(ref32, out32, count * sizeof(pj_int32_t))) {
+		PJ_LOG(1,(THIS_FILE, "%s: accum() mismatch, count=%u",
+			  ops->name, count));
+		return PJ_EBUG;
+	    }
+
+	    /* accum32 */
+	    {
+		static pj_int32_t in32[VERIFY_MAX];
+
+		for (i=0; i<count; ++i)
+		    in32[i] = (pj_int32_t)rand_sample(i) * (pj_rand() % 1024);
+
+		pj_memcpy(ref32, mix, count * sizeof(pj_int32_t));
+		pj_memcpy(out32, mix, count * sizeof(pj_int32_t));
+		scalar_ops.accum32(ref32, in32, count);
+		ops->accum32(out32, in32, count);
+		if (pj_memcmp(ref32, out32, count * sizeof(pj_int32_t))) {
+		    PJ_LOG(1,(THIS_FILE, "%s: accum32() mismatch, count=%u",
+			      ops->name, count));
+		    return PJ_EBUG;
+		}
+	    }
+
+	    /* dot */
+	    {
+		static pj_int16_t coef[VERIFY_MAX];
+
+		for (i=0; i<count; ++i)
+		    coef[i] = rand_sample(i);
+
+		if (scalar_ops.dot(in, coef, count) !=
+		    ops->dot(in, coef, count))
+		{
+		    PJ_LOG(1,(THIS_FILE, "%s: dot() mismatch, count=%u",
+			      ops->name, count));
+		    return PJ_EBUG;
+		}
+	    }
+
+	    /* level */
+	    {
+		conf_mix_level ref_lvl, lvl;
+
+		scalar_ops.level(in, count, &ref_lvl);
+		ops->level(in, count, &lvl);
+		if (!level_equal(&ref_lvl, &lvl)) {
+		    PJ_LOG(1,(THIS_FILE, "%s: level() mismatch, count=%u",
+			      ops->name, count));
+		    return PJ_EBUG;
+		}
+	    }
+
+	    for (a=0; a<PJ_ARRAY_SIZE(adj_levels); ++a) {
+		conf_mix_level ref_lvl, lvl;
+
+		/* adjust */
+		pj_memcpy(ref16, in, count * sizeof(pj_int16_t));
+		pj_memcpy(out16, in, count * sizeof(pj_int16_t));
+		scalar_ops.adjust(ref16, count, adj_levels[a], &ref_lvl);
+		ops->adjust(out16, count, adj_levels[a], &lvl);
+		if (pj_memcmp(ref16, out16, count * sizeof(pj_int16_t)) ||
+		    !level_equal(&ref_lvl, &lvl))
+		{
+		    PJ_LOG(1,(THIS_FILE, "%s: adjust() mismatch, count=%u "
+			      "adj_level=%u", ops->name, count,
+			      adj_levels[a]));
+		    return PJ_EBUG;
+		}
+
+		/* clip */
+		scalar_ops.clip(ref16, mix, count, adj_levels[a], &ref_lvl);
+		ops->clip(out16, mix, count, adj_levels[a], &lvl);
+		if (pj_memcmp(ref16, out16, count * sizeof(pj_int16_t)) ||
+		    !level_equal(&ref_lvl, &lvl))
+		{
+		    PJ_LOG(1,(THIS_FILE, "%s: clip() mismatch, count=%u "
+			      "adj_level=%u", ops->name, count,
+			      adj_levels[a]));
+		    return PJ_EBUG;
+		}
+
+		/* clip_sub */
+		scalar_ops.clip_sub(ref16, mix, in, count, adj_levels[a],
+				    &ref_lvl);
+		ops->clip_sub(out16, mix, in, count, adj_levels[a], &lvl);
+		if (pj_memcmp(ref16, out16, count * sizeof(pj_int16_t)) ||
+		    !level_equal(&ref_lvl, &lvl))
+		{
+		    PJ_LOG(1,(THIS_FILE, "%s: clip_sub() mismatch, count=%u "
+			      "adj_level=%u", ops->name, count,
+			      adj_levels[a]));
+		    return PJ_EBUG;
+		}
+	    }
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+pj_status_t conf_mix_verify(void)
+{
+    static const char *names[] = { "sse2", "avx2" };
+    unsigned i;
+
+    for (i=0; i<PJ_ARRAY_SIZE(names); ++i) {
+	const conf_mix_ops *ops = conf_mix_get_ops_by_name(names[i]);
+	pj_status_t status;
+
+	if (ops == NULL) {
+	    PJ_LOG(3,(THIS_FILE, "%s kernels not available, skipped",
+		      names[i]));
+	    continue;
+	}
+
+	status = verify_ops(ops);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	PJ_LOG(3,(THIS_FILE, "%s kernels are bit-exact with scalar",
+		  names[i]));
+    }
+
+    return PJ_SUCCESS;
+}
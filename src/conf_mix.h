@@ -0,0 +1,153 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __CONF_MIX_H__
+#define __CONF_MIX_H__
+
+/**
+ * @file conf_mix.h
+ * @brief Sample mixing kernels used by the conference bridge.
+ *
+ * The bridge spends most of its time accumulating frames into the
+ * listeners' mix buffers, applying level adjustment, clipping the mix
+ * back to 16bit and measuring signal level. These operations, and the
+ * dot product of the resampler, are provided here as a table of
+ * functions, with a portable scalar implementation and SSE2/AVX2
+ * implementations selected at run-time according to the CPU. All
+ * implementations produce bit-exact results.
+ */
+#include <pjlib.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Set to zero to build the scalar kernels only.
+ */
+#ifndef CONF_MIX_USE_SIMD
+#   define CONF_MIX_USE_SIMD	1
+#endif
+
+/**
+ * Level adjustment value which leaves the signal unchanged. Level
+ * adjustment passed to the kernels is (CONF_MIX_NORMAL_LEVEL + adj),
+ * where adj is the value given to the bridge's adjust_level() functions.
+ */
+#define CONF_MIX_NORMAL_LEVEL	128
+
+/**
+ * Signal level measured by the kernels. The absolute value of -32768 is
+ * saturated to 32767.
+ */
+typedef struct conf_mix_level
+{
+    pj_uint32_t	abs_sum;    /**< Sum of absolute sample values.	    */
+    pj_uint32_t	peak;	    /**< Largest absolute sample value.	    */
+    pj_uint64_t	sq_sum;	    /**< Sum of squared absolute sample
+				 values, for RMS.		    */
+} conf_mix_level;
+
+/**
+ * Mixing kernel implementation.
+ */
+typedef struct conf_mix_ops
+{
+    /** Implementation name ("scalar", "sse2", "avx2"). */
+    const char *name;
+
+    /**
+     * Accumulate a frame into a mix buffer: mix[i] += in[i].
+     */
+    void (*accum)(pj_int32_t *mix, const pj_int16_t *in, unsigned count);
+
+    /**
+     * Accumulate a mix buffer into another one: mix[i] += in[i].
+     */
+    void (*accum32)(pj_int32_t *mix, const pj_int32_t *in, unsigned count);
+
+    /**
+     * Apply level adjustment in place and measure the resulting level:
+     * buf[i] = clip(buf[i] * adj_level / CONF_MIX_NORMAL_LEVEL).
+     */
+    void (*adjust)(pj_int16_t *buf, unsigned count, unsigned adj_level,
+		   conf_mix_level *level);
+
+    /**
+     * Convert a mix buffer to 16bit samples, applying level adjustment,
+     * and measure the resulting level:
+     * out[i] = clip(mix[i] * adj_level / CONF_MIX_NORMAL_LEVEL).
+     */
+    void (*clip)(pj_int16_t *out, const pj_int32_t *mix, unsigned count,
+		 unsigned adj_level, conf_mix_level *level);
+
+    /**
+     * Same as clip(), but subtract a frame from the mix first:
+     * out[i] = clip((mix[i] - sub[i]) * adj_level / CONF_MIX_NORMAL_LEVEL).
+     * Used to remove a listener's own contribution from a shared mix.
+     */
+    void (*clip_sub)(pj_int16_t *out, const pj_int32_t *mix,
+		     const pj_int16_t *sub, unsigned count,
+		     unsigned adj_level, conf_mix_level *level);
+
+    /**
+     * Measure signal level of a frame.
+     */
+    void (*level)(const pj_int16_t *buf, unsigned count,
+		  conf_mix_level *level);
+
+    /**
+     * Dot product of two 16bit vectors, sum(a[i] * b[i]), computed
+     * modulo 2^32. Used by the polyphase resampler (see conf_resample.h),
+     * whose filter keeps the sum in range.
+     */
+    pj_int32_t (*dot)(const pj_int16_t *a, const pj_int16_t *b,
+		      unsigned count);
+
+} conf_mix_ops;
+
+
+/**
+ * Get the fastest implementation supported by the running CPU.
+ *
+ * @return	    The kernels, never NULL.
+ */
+const conf_mix_ops* conf_mix_get_ops(void);
+
+/**
+ * Get a specific implementation.
+ *
+ * @param name	    "scalar", "sse2" or "avx2".
+ *
+ * @return	    The kernels, or NULL if the implementation is not
+ *		    compiled in or not supported by the running CPU.
+ */
+const conf_mix_ops* conf_mix_get_ops_by_name(const char *name);
+
+/**
+ * Verify that every implementation supported by the running CPU is
+ * bit-exact with the scalar implementation, using random and boundary
+ * input of various lengths and level adjustments.
+ *
+ * @return	    PJ_SUCCESS if all results match.
+ */
+pj_status_t conf_mix_verify(void);
+
+
+PJ_END_DECL
+
+#endif	/* __CONF_MIX_H__ */
@@ -0,0 +1,324 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "conf_recorder.h"
+#include "conf_mix.h"
+#include "async_writer.h"
+
+#define THIS_FILE	"conf_recorder.c"
+
+
+struct conf_recorder
+{
+    confbridge		*conf;
+    unsigned		 layout;
+    unsigned		 channel_count;
+    unsigned		 samples_per_frame;  /**< Of all channels.	    */
+    const conf_mix_ops	*mix;
+    pj_bool_t		 has_mix;	/**< Track zero is the mix.	    */
+
+    unsigned		 track_cnt;
+    unsigned		 slot_cnt;
+    unsigned		*slots;		/**< Slots recorded, read by the
+					     bridge for our tap.	    */
+    int			*slot_track;	/**< Track of each slot, -1 if the
+					     slot is not recorded.	    */
+    unsigned		 slot_max;	/**< Size of slot_track.	    */
+    const pj_int16_t   **track_buf;	/**< Frame of each track in this
+					     tick.			    */
+    pj_int32_t		*mix_buf;
+    pj_int16_t		*mix_frame;
+    pj_int16_t		*silence;
+    pj_int16_t		*out_buf;	/**< Interleaved frame.		    */
+
+    async_writer_io	*io;
+    unsigned		 port_cnt;
+    pjmedia_port       **ports;		/**< A port per track, or one.	    */
+
+    pj_uint32_t		 ticks;
+    pj_uint64_t		 total_usec;
+    pj_uint32_t		 max_usec;
+};
+
+
+void conf_recorder_param_default(conf_recorder_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->layout = CONF_RECORDER_FILES;
+}
+
+
+/* Interleave the tracks, a channel group per track */
+static void interleave(conf_recorder *rec)
+{
+    unsigned chnum = rec->channel_count;
+    unsigned stride = rec->track_cnt * chnum;
+    unsigned nframes = rec->samples_per_frame / chnum;
+    unsigned t, i, c;
+
+    for (t = 0; t < rec->track_cnt; ++t) {
+	const pj_int16_t *in = rec->track_buf[t];
+	pj_int16_t *out = rec->out_buf + t * chnum;
+
+	if (chnum == 1) {
+	    for (i = 0; i < nframes; ++i, out += stride)
+		*out = in[i];
+	} else {
+	    for (i = 0; i < nframes; ++i, out += stride, in += chnum) {
+		for (c = 0; c < chnum; ++c)
+		    out[c] = in[c];
+	    }
+	}
+    }
+}
+
+/* Called in the tick with the frames read from the ports */
+static void on_tap(confbridge *conf, pj_uint32_t tick, unsigned count,
+		   const confbridge_tap_frame frames[], void *user_data)
+{
+    conf_recorder *rec = (conf_recorder*)user_data;
+    unsigned spf = rec->samples_per_frame;
+    pjmedia_frame frame;
+    pj_timestamp t0, t1;
+    pj_uint32_t usec;
+    unsigned i, t;
+
+    PJ_UNUSED_ARG(conf);
+    PJ_UNUSED_ARG(tick);
+
+    pj_get_timestamp(&t0);
+
+    /* Silence for the slots which gave nothing */
+    for (t = 0; t < rec->track_cnt; ++t)
+	rec->track_buf[t] = rec->silence;
+    for (i = 0; i < count; ++i) {
+	unsigned slot = frames[i].slot;
+
+	if (slot < rec->slot_max && rec->slot_track[slot] >= 0 &&
+	    frames[i].samples)
+	{
+	    rec->track_buf[rec->slot_track[slot]] = frames[i].samples;
+	}
+    }
+
+    if (rec->has_mix) {
+	conf_mix_level level;
+
+	pj_bzero(rec->mix_buf, spf * sizeof(rec->mix_buf[0]));
+	for (t = 1; t < rec->track_cnt; ++t) {
+	    if (rec->track_buf[t] != rec->silence)
+		rec->mix->accum(rec->mix_buf, rec->track_buf[t], spf);
+	}
+	rec->mix->clip(rec->mix_frame, rec->mix_buf, spf,
+		       CONF_MIX_NORMAL_LEVEL, &level);
+	rec->track_buf[0] = rec->mix_frame;
+    }
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    if (rec->layout == CONF_RECORDER_INTERLEAVED) {
+	interleave(rec);
+	frame.buf = rec->out_buf;
+	frame.size = spf * rec->track_cnt * 2;
+	pjmedia_port_put_frame(rec->ports[0], &frame);
+    } else {
+	frame.size = spf * 2;
+	for (t = 0; t < rec->track_cnt; ++t) {
+	    frame.buf = (void*)rec->track_buf[t];
+	    pjmedia_port_put_frame(rec->ports[t], &frame);
+	}
+    }
+
+    pj_get_timestamp(&t1);
+    usec = pj_elapsed_usec(&t0, &t1);
+    if (usec > rec->max_usec)
+	rec->max_usec = usec;
+    rec->total_usec += usec;
+    ++rec->ticks;
+}
+
+
+/* Create the writer of a track, or of all tracks */
+static pj_status_t create_writer(conf_recorder *rec, pj_pool_t *pool,
+				 const conf_recorder_param *param,
+				 const char *filename, unsigned chnum)
+{
+    pjmedia_port *master = confbridge_get_master_port(rec->conf);
+    unsigned clock_rate = PJMEDIA_PIA_SRATE(&master->info);
+    pj_ssize_t buff_size = 0;
+    pj_status_t status;
+
+    if (param->buffer_ms) {
+	buff_size = (pj_ssize_t)((pj_uint64_t)clock_rate * chnum * 2 *
+				 param->buffer_ms / 1000);
+    }
+
+    status = async_writer_create_shared(rec->io, pool, filename, clock_rate,
+					chnum, rec->samples_per_frame /
+					rec->channel_count * chnum, 16,
+					param->writer_options, buff_size,
+					&rec->ports[rec->port_cnt]);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    ++rec->port_cnt;
+    return PJ_SUCCESS;
+}
+
+pj_status_t conf_recorder_create(confbridge *conf,
+				 pj_pool_t *pool,
+				 const conf_recorder_param *param,
+				 conf_recorder **p_rec)
+{
+    pjmedia_port *master;
+    conf_recorder *rec;
+    char filename[PJ_MAXPATH];
+    unsigned i, spf;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(conf && pool && param && param->path &&
+		     param->slot_cnt && p_rec, PJ_EINVAL);
+
+    master = confbridge_get_master_port(conf);
+
+    rec = PJ_POOL_ZALLOC_T(pool, conf_recorder);
+    rec->conf = conf;
+    rec->layout = param->layout;
+    rec->channel_count = PJMEDIA_PIA_CCNT(&master->info);
+    rec->samples_per_frame = spf = PJMEDIA_PIA_SPF(&master->info);
+    rec->mix = conf_mix_get_ops();
+    rec->has_mix = !param->no_mix;
+    rec->track_cnt = param->slot_cnt + (rec->has_mix ? 1 : 0);
+
+    /* Tracks of the slots, after the mix */
+    rec->slot_cnt = param->slot_cnt;
+    rec->slots = (unsigned*) pj_pool_alloc(pool, rec->slot_cnt *
+					   sizeof(unsigned));
+    for (i = 0; i < param->slot_cnt; ++i) {
+	rec->slots[i] = param->slots ? param->slots[i] : i;
+	rec->slot_max = PJ_MAX(rec->slot_max, rec->slots[i] + 1);
+    }
+    rec->slot_track = (int*) pj_pool_alloc(pool, rec->slot_max *
+					   sizeof(int));
+    for (i = 0; i < rec->slot_max; ++i)
+	rec->slot_track[i] = -1;
+    for (i = 0; i < param->slot_cnt; ++i) {
+	unsigned slot = rec->slots[i];
+	PJ_ASSERT_RETURN(rec->slot_track[slot] < 0, PJ_EINVAL);
+	rec->slot_track[slot] = (rec->has_mix ? 1 : 0) + i;
+    }
+
+    rec->track_buf = (const pj_int16_t**)
+		     pj_pool_zalloc(pool, rec->track_cnt *
+					  sizeof(rec->track_buf[0]));
+    rec->mix_buf = (pj_int32_t*) pj_pool_alloc(pool, spf *
+					       sizeof(pj_int32_t));
+    rec->mix_frame = (pj_int16_t*) pj_pool_alloc(pool, spf * 2);
+    rec->silence = (pj_int16_t*) pj_pool_zalloc(pool, spf * 2);
+    rec->ports = (pjmedia_port**)
+		 pj_pool_zalloc(pool, rec->track_cnt * sizeof(pjmedia_port*));
+
+    /* One thread writes all the files */
+    status = async_writer_io_create(pool, &rec->io);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (rec->layout == CONF_RECORDER_INTERLEAVED) {
+	rec->out_buf = (pj_int16_t*) pj_pool_alloc(pool, spf * 2 *
+						   rec->track_cnt);
+	status = create_writer(rec, pool, param, param->path,
+			       rec->channel_count * rec->track_cnt);
+    } else {
+	if (rec->has_mix) {
+	    pj_ansi_snprintf(filename, sizeof(filename), "%s-mix.wav",
+			     param->path);
+	    status = create_writer(rec, pool, param, filename,
+				   rec->channel_count);
+	}
+	for (i = 0; i < param->slot_cnt && status == PJ_SUCCESS; ++i) {
+	    pj_ansi_snprintf(filename, sizeof(filename), "%s-%u.wav",
+			     param->path, rec->slots[i]);
+	    status = create_writer(rec, pool, param, filename,
+				   rec->channel_count);
+	}
+    }
+
+    if (status == PJ_SUCCESS)
+	status = confbridge_add_tap(conf, rec->slot_cnt, rec->slots,
+				    &on_tap, rec);
+    if (status != PJ_SUCCESS) {
+	for (i = 0; i < rec->port_cnt; ++i)
+	    pjmedia_port_destroy(rec->ports[i]);
+	async_writer_io_destroy(rec->io);
+	return status;
+    }
+
+    PJ_LOG(4,(THIS_FILE, "Recording %u slot(s)%s to %s%s", param->slot_cnt,
+	      rec->has_mix ? " and the mix" : "", param->path,
+	      rec->layout == CONF_RECORDER_INTERLEAVED ? "" : "-*.wav"));
+
+    *p_rec = rec;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_recorder_get_stat(conf_recorder *rec,
+				   conf_recorder_stat *stat)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(rec && stat, PJ_EINVAL);
+
+    pj_bzero(stat, sizeof(*stat));
+    stat->track_cnt = rec->track_cnt;
+    stat->ticks = rec->ticks;
+    if (rec->ticks)
+	stat->avg_tick_usec = (pj_uint32_t)(rec->total_usec / rec->ticks);
+    stat->max_tick_usec = rec->max_usec;
+
+    for (i = 0; i < rec->port_cnt; ++i) {
+	async_writer_stat ws;
+
+	async_writer_get_stat(rec->ports[i], &ws);
+	stat->overruns += ws.overruns;
+	stat->batches += ws.batches;
+	stat->write_errors += ws.write_errors;
+	stat->max_write_usec = PJ_MAX(stat->max_write_usec,
+				      ws.max_write_usec);
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_recorder_destroy(conf_recorder *rec)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(rec, PJ_EINVAL);
+
+    /* No tick touches the writers once this returns */
+    confbridge_remove_tap(rec->conf, &on_tap, rec);
+
+    for (i = 0; i < rec->port_cnt; ++i)
+	pjmedia_port_destroy(rec->ports[i]);
+    rec->port_cnt = 0;
+
+    return async_writer_io_destroy(rec->io);
+}
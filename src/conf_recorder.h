@@ -0,0 +1,153 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __CONF_RECORDER_H__
+#define __CONF_RECORDER_H__
+
+/**
+ * @file conf_recorder.h
+ * @brief Multi-track recorder of a conference bridge.
+ *
+ * A WAV writer port connected to the bridge records the mix of the ports
+ * connected to it, and recording each participant apart takes a writer
+ * port and a connection per participant. This recorder is attached to
+ * the bridge instead, with confbridge_add_tap(): in every tick it takes
+ * the frame received from each recorded slot, its stem, and sums them
+ * into a mix. It writes them either as one WAV file per track, or as one
+ * interleaved WAV file with a channel per track, the mix first.
+ *
+ * All the files are written by async writer ports (see async_writer.h)
+ * sharing one thread, so the clock thread only copies the frames into
+ * their rings and the disk sees large batches, whether one file or a
+ * hundred are written. Every track gets a frame in every tick, so the
+ * tracks stay aligned.
+ *
+ * The bridge reads the recorded slots for the recorder whether anybody
+ * listens to them or not, so every participant is recorded, connected or
+ * not. A track holds silence only for the ticks its slot had no audio to
+ * give: while the slot is empty, while the port's receive direction is
+ * disabled, or when the port returned no audio frame.
+ */
+#include <pjmedia.h>
+#include "confbridge.h"
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque declaration of the recorder.
+ */
+typedef struct conf_recorder conf_recorder;
+
+/**
+ * How the tracks are written.
+ */
+typedef enum conf_recorder_layout
+{
+    CONF_RECORDER_FILES,	    /**< One file per track: the mix in
+					 PATH-mix.wav, and the stem of
+					 slot N in PATH-N.wav.		    */
+    CONF_RECORDER_INTERLEAVED	    /**< PATH, with the channels of the
+					 mix then those of every stem, in
+					 the order of the slots.	    */
+} conf_recorder_layout;
+
+/**
+ * Recorder settings.
+ */
+typedef struct conf_recorder_param
+{
+    conf_recorder_layout layout;	    /**< Default FILES.		    */
+    const char	       *path;		    /**< File name, or file name
+						 prefix for FILES.	    */
+    unsigned		slot_cnt;	    /**< Number of slots recorded.  */
+    const unsigned     *slots;		    /**< Slots recorded. NULL, the
+						 default, records slots zero
+						 to slot_cnt-1.		    */
+    pj_bool_t		no_mix;		    /**< Don't write the mix.	    */
+    unsigned		writer_options;	    /**< Bitmask of
+						 #async_writer_option.	    */
+    unsigned		buffer_ms;	    /**< Audio each writer holds in
+						 its ring, zero for its
+						 default of five seconds.   */
+} conf_recorder_param;
+
+/**
+ * Recorder statistics.
+ */
+typedef struct conf_recorder_stat
+{
+    unsigned		track_cnt;	    /**< Stems, and the mix.	    */
+    pj_uint32_t		ticks;		    /**< Ticks recorded.	    */
+    pj_uint32_t		avg_tick_usec;	    /**< Average time taken from
+						 the tick.		    */
+    pj_uint32_t		max_tick_usec;	    /**< Longest time taken.	    */
+    pj_uint32_t		overruns;	    /**< Frames dropped by the
+						 writers, of all tracks.    */
+    pj_uint32_t		batches;	    /**< Writes to the files.	    */
+    pj_uint32_t		write_errors;	    /**< Writes that failed.	    */
+    pj_uint32_t		max_write_usec;	    /**< Longest write.		    */
+} conf_recorder_stat;
+
+
+/**
+ * Initialize the settings with default values.
+ *
+ * @param param		The settings.
+ */
+void conf_recorder_param_default(conf_recorder_param *param);
+
+/**
+ * Create the files and start recording.
+ *
+ * @param conf		The bridge.
+ * @param pool		Pool to allocate the recorder and its writers.
+ * @param param		The settings.
+ * @param p_rec		Pointer to receive the recorder.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_recorder_create(confbridge *conf,
+				 pj_pool_t *pool,
+				 const conf_recorder_param *param,
+				 conf_recorder **p_rec);
+
+/**
+ * Get the statistics.
+ *
+ * @param rec		The recorder.
+ * @param stat		The statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_recorder_get_stat(conf_recorder *rec,
+				   conf_recorder_stat *stat);
+
+/**
+ * Stop recording, write what is left and close the files.
+ *
+ * @param rec		The recorder.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_recorder_destroy(conf_recorder *rec);
+
+
+PJ_END_DECL
+
+#endif	/* __CONF_RECORDER_H__ */
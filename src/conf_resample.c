@@ -0,0 +1,494 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "conf_resample.h"
+#include <pjmedia.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define THIS_FILE	"conf_resample.c"
+
+/* Coefficients are Q14, each phase sums to exactly 1.0 */
+#define COEF_SHIFT	14
+#define COEF_ONE	(1 << COEF_SHIFT)
+
+/* Base number of taps per phase of the sinc filters */
+#define SMALL_TAPS	16
+#define LARGE_TAPS	32
+
+/* Relative cutoff of the sinc filters */
+#define SMALL_ROLLOFF	0.85
+#define LARGE_ROLLOFF	0.90
+
+/* Largest table accepted, in coefficients. Odd rate pairs such as
+ * 44100/44101 would need one phase per output sample.
+ */
+#define MAX_TABLE_SIZE	(1 << 20)
+
+#ifndef M_PI
+#   define M_PI		3.14159265358979323846
+#endif
+
+
+/*
+ * Filter table, shared by all resamplers with the same rates and
+ * quality.
+ */
+struct resample_table
+{
+    struct resample_table *next;
+    pj_pool_t		  *pool;
+    unsigned		   rate_in;	/**< Key: input clock rate.	    */
+    unsigned		   rate_out;	/**< Key: output clock rate.	    */
+    conf_resample_quality  quality;	/**< Key: filter quality.	    */
+    unsigned		   ref_cnt;	/**< Number of resamplers.	    */
+    unsigned		   up;		/**< L, interpolation factor.	    */
+    unsigned		   down;	/**< M, decimation factor.	    */
+    unsigned		   taps;	/**< Taps per phase.		    */
+    pj_int16_t		  *coef;	/**< up phases of taps coefficients,
+					     in dot product order.	    */
+};
+
+struct conf_resample_cache
+{
+    pj_pool_t		  *pool;
+    pj_pool_factory	  *pf;
+    pj_mutex_t		  *mutex;
+    struct resample_table *tables;
+};
+
+struct conf_resample
+{
+    conf_resample_cache	  *cache;
+    struct resample_table *table;	/**< Table in use.		    */
+    struct resample_table *base;	/**< Table the resampler was
+					     created with.		    */
+    struct resample_table *linear;	/**< Linear table to fall back to
+					     under load, built beforehand
+					     by conf_resample_prepare_
+					     linear(), or NULL.		    */
+    const conf_mix_ops	  *ops;
+    unsigned		   channel_count;
+    unsigned		   frame_in;	/**< Input samples per channel.    */
+    unsigned		   frame_out;	/**< Output samples per channel.   */
+    unsigned		   idx_step;	/**< down / up.			    */
+    unsigned		   phase_step;	/**< down % up.			    */
+    unsigned		   max_hist;	/**< Taps-1 of the filter the
+					     resampler was created with.    */
+    pj_int16_t		 **buf;		/**< Per channel, max_hist samples
+					     of history followed by the
+					     frame.			    */
+};
+
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+    while (b) {
+	unsigned t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+static double sinc(double x)
+{
+    if (x == 0)
+	return 1.0;
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+/*
+ * Prototype filter h[j], j < up*taps, running at the interpolated rate.
+ */
+static double proto(const struct resample_table *t, unsigned j)
+{
+    unsigned len = t->up * t->taps;
+    double cutoff, x, w;
+
+    /* Triangle, interpolating between x[idx-1] and x[idx] */
+    if (t->quality == CONF_RESAMPLE_LINEAR)
+	return (double)(j <= t->up ? j : len - j);
+
+    /* Blackman windowed sinc */
+    cutoff = (t->quality==CONF_RESAMPLE_LARGE) ? LARGE_ROLLOFF :
+						 SMALL_ROLLOFF;
+    cutoff *= 0.5 / PJ_MAX(t->up, t->down);
+    x = j - (len - 1) / 2.0;
+    w = 0.42 - 0.5 * cos(2 * M_PI * (j + 0.5) / len) +
+	0.08 * cos(4 * M_PI * (j + 0.5) / len);
+
+    return sinc(2 * cutoff * x) * w;
+}
+
+/*
+ * Fill the table. Output sample at interpolated position n uses
+ * h[n%up + k*up] * x[n/up - k]. Phase p is stored reversed, so that the
+ * filter is a plain dot product over the input history. Each phase is
+ * quantized to sum to exactly COEF_ONE, with the rounding error put on
+ * the largest tap.
+ */
+static void fill_table(struct resample_table *t)
+{
+    unsigned up = t->up, taps = t->taps;
+    unsigned p, k;
+
+    for (p=0; p<up; ++p) {
+	pj_int16_t *c = t->coef + p * taps;
+	double sum = 0;
+	int isum = 0;
+	unsigned big = 0;
+
+	for (k=0; k<taps; ++k)
+	    sum += proto(t, p + k * up);
+
+	for (k=0; k<taps; ++k) {
+	    double v = proto(t, p + (taps - 1 - k) * up);
+
+	    c[k] = (pj_int16_t)floor(v * COEF_ONE / sum + 0.5);
+	    isum += c[k];
+	    if (abs(c[k]) > abs(c[big]))
+		big = k;
+	}
+	c[big] = (pj_int16_t)(c[big] + COEF_ONE - isum);
+    }
+}
+
+/* Get the table for the rates, creating it if needed. Cache mutex must
+ * be held.
+ */
+static pj_status_t get_table(conf_resample_cache *cache,
+			     conf_resample_quality quality,
+			     unsigned rate_in,
+			     unsigned rate_out,
+			     struct resample_table **p_table)
+{
+    struct resample_table *t;
+    unsigned g, up, down, taps;
+    pj_pool_t *pool;
+
+    for (t=cache->tables; t; t=t->next) {
+	if (t->rate_in==rate_in && t->rate_out==rate_out &&
+	    t->quality==quality)
+	{
+	    ++t->ref_cnt;
+	    *p_table = t;
+	    return PJ_SUCCESS;
+	}
+    }
+
+    g = gcd(rate_in, rate_out);
+    up = rate_out / g;
+    down = rate_in / g;
+
+    if (quality == CONF_RESAMPLE_LINEAR) {
+	taps = 2;
+    } else {
+	/* Widen the filter by the decimation ratio, so that the lower
+	 * cutoff keeps the same transition band in input samples.
+	 */
+	taps = (quality==CONF_RESAMPLE_LARGE) ? LARGE_TAPS : SMALL_TAPS;
+	if (down > up)
+	    taps = (taps * down + up - 1) / up;
+	taps = (taps + 7) & ~7U;
+    }
+
+    if ((pj_uint64_t)up * taps > MAX_TABLE_SIZE)
+	return PJMEDIA_ENCCLOCKRATE;
+
+    pool = pj_pool_create(cache->pf, "rstab%p", 512 + up * taps * 2,
+			  512, NULL);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    t = PJ_POOL_ZALLOC_T(pool, struct resample_table);
+    t->pool = pool;
+    t->rate_in = rate_in;
+    t->rate_out = rate_out;
+    t->quality = quality;
+    t->ref_cnt = 1;
+    t->up = up;
+    t->down = down;
+    t->taps = taps;
+    t->coef = (pj_int16_t*) pj_pool_alloc(pool, up * taps * 2);
+    fill_table(t);
+
+    t->next = cache->tables;
+    cache->tables = t;
+
+    PJ_LOG(5,(THIS_FILE, "Resampler table %u->%u created: %u phases, "
+	      "%u taps", rate_in, rate_out, up, taps));
+
+    *p_table = t;
+    return PJ_SUCCESS;
+}
+
+/* Drop a reference to the table. Cache mutex must be held. */
+static void put_table(conf_resample_cache *cache, struct resample_table *t)
+{
+    struct resample_table **pt;
+
+    if (--t->ref_cnt)
+	return;
+
+    for (pt=&cache->tables; *pt!=t; pt=&(*pt)->next)
+	;
+    *pt = t->next;
+    pj_pool_release(t->pool);
+}
+
+
+pj_status_t conf_resample_cache_create(pj_pool_factory *pf,
+				       conf_resample_cache **p_cache)
+{
+    conf_resample_cache *cache;
+    pj_pool_t *pool;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pf && p_cache, PJ_EINVAL);
+
+    pool = pj_pool_create(pf, "rscache%p", 256, 256, NULL);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    cache = PJ_POOL_ZALLOC_T(pool, conf_resample_cache);
+    cache->pool = pool;
+    cache->pf = pf;
+
+    status = pj_mutex_create_simple(pool, "rscache", &cache->mutex);
+    if (status != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return status;
+    }
+
+    *p_cache = cache;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_resample_cache_destroy(conf_resample_cache *cache)
+{
+    PJ_ASSERT_RETURN(cache, PJ_EINVAL);
+
+    if (cache->tables)
+	return PJ_EBUSY;
+
+    pj_mutex_destroy(cache->mutex);
+    pj_pool_release(cache->pool);
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_resample_cache_get_info(conf_resample_cache *cache,
+					 unsigned *table_cnt,
+					 unsigned *ref_cnt,
+					 pj_size_t *size)
+{
+    struct resample_table *t;
+    unsigned tcnt = 0, rcnt = 0;
+    pj_size_t sz = 0;
+
+    PJ_ASSERT_RETURN(cache, PJ_EINVAL);
+
+    pj_mutex_lock(cache->mutex);
+    for (t=cache->tables; t; t=t->next) {
+	++tcnt;
+	rcnt += t->ref_cnt;
+	sz += t->up * t->taps * sizeof(pj_int16_t);
+    }
+    pj_mutex_unlock(cache->mutex);
+
+    if (table_cnt)
+	*table_cnt = tcnt;
+    if (ref_cnt)
+	*ref_cnt = rcnt;
+    if (size)
+	*size = sz;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t conf_resample_create(conf_resample_cache *cache,
+				 pj_pool_t *pool,
+				 const conf_mix_ops *ops,
+				 conf_resample_quality quality,
+				 unsigned channel_count,
+				 unsigned rate_in,
+				 unsigned rate_out,
+				 unsigned samples_in,
+				 conf_resample **p_resample)
+{
+    conf_resample *r;
+    struct resample_table *t;
+    unsigned frame_in, ch;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(cache && pool && ops && channel_count &&
+		     rate_in && rate_out && p_resample, PJ_EINVAL);
+    PJ_ASSERT_RETURN(quality <= CONF_RESAMPLE_LARGE, PJ_EINVAL);
+
+    /* Frames must contain whole input and output sample periods, so that
+     * every frame starts at phase zero.
+     */
+    if (samples_in % channel_count)
+	return PJMEDIA_ENCSAMPLESPFRAME;
+    frame_in = samples_in / channel_count;
+    if (frame_in == 0 ||
+	((pj_uint64_t)frame_in * rate_out) % rate_in != 0)
+    {
+	return PJMEDIA_ENCSAMPLESPFRAME;
+    }
+
+    pj_mutex_lock(cache->mutex);
+    status = get_table(cache, quality, rate_in, rate_out, &t);
+    pj_mutex_unlock(cache->mutex);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    r = PJ_POOL_ZALLOC_T(pool, conf_resample);
+    r->cache = cache;
+    r->table = r->base = t;
+    r->ops = ops;
+    r->channel_count = channel_count;
+    r->frame_in = frame_in;
+    r->frame_out = (unsigned)((pj_uint64_t)frame_in * rate_out / rate_in);
+    r->idx_step = t->down / t->up;
+    r->phase_step = t->down % t->up;
+    r->max_hist = t->taps - 1;
+
+    r->buf = (pj_int16_t**)
+	     pj_pool_alloc(pool, channel_count * sizeof(pj_int16_t*));
+    for (ch=0; ch<channel_count; ++ch) {
+	r->buf[ch] = (pj_int16_t*)
+		     pj_pool_zalloc(pool, (t->taps - 1 + frame_in) * 2);
+    }
+
+    *p_resample = r;
+    return PJ_SUCCESS;
+}
+
+
+unsigned conf_resample_get_output_size(const conf_resample *resample)
+{
+    return resample->frame_out * resample->channel_count;
+}
+
+
+void conf_resample_run(conf_resample *resample,
+		       const pj_int16_t *input,
+		       pj_int16_t *output)
+{
+    const struct resample_table *t = resample->table;
+    unsigned ch_cnt = resample->channel_count;
+    unsigned hist = resample->max_hist;
+    unsigned ch, i;
+
+    /* A filter shorter than the one we were created with is centered on
+     * the history, to keep the same delay.
+     */
+    for (ch=0; ch<ch_cnt; ++ch) {
+	pj_int16_t *buf = resample->buf[ch];
+	unsigned idx = (hist - (t->taps - 1)) / 2, phase = 0;
+
+	/* Append the frame to the history */
+	if (ch_cnt == 1) {
+	    pj_memcpy(buf + hist, input, resample->frame_in * 2);
+	} else {
+	    for (i=0; i<resample->frame_in; ++i)
+		buf[hist + i] = input[i * ch_cnt + ch];
+	}
+
+	for (i=0; i<resample->frame_out; ++i) {
+	    pj_int32_t y;
+
+	    y = resample->ops->dot(buf + idx, t->coef + phase * t->taps,
+				   t->taps);
+	    y = (y + (COEF_ONE >> 1)) >> COEF_SHIFT;
+	    if (y > 32767)
+		y = 32767;
+	    else if (y < -32768)
+		y = -32768;
+	    output[i * ch_cnt + ch] = (pj_int16_t)y;
+
+	    idx += resample->idx_step;
+	    phase += resample->phase_step;
+	    if (phase >= t->up) {
+		phase -= t->up;
+		++idx;
+	    }
+	}
+
+	/* Keep the tail as history for the next frame */
+	pj_memmove(buf, buf + resample->frame_in, hist * 2);
+    }
+}
+
+
+pj_status_t conf_resample_prepare_linear(conf_resample *resample)
+{
+    conf_resample_cache *cache = resample->cache;
+    const struct resample_table *base = resample->base;
+    pj_status_t status;
+
+    if (base->quality == CONF_RESAMPLE_LINEAR || resample->linear)
+	return PJ_SUCCESS;
+
+    /* The linear filter is the shortest, it always fits the history */
+    pj_mutex_lock(cache->mutex);
+    status = get_table(cache, CONF_RESAMPLE_LINEAR, base->rate_in,
+		       base->rate_out, &resample->linear);
+    pj_mutex_unlock(cache->mutex);
+
+    return status;
+}
+
+
+pj_status_t conf_resample_set_quality(conf_resample *resample,
+				      conf_resample_quality quality)
+{
+    PJ_ASSERT_RETURN(quality <= CONF_RESAMPLE_LARGE, PJ_EINVAL);
+
+    /* The history always holds max_hist samples. A shorter filter looks
+     * at the middle of it, see conf_resample_run(), so that the delay
+     * stays the same and the output carries on smoothly.
+     */
+    if (quality == resample->base->quality)
+	resample->table = resample->base;
+    else if (quality == CONF_RESAMPLE_LINEAR && resample->linear)
+	resample->table = resample->linear;
+    else if (quality > resample->base->quality)
+	return PJ_ETOOBIG;
+    else
+	return PJ_ENOTFOUND;
+
+    return PJ_SUCCESS;
+}
+
+
+void conf_resample_destroy(conf_resample *resample)
+{
+    conf_resample_cache *cache = resample->cache;
+
+    pj_mutex_lock(cache->mutex);
+    if (resample->linear)
+	put_table(cache, resample->linear);
+    put_table(cache, resample->base);
+    pj_mutex_unlock(cache->mutex);
+    resample->table = resample->base = resample->linear = NULL;
+}
@@ -0,0 +1,205 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __CONF_RESAMPLE_H__
+#define __CONF_RESAMPLE_H__
+
+/**
+ * @file conf_resample.h
+ * @brief Polyphase resampler with shared filter tables.
+ *
+ * The conference bridge converts every port whose clock rate differs
+ * from the bridge's. Each conversion runs a polyphase FIR filter: the
+ * rate ratio is reduced to L/M, and output sample n is the dot product
+ * of the input history with one of L phases of the filter. The dot
+ * product is the dot() kernel of conf_mix.h, so it runs on SSE2/AVX2
+ * when available.
+ *
+ * The filter tables only depend on the rates and the quality, so they
+ * are kept in a reference counted cache and shared by every resampler
+ * converting between the same rates. Only the input history is per
+ * resampler.
+ */
+#include "conf_mix.h"
+
+PJ_BEGIN_DECL
+
+/**
+ * Filter quality.
+ */
+typedef enum conf_resample_quality
+{
+    /** Linear interpolation, no anti-aliasing. */
+    CONF_RESAMPLE_LINEAR,
+
+    /** Windowed sinc filter with 16 taps per phase (more when
+     *  downsampling). */
+    CONF_RESAMPLE_SMALL,
+
+    /** Windowed sinc filter with 32 taps per phase (more when
+     *  downsampling). */
+    CONF_RESAMPLE_LARGE
+
+} conf_resample_quality;
+
+/**
+ * Opaque declaration of the filter table cache.
+ */
+typedef struct conf_resample_cache conf_resample_cache;
+
+/**
+ * Opaque declaration of a resampler.
+ */
+typedef struct conf_resample conf_resample;
+
+
+/**
+ * Create a filter table cache. Tables are allocated from their own
+ * pools, created from the specified pool factory, and released when
+ * the last resampler using them is destroyed.
+ *
+ * @param pf		Pool factory.
+ * @param p_cache	Pointer to receive the cache.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_resample_cache_create(pj_pool_factory *pf,
+				       conf_resample_cache **p_cache);
+
+/**
+ * Destroy the cache. All resamplers created from the cache must have
+ * been destroyed.
+ *
+ * @param cache		The cache.
+ *
+ * @return		PJ_SUCCESS on success, or PJ_EBUSY if some tables
+ *			are still in use.
+ */
+pj_status_t conf_resample_cache_destroy(conf_resample_cache *cache);
+
+/**
+ * Get cache statistics.
+ *
+ * @param cache		The cache.
+ * @param table_cnt	Optional pointer to receive the number of tables.
+ * @param ref_cnt	Optional pointer to receive the number of
+ *			resamplers using the tables.
+ * @param size		Optional pointer to receive the total size of the
+ *			tables, in bytes.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_resample_cache_get_info(conf_resample_cache *cache,
+					 unsigned *table_cnt,
+					 unsigned *ref_cnt,
+					 pj_size_t *size);
+
+/**
+ * Create a resampler, using (and creating when needed) the filter table
+ * for the rates and quality from the cache. The frame durations must
+ * match exactly, i.e. samples_in * rate_out must be a multiple of
+ * rate_in.
+ *
+ * @param cache		The cache.
+ * @param pool		Pool to allocate the resampler's history.
+ * @param ops		Kernels to run the filter with.
+ * @param quality	Filter quality.
+ * @param channel_count	Number of interleaved channels.
+ * @param rate_in	Input clock rate.
+ * @param rate_out	Output clock rate.
+ * @param samples_in	Number of samples (of all channels) per input
+ *			frame.
+ * @param p_resample	Pointer to receive the resampler.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_resample_create(conf_resample_cache *cache,
+				 pj_pool_t *pool,
+				 const conf_mix_ops *ops,
+				 conf_resample_quality quality,
+				 unsigned channel_count,
+				 unsigned rate_in,
+				 unsigned rate_out,
+				 unsigned samples_in,
+				 conf_resample **p_resample);
+
+/**
+ * Get the number of samples (of all channels) produced per input frame.
+ *
+ * @param resample	The resampler.
+ *
+ * @return		Output frame size.
+ */
+unsigned conf_resample_get_output_size(const conf_resample *resample);
+
+/**
+ * Convert one frame.
+ *
+ * @param resample	The resampler.
+ * @param input		Input frame, samples_in samples.
+ * @param output	Output frame, see conf_resample_get_output_size().
+ */
+void conf_resample_run(conf_resample *resample,
+		       const pj_int16_t *input,
+		       pj_int16_t *output);
+
+/**
+ * Build the linear filter table the resampler can fall back to under
+ * load, see conf_resample_set_quality(). This takes the cache mutex and
+ * may allocate, so it is called beforehand, not from the audio thread.
+ * Does nothing if the table is there already.
+ *
+ * @param resample	The resampler.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t conf_resample_prepare_linear(conf_resample *resample);
+
+/**
+ * Change the filter quality of a resampler, for instance to save time
+ * under load. The input history is kept, so the output carries on
+ * without a gap.
+ *
+ * Only the quality the resampler was created with, and the linear one
+ * once conf_resample_prepare_linear() has built it, can be switched to.
+ * This only switches tables: it neither locks nor allocates, and may be
+ * called from the audio thread.
+ *
+ * @param resample	The resampler.
+ * @param quality	New filter quality.
+ *
+ * @return		PJ_SUCCESS on success, PJ_ETOOBIG if the filter is
+ *			longer than the original one, or PJ_ENOTFOUND if
+ *			its table was not prepared.
+ */
+pj_status_t conf_resample_set_quality(conf_resample *resample,
+				      conf_resample_quality quality);
+
+/**
+ * Destroy the resampler and release its filter table. The history is
+ * owned by the pool given to conf_resample_create().
+ *
+ * @param resample	The resampler.
+ */
+void conf_resample_destroy(conf_resample *resample);
+
+
+PJ_END_DECL
+
+#endif	/* __CONF_RESAMPLE_H__ */
@@ -0,0 +1,895 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <pjmedia.h>
+#include <pjlib-util.h>	/* pj_getopt */
+#include <pjlib.h>
+
+#include <stdlib.h>	/* strtol() */
+#include <stdio.h>
+#include <math.h>	/* sin() */
+
+#include "util.h"
+#include "confbridge.h"
+#include "conf_mix.h"
+#include "mmap_player.h"
+#include "prompt_cache.h"
+
+/**
+ * \page page_pjmedia_samples_confbench_c Samples: Conference Bridge Benchmark
+ *
+ * Headless benchmark of the conference bridge mixing cost. The bridge is
+ * created without sound device and is clocked either by an unpaced loop
+ * or by a master port, so it runs on hosts without audio hardware.
+ *
+ * This file is pjsip-apps/src/samples/confbench.c
+ *
+ * \includelineno confbench.c
+ */
+
+
+/* For logging purpose. */
+#define THIS_FILE   "confbench.c"
+
+
+static const char *desc =
+ " FILE:								    \n"
+ "									    \n"
+ "  confbench.c								    \n"
+ "									    \n"
+ " PURPOSE:								    \n"
+ "									    \n"
+ "  Measure the mixing throughput of the conference bridge without any    \n"
+ "  sound device.							    \n"
+ "									    \n"
+ " USAGE:								    \n"
+ "									    \n"
+ "  confbench [options] [file1.wav] [file2.wav] ...			    \n"
+ "									    \n"
+ " options:								    \n"
+ "  -r, --rate=HZ        Set bridge clock rate (default=16000)		    \n"
+ "  -R, --port-rates=HZ  Comma separated clock rates of the synthetic	    \n"
+ "                       ports, assigned in round robin (default=bridge	    \n"
+ "                       clock rate), e.g. 8000,16000,44100,48000 to	    \n"
+ "                       measure the resampling cost			    \n"
+ "  -p, --ptime=MS       Set frame time in msec (default=20)		    \n"
+ "  -t, --ticks=NUM      Number of frames to mix per run (default=500)	    \n"
+ "  -m, --min-ports=NUM  Smallest number of ports to test (default=2)	    \n"
+ "  -n, --max-ports=NUM  Largest number of ports to test (default=512)	    \n"
+ "  -k, --fanout=NUM     Connect each port to NUM listeners (default=all)   \n"
+ "  -s, --slots=NUM      Create the bridge with NUM slots (default=number   \n"
+ "                       of ports + 1), to measure the cost of empty slots  \n"
+ "  -a, --speakers=NUM   Mix only the NUM loudest sources, confbridge only  \n"
+ "                       (default=0, mix all)				    \n"
+ "  -w, --workers=NUM    Number of mixing workers, confbridge only	    \n"
+ "                       (default=1)					    \n"
+ "  -c, --clock=TYPE     Clock source: \"loop\" runs the bridge unpaced,     \n"
+ "                       \"master\" paces it with a master port (realtime)  \n"
+ "  -b, --bridge=TYPE    Bridge to test: \"pjmedia\" (pjmedia_conf, default), \n"
+ "                       \"confbridge\", \"scalar\" (confbridge without     \n"
+ "                       SIMD kernels) or \"mixonce\" (confbridge with     \n"
+ "                       CONFBRIDGE_MIX_ONCE)				    \n"
+ "  -f, --file-port=TYPE Port for the WAV files: \"wav\" (pjmedia WAV	    \n"
+ "                       player, default), \"mmap\" (mapped, zero-copy) or  \n"
+ "                       \"cache\" (prompt cache, resampled to the bridge  \n"
+ "                       clock rate)					    \n"
+ "  -v, --verify         Check that the SIMD mixing kernels are bit-exact   \n"
+ "                       with the scalar ones, then exit		    \n"
+ "									    \n"
+ "  fileN.wav are optional mono 16 bit WAV files. When specified, the ports \n"
+ "  play these files (in round robin), otherwise synthetic tone ports are   \n"
+ "  used.								    \n"
+ "									    \n"
+ " DESCRIPTION:								    \n"
+ "									    \n"
+ "  For N = min-ports, 2*min-ports, .. max-ports, a bridge is created with  \n"
+ "  PJMEDIA_CONF_NO_DEVICE, N ports are added and each port is connected   \n"
+ "  to fanout listeners. The report shows mixed frames per second, the     \n"
+ "  bridge time per mixed frame (one source into one listener) and the     \n"
+ "  per-listener fan-out cost of one tick.				    \n";
+
+
+/* Bridge interface, so pjmedia_conf and confbridge can be compared */
+struct bridge_api
+{
+    const char	    *name;
+    unsigned	     options;
+    pj_status_t	   (*create)(pj_pool_t *pool, unsigned max_slots,
+			     unsigned clock_rate, unsigned samples_per_frame,
+			     unsigned options, void **p_bridge);
+    pj_status_t	   (*destroy)(void *bridge);
+    pjmedia_port*  (*get_master_port)(void *bridge);
+    pj_status_t	   (*add_port)(void *bridge, pj_pool_t *pool,
+			       pjmedia_port *port);
+    pj_status_t	   (*connect_port)(void *bridge, unsigned src,
+				   unsigned sink);
+    pj_status_t	   (*set_workers)(void *bridge, unsigned count);
+    pj_status_t	   (*set_speakers)(void *bridge, unsigned count);
+};
+
+/* Memory cap of the prompt cache, with --file-port=cache */
+#define PROMPT_CACHE_SIZE   (64 * 1024 * 1024)
+
+/* Maximum number of rates given with --port-rates */
+#define MAX_PORT_RATES	8
+
+/* Benchmark settings */
+struct bench_cfg
+{
+    const struct bridge_api *bridge;
+    unsigned	     clock_rate;
+    unsigned	     port_rate_cnt; /* 0 means the bridge clock rate	*/
+    unsigned	     port_rates[MAX_PORT_RATES];
+    unsigned	     ptime;
+    unsigned	     samples_per_frame;
+    unsigned	     ticks;
+    unsigned	     min_ports;
+    unsigned	     max_ports;
+    unsigned	     fanout;	    /* 0 means all-to-all		*/
+    unsigned	     slots;	    /* 0 means port count + 1		*/
+    unsigned	     workers;
+    unsigned	     speakers;	    /* 0 means mix every source		*/
+    pj_bool_t	     use_master;
+    enum {
+	FILE_PORT_WAV,		    /* pjmedia_wav_player_port_create()	*/
+	FILE_PORT_MMAP,		    /* mmap_player_create()		*/
+	FILE_PORT_CACHE		    /* prompt_cache_player_create()	*/
+    }		     file_port;
+    prompt_cache    *cache;	    /* With FILE_PORT_CACHE		*/
+    unsigned	     file_cnt;
+    char	   **files;
+};
+
+/* Result of one run */
+struct bench_result
+{
+    unsigned	     ports;
+    unsigned	     edges;	    /* Total number of connections	*/
+    unsigned	     ticks;	    /* Frames actually mixed		*/
+    double	     busy_nsec;	    /* Time spent inside the bridge	*/
+    double	     wall_nsec;	    /* Total elapsed time of the run	*/
+};
+
+
+/* Show usage */
+static void usage(void)
+{
+    puts("");
+    puts(desc);
+}
+
+
+/* Convert elapsed timestamp to nanoseconds without 32bit overflow. */
+static double elapsed_nsec(const pj_timestamp *start, const pj_timestamp *stop)
+{
+    static pj_timestamp freq;
+
+    if (freq.u64 == 0)
+	pj_get_timestamp_freq(&freq);
+
+    return (double)(stop->u64 - start->u64) * 1000000000.0 /
+	   (double)freq.u64;
+}
+
+
+/*****************************************************************************
+ * Bridge wrappers.
+ */
+static pj_status_t pjconf_create(pj_pool_t *pool, unsigned max_slots,
+				 unsigned clock_rate,
+				 unsigned samples_per_frame,
+				 unsigned options, void **p_bridge)
+{
+    return pjmedia_conf_create(pool, max_slots, clock_rate, 1,
+			       samples_per_frame, 16,
+			       options | PJMEDIA_CONF_NO_DEVICE,
+			       (pjmedia_conf**)p_bridge);
+}
+
+static pj_status_t pjconf_destroy(void *bridge)
+{
+    return pjmedia_conf_destroy((pjmedia_conf*)bridge);
+}
+
+static pjmedia_port *pjconf_get_master_port(void *bridge)
+{
+    return pjmedia_conf_get_master_port((pjmedia_conf*)bridge);
+}
+
+static pj_status_t pjconf_add_port(void *bridge, pj_pool_t *pool,
+				   pjmedia_port *port)
+{
+    return pjmedia_conf_add_port((pjmedia_conf*)bridge, pool, port,
+				 NULL, NULL);
+}
+
+static pj_status_t pjconf_connect_port(void *bridge, unsigned src,
+				       unsigned sink)
+{
+    return pjmedia_conf_connect_port((pjmedia_conf*)bridge, src, sink, 0);
+}
+
+static pj_status_t cbridge_create(pj_pool_t *pool, unsigned max_slots,
+				  unsigned clock_rate,
+				  unsigned samples_per_frame,
+				  unsigned options, void **p_bridge)
+{
+    return confbridge_create(pool, max_slots, clock_rate, 1,
+			     samples_per_frame, 16,
+			     options | CONFBRIDGE_NO_DEVICE,
+			     (confbridge**)p_bridge);
+}
+
+static pj_status_t cbridge_destroy(void *bridge)
+{
+    return confbridge_destroy((confbridge*)bridge);
+}
+
+static pjmedia_port *cbridge_get_master_port(void *bridge)
+{
+    return confbridge_get_master_port((confbridge*)bridge);
+}
+
+static pj_status_t cbridge_add_port(void *bridge, pj_pool_t *pool,
+				    pjmedia_port *port)
+{
+    return confbridge_add_port((confbridge*)bridge, pool, port, NULL, NULL);
+}
+
+static pj_status_t cbridge_connect_port(void *bridge, unsigned src,
+					unsigned sink)
+{
+    return confbridge_connect_port((confbridge*)bridge, src, sink, 0);
+}
+
+static pj_status_t cbridge_set_workers(void *bridge, unsigned count)
+{
+    return confbridge_set_worker_count((confbridge*)bridge, count);
+}
+
+static pj_status_t cbridge_set_speakers(void *bridge, unsigned count)
+{
+    return confbridge_set_active_speakers((confbridge*)bridge, count);
+}
+
+static const struct bridge_api bridges[] =
+{
+    { "pjmedia", 0, &pjconf_create, &pjconf_destroy, &pjconf_get_master_port,
+      &pjconf_add_port, &pjconf_connect_port, NULL, NULL },
+    { "confbridge", 0, &cbridge_create, &cbridge_destroy,
+      &cbridge_get_master_port, &cbridge_add_port, &cbridge_connect_port,
+      &cbridge_set_workers, &cbridge_set_speakers },
+    { "scalar", CONFBRIDGE_NO_SIMD, &cbridge_create, &cbridge_destroy,
+      &cbridge_get_master_port, &cbridge_add_port, &cbridge_connect_port,
+      &cbridge_set_workers, &cbridge_set_speakers },
+    { "mixonce", CONFBRIDGE_MIX_ONCE, &cbridge_create, &cbridge_destroy,
+      &cbridge_get_master_port, &cbridge_add_port, &cbridge_connect_port,
+      &cbridge_set_workers, &cbridge_set_speakers },
+};
+
+
+/*****************************************************************************
+ * Synthetic port: plays a sine tone and discards whatever it receives.
+ */
+struct synth_port
+{
+    pjmedia_port     base;
+    const pj_int16_t*table;
+    unsigned	     table_len;
+    unsigned	     pos;
+};
+
+static pj_status_t synth_get_frame(pjmedia_port *this_port,
+				   pjmedia_frame *frame)
+{
+    struct synth_port *sp = (struct synth_port*) this_port;
+    unsigned i, count = PJMEDIA_PIA_SPF(&this_port->info);
+    pj_int16_t *samples = (pj_int16_t*) frame->buf;
+
+    for (i=0; i<count; ++i) {
+	samples[i] = sp->table[sp->pos];
+	if (++sp->pos == sp->table_len)
+	    sp->pos = 0;
+    }
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = count * 2;
+    return PJ_SUCCESS;
+}
+
+static pj_status_t synth_put_frame(pjmedia_port *this_port,
+				   pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_SUCCESS;
+}
+
+/* Build one period of a sine tone, the frequency is varied per port so
+ * the mix does not degenerate into a single scaled tone.
+ */
+static const pj_int16_t *create_tone(pj_pool_t *pool, unsigned clock_rate,
+				     unsigned freq, unsigned *len)
+{
+    pj_int16_t *table;
+    unsigned i;
+
+    *len = clock_rate / freq;
+    table = (pj_int16_t*) pj_pool_alloc(pool, *len * sizeof(pj_int16_t));
+    for (i=0; i<*len; ++i) {
+	table[i] = (pj_int16_t)(4000.0 * sin(2 * 3.14159265358979 * i / *len));
+    }
+    return table;
+}
+
+static pj_status_t synth_port_create(pj_pool_t *pool, unsigned index,
+				     const struct bench_cfg *cfg,
+				     pjmedia_port **p_port)
+{
+    struct synth_port *sp;
+    unsigned clock_rate = cfg->clock_rate;
+    char name[32];
+    pj_str_t port_name;
+
+    if (cfg->port_rate_cnt)
+	clock_rate = cfg->port_rates[index % cfg->port_rate_cnt];
+
+    sp = PJ_POOL_ZALLOC_T(pool, struct synth_port);
+    pj_ansi_snprintf(name, sizeof(name), "synth%u", index);
+    pj_strdup2(pool, &port_name, name);
+
+    pjmedia_port_info_init(&sp->base.info, &port_name,
+			   PJMEDIA_SIG_CLASS_PORT_AUD('S','Y'),
+			   clock_rate, 1, 16, clock_rate * cfg->ptime / 1000);
+    sp->table = create_tone(pool, clock_rate, 200 + (index % 40) * 25,
+			    &sp->table_len);
+    sp->pos = (index * 7) % sp->table_len;
+    sp->base.get_frame = &synth_get_frame;
+    sp->base.put_frame = &synth_put_frame;
+
+    *p_port = &sp->base;
+    return PJ_SUCCESS;
+}
+
+
+/*****************************************************************************
+ * Timing port: wraps the bridge master port when the bridge is clocked by
+ * pjmedia_master_port, so that only the time spent in the bridge is counted.
+ */
+struct timing_port
+{
+    pjmedia_port     base;
+    pjmedia_port    *bridge;
+    unsigned	     ticks;
+    unsigned	     max_ticks;
+    double	     busy_nsec;
+    pj_sem_t	    *done;
+};
+
+static pj_status_t timing_get_frame(pjmedia_port *this_port,
+				    pjmedia_frame *frame)
+{
+    struct timing_port *tp = (struct timing_port*) this_port;
+    pj_timestamp t0, t1;
+    pj_status_t status;
+
+    if (tp->ticks >= tp->max_ticks) {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	return PJ_SUCCESS;
+    }
+
+    pj_get_timestamp(&t0);
+    status = pjmedia_port_get_frame(tp->bridge, frame);
+    pj_get_timestamp(&t1);
+
+    tp->busy_nsec += elapsed_nsec(&t0, &t1);
+    if (++tp->ticks == tp->max_ticks)
+	pj_sem_post(tp->done);
+
+    return status;
+}
+
+static pj_status_t timing_put_frame(pjmedia_port *this_port,
+				    pjmedia_frame *frame)
+{
+    struct timing_port *tp = (struct timing_port*) this_port;
+
+    if (tp->ticks >= tp->max_ticks)
+	return PJ_SUCCESS;
+
+    return pjmedia_port_put_frame(tp->bridge, frame);
+}
+
+
+/*****************************************************************************
+ * Run one benchmark with the specified number of ports.
+ */
+static pj_status_t run_bench(pj_pool_factory *pf, const struct bench_cfg *cfg,
+			     unsigned port_cnt, struct bench_result *res)
+{
+    const struct bridge_api *bridge = cfg->bridge;
+    pj_pool_t *pool;
+    void *conf = NULL;
+    pjmedia_port **ports;
+    pjmedia_port *master;
+    pjmedia_frame frame;
+    pj_timestamp t0, t1;
+    unsigned i, j, fanout;
+    pj_status_t status;
+
+    pj_bzero(res, sizeof(*res));
+    res->ports = port_cnt;
+
+    pool = pj_pool_create(pf, "confbench", 4000, 4000, NULL);
+    ports = (pjmedia_port**) pj_pool_zalloc(pool,
+					    port_cnt * sizeof(pjmedia_port*));
+
+    /* Slot zero is the master port, it is left unconnected. */
+    status = (*bridge->create)(pool,
+			       cfg->slots ? cfg->slots : port_cnt + 1,
+			       cfg->clock_rate,
+			       cfg->samples_per_frame, bridge->options,
+			       &conf);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to create conference bridge", status);
+	goto on_return;
+    }
+
+    if (cfg->workers > 1) {
+	status = (*bridge->set_workers)(conf, cfg->workers);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to create mixing workers", status);
+	    goto on_return;
+	}
+    }
+
+    if (cfg->speakers) {
+	status = (*bridge->set_speakers)(conf, cfg->speakers);
+	if (status != PJ_SUCCESS)
+	    goto on_return;
+    }
+
+    for (i=0; i<port_cnt; ++i) {
+	/* Only confbridge takes frames from where the port points */
+	pj_bool_t zero_copy = pj_ansi_strcmp(bridge->name, "pjmedia") != 0;
+
+	if (cfg->file_cnt && cfg->file_port == FILE_PORT_MMAP) {
+	    status = mmap_player_create(pool, cfg->files[i % cfg->file_cnt],
+					cfg->ptime,
+					zero_copy ? MMAP_PLAYER_ZERO_COPY : 0,
+					&ports[i]);
+	} else if (cfg->file_cnt && cfg->file_port == FILE_PORT_CACHE) {
+	    status = prompt_cache_player_create(cfg->cache, pool,
+					cfg->files[i % cfg->file_cnt],
+					cfg->clock_rate, cfg->ptime,
+					zero_copy ? PROMPT_CACHE_ZERO_COPY : 0,
+					&ports[i]);
+	} else if (cfg->file_cnt) {
+	    status = pjmedia_wav_player_port_create(pool,
+					cfg->files[i % cfg->file_cnt],
+					cfg->ptime, 0, 0, &ports[i]);
+	} else {
+	    status = synth_port_create(pool, i, cfg, &ports[i]);
+	}
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to create port", status);
+	    goto on_return;
+	}
+
+	status = (*bridge->add_port)(conf, pool, ports[i]);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to add conference port", status);
+	    goto on_return;
+	}
+    }
+
+    /* Each port transmits to the next 'fanout' ports (wrapping around),
+     * i.e. all-to-all when fanout is zero.
+     */
+    fanout = cfg->fanout;
+    if (fanout == 0 || fanout > port_cnt - 1)
+	fanout = port_cnt - 1;
+
+    for (i=0; i<port_cnt; ++i) {
+	for (j=1; j<=fanout; ++j) {
+	    unsigned dst = (i + j) % port_cnt;
+
+	    status = (*bridge->connect_port)(conf, i+1, dst+1);
+	    if (status != PJ_SUCCESS) {
+		app_perror(THIS_FILE, "Error connecting port", status);
+		goto on_return;
+	    }
+	    ++res->edges;
+	}
+    }
+
+    master = (*bridge->get_master_port)(conf);
+
+    if (cfg->use_master) {
+	struct timing_port *tp;
+	pjmedia_port *null_port;
+	pjmedia_master_port *mp;
+	const pj_str_t name = { "timing", 6 };
+
+	tp = PJ_POOL_ZALLOC_T(pool, struct timing_port);
+	pjmedia_port_info_init(&tp->base.info, &name,
+			       PJMEDIA_SIG_CLASS_PORT_AUD('T','M'),
+			       cfg->clock_rate, 1, 16, cfg->samples_per_frame);
+	tp->base.get_frame = &timing_get_frame;
+	tp->base.put_frame = &timing_put_frame;
+	tp->bridge = master;
+	tp->max_ticks = cfg->ticks;
+
+	status = pj_sem_create(pool, "timing", 0, 1, &tp->done);
+	if (status != PJ_SUCCESS)
+	    goto on_return;
+
+	status = pjmedia_null_port_create(pool, cfg->clock_rate, 1,
+					  cfg->samples_per_frame, 16,
+					  &null_port);
+	if (status != PJ_SUCCESS)
+	    goto on_return;
+
+	status = pjmedia_master_port_create(pool, null_port, &tp->base, 0,
+					    &mp);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to create master port", status);
+	    goto on_return;
+	}
+
+	pj_get_timestamp(&t0);
+	pjmedia_master_port_start(mp);
+	pj_sem_wait(tp->done);
+	pjmedia_master_port_stop(mp);
+	pj_get_timestamp(&t1);
+
+	pjmedia_master_port_destroy(mp, PJ_FALSE);
+	pjmedia_port_destroy(null_port);
+	pj_sem_destroy(tp->done);
+
+	res->ticks = tp->ticks;
+	res->busy_nsec = tp->busy_nsec;
+	res->wall_nsec = elapsed_nsec(&t0, &t1);
+
+    } else {
+	void *buf;
+
+	buf = pj_pool_zalloc(pool, cfg->samples_per_frame * 2);
+
+	/* Warm up caches before measuring */
+	for (i=0; i<10; ++i) {
+	    frame.buf = buf;
+	    frame.size = cfg->samples_per_frame * 2;
+	    pjmedia_port_get_frame(master, &frame);
+	}
+
+	pj_get_timestamp(&t0);
+	for (i=0; i<cfg->ticks; ++i) {
+	    frame.buf = buf;
+	    frame.size = cfg->samples_per_frame * 2;
+	    status = pjmedia_port_get_frame(master, &frame);
+	    if (status != PJ_SUCCESS) {
+		app_perror(THIS_FILE, "Bridge get_frame() failed", status);
+		goto on_return;
+	    }
+	}
+	pj_get_timestamp(&t1);
+
+	res->ticks = cfg->ticks;
+	res->busy_nsec = res->wall_nsec = elapsed_nsec(&t0, &t1);
+    }
+
+on_return:
+    if (conf)
+	(*bridge->destroy)(conf);
+    for (i=0; i<port_cnt; ++i) {
+	if (ports[i])
+	    pjmedia_port_destroy(ports[i]);
+    }
+    pj_pool_release(pool);
+
+    return status;
+}
+
+
+/* Print one line of result */
+static void print_result(const struct bench_cfg *cfg,
+			 const struct bench_result *res)
+{
+    double tick_nsec = res->busy_nsec / res->ticks;
+    double fps = res->ticks * 1000000000.0 / res->busy_nsec;
+
+    printf("%6u %8u %12.1f %12.0f %10.1f %12.1f %6.1f%%\n",
+	   res->ports,
+	   res->edges,
+	   fps,
+	   tick_nsec,
+	   res->edges ? tick_nsec / res->edges : 0.0,
+	   tick_nsec / res->ports,
+	   tick_nsec * 100.0 / (cfg->ptime * 1000000.0));
+}
+
+
+/*****************************************************************************
+ * main()
+ */
+int main(int argc, char *argv[])
+{
+    struct pj_getopt_option long_options[] = {
+	{ "rate",	1, 0, 'r' },
+	{ "port-rates",	1, 0, 'R' },
+	{ "ptime",	1, 0, 'p' },
+	{ "ticks",	1, 0, 't' },
+	{ "min-ports",	1, 0, 'm' },
+	{ "max-ports",	1, 0, 'n' },
+	{ "fanout",	1, 0, 'k' },
+	{ "slots",	1, 0, 's' },
+	{ "workers",	1, 0, 'w' },
+	{ "speakers",	1, 0, 'a' },
+	{ "clock",	1, 0, 'c' },
+	{ "bridge",	1, 0, 'b' },
+	{ "file-port",	1, 0, 'f' },
+	{ "verify",	0, 0, 'v' },
+	{ "help",	0, 0, 'h' },
+	{ NULL, 0, 0, 0 },
+    };
+    struct bench_cfg cfg;
+    pj_caching_pool cp;
+    pjmedia_endpt *med_endpt;
+    unsigned n;
+    int c, option_index;
+    char *err;
+    pj_bool_t verify = PJ_FALSE;
+    pj_status_t status;
+
+    /* Must init PJLIB first: */
+    status = pj_init();
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    /* Don't let the connect/disconnect logging flood the report */
+    pj_log_set_level(3);
+
+    pj_bzero(&cfg, sizeof(cfg));
+    cfg.bridge = &bridges[0];
+    cfg.clock_rate = 16000;
+    cfg.ptime = 20;
+    cfg.ticks = 500;
+    cfg.min_ports = 2;
+    cfg.max_ports = 512;
+    cfg.workers = 1;
+
+    pj_optind = 0;
+    while((c=pj_getopt_long(argc,argv, "r:R:p:t:m:n:k:s:w:a:c:b:f:vh",
+			    long_options, &option_index))!=-1)
+    {
+	long val = 0;
+
+	if (c != 'R' && c != 'c' && c != 'b' && c != 'f' && c != 'v' &&
+	    c != 'h' && c != '?')
+	{
+	    val = strtol(pj_optarg, &err, 10);
+	    if (*err || val < 0) {
+		printf("Error: invalid value for option '%c'\n", c);
+		return 1;
+	    }
+	}
+
+	switch (c) {
+	case 'r':
+	    cfg.clock_rate = (unsigned)val;
+	    break;
+	case 'R':
+	    {
+		char *p = pj_optarg;
+
+		for (cfg.port_rate_cnt=0; *p; ++cfg.port_rate_cnt) {
+		    val = strtol(p, &err, 10);
+		    if ((*err && *err != ',') || val < 8000 ||
+			cfg.port_rate_cnt == MAX_PORT_RATES)
+		    {
+			puts("Error: invalid port rates");
+			return 1;
+		    }
+		    cfg.port_rates[cfg.port_rate_cnt] = (unsigned)val;
+		    p = (*err ? err + 1 : err);
+		}
+	    }
+	    break;
+	case 'p':
+	    cfg.ptime = (unsigned)val;
+	    break;
+	case 't':
+	    cfg.ticks = (unsigned)val;
+	    break;
+	case 'm':
+	    cfg.min_ports = (unsigned)val;
+	    break;
+	case 'n':
+	    cfg.max_ports = (unsigned)val;
+	    break;
+	case 'k':
+	    cfg.fanout = (unsigned)val;
+	    break;
+	case 's':
+	    cfg.slots = (unsigned)val;
+	    break;
+	case 'w':
+	    cfg.workers = (unsigned)val;
+	    break;
+	case 'a':
+	    cfg.speakers = (unsigned)val;
+	    break;
+	case 'c':
+	    if (pj_ansi_strcmp(pj_optarg, "master") == 0)
+		cfg.use_master = PJ_TRUE;
+	    else if (pj_ansi_strcmp(pj_optarg, "loop") == 0)
+		cfg.use_master = PJ_FALSE;
+	    else {
+		puts("Error: clock must be \"loop\" or \"master\"");
+		return 1;
+	    }
+	    break;
+	case 'b':
+	    {
+		unsigned i;
+
+		for (i=0; i<PJ_ARRAY_SIZE(bridges); ++i) {
+		    if (pj_ansi_strcmp(pj_optarg, bridges[i].name) == 0)
+			break;
+		}
+		if (i == PJ_ARRAY_SIZE(bridges)) {
+		    puts("Error: unknown bridge type");
+		    return 1;
+		}
+		cfg.bridge = &bridges[i];
+	    }
+	    break;
+	case 'f':
+	    if (pj_ansi_strcmp(pj_optarg, "mmap") == 0)
+		cfg.file_port = FILE_PORT_MMAP;
+	    else if (pj_ansi_strcmp(pj_optarg, "cache") == 0)
+		cfg.file_port = FILE_PORT_CACHE;
+	    else if (pj_ansi_strcmp(pj_optarg, "wav") == 0)
+		cfg.file_port = FILE_PORT_WAV;
+	    else {
+		puts("Error: file port must be \"wav\", \"mmap\" or "
+		     "\"cache\"");
+		return 1;
+	    }
+	    break;
+	case 'v':
+	    verify = PJ_TRUE;
+	    break;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+
+    if (cfg.clock_rate < 8000 || cfg.ptime == 0 || cfg.ticks == 0 ||
+	cfg.min_ports < 2 || cfg.max_ports < cfg.min_ports ||
+	cfg.workers < 1 || cfg.workers > CONFBRIDGE_MAX_WORKERS ||
+	(cfg.slots && cfg.slots <= cfg.max_ports))
+    {
+	usage();
+	return 1;
+    }
+
+    if (cfg.workers > 1 && !cfg.bridge->set_workers) {
+	puts("Error: this bridge doesn't support mixing workers");
+	return 1;
+    }
+
+    if (cfg.speakers && !cfg.bridge->set_speakers) {
+	puts("Error: this bridge doesn't support active speaker mixing");
+	return 1;
+    }
+
+    if (verify) {
+	status = conf_mix_verify();
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Mixing kernels verification failed",
+		       status);
+	    return 1;
+	}
+	puts("Mixing kernels verified");
+	return 0;
+    }
+
+    cfg.samples_per_frame = cfg.clock_rate * cfg.ptime / 1000;
+    cfg.file_cnt = argc - pj_optind;
+    cfg.files = argv + pj_optind;
+
+    /* Must create a pool factory before we can allocate any memory. */
+    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+    /*
+     * Initialize media endpoint.
+     * This will implicitly initialize PJMEDIA too.
+     */
+    status = pjmedia_endpt_create(&cp.factory, NULL, 1, &med_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    /* One cache for all the runs, the first run decodes the files */
+    if (cfg.file_cnt && cfg.file_port == FILE_PORT_CACHE) {
+	status = prompt_cache_create(&cp.factory, PROMPT_CACHE_SIZE,
+				     &cfg.cache);
+	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    }
+
+    printf("Bridge: %s, %u worker(s), %u Hz, %u ms, %u ticks/run, %s clock, "
+	   "%s ports\n",
+	   cfg.bridge->name, cfg.workers, cfg.clock_rate, cfg.ptime,
+	   cfg.ticks,
+	   (cfg.use_master ? "master port" : "unpaced loop"),
+	   (!cfg.file_cnt ? "synthetic" :
+	    (cfg.file_port == FILE_PORT_MMAP ? "mmap player" :
+	     (cfg.file_port == FILE_PORT_CACHE ? "prompt cache" :
+	      "WAV player"))));
+    if (cfg.port_rate_cnt && !cfg.file_cnt) {
+	unsigned i;
+
+	printf("Port rates:");
+	for (i=0; i<cfg.port_rate_cnt; ++i)
+	    printf(" %u", cfg.port_rates[i]);
+	printf(" Hz\n");
+    }
+    printf("\n");
+    printf("%6s %8s %12s %12s %10s %12s %7s\n",
+	   "ports", "edges", "frames/s", "ns/tick", "ns/mixed",
+	   "ns/listener", "load");
+
+    for (n=cfg.min_ports; ; n*=2) {
+	struct bench_result res;
+
+	if (n > cfg.max_ports)
+	    n = cfg.max_ports;
+
+	status = run_bench(&cp.factory, &cfg, n, &res);
+	if (status != PJ_SUCCESS)
+	    break;
+
+	print_result(&cfg, &res);
+
+	if (n == cfg.max_ports)
+	    break;
+    }
+
+    if (cfg.cache) {
+	prompt_cache_stat stat;
+
+	prompt_cache_get_stat(cfg.cache, &stat);
+	printf("\nPrompt cache: %u prompts, %lu KB, %u hits, %u misses, "
+	       "%u evictions\n", stat.count, (unsigned long)stat.size / 1024,
+	       stat.hits, stat.misses, stat.evictions);
+	prompt_cache_destroy(cfg.cache);
+    }
+
+    /* Destroy media endpoint. */
+    pjmedia_endpt_destroy( med_endpt );
+
+    /* Destroy pool factory */
+    pj_caching_pool_destroy( &cp );
+
+    /* Shutdown PJLIB */
+    pj_shutdown();
+
+    return (status == PJ_SUCCESS) ? 0 : 1;
+}
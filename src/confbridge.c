@@ -0,0 +1,3570 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "confbridge.h"
+#include "conf_mix.h"
+#include "conf_resample.h"
+
+#define THIS_FILE	"confbridge.c"
+
+#define SIGNATURE	PJMEDIA_SIG_CLASS_PORT_AUD('C','B')
+#define NORMAL_LEVEL	CONF_MIX_NORMAL_LEVEL
+
+/* Number of frames buffered for sound device capture in slot zero */
+#define RX_BUF_COUNT	8
+
+/* Initial capacity of a port's listener array, it grows as needed */
+#define LISTENER_INIT_CAP   8
+
+/* Number of ports' frame buffers allocated together */
+#define FRAME_BUFS_CHUNK    16
+
+/* Maximum number of level subscribers */
+#define MAX_LEVEL_SUBS	    8
+
+/* Maximum number of frame taps */
+#define MAX_TAPS	    4
+
+/* Buckets of the latency histograms: four per octave, up to 2^40 */
+#define STAT_BUCKETS	    160
+
+/* Timestamps of the latency statistics, the CPU timestamp counter when
+ * available since it costs a few cycles.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   include <x86intrin.h>
+#   define STAT_HAS_TSC	    1
+#   define STAT_TS()	    __rdtsc()
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>
+#   define STAT_HAS_TSC	    1
+#   define STAT_TS()	    __rdtsc()
+#else
+#   define STAT_HAS_TSC	    0
+#   define STAT_TS()	    stat_ts()
+#endif
+
+/* Atomic pointer operations used to publish the connection graph */
+#if defined(__GNUC__)
+#   define PTR_XCHG(pp, v)	    __atomic_exchange_n(pp, v, __ATOMIC_ACQ_REL)
+#   define PTR_LOAD(pp)	    __atomic_load_n(pp, __ATOMIC_ACQUIRE)
+#   define PTR_CAS(pp, old, v)    __atomic_compare_exchange_n(pp, &(old), v, \
+					0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#elif defined(_MSC_VER)
+#   include <windows.h>
+#   define PTR_XCHG(pp, v)	    InterlockedExchangePointer((PVOID*)(pp), v)
+#   define PTR_LOAD(pp)	    InterlockedCompareExchangePointer( \
+					(PVOID*)(pp), NULL, NULL)
+#   define PTR_CAS(pp, old, v)    (InterlockedCompareExchangePointer( \
+					(PVOID*)(pp), v, old) == (old))
+#else
+#   error "Atomic pointer operations are not available for this compiler"
+#endif
+
+/* Sequence counter operations of the level snapshot (seqlock) */
+#if defined(__GNUC__)
+#   define SEQ_LOAD(p)		    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#   define SEQ_STORE(p, v)	    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#   define SEQ_FENCE_ACQ()	    __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#   define SEQ_FENCE_REL()	    __atomic_thread_fence(__ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#   define SEQ_LOAD(p)		    ((unsigned)InterlockedCompareExchange( \
+					(LONG volatile*)(p), 0, 0))
+#   define SEQ_STORE(p, v)	    InterlockedExchange((LONG volatile*)(p), \
+						(LONG)(v))
+#   define SEQ_FENCE_ACQ()	    MemoryBarrier()
+#   define SEQ_FENCE_REL()	    MemoryBarrier()
+#endif
+
+
+/*
+ * Latency histogram, see stat_add().
+ */
+struct stat_hist
+{
+    pj_uint32_t		 count;		/**< Number of values.		    */
+    pj_uint64_t		 max;		/**< Largest value.		    */
+    pj_uint32_t		 bucket[STAT_BUCKETS];
+};
+
+
+/*
+ * Port as seen by the mixer.
+ */
+struct graph_port
+{
+    struct conf_port	*cport;		/**< The port.			    */
+    unsigned		 slot;		/**< Slot number.		    */
+    unsigned		 first_edge;	/**< Listeners are edges[first_edge
+					     .. first_edge+listener_cnt).   */
+    unsigned		 listener_cnt;	/**< Number of listeners.	    */
+    unsigned		 transmitter_cnt;/**<Number of transmitters.	    */
+    pj_bool_t		 broadcast;	/**< Transmits to every other
+					     listening port (mix-once).	    */
+    int			 rx_adj_level;	/**< Adjustment level for rx.	    */
+    int			 tx_adj_level;	/**< Adjustment level for tx.	    */
+};
+
+
+/*
+ * Connection graph used by the mixer. The graph is immutable: connect,
+ * disconnect and level adjustment build a new graph from the ports'
+ * listener lists and levels and publish it, the mixer picks it up at the
+ * start of the next tick, and the old graph is freed once the mixer has
+ * let go of it. The mixer never waits for control operations.
+ *
+ * The graph only contains the occupied slots, in a compact array with
+ * slot zero first, and the listener lists in CSR form, referring to ports
+ * by their index in that array. The mixer walks the list of ports which
+ * have listeners (and the ports frame taps want read) and the edges, so
+ * a tick costs O(ports + connections) regardless of the number of slots
+ * in the bridge.
+ */
+struct conf_graph
+{
+    struct conf_graph	*next;		/**< Next in the retired list.	    */
+    pj_pool_t		*pool;		/**< Pool of this graph.	    */
+    unsigned		 connect_cnt;	/**< Number of connections.	    */
+    unsigned		 port_cnt;	/**< Number of ports.		    */
+    struct graph_port	*ports;		/**< Ports, ordered by slot.	    */
+    unsigned		 src_cnt;	/**< Number of ports with listeners.*/
+    unsigned		 read_cnt;	/**< Number of ports read: src_cnt,
+					     plus the tapped ones without
+					     listeners.			    */
+    unsigned		*srcs;		/**< Index of ports read, those
+					     with listeners first.	    */
+    unsigned		*edges;		/**< Index of listener ports.	    */
+    unsigned		 sub_cnt;	/**< Number of sub-bridge ports.    */
+    unsigned		*subs;		/**< Index of sub-bridge ports.	    */
+};
+
+
+/*
+ * Conference port.
+ */
+struct conf_port
+{
+    pj_str_t		 name;		/**< Port name.			    */
+    pjmedia_port	*port;		/**< get_frame() and put_frame()    */
+    pjmedia_port_op	 rx_setting;	/**< Can we receive from this port  */
+    pjmedia_port_op	 tx_setting;	/**< Can we transmit to this port   */
+
+    /* Connections and levels, maintained by the control operations under
+     * ctl_mutex. The mixer uses the published conf_graph instead.
+     */
+    pj_pool_t		*pool;		/**< Pool to grow listener_slots.   */
+    unsigned		 listener_cnt;	/**< Number of listeners.	    */
+    unsigned		 listener_cap;	/**< Capacity of listener_slots.    */
+    unsigned		*listener_slots;/**< Array of listeners.	    */
+    unsigned		 transmitter_cnt;/**<Number of transmitters.	    */
+    int			 rx_adj_level;	/**< Adjustment level for rx.	    */
+    int			 tx_adj_level;	/**< Adjustment level for tx.	    */
+    unsigned		 graph_idx;	/**< Index in the graph being built.*/
+    unsigned		 batch_cnt;	/**< Connections added by a batch.  */
+
+    unsigned		 clock_rate;	/**< Port's clock rate.		    */
+    unsigned		 samples_per_frame; /**< Port's samples per frame.  */
+
+    unsigned		 rx_level;	/**< Last rx level (0-255).	    */
+    unsigned		 tx_level;	/**< Last tx level (0-255).	    */
+    unsigned		 rx_peak;	/**< Last rx peak (0-32767).	    */
+    unsigned		 rx_rms;	/**< Last rx RMS (0-32767).	    */
+    unsigned		 tx_peak;	/**< Last tx peak (0-32767).	    */
+    unsigned		 tx_rms;	/**< Last tx RMS (0-32767).	    */
+
+    conf_resample	*rx_resample;	/**< Port to bridge resampler.	    */
+    conf_resample	*tx_resample;	/**< Bridge to port resampler.	    */
+    pj_int16_t		*port_buf;	/**< Frame at port's clock rate,
+					     used only when resampling.	    */
+    void		*frame_bufs;	/**< Block holding the three frame
+					     buffers below.		    */
+    pj_int32_t		*mix_buf;	/**< Mixing accumulator.	    */
+    pj_int16_t		*rx_frame;	/**< Received frame, bridge rate.   */
+    pj_int16_t		*tx_frame;	/**< Mixed frame, bridge rate.	    */
+    unsigned		 mix_cnt;	/**< Frames mixed in this tick.	    */
+    pj_bool_t		 rx_ok;		/**< rx_frame is valid this tick.   */
+    pj_bool_t		 in_sum;	/**< Frame is in the shared mix.    */
+    pj_bool_t		 rx_silent;	/**< Last frame read was silent.    */
+    pj_bool_t		 rx_audio;	/**< rx_frame holds audio read this
+					     tick, even if too quiet to be
+					     mixed.			    */
+    unsigned		 rx_frame_cnt;	/**< Frames read from the port.	    */
+    unsigned		 rx_silent_cnt;	/**< Silent frames read.	    */
+    unsigned		 speaker_level;	/**< Smoothed rx level for ranking. */
+    pj_bool_t		 active_speaker;/**< Selected as active speaker.    */
+
+    pjmedia_delay_buf	*delay_buf;	/**< Sound capture (slot zero).	    */
+    confbridge		*sub;		/**< Cascaded bridge, if any.	    */
+    pj_bool_t		 sub_mixed;	/**< Sub-bridge has mixed this tick.*/
+
+    /* Latency statistics, with CONFBRIDGE_PORT_STATS only */
+    struct stat_hist	*stats;		/**< Histograms, by
+					     confbridge_stat_type.	    */
+    pj_uint64_t		 mix_ts;	/**< Time accumulating our mix in
+					     this tick.			    */
+    unsigned		 rx_buf_puts;	/**< Frames put to delay_buf.	    */
+    unsigned		 rx_buf_gets;	/**< Frames taken from delay_buf.   */
+
+    pj_uint64_t		 tick_ts;	/**< Time reading the port in this
+					     tick, for the watchdog.	    */
+};
+
+
+/*
+ * Mixing worker. Worker zero is the thread which calls get_frame() of the
+ * master port (the clock), the others have their own thread.
+ */
+struct conf_worker
+{
+    confbridge		*conf;		/**< The bridge.		    */
+    unsigned		 index;		/**< Worker index.		    */
+    pj_thread_t		*thread;	/**< Worker thread (index > 0).	    */
+    pj_sem_t		*sem;		/**< Posted to run a phase.	    */
+    unsigned		 port_cnt;	/**< Ports read in the last tick.   */
+    pj_uint64_t		 tick_busy;	/**< Busy time this tick (ts units) */
+    unsigned		 ticks;		/**< Ticks since reset.		    */
+    pj_uint32_t		 last_usec;	/**< Busy time in the last tick.    */
+    pj_uint32_t		 max_usec;	/**< Longest busy time.		    */
+    pj_uint64_t		 total_usec;	/**< Total busy time.		    */
+    pj_uint64_t		 slow_ts;	/**< Time on the slowest port this
+					     tick (STAT_TS() units).	    */
+    unsigned		 slow_slot;	/**< The slowest port.		    */
+};
+
+
+/*
+ * Tick watchdog, see confbridge_set_watchdog(). Times are in timestamp
+ * units, except slow_ts.
+ */
+struct conf_watchdog
+{
+    confbridge_watchdog_param param;	/**< Settings.			    */
+    pj_uint64_t		 budget;	/**< Tick budget.		    */
+    pj_uint64_t		 recover;	/**< Budget of a fitting tick.	    */
+    unsigned		 strikes;	/**< Overruns toward the next step. */
+    unsigned		 calm;		/**< Consecutive fitting ticks.	    */
+    pj_uint32_t		 ticks;		/**< Ticks watched.		    */
+    pj_uint32_t		 overrun_cnt;	/**< Ticks over the budget.	    */
+    pj_uint64_t		 last;		/**< Duration of the last tick.	    */
+    pj_uint64_t		 last_late;	/**< Time over the budget...	    */
+    pj_uint64_t		 max_late;	/**< ...largest one...		    */
+    pj_uint64_t		 total_late;	/**< ...and their sum.		    */
+    int			 slow_slot;	/**< Slowest port of last overrun.  */
+    pj_uint64_t		 slow_ts;	/**< Its time, STAT_TS() units.	    */
+    unsigned		 degrade_cnt;	/**< Degradation steps taken.	    */
+};
+
+
+/* Tick phases, each one runs on all workers followed by a barrier. */
+enum tick_phase
+{
+    PHASE_READ,		/* Read frames from the ports.			    */
+    PHASE_MIX,		/* Accumulate the frames into the listeners.	    */
+    PHASE_WRITE		/* Clip the mix and write it to the ports.	    */
+};
+
+
+/*
+ * Conference bridge.
+ */
+struct confbridge
+{
+    unsigned		  options;	/**< Bitmask options.		    */
+    unsigned		  max_ports;	/**< Maximum ports.		    */
+    unsigned		  port_cnt;	/**< Current number of ports.	    */
+    unsigned		  connect_cnt;	/**< Total number of connections    */
+    unsigned		  listening_cnt;/**< Ports with transmitters.	    */
+    pjmedia_snd_port	 *snd_dev_port;	/**< Sound device port.		    */
+    pjmedia_port	 *master_port;	/**< Port zero's port.		    */
+    confbridge		 *parent;	/**< Bridge we're cascaded into.    */
+    pj_mutex_t		 *mutex;	/**< Conference mutex, held by the
+					     mixer during a tick.	    */
+    pj_mutex_t		 *ctl_mutex;	/**< Serializes control operations,
+					     never taken by the mixer.	    */
+    pj_pool_factory	 *pf;		/**< Factory for the graph pools.   */
+    struct conf_graph	 *graph;	/**< Graph used by the mixer.	    */
+    struct conf_graph	 *pending_graph;/**< Graph waiting for next tick.   */
+    struct conf_graph	 *retired_graph;/**< Graphs the mixer let go of.    */
+    struct conf_port	**ports;	/**< Array of ports.		    */
+    unsigned		  clock_rate;	/**< Sampling rate.		    */
+    unsigned		  channel_count;/**< Number of channels (1=mono).   */
+    unsigned		  samples_per_frame;	/**< Samples per frame.	    */
+    unsigned		  bits_per_sample;	/**< Bits per sample.	    */
+    const conf_mix_ops	 *mix;		/**< Mixing kernels.		    */
+    conf_resample_cache	 *resample_cache;/**<Resampler filter tables.	    */
+    conf_resample_quality resample_quality;/**<Quality of new resamplers.   */
+    pj_size_t		  frame_bufs_size;/**<Size of a port's frame buffers.*/
+    void		 *free_frame_bufs;/**<Recycled frame buffer blocks.  */
+    pj_int32_t		 *sum_buf;	/**< Shared mix of the ports which
+					     transmit to everyone else.	    */
+    unsigned		  sum_cnt;	/**< Frames in sum_buf this tick.   */
+    unsigned		  silence_level;/**< Frames below are not mixed.    */
+    pj_int16_t		 *silence_buf;	/**< Shared silence frame, written
+					     to ports with only silent
+					     transmitters.		    */
+    unsigned		  silence_samples;/**<Samples in silence_buf.	    */
+    unsigned		  max_speakers;	/**< Sources mixed, 0 for all.	    */
+    unsigned		  speaker_limit;/**< max_speakers, or less while
+					     degraded.			    */
+    unsigned		  speaker_hist[256 + CONFBRIDGE_SPEAKER_HYSTERESIS];
+					/**< Ranking histogram.		    */
+
+    pj_uint32_t		  tick;		/**< Frames mixed so far.	    */
+    unsigned		  level_seq;	/**< Odd while levels are written.  */
+    confbridge_level	 *levels;	/**< Level snapshot, by slot.	    */
+    unsigned		  level_sub_cnt;/**< Number of level subscribers.   */
+    struct {
+	confbridge_level_cb cb;
+	void		   *user_data;
+    }			  level_subs[MAX_LEVEL_SUBS];
+					/**< Level subscribers.		    */
+    unsigned		  tap_cnt;	/**< Number of frame taps.	    */
+    struct {
+	confbridge_tap_cb   cb;
+	void		   *user_data;
+	unsigned	    slot_cnt;
+	const unsigned	   *slots;
+    }			  taps[MAX_TAPS];
+					/**< Frame taps.		    */
+    unsigned		 *tapped;	/**< Per slot, number of taps which
+					     want it read.		    */
+    confbridge_tap_frame *tap_frames;	/**< Frames given to the taps.	    */
+
+    pj_pool_t		 *pool;		/**< Pool for workers, frame bufs.  */
+    pj_uint64_t		  ts_freq;	/**< Timestamp frequency.	    */
+    pj_uint64_t		  stat_ts0;	/**< STAT_TS() at creation...	    */
+    pj_timestamp	  stat_ref0;	/**< ...and pj_get_timestamp().	    */
+    unsigned		  worker_cnt;	/**< Number of workers (>= 1).	    */
+    struct conf_worker	  workers[CONFBRIDGE_MAX_WORKERS];
+    pj_sem_t		 *done_sem;	/**< Posted by workers after phase. */
+    enum tick_phase	  phase;	/**< Phase the workers run.	    */
+    pj_bool_t		  quit_workers;	/**< Tell the workers to quit.	    */
+
+    struct conf_watchdog  wd;		/**< Tick watchdog.		    */
+    unsigned		  degrade;	/**< confbridge_degrade steps in
+					     effect.			    */
+};
+
+
+/* Prototypes */
+static pj_status_t put_frame(pjmedia_port *this_port,
+			     pjmedia_frame *frame);
+static pj_status_t get_frame(pjmedia_port *this_port,
+			     pjmedia_frame *frame);
+static void stop_workers(confbridge *conf);
+static pj_bool_t tick_mix(confbridge *conf);
+static void init_watchdog(confbridge *conf);
+static void tick_write(confbridge *conf, const pj_int16_t *frame);
+
+
+/* Convert the measured level to the 0-255 range of pjmedia_conf. */
+static unsigned level_to_ulaw(const conf_mix_level *level, unsigned count)
+{
+    return pjmedia_linear2ulaw(level->abs_sum / count) ^ 0xff;
+}
+
+/* Integer square root. */
+static unsigned isqrt(pj_uint32_t v)
+{
+    pj_uint32_t root = 0, bit = 1u << 30;
+
+    while (bit > v)
+	bit >>= 2;
+    while (bit) {
+	if (v >= root + bit) {
+	    v -= root + bit;
+	    root = (root >> 1) + bit;
+	} else {
+	    root >>= 1;
+	}
+	bit >>= 2;
+    }
+    return root;
+}
+
+/* Get the RMS of the measured level, 0-32767. */
+static unsigned level_to_rms(const conf_mix_level *level, unsigned count)
+{
+    return isqrt((pj_uint32_t)(level->sq_sum / count));
+}
+
+
+#if !STAT_HAS_TSC
+static pj_uint64_t stat_ts(void)
+{
+    pj_timestamp ts;
+
+    pj_get_timestamp(&ts);
+    return ts.u64;
+}
+#endif
+
+
+/*
+ * Add a value to a histogram. Values below 4 have their own bucket,
+ * larger ones go to one of four buckets per octave, by the two bits
+ * following the leading one.
+ */
+static void stat_add(struct stat_hist *h, pj_uint64_t v)
+{
+    unsigned b;
+
+    if (v < 4) {
+	b = (unsigned)v;
+    } else {
+	unsigned e = 2;
+
+	while (e < 63 && (v >> (e + 1)))
+	    ++e;
+	b = (e - 1) * 4 + (unsigned)((v >> (e - 2)) & 3);
+	if (b >= STAT_BUCKETS)
+	    b = STAT_BUCKETS - 1;
+    }
+
+    ++h->bucket[b];
+    ++h->count;
+    if (v > h->max)
+	h->max = v;
+}
+
+
+/* Largest value which goes to bucket b. */
+static pj_uint64_t stat_bucket_max(unsigned b)
+{
+    unsigned e, m;
+
+    if (b < 4)
+	return b;
+
+    e = b / 4 + 1;
+    m = b % 4;
+    return ((pj_uint64_t)(5 + m) << (e - 2)) - 1;
+}
+
+
+/* Value below which per_mille of the values fall. */
+static pj_uint64_t stat_percentile(const struct stat_hist *h,
+				   unsigned per_mille)
+{
+    pj_uint64_t target, cnt = 0;
+    unsigned b;
+
+    if (h->count == 0)
+	return 0;
+
+    target = ((pj_uint64_t)h->count * per_mille + 999) / 1000;
+    for (b=0; b<STAT_BUCKETS; ++b) {
+	cnt += h->bucket[b];
+	if (cnt >= target)
+	    return PJ_MIN(stat_bucket_max(b), h->max);
+    }
+    return h->max;
+}
+
+
+/* Start timing an operation on the port, if we keep its statistics. */
+static pj_uint64_t stat_begin(const struct conf_port *cport)
+{
+    return cport->stats ? STAT_TS() : 0;
+}
+
+
+/* Record the duration of an operation started with stat_begin(). */
+static void stat_end(struct conf_port *cport, confbridge_stat_type type,
+		     pj_uint64_t t0)
+{
+    if (cport->stats)
+	stat_add(&cport->stats[type], STAT_TS() - t0);
+}
+
+
+/* Record the time to mix the port's frame: the accumulation counted in
+ * mix_ts, and the conversion started at t0.
+ */
+static void stat_mix(struct conf_port *cport, pj_uint64_t t0)
+{
+    if (cport->stats) {
+	stat_add(&cport->stats[CONFBRIDGE_STAT_MIX],
+		 cport->mix_ts + STAT_TS() - t0);
+	cport->mix_ts = 0;
+    }
+}
+
+
+/*
+ * Give the port its frame buffers. The buffers of all ports are carved
+ * from large blocks and recycled when ports are removed, so the buffers
+ * the mixer touches stay close together however sparse the slots are.
+ */
+static pj_status_t alloc_frame_bufs(confbridge *conf,
+				    struct conf_port *cport)
+{
+    pj_uint8_t *bufs;
+
+    if (!conf->free_frame_bufs) {
+	pj_uint8_t *chunk;
+	unsigned i;
+
+	chunk = (pj_uint8_t*) pj_pool_alloc(conf->pool, FRAME_BUFS_CHUNK *
+						       conf->frame_bufs_size);
+	if (!chunk)
+	    return PJ_ENOMEM;
+
+	for (i=0; i<FRAME_BUFS_CHUNK; ++i) {
+	    void **block = (void**)(chunk + i * conf->frame_bufs_size);
+
+	    *block = conf->free_frame_bufs;
+	    conf->free_frame_bufs = block;
+	}
+    }
+
+    bufs = (pj_uint8_t*) conf->free_frame_bufs;
+    conf->free_frame_bufs = *(void**)bufs;
+    pj_bzero(bufs, conf->frame_bufs_size);
+
+    cport->frame_bufs = bufs;
+    cport->mix_buf = (pj_int32_t*) bufs;
+    cport->rx_frame = (pj_int16_t*)
+		      (bufs + conf->samples_per_frame * sizeof(pj_int32_t));
+    cport->tx_frame = cport->rx_frame + conf->samples_per_frame;
+
+    return PJ_SUCCESS;
+}
+
+
+/* Return the port's frame buffers for reuse. */
+static void free_frame_bufs(confbridge *conf, struct conf_port *cport)
+{
+    *(void**)cport->frame_bufs = conf->free_frame_bufs;
+    conf->free_frame_bufs = cport->frame_bufs;
+    cport->frame_bufs = NULL;
+}
+
+
+/*
+ * Make room for cnt listeners in the port's listener array.
+ */
+static pj_status_t reserve_listeners(confbridge *conf,
+				     struct conf_port *cport,
+				     unsigned cnt)
+{
+    unsigned cap;
+    unsigned *slots;
+
+    if (cnt <= cport->listener_cap)
+	return PJ_SUCCESS;
+
+    cap = cport->listener_cap ? cport->listener_cap : LISTENER_INIT_CAP;
+    while (cap < cnt)
+	cap *= 2;
+    if (cap > conf->max_ports)
+	cap = conf->max_ports;
+
+    slots = (unsigned*) pj_pool_alloc(cport->pool, cap * sizeof(unsigned));
+    if (!slots)
+	return PJ_ENOMEM;
+
+    if (cport->listener_cnt)
+	pj_memcpy(slots, cport->listener_slots,
+		  cport->listener_cnt * sizeof(unsigned));
+    cport->listener_slots = slots;
+    cport->listener_cap = cap;
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Release the resamplers and frame buffers of a port which the mixer
+ * doesn't use anymore. The port itself is owned by the application.
+ */
+static void release_conf_port(confbridge *conf, struct conf_port *cport)
+{
+    if (cport->rx_resample) {
+	conf_resample_destroy(cport->rx_resample);
+	cport->rx_resample = NULL;
+    }
+    if (cport->tx_resample) {
+	conf_resample_destroy(cport->tx_resample);
+	cport->tx_resample = NULL;
+    }
+    if (cport->frame_bufs)
+	free_frame_bufs(conf, cport);
+}
+
+
+/*
+ * Build the linear tables the watchdog switches the port's resamplers to,
+ * see set_degrade(). Not to be called from the tick.
+ */
+static pj_status_t prepare_linear(struct conf_port *cport)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    if (cport->rx_resample)
+	status = conf_resample_prepare_linear(cport->rx_resample);
+    if (status == PJ_SUCCESS && cport->tx_resample)
+	status = conf_resample_prepare_linear(cport->tx_resample);
+    return status;
+}
+
+
+/*
+ * Create port.
+ */
+static pj_status_t create_conf_port( pj_pool_t *pool,
+				     confbridge *conf,
+				     pjmedia_port *port,
+				     const pj_str_t *name,
+				     struct conf_port **p_conf_port)
+{
+    struct conf_port *conf_port;
+    unsigned port_rate, port_spf;
+    pj_status_t status;
+
+    conf_port = PJ_POOL_ZALLOC_T(pool, struct conf_port);
+
+    pj_strdup_with_null(pool, &conf_port->name, name);
+
+    conf_port->port = port;
+    conf_port->rx_setting = PJMEDIA_PORT_ENABLE;
+    conf_port->tx_setting = PJMEDIA_PORT_ENABLE;
+    conf_port->rx_adj_level = NORMAL_LEVEL;
+    conf_port->tx_adj_level = NORMAL_LEVEL;
+
+    conf_port->pool = pool;
+    status = reserve_listeners(conf, conf_port, LISTENER_INIT_CAP);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (conf->options & CONFBRIDGE_PORT_STATS) {
+	conf_port->stats = (struct stat_hist*)
+			   pj_pool_zalloc(pool, CONFBRIDGE_STAT_COUNT *
+						sizeof(struct stat_hist));
+	if (!conf_port->stats)
+	    return PJ_ENOMEM;
+    }
+
+    port_rate = PJMEDIA_PIA_SRATE(&port->info);
+    port_spf = PJMEDIA_PIA_SPF(&port->info);
+    conf_port->clock_rate = port_rate;
+    conf_port->samples_per_frame = port_spf;
+
+    /* Create resamplers if the port's clock rate differs. Ports with
+     * the same clock rate share the filter tables.
+     */
+    if (port_rate != conf->clock_rate) {
+	conf_resample_quality quality = conf->resample_quality;
+
+	status = conf_resample_create(conf->resample_cache, pool, conf->mix,
+				      quality, conf->channel_count,
+				      port_rate, conf->clock_rate,
+				      port_spf, &conf_port->rx_resample);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	status = conf_resample_create(conf->resample_cache, pool, conf->mix,
+				      quality, conf->channel_count,
+				      conf->clock_rate, port_rate,
+				      conf->samples_per_frame,
+				      &conf_port->tx_resample);
+	if (status == PJ_SUCCESS &&
+	    (conf->wd.param.degrade & CONFBRIDGE_DEGRADE_RESAMPLE))
+	{
+	    status = prepare_linear(conf_port);
+	}
+	if (status != PJ_SUCCESS) {
+	    release_conf_port(conf, conf_port);
+	    return status;
+	}
+
+	conf_port->port_buf = (pj_int16_t*)
+			      pj_pool_zalloc(pool, port_spf * 2);
+    }
+
+    status = alloc_frame_bufs(conf, conf_port);
+    if (status != PJ_SUCCESS) {
+	release_conf_port(conf, conf_port);
+	return status;
+    }
+
+    *p_conf_port = conf_port;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Create the master port and the sound device for slot zero.
+ */
+static pj_status_t create_master_port(pj_pool_t *pool, confbridge *conf)
+{
+    const pj_str_t name = { "Master/sound", 12 };
+    struct conf_port *conf_port;
+    unsigned ptime;
+    pj_status_t status;
+
+    conf->master_port = PJ_POOL_ZALLOC_T(pool, pjmedia_port);
+    pjmedia_port_info_init(&conf->master_port->info, &name, SIGNATURE,
+			   conf->clock_rate, conf->channel_count,
+			   conf->bits_per_sample, conf->samples_per_frame);
+    conf->master_port->port_data.pdata = conf;
+    conf->master_port->port_data.ldata = 0;
+    conf->master_port->get_frame = &get_frame;
+    conf->master_port->put_frame = &put_frame;
+
+    status = create_conf_port(pool, conf, conf->master_port, &name,
+			      &conf_port);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Captured frames arrive from the sound device thread, buffer them
+     * until the next tick.
+     */
+    ptime = conf->samples_per_frame * 1000 / conf->clock_rate /
+	    conf->channel_count;
+    status = pjmedia_delay_buf_create(pool, name.ptr, conf->clock_rate,
+				      conf->samples_per_frame,
+				      conf->channel_count,
+				      RX_BUF_COUNT * ptime, 0,
+				      &conf_port->delay_buf);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if ((conf->options & CONFBRIDGE_NO_DEVICE) == 0) {
+	if (conf->options & CONFBRIDGE_NO_MIC) {
+	    status = pjmedia_snd_port_create_player(pool, -1,
+					conf->clock_rate,
+					conf->channel_count,
+					conf->samples_per_frame,
+					conf->bits_per_sample,
+					0, &conf->snd_dev_port);
+	} else {
+	    status = pjmedia_snd_port_create(pool, -1, -1,
+					conf->clock_rate,
+					conf->channel_count,
+					conf->samples_per_frame,
+					conf->bits_per_sample,
+					0, &conf->snd_dev_port);
+	}
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    conf->ports[0] = conf_port;
+    conf->port_cnt++;
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Check if the port transmits to every other port that has a transmitter
+ * (and not to itself), so its frame can go to the shared mix. Listeners
+ * always have a transmitter, so comparing the counts is enough.
+ */
+static pj_bool_t is_broadcast(confbridge *conf, unsigned slot,
+			      const struct conf_port *cport)
+{
+    unsigned j, others;
+
+    others = conf->listening_cnt - (cport->transmitter_cnt ? 1 : 0);
+    if (cport->listener_cnt == 0 || cport->listener_cnt != others)
+	return PJ_FALSE;
+
+    for (j=0; j<cport->listener_cnt; ++j) {
+	if (cport->listener_slots[j] == slot)
+	    return PJ_FALSE;
+    }
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Allocate a graph with room for port_cnt ports and max_edges connections.
+ */
+static pj_status_t alloc_graph(confbridge *conf, unsigned port_cnt,
+			       unsigned max_edges,
+			       struct conf_graph **p_graph)
+{
+    struct conf_graph *graph;
+    pj_pool_t *pool;
+    pj_size_t size;
+
+    size = sizeof(struct conf_graph) + 256 +
+	   port_cnt * (sizeof(struct graph_port) + 2 * sizeof(unsigned)) +
+	   max_edges * sizeof(unsigned);
+    pool = pj_pool_create(conf->pf, "confgraph%p", size, 256, NULL);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    graph = PJ_POOL_ZALLOC_T(pool, struct conf_graph);
+    graph->pool = pool;
+    graph->ports = (struct graph_port*)
+		   pj_pool_zalloc(pool, port_cnt * sizeof(struct graph_port));
+    graph->srcs = (unsigned*)
+		  pj_pool_alloc(pool, port_cnt * sizeof(unsigned));
+    graph->edges = (unsigned*)
+		   pj_pool_alloc(pool, max_edges * sizeof(unsigned));
+    graph->subs = (unsigned*)
+		  pj_pool_alloc(pool, port_cnt * sizeof(unsigned));
+
+    *p_graph = graph;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Fill the graph from the ports' listener lists and levels, ctl_mutex
+ * must be held. The graph must have room for all ports and connections.
+ */
+static void fill_graph(confbridge *conf, struct conf_graph *graph)
+{
+    unsigned i, edge_cnt;
+
+    graph->connect_cnt = conf->connect_cnt;
+    graph->port_cnt = 0;
+    graph->src_cnt = 0;
+    graph->read_cnt = 0;
+    graph->sub_cnt = 0;
+
+    for (i=0; i<conf->max_ports; ++i) {
+	struct conf_port *cport = conf->ports[i];
+	struct graph_port *gp;
+
+	if (!cport)
+	    continue;
+
+	cport->graph_idx = graph->port_cnt++;
+	gp = &graph->ports[cport->graph_idx];
+	gp->cport = cport;
+	gp->slot = i;
+	gp->listener_cnt = cport->listener_cnt;
+	gp->transmitter_cnt = cport->transmitter_cnt;
+	gp->broadcast = is_broadcast(conf, i, cport);
+	gp->rx_adj_level = cport->rx_adj_level;
+	gp->tx_adj_level = cport->tx_adj_level;
+	if (cport->sub)
+	    graph->subs[graph->sub_cnt++] = cport->graph_idx;
+    }
+
+    edge_cnt = 0;
+    for (i=0; i<graph->port_cnt; ++i) {
+	struct graph_port *gp = &graph->ports[i];
+	unsigned j;
+
+	gp->first_edge = edge_cnt;
+	if (gp->listener_cnt == 0)
+	    continue;
+
+	graph->srcs[graph->src_cnt++] = i;
+	for (j=0; j<gp->listener_cnt; ++j) {
+	    unsigned listener = gp->cport->listener_slots[j];
+	    graph->edges[edge_cnt++] = conf->ports[listener]->graph_idx;
+	}
+    }
+
+    /* Tapped ports are read even when nobody listens to them */
+    graph->read_cnt = graph->src_cnt;
+    for (i=0; i<graph->port_cnt; ++i) {
+	struct graph_port *gp = &graph->ports[i];
+
+	if (gp->listener_cnt == 0 && conf->tapped[gp->slot])
+	    graph->srcs[graph->read_cnt++] = i;
+    }
+
+    pj_assert(graph->port_cnt == conf->port_cnt);
+    pj_assert(edge_cnt == conf->connect_cnt);
+}
+
+
+/*
+ * Build a graph from the ports' listener lists and levels, ctl_mutex
+ * must be held.
+ */
+static pj_status_t build_graph(confbridge *conf, struct conf_graph **p_graph)
+{
+    pj_status_t status;
+
+    status = alloc_graph(conf, conf->port_cnt, conf->connect_cnt, p_graph);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    fill_graph(conf, *p_graph);
+    return PJ_SUCCESS;
+}
+
+
+/* Free the graphs the mixer no longer uses, ctl_mutex must be held. */
+static void reclaim_graphs(confbridge *conf)
+{
+    struct conf_graph *graph;
+
+    graph = (struct conf_graph*) PTR_XCHG(&conf->retired_graph, NULL);
+    while (graph) {
+	struct conf_graph *next = graph->next;
+
+	pj_pool_release(graph->pool);
+	graph = next;
+    }
+}
+
+
+/*
+ * Hand a filled graph over to the mixer, ctl_mutex must be held. The
+ * mixer starts using it on the next tick.
+ */
+static void install_graph(confbridge *conf, struct conf_graph *graph)
+{
+    struct conf_graph *old;
+
+    /* A graph which is still pending has never been seen by the mixer */
+    old = (struct conf_graph*) PTR_XCHG(&conf->pending_graph, graph);
+    if (old)
+	pj_pool_release(old->pool);
+
+    reclaim_graphs(conf);
+}
+
+
+/*
+ * Publish a new graph built from the ports' listener lists and levels,
+ * ctl_mutex must be held.
+ */
+static pj_status_t publish_graph(confbridge *conf)
+{
+    struct conf_graph *graph;
+    pj_status_t status;
+
+    status = build_graph(conf, &graph);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    install_graph(conf, graph);
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Switch the mixer to the pending graph, if any. Called by the mixer at
+ * the start of a tick, or by control operations which hold the conference
+ * mutex and need the mixer to stop using a slot.
+ */
+static void apply_pending_graph(confbridge *conf)
+{
+    struct conf_graph *graph, *old;
+
+    graph = (struct conf_graph*) PTR_XCHG(&conf->pending_graph, NULL);
+    if (!graph)
+	return;
+
+    /* Hand the old graph over to the control side for freeing. */
+    old = conf->graph;
+    conf->graph = graph;
+    if (old) {
+	struct conf_graph *head = (struct conf_graph*)
+				  PTR_LOAD(&conf->retired_graph);
+	do {
+	    old->next = head;
+	} while (!PTR_CAS(&conf->retired_graph, head, old));
+    }
+}
+
+
+/*
+ * Create conference bridge.
+ */
+pj_status_t confbridge_create(pj_pool_t *pool,
+			      unsigned max_ports,
+			      unsigned clock_rate,
+			      unsigned channel_count,
+			      unsigned samples_per_frame,
+			      unsigned bits_per_sample,
+			      unsigned options,
+			      confbridge **p_conf)
+{
+    confbridge *conf;
+    pj_timestamp ts_freq;
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && max_ports && clock_rate && channel_count &&
+		     samples_per_frame && p_conf, PJ_EINVAL);
+
+    /* Only 16bit PCM is supported. */
+    PJ_ASSERT_RETURN(bits_per_sample == 16, PJMEDIA_ENCBITS);
+
+    PJ_LOG(5,(THIS_FILE, "Creating conference bridge with %d ports",
+	      max_ports));
+
+    conf = PJ_POOL_ZALLOC_T(pool, confbridge);
+
+    conf->ports = (struct conf_port**)
+		  pj_pool_zalloc(pool, max_ports*sizeof(void*));
+    conf->options = options;
+    conf->max_ports = max_ports;
+    conf->clock_rate = clock_rate;
+    conf->channel_count = channel_count;
+    conf->samples_per_frame = samples_per_frame;
+    conf->bits_per_sample = bits_per_sample;
+
+    conf->pool = pool;
+    conf->frame_bufs_size = samples_per_frame * (sizeof(pj_int32_t) +
+						 2 * sizeof(pj_int16_t));
+    conf->frame_bufs_size = (conf->frame_bufs_size + 63) & ~(pj_size_t)63;
+    conf->worker_cnt = 1;
+    for (i=0; i<CONFBRIDGE_MAX_WORKERS; ++i) {
+	conf->workers[i].conf = conf;
+	conf->workers[i].index = i;
+    }
+    pj_get_timestamp_freq(&ts_freq);
+    conf->ts_freq = ts_freq.u64;
+    conf->stat_ts0 = STAT_TS();
+    pj_get_timestamp(&conf->stat_ref0);
+
+    conf->sum_buf = (pj_int32_t*)
+		    pj_pool_zalloc(pool, samples_per_frame *
+					 sizeof(conf->sum_buf[0]));
+
+    conf->levels = (confbridge_level*)
+		   pj_pool_zalloc(pool, max_ports * sizeof(confbridge_level));
+    for (i=0; i<max_ports; ++i)
+	conf->levels[i].slot = i;
+
+    conf->tapped = (unsigned*) pj_pool_zalloc(pool, max_ports *
+						      sizeof(unsigned));
+    conf->tap_frames = (confbridge_tap_frame*)
+		       pj_pool_zalloc(pool, max_ports *
+					    sizeof(confbridge_tap_frame));
+
+    conf->silence_level = CONFBRIDGE_SILENCE_LEVEL;
+    conf->silence_samples = samples_per_frame;
+    conf->silence_buf = (pj_int16_t*)
+			pj_pool_zalloc(pool, samples_per_frame *
+					     sizeof(conf->silence_buf[0]));
+
+    if (options & CONFBRIDGE_NO_SIMD)
+	conf->mix = conf_mix_get_ops_by_name("scalar");
+    else
+	conf->mix = conf_mix_get_ops();
+
+    if (options & CONFBRIDGE_USE_LINEAR)
+	conf->resample_quality = CONF_RESAMPLE_LINEAR;
+    else if (options & CONFBRIDGE_SMALL_FILTER)
+	conf->resample_quality = CONF_RESAMPLE_SMALL;
+    else
+	conf->resample_quality = CONF_RESAMPLE_LARGE;
+
+    confbridge_watchdog_param_default(&conf->wd.param);
+    init_watchdog(conf);
+
+    conf->pf = pool->factory;
+
+    status = conf_resample_cache_create(conf->pf, &conf->resample_cache);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pj_mutex_create_recursive(pool, "conf", &conf->mutex);
+    if (status != PJ_SUCCESS) {
+	conf_resample_cache_destroy(conf->resample_cache);
+	return status;
+    }
+
+    status = pj_mutex_create_recursive(pool, "confctl", &conf->ctl_mutex);
+    if (status != PJ_SUCCESS) {
+	pj_mutex_destroy(conf->mutex);
+	conf_resample_cache_destroy(conf->resample_cache);
+	return status;
+    }
+
+    status = create_master_port(pool, conf);
+    if (status == PJ_SUCCESS)
+	status = build_graph(conf, &conf->graph);
+    if (status != PJ_SUCCESS) {
+	confbridge_destroy(conf);
+	return status;
+    }
+
+    /* Start mixing by the sound device clock. */
+    if (conf->snd_dev_port) {
+	status = pjmedia_snd_port_connect(conf->snd_dev_port,
+					  conf->master_port);
+	if (status != PJ_SUCCESS) {
+	    confbridge_destroy(conf);
+	    return status;
+	}
+    }
+
+    PJ_LOG(5,(THIS_FILE, "Conference bridge created, mixing with %s "
+	      "kernels", conf->mix->name));
+
+    *p_conf = conf;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Destroy conference bridge.
+ */
+pj_status_t confbridge_destroy(confbridge *conf)
+{
+    unsigned i, ci;
+
+    PJ_ASSERT_RETURN(conf != NULL, PJ_EINVAL);
+
+    /* A cascaded bridge must be removed from its parent first */
+    PJ_ASSERT_RETURN(conf->parent == NULL, PJ_EBUSY);
+
+    /* Destroy sound device port. */
+    if (conf->snd_dev_port) {
+	pjmedia_snd_port_destroy(conf->snd_dev_port);
+	conf->snd_dev_port = NULL;
+    }
+
+    /* Stop worker threads */
+    stop_workers(conf);
+    for (i=1; i<CONFBRIDGE_MAX_WORKERS; ++i) {
+	if (conf->workers[i].sem)
+	    pj_sem_destroy(conf->workers[i].sem);
+    }
+    if (conf->done_sem)
+	pj_sem_destroy(conf->done_sem);
+
+    /* Destroy resamplers and delay buffer. */
+    for (i=0, ci=0; i<conf->max_ports && ci<conf->port_cnt; ++i) {
+	struct conf_port *cport = conf->ports[i];
+
+	if (!cport)
+	    continue;
+
+	++ci;
+	release_conf_port(conf, cport);
+	if (cport->sub)
+	    cport->sub->parent = NULL;
+	if (cport->delay_buf)
+	    pjmedia_delay_buf_destroy(cport->delay_buf);
+    }
+
+    /* Free the connection graphs */
+    reclaim_graphs(conf);
+    if (conf->pending_graph)
+	pj_pool_release(conf->pending_graph->pool);
+    if (conf->graph)
+	pj_pool_release(conf->graph->pool);
+
+    /* Destroy mutex */
+    if (conf->mutex)
+	pj_mutex_destroy(conf->mutex);
+    if (conf->ctl_mutex)
+	pj_mutex_destroy(conf->ctl_mutex);
+
+    /* All resamplers are gone, so are the filter tables */
+    if (conf->resample_cache)
+	conf_resample_cache_destroy(conf->resample_cache);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get port zero interface.
+ */
+pjmedia_port* confbridge_get_master_port(confbridge *conf)
+{
+    PJ_ASSERT_RETURN(conf != NULL, NULL);
+    return conf->master_port;
+}
+
+
+/*
+ * Add a port, or the master port of a sub-bridge, to the bridge.
+ */
+static pj_status_t add_port(confbridge *conf,
+			    pj_pool_t *pool,
+			    pjmedia_port *strm_port,
+			    confbridge *sub,
+			    const pj_str_t *port_name,
+			    unsigned *p_slot)
+{
+    struct conf_port *conf_port;
+    pj_int16_t *silence_buf = NULL;
+    unsigned index;
+    pj_status_t status;
+
+    /* If port_name is not specified, use the port's name */
+    if (!port_name)
+	port_name = &strm_port->info.name;
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    if (conf->port_cnt >= conf->max_ports) {
+	pj_assert(!"Too many ports");
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_ETOOMANY;
+    }
+
+    /* Find empty port in the conference bridge. */
+    for (index=0; index < conf->max_ports; ++index) {
+	if (conf->ports[index] == NULL)
+	    break;
+    }
+
+    pj_assert(index != conf->max_ports);
+
+    /* Create conf port structure, the mixer doesn't see it yet. */
+    status = create_conf_port(pool, conf, strm_port, port_name, &conf_port);
+    if (status != PJ_SUCCESS) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+    conf_port->sub = sub;
+
+    /* The shared silence frame must be large enough for the port. */
+    if (conf_port->samples_per_frame > conf->silence_samples) {
+	silence_buf = (pj_int16_t*)
+		      pj_pool_zalloc(conf->pool,
+				     conf_port->samples_per_frame *
+				     sizeof(conf->silence_buf[0]));
+	if (!silence_buf) {
+	    release_conf_port(conf, conf_port);
+	    pj_mutex_unlock(conf->ctl_mutex);
+	    return PJ_ENOMEM;
+	}
+    }
+
+    /* Put the port, the mixer must see its levels as soon as it sees
+     * the port.
+     */
+    pj_mutex_lock(conf->mutex);
+    if (silence_buf) {
+	conf->silence_buf = silence_buf;
+	conf->silence_samples = conf_port->samples_per_frame;
+    }
+    conf->ports[index] = conf_port;
+    conf->port_cnt++;
+    if (sub)
+	sub->parent = conf;
+    status = publish_graph(conf);
+    if (status != PJ_SUCCESS) {
+	conf->ports[index] = NULL;
+	conf->port_cnt--;
+	if (sub)
+	    sub->parent = NULL;
+	release_conf_port(conf, conf_port);
+	pj_mutex_unlock(conf->mutex);
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+    apply_pending_graph(conf);
+    pj_mutex_unlock(conf->mutex);
+
+    /* Done. */
+    if (p_slot) {
+	*p_slot = index;
+    }
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Add stream port to the conference bridge.
+ */
+pj_status_t confbridge_add_port(confbridge *conf,
+				pj_pool_t *pool,
+				pjmedia_port *strm_port,
+				const pj_str_t *port_name,
+				unsigned *p_slot)
+{
+    PJ_ASSERT_RETURN(conf && pool && strm_port, PJ_EINVAL);
+
+    /* Port must have the same bits per sample, channel count and ptime
+     * as the bridge. Clock rate conversion is done by the bridge.
+     */
+    if (PJMEDIA_PIA_BITS(&strm_port->info) != conf->bits_per_sample)
+	return PJMEDIA_ENCBITS;
+    if (PJMEDIA_PIA_CCNT(&strm_port->info) != conf->channel_count)
+	return PJMEDIA_ENCCHANNEL;
+    if (PJMEDIA_PIA_SPF(&strm_port->info) * conf->clock_rate !=
+	conf->samples_per_frame * PJMEDIA_PIA_SRATE(&strm_port->info))
+    {
+	return PJMEDIA_ENCSAMPLESPFRAME;
+    }
+
+    return add_port(conf, pool, strm_port, NULL, port_name, p_slot);
+}
+
+
+/*
+ * Cascade a bridge into the conference bridge.
+ */
+pj_status_t confbridge_add_bridge(confbridge *conf,
+				  pj_pool_t *pool,
+				  confbridge *sub,
+				  const pj_str_t *name,
+				  unsigned *p_slot)
+{
+    confbridge *c;
+
+    PJ_ASSERT_RETURN(conf && pool && sub, PJ_EINVAL);
+
+    /* Both halves of the sub-bridge's tick run inside ours, so the frames
+     * must line up exactly, and nothing else may clock the sub-bridge.
+     */
+    if (sub->channel_count != conf->channel_count)
+	return PJMEDIA_ENCCHANNEL;
+    if (sub->clock_rate != conf->clock_rate)
+	return PJMEDIA_ENCCLOCKRATE;
+    if (sub->samples_per_frame != conf->samples_per_frame)
+	return PJMEDIA_ENCSAMPLESPFRAME;
+    if (sub->snd_dev_port || sub->parent)
+	return PJ_EBUSY;
+
+    /* No loops */
+    for (c=conf; c; c=c->parent) {
+	if (c == sub)
+	    return PJ_EINVALIDOP;
+    }
+
+    return add_port(conf, pool, sub->master_port, sub, name, p_slot);
+}
+
+
+/*
+ * Change TX and RX settings for the port.
+ */
+pj_status_t confbridge_configure_port(confbridge *conf,
+				      unsigned slot,
+				      pjmedia_port_op tx,
+				      pjmedia_port_op rx)
+{
+    struct conf_port *conf_port;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && slot<conf->max_ports, PJ_EINVAL);
+
+    pj_mutex_lock(conf->mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[slot];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->mutex);
+	return PJ_EINVAL;
+    }
+
+    if (tx != PJMEDIA_PORT_NO_CHANGE)
+	conf_port->tx_setting = tx;
+
+    if (rx != PJMEDIA_PORT_NO_CHANGE)
+	conf_port->rx_setting = rx;
+
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Add a connection to the listener lists, ctl_mutex must be held.
+ * Returns PJ_FALSE if the connection already exists.
+ */
+static pj_bool_t add_edge(confbridge *conf, unsigned src_slot,
+			  unsigned sink_slot)
+{
+    struct conf_port *src_port = conf->ports[src_slot];
+    struct conf_port *dst_port = conf->ports[sink_slot];
+    unsigned i;
+
+    /* Check if connection has been made */
+    for (i=0; i<src_port->listener_cnt; ++i) {
+	if (src_port->listener_slots[i] == sink_slot)
+	    return PJ_FALSE;
+    }
+
+    /* The caller has reserved room for the listener. */
+    pj_assert(src_port->listener_cnt < src_port->listener_cap);
+    src_port->listener_slots[src_port->listener_cnt] = sink_slot;
+    ++conf->connect_cnt;
+    ++src_port->listener_cnt;
+    if (dst_port->transmitter_cnt++ == 0)
+	++conf->listening_cnt;
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Remove a connection from the listener lists, ctl_mutex must be held.
+ * Returns PJ_FALSE if there is no such connection.
+ */
+static pj_bool_t del_edge(confbridge *conf, unsigned src_slot,
+			  unsigned sink_slot)
+{
+    struct conf_port *src_port = conf->ports[src_slot];
+    struct conf_port *dst_port = conf->ports[sink_slot];
+    unsigned i;
+
+    for (i=0; i<src_port->listener_cnt; ++i) {
+	if (src_port->listener_slots[i] == sink_slot)
+	    break;
+    }
+
+    if (i == src_port->listener_cnt)
+	return PJ_FALSE;
+
+    pj_assert(src_port->listener_cnt > 0 &&
+	      src_port->listener_cnt <= conf->max_ports);
+    pj_assert(dst_port->transmitter_cnt > 0 &&
+	      dst_port->transmitter_cnt <= conf->max_ports);
+    pj_memmove(&src_port->listener_slots[i],
+	       &src_port->listener_slots[i+1],
+	       (src_port->listener_cnt-i-1) * sizeof(unsigned));
+    --conf->connect_cnt;
+    --src_port->listener_cnt;
+    if (--dst_port->transmitter_cnt == 0)
+	--conf->listening_cnt;
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Connect port.
+ */
+pj_status_t confbridge_connect_port(confbridge *conf,
+				    unsigned src_slot,
+				    unsigned sink_slot,
+				    int level)
+{
+    struct conf_port *src_port, *dst_port;
+    pj_status_t status = PJ_SUCCESS;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && src_slot<conf->max_ports &&
+		     sink_slot<conf->max_ports, PJ_EINVAL);
+
+    /* Per connection level adjustment is not supported. */
+    PJ_ASSERT_RETURN(level == 0, PJ_EINVAL);
+
+    /* Only the control lock is needed, the mixer is not blocked. */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Ports must be valid. */
+    src_port = conf->ports[src_slot];
+    dst_port = conf->ports[sink_slot];
+    if (!src_port || !dst_port) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    status = reserve_listeners(conf, src_port, src_port->listener_cnt + 1);
+    if (status != PJ_SUCCESS) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+
+    if (add_edge(conf, src_slot, sink_slot)) {
+	status = publish_graph(conf);
+	if (status != PJ_SUCCESS) {
+	    del_edge(conf, src_slot, sink_slot);
+	} else {
+	    PJ_LOG(4,(THIS_FILE,
+		      "Port %d (%.*s) transmitting to port %d (%.*s)",
+		      src_slot,
+		      (int)src_port->name.slen,
+		      src_port->name.ptr,
+		      sink_slot,
+		      (int)dst_port->name.slen,
+		      dst_port->name.ptr));
+	}
+    }
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return status;
+}
+
+
+/*
+ * Disconnect port
+ */
+pj_status_t confbridge_disconnect_port(confbridge *conf,
+				       unsigned src_slot,
+				       unsigned sink_slot)
+{
+    struct conf_port *src_port, *dst_port;
+    pj_status_t status = PJ_SUCCESS;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && src_slot<conf->max_ports &&
+		     sink_slot<conf->max_ports, PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Ports must be valid. */
+    src_port = conf->ports[src_slot];
+    dst_port = conf->ports[sink_slot];
+    if (!src_port || !dst_port) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    if (del_edge(conf, src_slot, sink_slot)) {
+	status = publish_graph(conf);
+	if (status != PJ_SUCCESS) {
+	    add_edge(conf, src_slot, sink_slot);
+	} else {
+	    PJ_LOG(4,(THIS_FILE,
+		      "Port %d (%.*s) stop transmitting to port %d (%.*s)",
+		      src_slot,
+		      (int)src_port->name.slen,
+		      src_port->name.ptr,
+		      sink_slot,
+		      (int)dst_port->name.slen,
+		      dst_port->name.ptr));
+	}
+    }
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return status;
+}
+
+
+/*
+ * Get number of ports currently registered to the conference bridge.
+ */
+unsigned confbridge_get_port_count(confbridge *conf)
+{
+    return conf->port_cnt;
+}
+
+
+/*
+ * Get total number of ports connections currently set up in the bridge.
+ */
+unsigned confbridge_get_connect_count(confbridge *conf)
+{
+    return conf->connect_cnt;
+}
+
+
+/*
+ * Remove the specified port.
+ */
+pj_status_t confbridge_remove_port(confbridge *conf, unsigned port)
+{
+    struct conf_port *conf_port;
+    unsigned i;
+    pj_status_t status;
+
+    /* Check arguments; slot zero (the master port) can not be removed */
+    PJ_ASSERT_RETURN(conf && port > 0 && port < conf->max_ports, PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[port];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    conf_port->tx_setting = PJMEDIA_PORT_DISABLE;
+    conf_port->rx_setting = PJMEDIA_PORT_DISABLE;
+
+    /* Remove this port from transmit array of other ports. */
+    for (i=0; i<conf->max_ports; ++i) {
+	if (conf->ports[i] && conf->ports[i]->listener_cnt)
+	    del_edge(conf, i, port);
+    }
+
+    /* Remove the connections to the ports we're transmitting to */
+    while (conf_port->listener_cnt) {
+	del_edge(conf, port,
+		 conf_port->listener_slots[conf_port->listener_cnt-1]);
+    }
+
+    /* Remove the port and make sure the mixer stops using it. */
+    pj_mutex_lock(conf->mutex);
+
+    conf->ports[port] = NULL;
+    --conf->port_cnt;
+    status = publish_graph(conf);
+    if (status != PJ_SUCCESS) {
+	/* The mixer may still use the old connections, keep the port
+	 * (disabled and disconnected) in the bridge.
+	 */
+	conf->ports[port] = conf_port;
+	++conf->port_cnt;
+	pj_mutex_unlock(conf->mutex);
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+
+    apply_pending_graph(conf);
+
+    /* The sub-bridge isn't clocked by us anymore */
+    if (conf_port->sub)
+	conf_port->sub->parent = NULL;
+
+    pj_mutex_unlock(conf->mutex);
+
+    release_conf_port(conf, conf_port);
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    PJ_LOG(4,(THIS_FILE,"Removed port %d (%.*s)",
+	      port, (int)conf_port->name.slen, conf_port->name.ptr));
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get port info
+ */
+pj_status_t confbridge_get_port_info(confbridge *conf,
+				     unsigned slot,
+				     confbridge_port_info *info)
+{
+    struct conf_port *conf_port;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && slot<conf->max_ports, PJ_EINVAL);
+
+    /* Lock mutex */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[slot];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    pj_bzero(info, sizeof(confbridge_port_info));
+
+    info->slot = slot;
+    info->name = conf_port->name;
+    info->tx_setting = conf_port->tx_setting;
+    info->rx_setting = conf_port->rx_setting;
+    info->listener_cnt = conf_port->listener_cnt;
+    info->listener_slots = conf_port->listener_slots;
+    info->transmitter_cnt = conf_port->transmitter_cnt;
+    info->clock_rate = conf_port->clock_rate;
+    info->channel_count = PJMEDIA_PIA_CCNT(&conf_port->port->info);
+    info->samples_per_frame = conf_port->samples_per_frame;
+    info->bits_per_sample = PJMEDIA_PIA_BITS(&conf_port->port->info);
+    info->tx_adj_level = conf_port->tx_adj_level - NORMAL_LEVEL;
+    info->rx_adj_level = conf_port->rx_adj_level - NORMAL_LEVEL;
+    info->rx_silent = conf_port->rx_silent;
+    info->rx_frame_cnt = conf_port->rx_frame_cnt;
+    info->rx_silent_cnt = conf_port->rx_silent_cnt;
+    info->active_speaker = conf->speaker_limit && conf_port->active_speaker;
+    info->sub_bridge = conf_port->sub;
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t confbridge_get_ports_info(confbridge *conf,
+				      unsigned *size,
+				      confbridge_port_info info[])
+{
+    unsigned i, count=0;
+
+    PJ_ASSERT_RETURN(conf && size && info, PJ_EINVAL);
+
+    /* Lock mutex */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    for (i=0; i<conf->max_ports && count<*size; ++i) {
+	if (!conf->ports[i])
+	    continue;
+
+	confbridge_get_port_info(conf, i, &info[count]);
+	++count;
+    }
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    *size = count;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Convert a histogram to nanoseconds, with scale units per second.
+ */
+static void stat_get(const struct stat_hist *h, pj_uint64_t scale,
+		     confbridge_stat *stat)
+{
+    pj_uint64_t v[3];
+    pj_uint32_t ns[3];
+    unsigned i;
+
+    v[0] = stat_percentile(h, 500);
+    v[1] = stat_percentile(h, 990);
+    v[2] = h->max;
+    for (i=0; i<3; ++i) {
+	double d = (double)(pj_int64_t)v[i] * 1e9 / (double)(pj_int64_t)scale;
+	ns[i] = d < 4294967295.0 ? (pj_uint32_t)d : 0xFFFFFFFF;
+    }
+
+    stat->count = h->count;
+    stat->p50 = ns[0];
+    stat->p99 = ns[1];
+    stat->max = ns[2];
+}
+
+
+/*
+ * Frequency of STAT_TS(), measured against pj_get_timestamp() since the
+ * bridge was created when it's the CPU's timestamp counter.
+ */
+static pj_uint64_t stat_ts_freq(const confbridge *conf)
+{
+#if STAT_HAS_TSC
+    pj_timestamp now;
+    pj_uint64_t ticks, elapsed;
+
+    ticks = STAT_TS() - conf->stat_ts0;
+    pj_get_timestamp(&now);
+    elapsed = now.u64 - conf->stat_ref0.u64;
+    if (ticks && elapsed) {
+	double freq = (double)(pj_int64_t)ticks * (double)(pj_int64_t)
+		      conf->ts_freq / (double)(pj_int64_t)elapsed;
+	if (freq >= 1)
+	    return (pj_uint64_t)freq;
+    }
+    return conf->ts_freq;
+#else
+    return conf->ts_freq;
+#endif
+}
+
+
+pj_status_t confbridge_get_ports_stats(confbridge *conf,
+				       unsigned *size,
+				       confbridge_port_stats stats[])
+{
+    pj_uint64_t freq;
+    unsigned i, count=0;
+
+    PJ_ASSERT_RETURN(conf && size && stats, PJ_EINVAL);
+
+    if ((conf->options & CONFBRIDGE_PORT_STATS) == 0)
+	return PJ_EINVALIDOP;
+
+    freq = stat_ts_freq(conf);
+
+    /* Lock mutex. The histograms are read while the mixer updates them,
+     * so the figures may be off by the frames of the current tick.
+     */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    for (i=0; i<conf->max_ports && count<*size; ++i) {
+	struct conf_port *cport = conf->ports[i];
+	unsigned t;
+
+	if (!cport)
+	    continue;
+
+	stats[count].slot = i;
+	for (t=0; t<CONFBRIDGE_STAT_COUNT; ++t) {
+	    /* Capture buffer occupancy is counted in samples */
+	    stat_get(&cport->stats[t],
+		     t == CONFBRIDGE_STAT_RX_BUF ? conf->clock_rate : freq,
+		     &stats[count].stat[t]);
+	}
+	++count;
+    }
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    *size = count;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t confbridge_reset_ports_stats(confbridge *conf)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(conf, PJ_EINVAL);
+
+    if ((conf->options & CONFBRIDGE_PORT_STATS) == 0)
+	return PJ_EINVALIDOP;
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    for (i=0; i<conf->max_ports; ++i) {
+	if (conf->ports[i]) {
+	    pj_bzero(conf->ports[i]->stats,
+		     CONFBRIDGE_STAT_COUNT * sizeof(struct stat_hist));
+	}
+    }
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get signal level.
+ */
+pj_status_t confbridge_get_signal_level(confbridge *conf,
+					unsigned slot,
+					unsigned *tx_level,
+					unsigned *rx_level)
+{
+    struct conf_port *conf_port;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && slot<conf->max_ports, PJ_EINVAL);
+
+    /* Lock mutex */
+    pj_mutex_lock(conf->mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[slot];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->mutex);
+	return PJ_EINVAL;
+    }
+
+    if (tx_level != NULL) {
+	*tx_level = conf_port->tx_level;
+    }
+
+    if (rx_level != NULL)
+	*rx_level = conf_port->rx_level;
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Adjust RX level of individual port.
+ */
+pj_status_t confbridge_adjust_rx_level(confbridge *conf,
+				       unsigned slot,
+				       int adj_level)
+{
+    struct conf_port *conf_port;
+    int old_level;
+    pj_status_t status;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && slot<conf->max_ports, PJ_EINVAL);
+
+    /* Value must be from -128 to +127 */
+    /* Disabled, you can put more than +127, at your own risk:
+     PJ_ASSERT_RETURN(adj_level >= -128 && adj_level <= 127, PJ_EINVAL);
+     */
+    PJ_ASSERT_RETURN(adj_level >= -128, PJ_EINVAL);
+
+    /* Lock mutex */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[slot];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    /* Set normalized adjustment level, effective on the next frame. */
+    old_level = conf_port->rx_adj_level;
+    conf_port->rx_adj_level = adj_level + NORMAL_LEVEL;
+    status = publish_graph(conf);
+    if (status != PJ_SUCCESS)
+	conf_port->rx_adj_level = old_level;
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return status;
+}
+
+
+/*
+ * Adjust TX level of individual port.
+ */
+pj_status_t confbridge_adjust_tx_level(confbridge *conf,
+				       unsigned slot,
+				       int adj_level)
+{
+    struct conf_port *conf_port;
+    int old_level;
+    pj_status_t status;
+
+    /* Check arguments */
+    PJ_ASSERT_RETURN(conf && slot<conf->max_ports, PJ_EINVAL);
+
+    /* Value must be from -128 to +127 */
+    /* Disabled, you can put more than +127,, at your own risk:
+     PJ_ASSERT_RETURN(adj_level >= -128 && adj_level <= 127, PJ_EINVAL);
+     */
+    PJ_ASSERT_RETURN(adj_level >= -128, PJ_EINVAL);
+
+    /* Lock mutex */
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Port must be valid. */
+    conf_port = conf->ports[slot];
+    if (conf_port == NULL) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_EINVAL;
+    }
+
+    /* Set normalized adjustment level, effective on the next frame. */
+    old_level = conf_port->tx_adj_level;
+    conf_port->tx_adj_level = adj_level + NORMAL_LEVEL;
+    status = publish_graph(conf);
+    if (status != PJ_SUCCESS)
+	conf_port->tx_adj_level = old_level;
+
+    /* Unlock mutex */
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return status;
+}
+
+
+/*
+ * Set the silence level.
+ */
+pj_status_t confbridge_set_silence_level(confbridge *conf, unsigned level)
+{
+    PJ_ASSERT_RETURN(conf && level <= 255, PJ_EINVAL);
+
+    /* A single word the mixer only reads, it's picked up within a frame
+     * without any locking.
+     */
+    conf->silence_level = level;
+
+    PJ_LOG(4,(THIS_FILE, "Silence level set to %u", level));
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get the silence level.
+ */
+unsigned confbridge_get_silence_level(confbridge *conf)
+{
+    PJ_ASSERT_RETURN(conf != NULL, 0);
+    return conf->silence_level;
+}
+
+
+/*
+ * Number of speakers mixed: the user's setting, or the watchdog's while
+ * it degrades the mix. Bridge mutex must be held.
+ */
+static void update_speaker_limit(confbridge *conf)
+{
+    unsigned limit = conf->max_speakers;
+
+    if ((conf->degrade & CONFBRIDGE_DEGRADE_SPEAKERS) &&
+	(limit == 0 || limit > conf->wd.param.speakers))
+    {
+	limit = conf->wd.param.speakers;
+    }
+    conf->speaker_limit = limit;
+}
+
+
+/*
+ * Set the number of active speakers.
+ */
+pj_status_t confbridge_set_active_speakers(confbridge *conf,
+					   unsigned count)
+{
+    PJ_ASSERT_RETURN(conf, PJ_EINVAL);
+
+    /* Changed between ticks, the ranking state carries over. */
+    pj_mutex_lock(conf->mutex);
+    conf->max_speakers = count;
+    update_speaker_limit(conf);
+    pj_mutex_unlock(conf->mutex);
+
+    PJ_LOG(4,(THIS_FILE, "Active speakers set to %u", count));
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get the active speakers.
+ */
+pj_status_t confbridge_get_active_speakers(confbridge *conf,
+					   unsigned *count,
+					   unsigned slots[])
+{
+    unsigned i, cnt = 0;
+
+    PJ_ASSERT_RETURN(conf && count && slots, PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    for (i=0; i<conf->max_ports && cnt<*count; ++i) {
+	struct conf_port *cport = conf->ports[i];
+
+	if (cport && conf->speaker_limit && cport->active_speaker)
+	    slots[cnt++] = i;
+    }
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    *count = cnt;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Apply a batch of operations on one frame boundary.
+ */
+pj_status_t confbridge_update(confbridge *conf,
+			      unsigned count,
+			      const confbridge_op ops[])
+{
+    struct conf_graph *graph;
+    unsigned i, max_edges;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(conf && (count == 0 || ops), PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* Validate the whole batch before changing anything. */
+    max_edges = conf->connect_cnt;
+    for (i=0; i<count; ++i) {
+	if (ops[i].slot < conf->max_ports && conf->ports[ops[i].slot])
+	    conf->ports[ops[i].slot]->batch_cnt = 0;
+    }
+    for (i=0; i<count; ++i) {
+	const confbridge_op *op = &ops[i];
+	pj_bool_t valid;
+
+	switch (op->type) {
+	case CONFBRIDGE_OP_CONNECT:
+	    ++max_edges;
+	    /* Fallthrough */
+	case CONFBRIDGE_OP_DISCONNECT:
+	    valid = (op->slot < conf->max_ports && conf->ports[op->slot] &&
+		     op->sink_slot < conf->max_ports &&
+		     conf->ports[op->sink_slot]);
+	    if (valid && op->type == CONFBRIDGE_OP_CONNECT)
+		++conf->ports[op->slot]->batch_cnt;
+	    break;
+	case CONFBRIDGE_OP_ADJUST_RX_LEVEL:
+	case CONFBRIDGE_OP_ADJUST_TX_LEVEL:
+	    valid = (op->slot < conf->max_ports && conf->ports[op->slot] &&
+		     op->level >= -128);
+	    break;
+	default:
+	    valid = PJ_FALSE;
+	    break;
+	}
+
+	if (!valid) {
+	    PJ_LOG(4,(THIS_FILE, "Invalid operation %u in batch, nothing "
+		      "was changed", i));
+	    pj_mutex_unlock(conf->ctl_mutex);
+	    return PJ_EINVAL;
+	}
+    }
+
+    /* Allocations are the only thing that can fail, so do them first
+     * and the batch is applied either completely or not at all. Growing
+     * the listener arrays of untouched ports is harmless.
+     */
+    for (i=0; i<count; ++i) {
+	struct conf_port *cport = conf->ports[ops[i].slot];
+
+	if (ops[i].type != CONFBRIDGE_OP_CONNECT || !cport->batch_cnt)
+	    continue;
+
+	status = reserve_listeners(conf, cport,
+				   cport->listener_cnt + cport->batch_cnt);
+	if (status != PJ_SUCCESS) {
+	    pj_mutex_unlock(conf->ctl_mutex);
+	    return status;
+	}
+	cport->batch_cnt = 0;
+    }
+
+    status = alloc_graph(conf, conf->port_cnt, max_edges, &graph);
+    if (status != PJ_SUCCESS) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+
+    for (i=0; i<count; ++i) {
+	const confbridge_op *op = &ops[i];
+
+	switch (op->type) {
+	case CONFBRIDGE_OP_CONNECT:
+	    add_edge(conf, op->slot, op->sink_slot);
+	    break;
+	case CONFBRIDGE_OP_DISCONNECT:
+	    del_edge(conf, op->slot, op->sink_slot);
+	    break;
+	case CONFBRIDGE_OP_ADJUST_RX_LEVEL:
+	    conf->ports[op->slot]->rx_adj_level = op->level + NORMAL_LEVEL;
+	    break;
+	case CONFBRIDGE_OP_ADJUST_TX_LEVEL:
+	    conf->ports[op->slot]->tx_adj_level = op->level + NORMAL_LEVEL;
+	    break;
+	}
+    }
+
+    fill_graph(conf, graph);
+    install_graph(conf, graph);
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    PJ_LOG(4,(THIS_FILE, "Applied batch of %u operations, %u connections",
+	      count, graph->connect_cnt));
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get the mixing kernel name.
+ */
+const char* confbridge_get_mix_impl(confbridge *conf)
+{
+    PJ_ASSERT_RETURN(conf != NULL, NULL);
+    return conf->mix->name;
+}
+
+
+/*
+ * Apply rx level adjustment to the frame in rx_frame and measure its
+ * level. Returns PJ_FALSE if the frame is silent and must not be mixed.
+ */
+static pj_bool_t accept_rx_frame(confbridge *conf,
+				 const struct graph_port *gp)
+{
+    struct conf_port *cport = gp->cport;
+    conf_mix_level level;
+
+    conf->mix->adjust(cport->rx_frame, conf->samples_per_frame,
+		      gp->rx_adj_level, &level);
+    cport->rx_level = level_to_ulaw(&level, conf->samples_per_frame);
+    cport->rx_peak = level.peak;
+    if ((conf->degrade & CONFBRIDGE_DEGRADE_LEVELS) == 0)
+	cport->rx_rms = level_to_rms(&level, conf->samples_per_frame);
+
+    /* Silent frames are not mixed, so listeners of silent ports only
+     * cost the check below.
+     */
+    if (level.peak == 0 || cport->rx_level < conf->silence_level)
+	return PJ_FALSE;
+
+    --cport->rx_silent_cnt;
+    cport->rx_silent = PJ_FALSE;
+    return PJ_TRUE;
+}
+
+
+/*
+ * Record how much audio waits in slot zero's capture buffer, counting
+ * the frames put by the sound device and those we take. The delay
+ * buffer drops the oldest frames when full.
+ */
+static void stat_rx_buf(confbridge *conf, struct conf_port *cport)
+{
+    unsigned puts = SEQ_LOAD(&cport->rx_buf_puts);
+    unsigned pending = puts - cport->rx_buf_gets;
+
+    if (pending > RX_BUF_COUNT) {
+	pending = RX_BUF_COUNT;
+	cport->rx_buf_gets = puts - pending;
+    }
+    stat_add(&cport->stats[CONFBRIDGE_STAT_RX_BUF],
+	     (pj_uint64_t)pending * conf->samples_per_frame /
+	     conf->channel_count);
+    if (pending)
+	++cport->rx_buf_gets;
+}
+
+
+/*
+ * Read a frame from the port into rx_frame.
+ */
+static void read_port(confbridge *conf, const struct graph_port *gp)
+{
+    struct conf_port *cport = gp->cport;
+    pj_bool_t sub_ok = PJ_FALSE;
+
+    cport->rx_level = cport->rx_peak = cport->rx_rms = 0;
+    cport->rx_ok = PJ_FALSE;
+    cport->rx_audio = PJ_FALSE;
+    cport->in_sum = PJ_FALSE;
+
+    /* A sub-bridge mixes now, whether we receive from it or not. */
+    if (cport->sub) {
+	pj_uint64_t t0 = stat_begin(cport);
+
+	sub_ok = tick_mix(cport->sub);
+	cport->sub_mixed = PJ_TRUE;
+	stat_end(cport, CONFBRIDGE_STAT_GET_FRAME, t0);
+    }
+
+    /* Skip if we're not allowed to receive from this port. Ports nobody
+     * listens to are not read at all, unless a tap wants them. Slot zero
+     * of a sub-bridge is fed by the parent later in the tick, see
+     * feed_master().
+     */
+    if (cport->rx_setting != PJMEDIA_PORT_ENABLE ||
+	(gp->slot == 0 && conf->parent))
+    {
+	return;
+    }
+
+    /* Until we know better, the frame is silent and won't be mixed. */
+    ++cport->rx_frame_cnt;
+    ++cport->rx_silent_cnt;
+    cport->rx_silent = PJ_TRUE;
+
+    if (cport->sub) {
+	/* What the sub-bridge's ports transmit to its slot zero */
+	if (!sub_ok)
+	    return;
+	pj_memcpy(cport->rx_frame, cport->sub->ports[0]->tx_frame,
+		  conf->samples_per_frame * 2);
+    } else if (cport->delay_buf) {
+	pj_uint64_t t0;
+	pj_status_t status;
+
+	/* Slot zero: frame captured by the sound device */
+	if (cport->stats)
+	    stat_rx_buf(conf, cport);
+
+	t0 = stat_begin(cport);
+	status = pjmedia_delay_buf_get(cport->delay_buf, cport->rx_frame);
+	stat_end(cport, CONFBRIDGE_STAT_GET_FRAME, t0);
+	if (status != PJ_SUCCESS)
+	    return;
+    } else {
+	pjmedia_frame frame;
+	pj_uint64_t t0;
+	pj_status_t status;
+
+	pj_bzero(&frame, sizeof(frame));
+	frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame.buf = cport->rx_resample ? cport->port_buf : cport->rx_frame;
+	frame.size = cport->samples_per_frame * 2;
+
+	t0 = stat_begin(cport);
+	status = pjmedia_port_get_frame(cport->port, &frame);
+	stat_end(cport, CONFBRIDGE_STAT_GET_FRAME, t0);
+	if (status != PJ_SUCCESS || frame.type != PJMEDIA_FRAME_TYPE_AUDIO)
+	    return;
+
+	/* Zero-copy ports may hand out a buffer of their own */
+	if (cport->rx_resample) {
+	    conf_resample_run(cport->rx_resample,
+			      (const pj_int16_t*)frame.buf, cport->rx_frame);
+	} else if (frame.buf != cport->rx_frame) {
+	    pj_memcpy(cport->rx_frame, frame.buf,
+		      conf->samples_per_frame * 2);
+	}
+    }
+
+    cport->rx_audio = PJ_TRUE;
+    if (!accept_rx_frame(conf, gp))
+	return;
+    cport->rx_ok = PJ_TRUE;
+
+    /* With CONFBRIDGE_MIX_ONCE, a port which transmits to everyone else
+     * is mixed once into the shared mix instead of into every listener;
+     * each listener later subtracts its own frame from it (N-1 mixing).
+     */
+    if ((conf->options & CONFBRIDGE_MIX_ONCE) && gp->broadcast)
+	cport->in_sum = PJ_TRUE;
+}
+
+
+/*
+ * Feed the frame transmitted by the parent to slot zero of a sub-bridge.
+ * It's too late for the MIX phase, so it is mixed into slot zero's
+ * listeners here.
+ */
+static void feed_master(confbridge *conf, const pj_int16_t *frame)
+{
+    const struct conf_graph *graph = conf->graph;
+    const struct graph_port *gp = &graph->ports[0];
+    struct conf_port *cport = gp->cport;
+    unsigned spf = conf->samples_per_frame;
+    const unsigned *edge, *end;
+
+    if (cport->rx_setting != PJMEDIA_PORT_ENABLE || gp->listener_cnt == 0)
+	return;
+
+    ++cport->rx_frame_cnt;
+    ++cport->rx_silent_cnt;
+    cport->rx_silent = PJ_TRUE;
+
+    if (!frame)
+	return;
+
+    pj_memcpy(cport->rx_frame, frame, spf * 2);
+    if (!accept_rx_frame(conf, gp))
+	return;
+
+    edge = graph->edges + gp->first_edge;
+    end = edge + gp->listener_cnt;
+    for (; edge != end; ++edge) {
+	struct conf_port *listener = graph->ports[*edge].cport;
+
+	pj_uint64_t t0;
+
+	if (listener->tx_setting != PJMEDIA_PORT_ENABLE)
+	    continue;
+
+	t0 = stat_begin(listener);
+	if (listener->mix_cnt++ == 0)
+	    pj_bzero(listener->mix_buf, spf * sizeof(listener->mix_buf[0]));
+	conf->mix->accum(listener->mix_buf, cport->rx_frame, spf);
+	if (listener->stats)
+	    listener->mix_ts += STAT_TS() - t0;
+    }
+}
+
+
+/*
+ * Mix the received frames. Worker w of n accumulates the frames into the
+ * listeners whose graph index modulo n is w, and its share of the samples
+ * of the shared mix, so the workers never write to the same buffer. The
+ * 32bit sums don't depend on the order of accumulation, so the result is
+ * the same for any number of workers. Only the ports somebody listens to
+ * are visited, so idle ports and empty slots cost nothing here.
+ */
+static void mix_ports(confbridge *conf, unsigned w, unsigned n)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned spf = conf->samples_per_frame;
+    unsigned sum_off = spf * w / n;
+    unsigned sum_len = spf * (w+1) / n - sum_off;
+    unsigned i, sum_cnt = 0;
+
+    for (i=0; i<graph->src_cnt; ++i) {
+	const struct graph_port *gp = &graph->ports[graph->srcs[i]];
+	struct conf_port *cport = gp->cport;
+	const unsigned *edge, *end;
+
+	if (!cport->rx_ok)
+	    continue;
+
+	if (cport->in_sum) {
+	    if (sum_cnt++ == 0) {
+		pj_bzero(conf->sum_buf + sum_off,
+			 sum_len * sizeof(conf->sum_buf[0]));
+	    }
+	    conf->mix->accum(conf->sum_buf + sum_off,
+			     cport->rx_frame + sum_off, sum_len);
+	    continue;
+	}
+
+	/* Mix the frame into the listeners' mix buffer. */
+	edge = graph->edges + gp->first_edge;
+	end = edge + gp->listener_cnt;
+	for (; edge != end; ++edge) {
+	    struct conf_port *listener;
+	    pj_uint64_t t0;
+
+	    if (n > 1 && *edge % n != w)
+		continue;
+
+	    listener = graph->ports[*edge].cport;
+	    if (listener->tx_setting != PJMEDIA_PORT_ENABLE)
+		continue;
+
+	    t0 = stat_begin(listener);
+	    if (listener->mix_cnt++ == 0) {
+		pj_bzero(listener->mix_buf,
+			 spf * sizeof(listener->mix_buf[0]));
+	    }
+	    conf->mix->accum(listener->mix_buf, cport->rx_frame, spf);
+	    if (listener->stats)
+		listener->mix_ts += STAT_TS() - t0;
+	}
+    }
+
+    /* Every worker counts the same, one of them publishes it. */
+    if (w == 0)
+	conf->sum_cnt = sum_cnt;
+}
+
+
+/*
+ * Convert the mix buffer of the port to a frame. Returns PJ_FALSE when
+ * nothing was mixed for the port in this tick.
+ */
+static pj_bool_t mix_port(confbridge *conf, const struct graph_port *gp)
+{
+    struct conf_port *cport = gp->cport;
+    const pj_int32_t *mix = cport->mix_buf;
+    conf_mix_level level;
+    pj_bool_t has_sum;
+
+    cport->tx_level = cport->tx_peak = cport->tx_rms = 0;
+
+    /* Ports which are not read keep no stale rx level. */
+    if (gp->listener_cnt == 0) {
+	cport->rx_level = cport->rx_peak = cport->rx_rms = 0;
+	cport->speaker_level = 0;
+	cport->active_speaker = PJ_FALSE;
+    }
+
+    /* The shared mix goes to every port with a transmitter. It contains
+     * the port's own frame when the port is in it, so it only carries
+     * audio for us if someone else is in it too.
+     */
+    has_sum = (gp->transmitter_cnt &&
+	       conf->sum_cnt > (cport->in_sum ? 1u : 0u));
+
+    if (cport->tx_setting != PJMEDIA_PORT_ENABLE ||
+	(cport->mix_cnt == 0 && !has_sum))
+    {
+	cport->mix_cnt = 0;
+	cport->rx_ok = cport->in_sum = PJ_FALSE;
+	return PJ_FALSE;
+    }
+
+    if (has_sum) {
+	if (cport->mix_cnt)
+	    conf->mix->accum32(cport->mix_buf, conf->sum_buf,
+			       conf->samples_per_frame);
+	else
+	    mix = conf->sum_buf;
+    }
+
+    if (has_sum && cport->in_sum) {
+	conf->mix->clip_sub(cport->tx_frame, mix, cport->rx_frame,
+			    conf->samples_per_frame,
+			    gp->tx_adj_level, &level);
+    } else {
+	conf->mix->clip(cport->tx_frame, mix, conf->samples_per_frame,
+			gp->tx_adj_level, &level);
+    }
+    cport->tx_level = level_to_ulaw(&level, conf->samples_per_frame);
+    cport->tx_peak = level.peak;
+    if ((conf->degrade & CONFBRIDGE_DEGRADE_LEVELS) == 0)
+	cport->tx_rms = level_to_rms(&level, conf->samples_per_frame);
+
+    /* Only the sources are read in the next tick, clear the state of the
+     * frame we've read here.
+     */
+    cport->mix_cnt = 0;
+    cport->rx_ok = cport->in_sum = PJ_FALSE;
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Write the mixed frame to the port.
+ */
+static void write_port(confbridge *conf, const struct graph_port *gp)
+{
+    struct conf_port *cport = gp->cport;
+    pjmedia_frame frame;
+
+    pj_uint64_t t0;
+
+    /* Finish the sub-bridge's tick with what we transmit to it */
+    if (cport->sub) {
+	pj_bool_t has_frame;
+
+	if (!cport->sub_mixed)
+	    tick_mix(cport->sub);
+	cport->sub_mixed = PJ_FALSE;
+
+	t0 = stat_begin(cport);
+	has_frame = mix_port(conf, gp);
+	if (has_frame)
+	    stat_mix(cport, t0);
+
+	t0 = stat_begin(cport);
+	tick_write(cport->sub, has_frame ? cport->tx_frame : NULL);
+	stat_end(cport, CONFBRIDGE_STAT_PUT_FRAME, t0);
+	return;
+    }
+
+    pj_bzero(&frame, sizeof(frame));
+
+    t0 = stat_begin(cport);
+    if (!mix_port(conf, gp)) {
+	if (cport->tx_setting != PJMEDIA_PORT_ENABLE)
+	    return;
+
+	if (gp->transmitter_cnt) {
+	    /* All transmitters are silent, give the port the shared
+	     * silence frame. Ports must not modify the frame they get.
+	     */
+	    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	    frame.buf = conf->silence_buf;
+	    frame.size = cport->samples_per_frame * 2;
+	} else {
+	    frame.type = PJMEDIA_FRAME_TYPE_NONE;
+	}
+
+	t0 = stat_begin(cport);
+	pjmedia_port_put_frame(cport->port, &frame);
+	stat_end(cport, CONFBRIDGE_STAT_PUT_FRAME, t0);
+	return;
+    }
+
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    if (cport->tx_resample) {
+	conf_resample_run(cport->tx_resample, cport->tx_frame,
+			  cport->port_buf);
+	frame.buf = cport->port_buf;
+    } else {
+	frame.buf = cport->tx_frame;
+    }
+    frame.size = cport->samples_per_frame * 2;
+    stat_mix(cport, t0);
+
+    t0 = stat_begin(cport);
+    pjmedia_port_put_frame(cport->port, &frame);
+    stat_end(cport, CONFBRIDGE_STAT_PUT_FRAME, t0);
+}
+
+
+/*
+ * Select the active speakers among the sources read in this tick, and
+ * drop the frames of the others from the mix. The sources are ranked by
+ * a smoothed level, plus a bonus for the current speakers (hysteresis).
+ * The scores are small integers, so a histogram finds the cut-off score
+ * in O(ports); ties at the cut-off go to the lower graph index.
+ */
+static void select_speakers(confbridge *conf)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned *hist = conf->speaker_hist;
+    unsigned i, score, cut, above, tie_cnt;
+
+    for (i=0; i<graph->src_cnt; ++i) {
+	struct conf_port *cport = graph->ports[graph->srcs[i]].cport;
+
+	cport->speaker_level = (cport->speaker_level * 3 +
+				cport->rx_level) / 4;
+    }
+
+    if (graph->src_cnt <= conf->speaker_limit) {
+	for (i=0; i<graph->src_cnt; ++i)
+	    graph->ports[graph->srcs[i]].cport->active_speaker = PJ_TRUE;
+	return;
+    }
+
+    pj_bzero(hist, sizeof(conf->speaker_hist));
+    for (i=0; i<graph->src_cnt; ++i) {
+	struct conf_port *cport = graph->ports[graph->srcs[i]].cport;
+
+	score = cport->speaker_level;
+	if (cport->active_speaker)
+	    score += CONFBRIDGE_SPEAKER_HYSTERESIS;
+	++hist[score];
+    }
+
+    /* Find the score of the last speaker which makes it. */
+    above = 0;
+    cut = PJ_ARRAY_SIZE(conf->speaker_hist);
+    while (cut > 0 && above + hist[cut-1] <= conf->speaker_limit)
+	above += hist[--cut];
+    if (cut > 0)
+	--cut;
+    tie_cnt = conf->speaker_limit - above;
+
+    for (i=0; i<graph->src_cnt; ++i) {
+	struct conf_port *cport = graph->ports[graph->srcs[i]].cport;
+	pj_bool_t active;
+
+	score = cport->speaker_level;
+	if (cport->active_speaker)
+	    score += CONFBRIDGE_SPEAKER_HYSTERESIS;
+
+	if (score > cut) {
+	    active = PJ_TRUE;
+	} else if (score == cut && tie_cnt) {
+	    active = PJ_TRUE;
+	    --tie_cnt;
+	} else {
+	    active = PJ_FALSE;
+	}
+
+	cport->active_speaker = active;
+	if (!active)
+	    cport->rx_ok = cport->in_sum = PJ_FALSE;
+    }
+}
+
+
+/*
+ * Write the port, keeping track of the slowest port of the tick for the
+ * watchdog.
+ */
+static void write_port_timed(confbridge *conf, struct conf_worker *worker,
+			     const struct graph_port *gp)
+{
+    struct conf_port *cport = gp->cport;
+    pj_uint64_t ts = STAT_TS();
+
+    write_port(conf, gp);
+
+    ts = STAT_TS() - ts + cport->tick_ts;
+    cport->tick_ts = 0;
+    if (ts > worker->slow_ts) {
+	worker->slow_ts = ts;
+	worker->slow_slot = gp->slot;
+    }
+}
+
+
+/*
+ * Run one phase of the tick for worker w.
+ */
+static void run_phase(confbridge *conf, unsigned w)
+{
+    const struct conf_graph *graph = conf->graph;
+    struct conf_worker *worker = &conf->workers[w];
+    unsigned n = conf->worker_cnt;
+    pj_bool_t timed = (conf->wd.budget != 0 && !conf->parent);
+    pj_timestamp t0, t1;
+    unsigned i;
+
+    pj_get_timestamp(&t0);
+
+    switch (conf->phase) {
+    case PHASE_READ:
+	worker->port_cnt = 0;
+	worker->slow_ts = 0;
+	for (i=w; i<graph->read_cnt; i+=n) {
+	    const struct graph_port *gp = &graph->ports[graph->srcs[i]];
+
+	    if (timed) {
+		pj_uint64_t ts = STAT_TS();
+
+		read_port(conf, gp);
+		gp->cport->tick_ts = STAT_TS() - ts;
+	    } else {
+		read_port(conf, gp);
+	    }
+	    ++worker->port_cnt;
+	}
+	break;
+    case PHASE_MIX:
+	mix_ports(conf, w, n);
+	break;
+    case PHASE_WRITE:
+	/* Slot zero's mix is handled by get_frame() */
+	for (i=(w ? w : n); i<graph->port_cnt; i+=n) {
+	    if (timed)
+		write_port_timed(conf, worker, &graph->ports[i]);
+	    else
+		write_port(conf, &graph->ports[i]);
+	}
+	break;
+    }
+
+    pj_get_timestamp(&t1);
+    worker->tick_busy += t1.u64 - t0.u64;
+}
+
+
+/*
+ * Run a phase on all workers and wait until all of them are done.
+ */
+static void run_tick_phase(confbridge *conf, enum tick_phase phase)
+{
+    unsigned i;
+
+    conf->phase = phase;
+
+    for (i=1; i<conf->worker_cnt; ++i)
+	pj_sem_post(conf->workers[i].sem);
+
+    run_phase(conf, 0);
+
+    for (i=1; i<conf->worker_cnt; ++i)
+	pj_sem_wait(conf->done_sem);
+}
+
+
+/*
+ * Worker thread.
+ */
+static int worker_thread(void *arg)
+{
+    struct conf_worker *worker = (struct conf_worker*) arg;
+    confbridge *conf = worker->conf;
+
+    for (;;) {
+	pj_sem_wait(worker->sem);
+	if (conf->quit_workers)
+	    break;
+
+	run_phase(conf, worker->index);
+	pj_sem_post(conf->done_sem);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Stop the worker threads, the bridge must be locked or idle.
+ */
+static void stop_workers(confbridge *conf)
+{
+    unsigned i;
+
+    conf->quit_workers = PJ_TRUE;
+
+    for (i=1; i<conf->worker_cnt; ++i) {
+	struct conf_worker *worker = &conf->workers[i];
+
+	if (!worker->thread)
+	    continue;
+
+	pj_sem_post(worker->sem);
+	pj_thread_join(worker->thread);
+	pj_thread_destroy(worker->thread);
+	worker->thread = NULL;
+    }
+
+    conf->quit_workers = PJ_FALSE;
+    conf->worker_cnt = 1;
+}
+
+
+/* Reset the load statistics of the workers. */
+static void reset_worker_stat(confbridge *conf)
+{
+    unsigned i;
+
+    for (i=0; i<CONFBRIDGE_MAX_WORKERS; ++i) {
+	struct conf_worker *worker = &conf->workers[i];
+
+	worker->port_cnt = 0;
+	worker->tick_busy = 0;
+	worker->ticks = 0;
+	worker->last_usec = 0;
+	worker->max_usec = 0;
+	worker->total_usec = 0;
+    }
+}
+
+
+/*
+ * Set the number of mixing workers.
+ */
+pj_status_t confbridge_set_worker_count(confbridge *conf, unsigned count)
+{
+    unsigned i;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(conf && count >= 1 && count <= CONFBRIDGE_MAX_WORKERS,
+		     PJ_EINVAL);
+
+    /* Holding the mutex guarantees that no tick is in progress. */
+    pj_mutex_lock(conf->mutex);
+
+    stop_workers(conf);
+    reset_worker_stat(conf);
+
+    if (count > 1 && !conf->done_sem) {
+	status = pj_sem_create(conf->pool, "confdone", 0,
+			       CONFBRIDGE_MAX_WORKERS, &conf->done_sem);
+	if (status != PJ_SUCCESS)
+	    goto on_return;
+    }
+
+    for (i=1; i<count; ++i) {
+	struct conf_worker *worker = &conf->workers[i];
+	char name[16];
+
+	if (!worker->sem) {
+	    status = pj_sem_create(conf->pool, "confwork", 0, 1,
+				   &worker->sem);
+	    if (status != PJ_SUCCESS)
+		break;
+	}
+
+	pj_ansi_snprintf(name, sizeof(name), "confwork%u", i);
+	status = pj_thread_create(conf->pool, name, &worker_thread, worker,
+				  0, 0, &worker->thread);
+	if (status != PJ_SUCCESS)
+	    break;
+
+	conf->worker_cnt = i + 1;
+    }
+
+    if (status != PJ_SUCCESS) {
+	PJ_LOG(3,(THIS_FILE, "Unable to create mixing worker thread, "
+		  "using %u worker(s)", conf->worker_cnt));
+    } else {
+	PJ_LOG(4,(THIS_FILE, "Conference bridge mixing with %u worker(s)",
+		  conf->worker_cnt));
+    }
+
+on_return:
+    pj_mutex_unlock(conf->mutex);
+    return status;
+}
+
+
+/*
+ * Get the number of mixing workers.
+ */
+unsigned confbridge_get_worker_count(confbridge *conf)
+{
+    PJ_ASSERT_RETURN(conf != NULL, 0);
+    return conf->worker_cnt;
+}
+
+
+/*
+ * Get the load statistics of the workers.
+ */
+pj_status_t confbridge_get_worker_info(confbridge *conf,
+				       unsigned *count,
+				       confbridge_worker_info info[])
+{
+    unsigned i, ptime_usec;
+
+    PJ_ASSERT_RETURN(conf && count && info, PJ_EINVAL);
+
+    ptime_usec = (unsigned)((pj_uint64_t)conf->samples_per_frame * 1000000 /
+			    conf->clock_rate / conf->channel_count);
+
+    pj_mutex_lock(conf->mutex);
+
+    for (i=0; i<conf->worker_cnt && i<*count; ++i) {
+	const struct conf_worker *worker = &conf->workers[i];
+	confbridge_worker_info *wi = &info[i];
+
+	pj_bzero(wi, sizeof(*wi));
+	wi->index = i;
+	wi->port_cnt = worker->port_cnt;
+	wi->ticks = worker->ticks;
+	wi->last_usec = worker->last_usec;
+	wi->max_usec = worker->max_usec;
+	if (worker->ticks) {
+	    wi->avg_usec = (pj_uint32_t)(worker->total_usec / worker->ticks);
+	    wi->load = wi->avg_usec * 100 / ptime_usec;
+	}
+    }
+    *count = i;
+
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Publish the levels of this tick, only the clock thread writes them.
+ * Readers copy the snapshot and retry if the sequence number changed
+ * meanwhile, so they never wait for the mixer nor make it wait.
+ */
+static void publish_levels(confbridge *conf)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned i, seq = conf->level_seq;
+
+    SEQ_STORE(&conf->level_seq, seq + 1);
+    SEQ_FENCE_REL();
+
+    ++conf->tick;
+    for (i=0; i<graph->port_cnt; ++i) {
+	const struct conf_port *cport = graph->ports[i].cport;
+	confbridge_level *lvl = &conf->levels[graph->ports[i].slot];
+
+	lvl->tick = conf->tick;
+	lvl->rx_level = cport->rx_level;
+	lvl->tx_level = cport->tx_level;
+	lvl->rx_peak = cport->rx_peak;
+	lvl->rx_rms = cport->rx_rms;
+	lvl->tx_peak = cport->tx_peak;
+	lvl->tx_rms = cport->tx_rms;
+    }
+
+    SEQ_STORE(&conf->level_seq, seq + 2);
+}
+
+
+/*
+ * Get the levels of the last tick, without locking.
+ */
+pj_status_t confbridge_get_levels(confbridge *conf,
+				  unsigned count,
+				  const unsigned slots[],
+				  confbridge_level levels[],
+				  pj_uint32_t *tick)
+{
+    unsigned i, seq;
+
+    PJ_ASSERT_RETURN(conf && (count == 0 || (slots && levels)), PJ_EINVAL);
+
+    for (i=0; i<count; ++i) {
+	PJ_ASSERT_RETURN(slots[i] < conf->max_ports, PJ_EINVAL);
+    }
+
+    do {
+	while ((seq = SEQ_LOAD(&conf->level_seq)) & 1)
+	    ;
+
+	for (i=0; i<count; ++i)
+	    levels[i] = conf->levels[slots[i]];
+	if (tick)
+	    *tick = conf->tick;
+
+	SEQ_FENCE_ACQ();
+    } while (SEQ_LOAD(&conf->level_seq) != seq);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Subscribe to level updates.
+ */
+pj_status_t confbridge_subscribe_levels(confbridge *conf,
+					confbridge_level_cb cb,
+					void *user_data)
+{
+    PJ_ASSERT_RETURN(conf && cb, PJ_EINVAL);
+
+    pj_mutex_lock(conf->mutex);
+
+    if (conf->level_sub_cnt == MAX_LEVEL_SUBS) {
+	pj_mutex_unlock(conf->mutex);
+	return PJ_ETOOMANY;
+    }
+
+    conf->level_subs[conf->level_sub_cnt].cb = cb;
+    conf->level_subs[conf->level_sub_cnt].user_data = user_data;
+    ++conf->level_sub_cnt;
+
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Unsubscribe from level updates.
+ */
+pj_status_t confbridge_unsubscribe_levels(confbridge *conf,
+					  confbridge_level_cb cb,
+					  void *user_data)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(conf && cb, PJ_EINVAL);
+
+    /* The callbacks run with the mutex held, none is called after we
+     * return.
+     */
+    pj_mutex_lock(conf->mutex);
+
+    for (i=0; i<conf->level_sub_cnt; ++i) {
+	if (conf->level_subs[i].cb == cb &&
+	    conf->level_subs[i].user_data == user_data)
+	{
+	    break;
+	}
+    }
+
+    if (i == conf->level_sub_cnt) {
+	pj_mutex_unlock(conf->mutex);
+	return PJ_ENOTFOUND;
+    }
+
+    pj_array_erase(conf->level_subs, sizeof(conf->level_subs[0]),
+		   conf->level_sub_cnt, i);
+    --conf->level_sub_cnt;
+
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Give the frames read in this tick to the taps.
+ */
+static void run_taps(confbridge *conf)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned i;
+
+    for (i=0; i<graph->read_cnt; ++i) {
+	const struct graph_port *gp = &graph->ports[graph->srcs[i]];
+	confbridge_tap_frame *tf = &conf->tap_frames[i];
+
+	tf->slot = gp->slot;
+	tf->samples = gp->cport->rx_audio ? gp->cport->rx_frame : NULL;
+    }
+
+    /* The tick is numbered as in the levels published at its end */
+    for (i=0; i<conf->tap_cnt; ++i)
+	(*conf->taps[i].cb)(conf, conf->tick + 1, graph->read_cnt,
+			    conf->tap_frames, conf->taps[i].user_data);
+}
+
+
+/*
+ * Add a frame tap.
+ */
+pj_status_t confbridge_add_tap(confbridge *conf,
+			       unsigned slot_cnt,
+			       const unsigned slots[],
+			       confbridge_tap_cb cb,
+			       void *user_data)
+{
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(conf && cb && (slot_cnt == 0 || slots), PJ_EINVAL);
+
+    for (i=0; i<slot_cnt; ++i) {
+	PJ_ASSERT_RETURN(slots[i] < conf->max_ports, PJ_EINVAL);
+    }
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    if (conf->tap_cnt == MAX_TAPS) {
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_ETOOMANY;
+    }
+
+    /* Have the slots read from the next tick on */
+    for (i=0; i<slot_cnt; ++i)
+	++conf->tapped[slots[i]];
+    status = publish_graph(conf);
+    if (status != PJ_SUCCESS) {
+	for (i=0; i<slot_cnt; ++i)
+	    --conf->tapped[slots[i]];
+	pj_mutex_unlock(conf->ctl_mutex);
+	return status;
+    }
+
+    pj_mutex_lock(conf->mutex);
+    conf->taps[conf->tap_cnt].cb = cb;
+    conf->taps[conf->tap_cnt].user_data = user_data;
+    conf->taps[conf->tap_cnt].slot_cnt = slot_cnt;
+    conf->taps[conf->tap_cnt].slots = slots;
+    ++conf->tap_cnt;
+    apply_pending_graph(conf);
+    pj_mutex_unlock(conf->mutex);
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Remove a frame tap.
+ */
+pj_status_t confbridge_remove_tap(confbridge *conf,
+				  confbridge_tap_cb cb,
+				  void *user_data)
+{
+    unsigned i, slot_cnt;
+    const unsigned *slots;
+
+    PJ_ASSERT_RETURN(conf && cb, PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* The taps run with the mutex held, none is called after we return */
+    pj_mutex_lock(conf->mutex);
+
+    for (i=0; i<conf->tap_cnt; ++i) {
+	if (conf->taps[i].cb == cb && conf->taps[i].user_data == user_data)
+	    break;
+    }
+
+    if (i == conf->tap_cnt) {
+	pj_mutex_unlock(conf->mutex);
+	pj_mutex_unlock(conf->ctl_mutex);
+	return PJ_ENOTFOUND;
+    }
+
+    slot_cnt = conf->taps[i].slot_cnt;
+    slots = conf->taps[i].slots;
+    pj_array_erase(conf->taps, sizeof(conf->taps[0]), conf->tap_cnt, i);
+    --conf->tap_cnt;
+
+    pj_mutex_unlock(conf->mutex);
+
+    /* Stop reading the slots nobody else wants. Should the new graph
+     * fail, the old one only reads a few ports more than needed.
+     */
+    for (i=0; i<slot_cnt; ++i)
+	--conf->tapped[slots[i]];
+    publish_graph(conf);
+
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Set the resampling quality of the ports. Bridge mutex must be held.
+ * Ports added afterwards get the configured quality.
+ */
+static void set_resample_quality(confbridge *conf,
+				 conf_resample_quality quality)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned i;
+
+    for (i=0; i<graph->port_cnt; ++i) {
+	struct conf_port *cport = graph->ports[i].cport;
+
+	if (cport->rx_resample)
+	    conf_resample_set_quality(cport->rx_resample, quality);
+	if (cport->tx_resample)
+	    conf_resample_set_quality(cport->tx_resample, quality);
+    }
+}
+
+
+/*
+ * Put the degradation steps into effect. Bridge mutex must be held.
+ */
+static void set_degrade(confbridge *conf, unsigned degrade)
+{
+    unsigned changed = conf->degrade ^ degrade;
+
+    conf->degrade = degrade;
+
+    if (changed & CONFBRIDGE_DEGRADE_RESAMPLE) {
+	set_resample_quality(conf, (degrade & CONFBRIDGE_DEGRADE_RESAMPLE) ?
+				   CONF_RESAMPLE_LINEAR :
+				   conf->resample_quality);
+    }
+    if (changed & CONFBRIDGE_DEGRADE_SPEAKERS)
+	update_speaker_limit(conf);
+}
+
+
+/*
+ * Take the next allowed degradation step, or undo the last one.
+ */
+static void degrade_step(confbridge *conf, pj_bool_t more)
+{
+    static const struct {
+	unsigned    step;
+	const char *name;
+    } steps[] = {
+	{ CONFBRIDGE_DEGRADE_LEVELS,	"metering" },
+	{ CONFBRIDGE_DEGRADE_RESAMPLE,	"resampling quality" },
+	{ CONFBRIDGE_DEGRADE_SPEAKERS,	"mixing all speakers" }
+    };
+    int i;
+
+    if (more) {
+	for (i=0; i<(int)PJ_ARRAY_SIZE(steps); ++i) {
+	    unsigned step = steps[i].step;
+
+	    if ((conf->wd.param.degrade & step) && !(conf->degrade & step)) {
+		set_degrade(conf, conf->degrade | step);
+		++conf->wd.degrade_cnt;
+		PJ_LOG(3,(THIS_FILE, "Bridge ticks overrun, giving up %s",
+			  steps[i].name));
+		return;
+	    }
+	}
+    } else {
+	for (i=PJ_ARRAY_SIZE(steps)-1; i>=0; --i) {
+	    unsigned step = steps[i].step;
+
+	    if (conf->degrade & step) {
+		set_degrade(conf, conf->degrade & ~step);
+		PJ_LOG(4,(THIS_FILE, "Bridge ticks fit again, restoring %s",
+			  steps[i].name));
+		return;
+	    }
+	}
+    }
+}
+
+
+/*
+ * Check the duration of the tick which just ended against its budget,
+ * and degrade or restore the mix accordingly.
+ */
+static void watch_tick(confbridge *conf, pj_uint64_t elapsed)
+{
+    struct conf_watchdog *wd = &conf->wd;
+
+    ++wd->ticks;
+    wd->last = elapsed;
+
+    if (elapsed > wd->budget) {
+	pj_uint64_t late = elapsed - wd->budget;
+	unsigned i;
+
+	++wd->overrun_cnt;
+	wd->last_late = late;
+	wd->total_late += late;
+	if (late > wd->max_late)
+	    wd->max_late = late;
+
+	/* Blame the slowest port of all workers */
+	wd->slow_slot = -1;
+	wd->slow_ts = 0;
+	for (i=0; i<conf->worker_cnt; ++i) {
+	    const struct conf_worker *worker = &conf->workers[i];
+
+	    if (worker->slow_ts > wd->slow_ts) {
+		wd->slow_ts = worker->slow_ts;
+		wd->slow_slot = worker->slow_slot;
+	    }
+	}
+
+	PJ_LOG(5,(THIS_FILE, "Bridge tick %u overrun by %u usec, slowest "
+		  "port %d", conf->tick,
+		  (unsigned)(late * 1000000 / conf->ts_freq), wd->slow_slot));
+
+	wd->calm = 0;
+	if (wd->param.degrade && ++wd->strikes >= wd->param.trigger) {
+	    wd->strikes = 0;
+	    degrade_step(conf, PJ_TRUE);
+	}
+    } else if (elapsed < wd->recover) {
+	if (++wd->calm >= wd->param.recover_ticks) {
+	    wd->calm = 0;
+	    wd->strikes = 0;
+	    if (conf->degrade)
+		degrade_step(conf, PJ_FALSE);
+	}
+    } else {
+	wd->calm = 0;
+    }
+}
+
+
+/*
+ * Reset the watchdog for its current settings.
+ */
+static void init_watchdog(confbridge *conf)
+{
+    struct conf_watchdog *wd = &conf->wd;
+    pj_uint64_t ptime;
+
+    ptime = (pj_uint64_t)conf->samples_per_frame * conf->ts_freq /
+	    conf->clock_rate / conf->channel_count;
+
+    wd->budget = ptime * wd->param.budget / 100;
+    wd->recover = ptime * wd->param.recover_budget / 100;
+    wd->strikes = wd->calm = 0;
+    wd->ticks = wd->overrun_cnt = 0;
+    wd->last = wd->last_late = wd->max_late = wd->total_late = 0;
+    wd->slow_slot = -1;
+    wd->slow_ts = 0;
+    wd->degrade_cnt = 0;
+}
+
+
+void confbridge_watchdog_param_default(confbridge_watchdog_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->budget = 100;
+    param->speakers = 8;
+    param->trigger = 3;
+    param->recover_budget = 70;
+    param->recover_ticks = 500;
+}
+
+
+pj_status_t confbridge_set_watchdog(confbridge *conf,
+				    const confbridge_watchdog_param *param)
+{
+    PJ_ASSERT_RETURN(conf && param, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->trigger && param->recover_ticks, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->speakers ||
+		     !(param->degrade & CONFBRIDGE_DEGRADE_SPEAKERS),
+		     PJ_EINVAL);
+
+    pj_mutex_lock(conf->ctl_mutex);
+
+    /* The tick may switch the resamplers to linear from now on, have the
+     * tables ready. The ports being added check the parameters too.
+     */
+    if (param->degrade & CONFBRIDGE_DEGRADE_RESAMPLE) {
+	unsigned i;
+
+	for (i=0; i<conf->max_ports; ++i) {
+	    pj_status_t status;
+
+	    if (!conf->ports[i])
+		continue;
+	    status = prepare_linear(conf->ports[i]);
+	    if (status != PJ_SUCCESS) {
+		pj_mutex_unlock(conf->ctl_mutex);
+		return status;
+	    }
+	}
+    }
+
+    pj_mutex_lock(conf->mutex);
+
+    set_degrade(conf, 0);
+    conf->wd.param = *param;
+    init_watchdog(conf);
+
+    pj_mutex_unlock(conf->mutex);
+    pj_mutex_unlock(conf->ctl_mutex);
+
+    PJ_LOG(4,(THIS_FILE, "Tick watchdog set, budget %u%%, degradation "
+	      "steps 0x%x", param->budget, param->degrade));
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t confbridge_get_watchdog_info(confbridge *conf,
+					 confbridge_watchdog_info *info)
+{
+    const struct conf_watchdog *wd = &conf->wd;
+    pj_uint64_t freq;
+
+    PJ_ASSERT_RETURN(conf && info, PJ_EINVAL);
+
+    freq = stat_ts_freq(conf);
+
+    pj_mutex_lock(conf->mutex);
+
+    pj_bzero(info, sizeof(*info));
+    info->ticks = wd->ticks;
+    info->overrun_cnt = wd->overrun_cnt;
+    info->last_usec = (pj_uint32_t)(wd->last * 1000000 / conf->ts_freq);
+    info->last_late_usec = (pj_uint32_t)(wd->last_late * 1000000 /
+					 conf->ts_freq);
+    info->max_late_usec = (pj_uint32_t)(wd->max_late * 1000000 /
+					conf->ts_freq);
+    if (wd->overrun_cnt) {
+	info->avg_late_usec = (pj_uint32_t)(wd->total_late / wd->overrun_cnt *
+					    1000000 / conf->ts_freq);
+    }
+    info->slow_slot = wd->slow_slot;
+    info->slow_usec = (pj_uint32_t)(wd->slow_ts * 1000000 / freq);
+    info->degrade = conf->degrade;
+    info->degrade_cnt = wd->degrade_cnt;
+
+    pj_mutex_unlock(conf->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Lock the bridge and, recursively, its sub-bridges for a tick, and pick
+ * up the latest connection graphs at the frame boundary. Parents are
+ * always locked before their sub-bridges.
+ */
+static void lock_tick(confbridge *conf)
+{
+    const struct conf_graph *graph;
+    unsigned i;
+
+    pj_mutex_lock(conf->mutex);
+    apply_pending_graph(conf);
+
+    graph = conf->graph;
+    for (i=0; i<graph->sub_cnt; ++i)
+	lock_tick(graph->ports[graph->subs[i]].cport->sub);
+}
+
+
+static void unlock_tick(confbridge *conf)
+{
+    const struct conf_graph *graph = conf->graph;
+    unsigned i;
+
+    for (i=0; i<graph->sub_cnt; ++i)
+	unlock_tick(graph->ports[graph->subs[i]].cport->sub);
+    pj_mutex_unlock(conf->mutex);
+}
+
+
+/*
+ * First half of a tick: read the ports and mix them. Returns PJ_TRUE if
+ * there is a mix for slot zero in its tx_frame.
+ */
+static pj_bool_t tick_mix(confbridge *conf)
+{
+    struct conf_port *cport = conf->ports[0];
+    pj_uint64_t t0;
+
+    run_tick_phase(conf, PHASE_READ);
+    if (conf->tap_cnt)
+	run_taps(conf);
+    if (conf->speaker_limit)
+	select_speakers(conf);
+    run_tick_phase(conf, PHASE_MIX);
+
+    t0 = stat_begin(cport);
+    if (!mix_port(conf, &conf->graph->ports[0]))
+	return PJ_FALSE;
+    stat_mix(cport, t0);
+    return PJ_TRUE;
+}
+
+
+/*
+ * Second half of a tick: write the mix to the ports. A sub-bridge gets
+ * the frame its parent transmits to it for slot zero first.
+ */
+static void tick_write(confbridge *conf, const pj_int16_t *frame)
+{
+    unsigned i;
+
+    if (conf->parent)
+	feed_master(conf, frame);
+
+    run_tick_phase(conf, PHASE_WRITE);
+
+    /* Publish the levels and tell the subscribers, unless the watchdog
+     * told us to save the time.
+     */
+    if (conf->degrade & CONFBRIDGE_DEGRADE_LEVELS) {
+	++conf->tick;
+    } else {
+	publish_levels(conf);
+	for (i=0; i<conf->level_sub_cnt; ++i)
+	    (*conf->level_subs[i].cb)(conf, conf->tick,
+				      conf->level_subs[i].user_data);
+    }
+
+    /* Update worker load */
+    for (i=0; i<conf->worker_cnt; ++i) {
+	struct conf_worker *worker = &conf->workers[i];
+	pj_uint32_t usec;
+
+	usec = (pj_uint32_t)(worker->tick_busy * 1000000 / conf->ts_freq);
+	worker->tick_busy = 0;
+	worker->last_usec = usec;
+	if (usec > worker->max_usec)
+	    worker->max_usec = usec;
+	worker->total_usec += usec;
+	++worker->ticks;
+    }
+}
+
+
+/*
+ * Player callback: run one mixing tick. The tick runs in three phases,
+ * each one sharded across the workers and followed by a barrier: read
+ * all ports, mix them, then write the mix to the ports. Sub-bridges run
+ * their own phases from within our READ and WRITE phases.
+ */
+static pj_status_t get_frame(pjmedia_port *this_port,
+			     pjmedia_frame *frame)
+{
+    confbridge *conf = (confbridge*) this_port->port_data.pdata;
+    pj_timestamp t0, t1;
+
+    frame->size = conf->samples_per_frame * 2;
+
+    /* A sub-bridge is clocked by its parent */
+    if (conf->parent) {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	return PJ_EINVALIDOP;
+    }
+
+    /* Waiting for the lock counts toward the tick's deadline too */
+    pj_get_timestamp(&t0);
+    lock_tick(conf);
+
+    /* Slot zero's mix goes to the sound device */
+    if (tick_mix(conf)) {
+	pj_memcpy(frame->buf, conf->ports[0]->tx_frame,
+		  conf->samples_per_frame * 2);
+    } else {
+	pj_bzero(frame->buf, conf->samples_per_frame * 2);
+    }
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+
+    tick_write(conf, NULL);
+
+    if (conf->wd.budget) {
+	pj_get_timestamp(&t1);
+	watch_tick(conf, t1.u64 - t0.u64);
+    }
+
+    unlock_tick(conf);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Recorder callback: frame captured by the sound device.
+ */
+static pj_status_t put_frame(pjmedia_port *this_port,
+			     pjmedia_frame *frame)
+{
+    confbridge *conf = (confbridge*) this_port->port_data.pdata;
+    struct conf_port *port = conf->ports[0];
+
+    /* Skip if this port is muted/disabled or nobody listens to it. */
+    if (port->rx_setting != PJMEDIA_PORT_ENABLE || port->listener_cnt == 0)
+	return PJ_SUCCESS;
+
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+	return PJ_SUCCESS;
+
+    if (port->stats) {
+	pj_uint64_t t0 = STAT_TS();
+	pj_status_t status;
+
+	status = pjmedia_delay_buf_put(port->delay_buf,
+				       (pj_int16_t*)frame->buf);
+	stat_end(port, CONFBRIDGE_STAT_PUT_FRAME, t0);
+	SEQ_STORE(&port->rx_buf_puts, port->rx_buf_puts + 1);
+	return status;
+    }
+
+    return pjmedia_delay_buf_put(port->delay_buf, (pj_int16_t*)frame->buf);
+}
@@ -0,0 +1,804 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __CONFBRIDGE_H__
+#define __CONFBRIDGE_H__
+
+/**
+ * @file confbridge.h
+ * @brief Conference bridge used by the samples.
+ *
+ * This is an application level conference bridge with the same interface
+ * and behavior as pjmedia_conf (see pjmedia/conference.h): slot zero is
+ * the master port, which is connected to the sound device unless
+ * CONFBRIDGE_NO_DEVICE is specified, and each call to the master port's
+ * get_frame() runs one mixing tick. Unlike pjmedia_conf, the mixing
+ * internals live in this tree so they can be tuned by the samples.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque type for the conference bridge.
+ */
+typedef struct confbridge confbridge;
+
+/**
+ * Maximum number of mixing workers, see confbridge_set_worker_count().
+ */
+#ifndef CONFBRIDGE_MAX_WORKERS
+#   define CONFBRIDGE_MAX_WORKERS	16
+#endif
+
+/**
+ * Default silence level, see confbridge_set_silence_level(). Zero only
+ * treats frames without audio or with all samples zero as silent, which
+ * doesn't change the mix.
+ */
+#ifndef CONFBRIDGE_SILENCE_LEVEL
+#   define CONFBRIDGE_SILENCE_LEVEL	0
+#endif
+
+/**
+ * Level bonus of the active speakers when the sources are ranked, see
+ * confbridge_set_active_speakers(). A speaker is only replaced by one
+ * which is louder by more than this, in the 0-255 range of
+ * confbridge_get_signal_level().
+ */
+#ifndef CONFBRIDGE_SPEAKER_HYSTERESIS
+#   define CONFBRIDGE_SPEAKER_HYSTERESIS	12
+#endif
+
+/**
+ * Bridge options, can be combined.
+ */
+enum confbridge_option
+{
+    CONFBRIDGE_NO_MIC	    = 1,    /**< Disable audio streams from the
+					 microphone device.		    */
+    CONFBRIDGE_NO_DEVICE    = 2,    /**< Do not create sound device.	    */
+    CONFBRIDGE_SMALL_FILTER = 4,    /**< Use small filter table when
+					 resampling.			    */
+    CONFBRIDGE_USE_LINEAR   = 8,    /**< Use linear resampling instead of
+					 filter based.			    */
+    CONFBRIDGE_NO_SIMD	    = 16,   /**< Use the scalar mixing kernels
+					 even when the CPU supports SIMD.   */
+    CONFBRIDGE_MIX_ONCE	    = 32,   /**< Mix the ports which transmit to
+					 all other listening ports once
+					 per tick, and give each listener
+					 that mix minus its own frame.
+					 Output is identical, but an
+					 all-to-all conference costs O(N)
+					 instead of O(N^2).		    */
+    CONFBRIDGE_PORT_STATS   = 64    /**< Record per port latency
+					 histograms, see
+					 confbridge_get_ports_stats().	    */
+};
+
+/**
+ * Conference port info.
+ */
+typedef struct confbridge_port_info
+{
+    unsigned		slot;		    /**< Slot number.		    */
+    pj_str_t		name;		    /**< Port name.		    */
+    pjmedia_port_op	tx_setting;	    /**< Transmit settings.	    */
+    pjmedia_port_op	rx_setting;	    /**< Receive settings.	    */
+    unsigned		listener_cnt;	    /**< Number of listeners.	    */
+    unsigned	       *listener_slots;	    /**< Array of listeners.	    */
+    unsigned		transmitter_cnt;    /**< Number of transmitters.    */
+    unsigned		clock_rate;	    /**< Clock rate of the port.    */
+    unsigned		channel_count;	    /**< Number of channels.	    */
+    unsigned		samples_per_frame;  /**< Samples per frame	    */
+    unsigned		bits_per_sample;    /**< Bits per sample.	    */
+    int			tx_adj_level;	    /**< Tx level adjustment.	    */
+    int			rx_adj_level;	    /**< Rx level adjustment.	    */
+    pj_bool_t		rx_silent;	    /**< Last frame read from the
+						 port was silent.	    */
+    unsigned		rx_frame_cnt;	    /**< Frames read from the port. */
+    unsigned		rx_silent_cnt;	    /**< Frames read which were
+						 silent and not mixed.	    */
+    pj_bool_t		active_speaker;	    /**< Port is one of the active
+						 speakers being mixed.	    */
+    confbridge	       *sub_bridge;	    /**< Sub-bridge of the port, see
+						 confbridge_add_bridge().   */
+} confbridge_port_info;
+
+
+/**
+ * Signal levels of a port in one frame, see confbridge_get_levels().
+ */
+typedef struct confbridge_level
+{
+    unsigned		slot;		    /**< Slot number.		    */
+    pj_uint32_t		tick;		    /**< Frame the levels were
+						 measured in. Older than
+						 the current frame if the
+						 slot is empty.		    */
+    unsigned		rx_level;	    /**< Rx level, 0-255, same as
+						 the signal level.	    */
+    unsigned		tx_level;	    /**< Tx level, 0-255.	    */
+    unsigned		rx_peak;	    /**< Rx peak sample, 0-32767.   */
+    unsigned		rx_rms;		    /**< Rx RMS, 0-32767.	    */
+    unsigned		tx_peak;	    /**< Tx peak sample, 0-32767.   */
+    unsigned		tx_rms;		    /**< Tx RMS, 0-32767.	    */
+} confbridge_level;
+
+/**
+ * Callback called at the end of every frame, after the levels of the
+ * frame are published. It is called from the clock thread with the
+ * bridge mutex held, so it should only note the event (e.g. post a
+ * semaphore) and let its own thread call confbridge_get_levels().
+ *
+ * @param conf		    The conference bridge.
+ * @param tick		    The frame whose levels were just published.
+ * @param user_data	    User data given when subscribing.
+ */
+typedef void (*confbridge_level_cb)(confbridge *conf, pj_uint32_t tick,
+				    void *user_data);
+
+/**
+ * Frame received from a port in a tick, see confbridge_tap_cb.
+ */
+typedef struct confbridge_tap_frame
+{
+    unsigned		slot;		    /**< Slot number.		    */
+    const pj_int16_t   *samples;	    /**< The frame, at the clock
+						 rate and frame size of the
+						 bridge, after the rx level
+						 adjustment. NULL if the
+						 port gave no audio.	    */
+} confbridge_tap_frame;
+
+/**
+ * Callback called in every tick with the frames received from the ports,
+ * once they are all read and before they are mixed. The ports the bridge
+ * reads are given: those with listeners, then those without in the slot
+ * list of any tap. Frames too quiet to be mixed are given too; a port
+ * whose receive direction is disabled (see confbridge_configure_port()),
+ * or which gave no audio, is given with no samples. Empty slots are not
+ * given. It is called from the clock thread with the bridge mutex held,
+ * and the frames are only valid during the call, so it should only copy
+ * them out (e.g. into a ring) and leave anything slow to its own thread.
+ *
+ * @param conf		    The conference bridge.
+ * @param tick		    The frame, numbered as the levels published at
+ *			    its end.
+ * @param count		    Number of frames.
+ * @param frames	    The frames.
+ * @param user_data	    User data given when adding the tap.
+ */
+typedef void (*confbridge_tap_cb)(confbridge *conf, pj_uint32_t tick,
+				  unsigned count,
+				  const confbridge_tap_frame frames[],
+				  void *user_data);
+
+/**
+ * Load statistics of a mixing worker.
+ */
+typedef struct confbridge_worker_info
+{
+    unsigned		index;		    /**< Worker index, zero is the
+						 clock thread.		    */
+    unsigned		port_cnt;	    /**< Ports read by the worker.  */
+    unsigned		ticks;		    /**< Ticks since the worker
+						 count was set.		    */
+    pj_uint32_t		last_usec;	    /**< Busy time in last tick.    */
+    pj_uint32_t		avg_usec;	    /**< Average busy time per tick.*/
+    pj_uint32_t		max_usec;	    /**< Longest busy time.	    */
+    unsigned		load;		    /**< Average busy time, in
+						 percent of the frame time. */
+} confbridge_worker_info;
+
+
+/**
+ * Degradation steps of the tick watchdog, see confbridge_set_watchdog().
+ * While ticks keep overrunning their budget, the allowed steps are taken
+ * one at a time in this order, and undone in reverse order once the
+ * ticks fit again.
+ */
+typedef enum confbridge_degrade
+{
+    CONFBRIDGE_DEGRADE_LEVELS	= 1,	/**< Skip metering: no RMS, and no
+					     level snapshot or callbacks
+					     (confbridge_get_levels()).
+					     Silence detection and speaker
+					     ranking keep working.	    */
+    CONFBRIDGE_DEGRADE_RESAMPLE = 2,	/**< Resample with linear
+					     interpolation.		    */
+    CONFBRIDGE_DEGRADE_SPEAKERS = 4	/**< Mix only the loudest speakers,
+					     as confbridge_set_active_speakers()
+					     does.			    */
+} confbridge_degrade;
+
+/**
+ * Tick watchdog settings.
+ */
+typedef struct confbridge_watchdog_param
+{
+    unsigned		budget;		    /**< Tick budget, in percent of
+						 the frame time. Zero disables
+						 the watchdog. Default 100. */
+    unsigned		degrade;	    /**< Bitmask of the allowed
+						 #confbridge_degrade steps.
+						 Default zero: count only.  */
+    unsigned		speakers;	    /**< Speakers mixed with
+						 CONFBRIDGE_DEGRADE_SPEAKERS.
+						 Default 8.		    */
+    unsigned		trigger;	    /**< Overruns which take the
+						 next step. Default 3.	    */
+    unsigned		recover_budget;	    /**< A tick fits when it takes
+						 less than this, in percent of
+						 the frame time. Default 70.*/
+    unsigned		recover_ticks;	    /**< Consecutive fitting ticks
+						 which undo a step, and clear
+						 the overruns counted toward
+						 the next one. Default 500. */
+} confbridge_watchdog_param;
+
+/**
+ * Tick watchdog statistics.
+ */
+typedef struct confbridge_watchdog_info
+{
+    pj_uint32_t		ticks;		    /**< Ticks watched.		    */
+    pj_uint32_t		overrun_cnt;	    /**< Ticks over the budget.	    */
+    pj_uint32_t		last_usec;	    /**< Duration of the last tick. */
+    pj_uint32_t		last_late_usec;	    /**< Time over the budget of
+						 the last overrun.	    */
+    pj_uint32_t		avg_late_usec;	    /**< Average of the overruns.   */
+    pj_uint32_t		max_late_usec;	    /**< Largest overrun.	    */
+    int			slow_slot;	    /**< Slowest port of the last
+						 overrun tick, -1 if none.  */
+    pj_uint32_t		slow_usec;	    /**< Time spent on it, reading,
+						 mixing and writing.	    */
+    unsigned		degrade;	    /**< #confbridge_degrade steps
+						 in effect.		    */
+    unsigned		degrade_cnt;	    /**< Steps taken so far.	    */
+} confbridge_watchdog_info;
+
+
+/**
+ * Per port latency statistics, see confbridge_get_ports_stats().
+ */
+typedef enum confbridge_stat_type
+{
+    CONFBRIDGE_STAT_GET_FRAME,	    /**< Duration of the port's
+					 get_frame(). For a sub-bridge,
+					 the first half of its tick.	    */
+    CONFBRIDGE_STAT_PUT_FRAME,	    /**< Duration of the port's
+					 put_frame(). For slot zero, the
+					 sound device's put_frame() into
+					 the bridge; for a sub-bridge,
+					 the second half of its tick.	    */
+    CONFBRIDGE_STAT_MIX,	    /**< Time to mix the port's frame:
+					 accumulating its transmitters,
+					 clipping and resampling.	    */
+    CONFBRIDGE_STAT_RX_BUF,	    /**< Audio waiting in the capture
+					 buffer of slot zero when a frame
+					 is taken from it.		    */
+    CONFBRIDGE_STAT_COUNT	    /**< Number of statistics.		    */
+} confbridge_stat_type;
+
+/**
+ * Distribution of one statistic. Values are in nanoseconds; percentiles
+ * are the upper bound of the histogram bucket they fall in, which is
+ * within 25% of the value.
+ */
+typedef struct confbridge_stat
+{
+    pj_uint32_t		count;		    /**< Number of samples.	    */
+    pj_uint32_t		p50;		    /**< Median.		    */
+    pj_uint32_t		p99;		    /**< 99th percentile.	    */
+    pj_uint32_t		max;		    /**< Largest value.		    */
+} confbridge_stat;
+
+/**
+ * Latency statistics of a port.
+ */
+typedef struct confbridge_port_stats
+{
+    unsigned		slot;		    /**< Slot number.		    */
+    confbridge_stat	stat[CONFBRIDGE_STAT_COUNT];
+					    /**< Indexed by
+						 #confbridge_stat_type.	    */
+} confbridge_port_stats;
+
+
+/**
+ * Operation in a batch update, see confbridge_update().
+ */
+typedef enum confbridge_op_type
+{
+    CONFBRIDGE_OP_CONNECT,	    /**< Connect slot to sink_slot.	    */
+    CONFBRIDGE_OP_DISCONNECT,	    /**< Disconnect slot from sink_slot.    */
+    CONFBRIDGE_OP_ADJUST_RX_LEVEL,  /**< Set rx level of slot.		    */
+    CONFBRIDGE_OP_ADJUST_TX_LEVEL   /**< Set tx level of slot.		    */
+} confbridge_op_type;
+
+/**
+ * Batch update operation.
+ */
+typedef struct confbridge_op
+{
+    confbridge_op_type	type;		    /**< Operation.		    */
+    unsigned		slot;		    /**< Source slot, or the slot
+						 to adjust.		    */
+    unsigned		sink_slot;	    /**< Sink slot (connect and
+						 disconnect only).	    */
+    int			level;		    /**< Level adjustment (-128 or
+						 more, adjust only).	    */
+} confbridge_op;
+
+
+/**
+ * Create conference bridge. The parameters are the same as
+ * pjmedia_conf_create().
+ *
+ * @param pool		    Pool to use to allocate the bridge and
+ *			    additional buffers for the sound device.
+ * @param max_slots	    Maximum number of slots/ports, including
+ *			    slot zero.
+ * @param clock_rate	    Set the sampling rate of the bridge.
+ * @param channel_count	    Number of channels in the PCM stream.
+ * @param samples_per_frame Set the number of samples per frame.
+ * @param bits_per_sample   Set the number of bits per sample, must be 16.
+ * @param options	    Bitmask of #confbridge_option.
+ * @param p_conf	    Pointer to receive the conference bridge instance.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_create(pj_pool_t *pool,
+			      unsigned max_slots,
+			      unsigned clock_rate,
+			      unsigned channel_count,
+			      unsigned samples_per_frame,
+			      unsigned bits_per_sample,
+			      unsigned options,
+			      confbridge **p_conf);
+
+/**
+ * Destroy conference bridge. Ports that were added to the bridge are not
+ * destroyed.
+ */
+pj_status_t confbridge_destroy(confbridge *conf);
+
+/**
+ * Get the master port (slot zero) of the bridge. When the bridge is
+ * created with CONFBRIDGE_NO_DEVICE, the application drives the bridge
+ * by calling get_frame()/put_frame() of this port, e.g. with
+ * pjmedia_master_port.
+ */
+pjmedia_port* confbridge_get_master_port(confbridge *conf);
+
+/**
+ * Add media port to the bridge. The port must have the same ptime and
+ * channel count as the bridge, the clock rate may differ.
+ *
+ * @param conf		    The conference bridge.
+ * @param pool		    Pool to allocate buffers for this port.
+ * @param strm_port	    Stream port interface.
+ * @param name		    Optional name, default is the port's name.
+ * @param p_slot	    Optional pointer to receive the slot index.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_add_port(confbridge *conf,
+				pj_pool_t *pool,
+				pjmedia_port *strm_port,
+				const pj_str_t *name,
+				unsigned *p_slot);
+
+/**
+ * Remove the specified port from the bridge, disconnecting it from all
+ * other ports. Unlike connect and disconnect, this waits for the current
+ * frame to finish, so the port is no longer used by the bridge when the
+ * function returns.
+ */
+pj_status_t confbridge_remove_port(confbridge *conf, unsigned slot);
+
+/**
+ * Cascade another bridge into this one. The sub-bridge appears in a slot
+ * of this bridge as a single port: what the sub-bridge's ports transmit
+ * to its slot zero is received from that port, and what this bridge
+ * transmits to that port is received by the sub-bridge's slot zero.
+ * Connect the sub-bridge's ports to and from its slot zero, as for the
+ * sound device of a standalone bridge.
+ *
+ * The sub-bridge is clocked by this bridge: both halves of its tick run
+ * within this bridge's tick, its mix is read before this bridge mixes
+ * and this bridge's mix is delivered before the sub-bridge writes to
+ * its ports. A cascade therefore adds neither latency nor buffering,
+ * and the bridges can't drift apart. Sub-bridges may be cascaded
+ * further.
+ *
+ * The sub-bridge must be created with CONFBRIDGE_NO_DEVICE and have the
+ * same clock rate, channel count and samples per frame as this bridge.
+ * Its master port must not be used while it is cascaded, and it must be
+ * removed with confbridge_remove_port() before it is destroyed. Slot
+ * zero of the sub-bridge is not subject to active speaker selection.
+ *
+ * @param conf		    The conference bridge.
+ * @param pool		    Pool to allocate buffers for this port.
+ * @param sub		    The bridge to cascade.
+ * @param name		    Optional name, default is the name of the
+ *			    sub-bridge's master port.
+ * @param p_slot	    Optional pointer to receive the slot index.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_add_bridge(confbridge *conf,
+				  pj_pool_t *pool,
+				  confbridge *sub,
+				  const pj_str_t *name,
+				  unsigned *p_slot);
+
+/**
+ * Enable/disable transmission and reception of the specified port.
+ */
+pj_status_t confbridge_configure_port(confbridge *conf,
+				      unsigned slot,
+				      pjmedia_port_op tx,
+				      pjmedia_port_op rx);
+
+/**
+ * Enable unidirectional audio from the source to the sink slot. The
+ * connection takes effect at the start of the next frame. Connecting and
+ * disconnecting don't wait for the mixer, and the mixer never waits for
+ * them: the mixer works on an immutable snapshot of the connections and
+ * picks up the new one at the frame boundary.
+ *
+ * @param conf		    The conference bridge.
+ * @param src_slot	    Source slot.
+ * @param sink_slot	    Sink slot.
+ * @param adj_level	    Reserved, must be zero.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_connect_port(confbridge *conf,
+				    unsigned src_slot,
+				    unsigned sink_slot,
+				    int adj_level);
+
+/**
+ * Disconnect unidirectional audio from the source to the sink slot. Like
+ * confbridge_connect_port(), this takes effect on the next frame.
+ */
+pj_status_t confbridge_disconnect_port(confbridge *conf,
+				       unsigned src_slot,
+				       unsigned sink_slot);
+
+/**
+ * Get number of ports currently registered to the bridge.
+ */
+unsigned confbridge_get_port_count(confbridge *conf);
+
+/**
+ * Get total number of connections in the bridge.
+ */
+unsigned confbridge_get_connect_count(confbridge *conf);
+
+/**
+ * Get port info.
+ */
+pj_status_t confbridge_get_port_info(confbridge *conf,
+				     unsigned slot,
+				     confbridge_port_info *info);
+
+/**
+ * Get occupied ports info.
+ *
+ * @param conf		    The conference bridge.
+ * @param size		    On input, the maximum number of elements in the
+ *			    array. On output, the number of elements filled.
+ * @param info		    Array of port info.
+ */
+pj_status_t confbridge_get_ports_info(confbridge *conf,
+				      unsigned *size,
+				      confbridge_port_info info[]);
+
+/**
+ * Get the latency statistics of the occupied ports. The bridge must have
+ * been created with CONFBRIDGE_PORT_STATS. Durations are measured with
+ * the CPU timestamp counter where available. The histograms are read
+ * while the bridge runs, so a statistic may miss the frame being
+ * recorded.
+ *
+ * @param conf		    The conference bridge.
+ * @param size		    On input, the maximum number of elements in the
+ *			    array. On output, the number of elements filled.
+ * @param stats		    Array of port statistics.
+ *
+ * @return		    PJ_SUCCESS on success, or PJ_EINVALIDOP if the
+ *			    statistics are not enabled.
+ */
+pj_status_t confbridge_get_ports_stats(confbridge *conf,
+				       unsigned *size,
+				       confbridge_port_stats stats[]);
+
+/**
+ * Clear the latency statistics of all ports.
+ *
+ * @param conf		    The conference bridge.
+ *
+ * @return		    PJ_SUCCESS on success, or PJ_EINVALIDOP if the
+ *			    statistics are not enabled.
+ */
+pj_status_t confbridge_reset_ports_stats(confbridge *conf);
+
+/**
+ * Get last signal level transmitted to and received from the port, in
+ * the same 0-255 range as pjmedia_conf_get_signal_level().
+ */
+pj_status_t confbridge_get_signal_level(confbridge *conf,
+					unsigned slot,
+					unsigned *tx_level,
+					unsigned *rx_level);
+
+/**
+ * Get the levels of the ports in the last frame. The mixer publishes
+ * the levels of all ports once per frame into a snapshot, and this
+ * function copies them out without taking any lock: it never waits for
+ * the mixer nor delays it, so many ports can be watched at frame rate.
+ * The levels returned are all from the same frame.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    Number of slots.
+ * @param slots		    The slots to get the levels of.
+ * @param levels	    Array to receive the levels, in the order of
+ *			    slots.
+ * @param tick		    Optional, receives the last frame number.
+ *			    Levels with an older tick are of empty slots.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_get_levels(confbridge *conf,
+				  unsigned count,
+				  const unsigned slots[],
+				  confbridge_level levels[],
+				  pj_uint32_t *tick);
+
+/**
+ * Get called at the end of every frame, once the levels are published.
+ * Up to 8 callbacks can be subscribed.
+ *
+ * @param conf		    The conference bridge.
+ * @param cb		    The callback.
+ * @param user_data	    User data passed to the callback.
+ *
+ * @return		    PJ_SUCCESS, or PJ_ETOOMANY.
+ */
+pj_status_t confbridge_subscribe_levels(confbridge *conf,
+					confbridge_level_cb cb,
+					void *user_data);
+
+/**
+ * Remove a subscription made with confbridge_subscribe_levels(). The
+ * callback is not called anymore once this returns.
+ *
+ * @return		    PJ_SUCCESS, or PJ_ENOTFOUND.
+ */
+pj_status_t confbridge_unsubscribe_levels(confbridge *conf,
+					  confbridge_level_cb cb,
+					  void *user_data);
+
+/**
+ * Get the frames received from the ports in every tick, see
+ * confbridge_tap_cb. The ports in the given slots are read whether
+ * anybody listens to them or not, including the ports added to these
+ * slots later. Up to 4 taps can be added.
+ *
+ * @param conf		    The conference bridge.
+ * @param slot_cnt	    Number of slots to read.
+ * @param slots		    The slots to read. The array must stay valid
+ *			    until the tap is removed.
+ * @param cb		    The callback.
+ * @param user_data	    User data passed to the callback.
+ *
+ * @return		    PJ_SUCCESS, or PJ_ETOOMANY.
+ */
+pj_status_t confbridge_add_tap(confbridge *conf,
+			       unsigned slot_cnt,
+			       const unsigned slots[],
+			       confbridge_tap_cb cb,
+			       void *user_data);
+
+/**
+ * Remove a tap added with confbridge_add_tap(). The callback is not
+ * called anymore once this returns.
+ *
+ * @return		    PJ_SUCCESS, or PJ_ENOTFOUND.
+ */
+pj_status_t confbridge_remove_tap(confbridge *conf,
+				  confbridge_tap_cb cb,
+				  void *user_data);
+
+/**
+ * Adjust the level of signal received from the port. Value zero leaves
+ * the signal unchanged, -128 mutes it, and positive values amplify it
+ * (+128 doubles the amplitude). The new level is used from the next
+ * frame on.
+ */
+pj_status_t confbridge_adjust_rx_level(confbridge *conf,
+				       unsigned slot,
+				       int adj_level);
+
+/**
+ * Adjust the level of signal transmitted to the port, see
+ * confbridge_adjust_rx_level().
+ */
+pj_status_t confbridge_adjust_tx_level(confbridge *conf,
+				       unsigned slot,
+				       int adj_level);
+
+/**
+ * Set the silence level. A frame read from a port is silent when the
+ * port returns no audio (e.g. PJMEDIA_FRAME_TYPE_NONE from a port with
+ * VAD), when all its samples are zero, or when its level (after rx level
+ * adjustment, in the range of confbridge_get_signal_level()) is below
+ * the silence level. Silent frames are not mixed at all, and a port
+ * whose transmitters are all silent gets a shared silence frame without
+ * any mixing or level adjustment.
+ *
+ * @param conf		    The conference bridge.
+ * @param level		    Silence level, 0-255. Zero, the default, skips
+ *			    only the frames which wouldn't change the mix.
+ */
+pj_status_t confbridge_set_silence_level(confbridge *conf, unsigned level);
+
+/**
+ * Get the silence level.
+ */
+unsigned confbridge_get_silence_level(confbridge *conf);
+
+/**
+ * Mix only the loudest sources. Every frame the ports somebody listens
+ * to are ranked by their smoothed rx level, with a bonus for the ones
+ * already selected so the selection doesn't flap between speakers of
+ * similar level, and only the top count are mixed into their listeners.
+ * A tick then costs O(ports + count * listeners) instead of
+ * O(ports * listeners), and the noise of the other ports is not added
+ * to the mix.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    Number of active speakers, zero (the default)
+ *			    mixes every source.
+ */
+pj_status_t confbridge_set_active_speakers(confbridge *conf,
+					   unsigned count);
+
+/**
+ * Get the slots of the active speakers selected in the last frame.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    On input, the maximum number of elements in the
+ *			    array. On output, the number of elements filled.
+ * @param slots		    Array of slots, ordered by slot number.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_get_active_speakers(confbridge *conf,
+					   unsigned *count,
+					   unsigned slots[]);
+
+/**
+ * Apply a batch of connect, disconnect and level operations atomically:
+ * the mixer sees either none or all of them, starting on the same frame,
+ * so listeners never hear a partly applied layout. Operations are applied
+ * in order, connecting ports which are already connected and
+ * disconnecting ports which are not are no-ops, like the single
+ * operations. The cost is one pass over the operations plus one over the
+ * connections, regardless of the batch size.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    Number of operations.
+ * @param ops		    The operations.
+ *
+ * @return		    PJ_SUCCESS on success. If an operation refers to
+ *			    an invalid slot or level, PJ_EINVAL is returned
+ *			    and nothing is changed.
+ */
+pj_status_t confbridge_update(confbridge *conf,
+			      unsigned count,
+			      const confbridge_op ops[]);
+
+/**
+ * Set the number of mixing workers. With one worker (the default) the
+ * whole tick runs in the thread which calls the master port's
+ * get_frame(). With more workers, count-1 threads are started and the
+ * ports are shared between them by slot number: reading frames from the
+ * ports, mixing them and writing the mix back run in parallel, with a
+ * barrier between the steps. The output is identical to the single
+ * threaded bridge, but the ports' get_frame() and put_frame() may be
+ * called from the worker threads.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    Number of workers, 1 to CONFBRIDGE_MAX_WORKERS.
+ *
+ * @return		    PJ_SUCCESS on success. If a thread can't be
+ *			    created, the bridge keeps running with the
+ *			    workers created so far.
+ */
+pj_status_t confbridge_set_worker_count(confbridge *conf, unsigned count);
+
+/**
+ * Get the number of mixing workers.
+ */
+unsigned confbridge_get_worker_count(confbridge *conf);
+
+/**
+ * Get the load statistics of the mixing workers.
+ *
+ * @param conf		    The conference bridge.
+ * @param count		    On input, the maximum number of elements in the
+ *			    array. On output, the number of elements filled.
+ * @param info		    Array of worker info.
+ */
+pj_status_t confbridge_get_worker_info(confbridge *conf,
+				       unsigned *count,
+				       confbridge_worker_info info[]);
+
+/**
+ * Initialize the tick watchdog settings with the default values.
+ *
+ * @param param		    The settings.
+ */
+void confbridge_watchdog_param_default(confbridge_watchdog_param *param);
+
+/**
+ * Configure the tick watchdog. The watchdog measures every tick of the
+ * bridge, from the master port's get_frame() call to its return, and
+ * counts the ticks which take longer than the budget, along with the
+ * slowest port of each of them. With degradation steps allowed, it also
+ * trades quality for time under load, see #confbridge_degrade. The
+ * watchdog runs with the default settings from the creation of the
+ * bridge; cascaded bridges are measured as ports of their parent.
+ *
+ * Setting the watchdog undoes the steps in effect and resets the
+ * statistics.
+ *
+ * @param conf		    The conference bridge.
+ * @param param		    The settings.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_set_watchdog(confbridge *conf,
+				    const confbridge_watchdog_param *param);
+
+/**
+ * Get the tick watchdog statistics.
+ *
+ * @param conf		    The conference bridge.
+ * @param info		    The statistics.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t confbridge_get_watchdog_info(confbridge *conf,
+					 confbridge_watchdog_info *info);
+
+/**
+ * Get the name of the mixing kernels in use ("scalar", "sse2", "avx2").
+ */
+const char* confbridge_get_mix_impl(confbridge *conf);
+
+
+PJ_END_DECL
+
+#endif	/* __CONFBRIDGE_H__ */
@@ -26,12 +26,17 @@
 #include <stdio.h>
 
 #include "util.h"
+#include "confbridge.h"
+#include "conf_recorder.h"
+#include "async_writer.h"
+#include "mmap_player.h"
 
 /**
  * \page page_pjmedia_samples_confsample_c Samples: Using Conference Bridge
  *
  * Sample to mix multiple files in the conference bridge and play the
- * result to sound device.
+ * result to sound device. The bridge is the in-tree confbridge (see
+ * confbridge.h), which behaves like pjmedia_conf.
  *
  * This file is pjsip-apps/src/samples/confsample.c
  *
@@ -84,10 +89,21 @@ static const char *desc =
  */
 
 /* List the ports in the conference bridge */
-static void conf_list(pjmedia_conf *conf, pj_bool_t detail);
+static void conf_list(confbridge *conf, pj_bool_t detail);
 
 /* Display VU meter */
-static void monitor_level(pjmedia_conf *conf, int slot, int dir, int dur);
+static void monitor_level(confbridge *conf, pj_pool_t *pool, int slot,
+			  int dir, int dur);
+
+/* Apply a script of connect/disconnect/level operations */
+static void run_script(confbridge *conf, const char *filename);
+
+/* Show per port latency statistics */
+static void show_stats(confbridge *conf);
+
+/* Start or stop recording a track per port */
+static void toggle_multitrack(confbridge *conf, pj_pool_factory *pf,
+			      int port_count, int skip_slot);
 
 
 /* Show usage */
@@ -135,11 +151,12 @@ int main(int argc, char *argv[])
     pj_caching_pool cp;
     pjmedia_endpt *med_endpt;
     pj_pool_t *pool;
-    pjmedia_conf *conf;
+    confbridge *conf;
 
     int i, port_count, file_count;
     pjmedia_port **file_port;	/* Array of file ports */
     pjmedia_port *rec_port = NULL;  /* Wav writer port */
+    unsigned rec_slot = (unsigned)-1;
 
     char tmp[10];
     pj_status_t status;
@@ -180,35 +197,39 @@ int main(int argc, char *argv[])
     port_count = file_count + 1 + RECORDER;
 
     /* Create the conference bridge. 
-     * With default options (zero), the bridge will create an instance of
-     * sound capture and playback device and connect them to slot zero.
+     * The bridge will create an instance of sound capture and playback
+     * device and connect them to slot zero, and keep per port latency
+     * statistics for the 'p' menu.
      */
-    status = pjmedia_conf_create( pool,	    /* pool to use	    */
-				  port_count,/* number of ports	    */
-				  clock_rate,
-				  channel_count,
-				  samples_per_frame,
-				  bits_per_sample,
-				  0,	    /* options		    */
-				  &conf	    /* result		    */
-				  );
+    status = confbridge_create( pool,	    /* pool to use	    */
+				port_count,/* number of ports	    */
+				clock_rate,
+				channel_count,
+				samples_per_frame,
+				bits_per_sample,
+				CONFBRIDGE_PORT_STATS, /* options   */
+				&conf	    /* result		    */
+				);
     if (status != PJ_SUCCESS) {
 	app_perror(THIS_FILE, "Unable to create conference bridge", status);
 	return 1;
     }
 
 #if RECORDER
-    status = pjmedia_wav_writer_port_create(  pool, "confrecord.wav",
-					      clock_rate, channel_count,
-					      samples_per_frame, 
-					      bits_per_sample, 0, 0, 
-					      &rec_port);
+    /* The file is written from a thread of its own, the bridge clock
+     * only copies the mix into the writer's ring.
+     */
+    status = async_writer_create( pool, "confrecord.wav",
+				  clock_rate, channel_count,
+				  samples_per_frame, 
+				  bits_per_sample, 0, 0, 
+				  &rec_port);
     if (status != PJ_SUCCESS) {
 	app_perror(THIS_FILE, "Unable to create WAV writer", status);
 	return 1;
     }
 
-    pjmedia_conf_add_port(conf, pool, rec_port, NULL, NULL);
+    confbridge_add_port(conf, pool, rec_port, NULL, &rec_slot);
 #endif
 
 
@@ -217,8 +238,19 @@ int main(int argc, char *argv[])
 
     for (i=0; i<file_count; ++i) {
 
-	/* Load the WAV file to file port. */
-	status = pjmedia_wav_player_port_create( 
+	/* Map the WAV file to a file port, the bridge takes the frames
+	 * straight from the mapping. Other than 16 bit PCM files are read
+	 * by the pjmedia player.
+	 */
+	status = mmap_player_create(
+			pool,		    /* pool.	    */
+			argv[i+pj_optind],  /* filename	    */
+			0,		    /* use default ptime */
+			MMAP_PLAYER_ZERO_COPY, /* options   */
+			&file_port[i]	    /* result	    */
+			);
+	if (status == PJMEDIA_EWAVEUNSUPP) {
+	    status = pjmedia_wav_player_port_create( 
 			pool,		    /* pool.	    */
 			argv[i+pj_optind],  /* filename	    */
 			0,		    /* use default ptime */
@@ -226,6 +258,7 @@ int main(int argc, char *argv[])
 			0,		    /* buf size	    */
 			&file_port[i]	    /* result	    */
 			);
+	}
 	if (status != PJ_SUCCESS) {
 	    char title[80];
 	    pj_ansi_sprintf(title, "Unable to use %s", argv[i+pj_optind]);
@@ -235,12 +268,12 @@ int main(int argc, char *argv[])
 	}
 
 	/* Add the file port to conference bridge */
-	status = pjmedia_conf_add_port( conf,		/* The bridge	    */
-					pool,		/* pool		    */
-					file_port[i],	/* port to connect  */
-					NULL,		/* Use port's name  */
-					NULL		/* ptr for slot #   */
-					);
+	status = confbridge_add_port( conf,		/* The bridge	    */
+				      pool,		/* pool		    */
+				      file_port[i],	/* port to connect  */
+				      NULL,		/* Use port's name  */
+				      NULL		/* ptr for slot #   */
+				      );
 	if (status != PJ_SUCCESS) {
 	    app_perror(THIS_FILE, "Unable to add conference port", status);
 	    return 1;
@@ -281,6 +314,13 @@ int main(int argc, char *argv[])
 	puts("  t    Adjust signal level transmitted (tx) to a port");
 	puts("  r    Adjust signal level received (rx) from a port");
 	puts("  v    Display VU meter for a particular port");
+	puts("  w    Set number of mixing worker threads");
+	puts("  l    Set silence level (silent frames are not mixed)");
+	puts("  k    Mix only the K loudest speakers");
+	puts("  b    Apply a batch script of connect/disconnect/level changes");
+	puts("  p    Show per port latency (p50/p99/max)");
+	puts("  R    Reset latency statistics");
+	puts("  m    Start/stop recording a track per port");
 	puts("  q    Quit");
 	puts("");
 	
@@ -314,7 +354,7 @@ int main(int argc, char *argv[])
 		continue;
 	    }
 
-	    status = pjmedia_conf_connect_port(conf, src, dst, 0);
+	    status = confbridge_connect_port(conf, src, dst, 0);
 	    if (status != PJ_SUCCESS)
 		app_perror(THIS_FILE, "Error connecting port", status);
 	    
@@ -339,7 +379,7 @@ int main(int argc, char *argv[])
 		continue;
 	    }
 
-	    status = pjmedia_conf_disconnect_port(conf, src, dst);
+	    status = confbridge_disconnect_port(conf, src, dst);
 	    if (status != PJ_SUCCESS)
 		app_perror(THIS_FILE, "Error connecting port", status);
 	    
@@ -366,7 +406,7 @@ int main(int argc, char *argv[])
 		continue;
 	    }
 
-	    status = pjmedia_conf_adjust_tx_level( conf, src, level);
+	    status = confbridge_adjust_tx_level( conf, src, level);
 	    if (status != PJ_SUCCESS)
 		app_perror(THIS_FILE, "Error adjusting level", status);
 	    break;
@@ -392,7 +432,7 @@ int main(int argc, char *argv[])
 		continue;
 	    }
 
-	    status = pjmedia_conf_adjust_rx_level( conf, src, level);
+	    status = confbridge_adjust_rx_level( conf, src, level);
 	    if (status != PJ_SUCCESS)
 		app_perror(THIS_FILE, "Error adjusting level", status);
 	    break;
@@ -423,7 +463,95 @@ int main(int argc, char *argv[])
 		continue;
 	    }
 
-	    monitor_level(conf, src, tmp2[0], dur);
+	    monitor_level(conf, pool, src, tmp2[0], dur);
+	    break;
+
+	case 'w':
+	    puts("");
+	    puts("Set number of mixing worker threads");
+	    if (!input("Enter number of workers (1 for single threaded)",
+		       tmp1, sizeof(tmp1)) )
+		continue;
+	    src = strtol(tmp1, &err, 10);
+	    if (*err || src < 1 || src > CONFBRIDGE_MAX_WORKERS) {
+		printf("Invalid number, must be 1 to %d\n",
+		       CONFBRIDGE_MAX_WORKERS);
+		continue;
+	    }
+
+	    status = confbridge_set_worker_count(conf, src);
+	    if (status != PJ_SUCCESS)
+		app_perror(THIS_FILE, "Error creating worker threads", status);
+	    break;
+
+	case 'l':
+	    puts("");
+	    printf("Set silence level, currently %u\n",
+		   confbridge_get_silence_level(conf));
+	    if (!input("Enter level (0-255, 0 skips only all-zero frames)",
+		       tmp1, sizeof(tmp1)) )
+		continue;
+	    level = strtol(tmp1, &err, 10);
+	    if (*err || level < 0 || level > 255) {
+		puts("Invalid level");
+		continue;
+	    }
+
+	    status = confbridge_set_silence_level(conf, level);
+	    if (status != PJ_SUCCESS)
+		app_perror(THIS_FILE, "Error setting silence level", status);
+	    break;
+
+	case 'k':
+	    puts("");
+	    puts("Mix only the K loudest speakers");
+	    if (!input("Enter K (0 to mix every port)", tmp1, sizeof(tmp1)) )
+		continue;
+	    level = strtol(tmp1, &err, 10);
+	    if (*err || level < 0) {
+		puts("Invalid number");
+		continue;
+	    }
+
+	    status = confbridge_set_active_speakers(conf, level);
+	    if (status != PJ_SUCCESS)
+		app_perror(THIS_FILE, "Error setting active speakers", status);
+	    break;
+
+	case 'b':
+	    puts("");
+	    puts("Apply a batch script. Each line of the script is one of:");
+	    puts("  c SRC DST     connect port SRC to port DST");
+	    puts("  d SRC DST     disconnect port SRC from port DST");
+	    puts("  t PORT LEVEL  adjust transmit level of PORT");
+	    puts("  r PORT LEVEL  adjust receive level of PORT");
+	    puts("Empty lines and lines starting with '#' are ignored. All");
+	    puts("operations take effect together on the same frame.");
+	    {
+		char filename[256];
+
+		if (!input("Enter script file name", filename,
+			   sizeof(filename)))
+		{
+		    continue;
+		}
+		run_script(conf, filename);
+	    }
+	    break;
+
+	case 'p':
+	    puts("");
+	    show_stats(conf);
+	    break;
+
+	case 'R':
+	    confbridge_reset_ports_stats(conf);
+	    puts("Latency statistics reset");
+	    break;
+
+	case 'm':
+	    puts("");
+	    toggle_multitrack(conf, &cp.factory, port_count, (int)rec_slot);
 	    break;
 
 	case 'q':
@@ -439,8 +567,11 @@ on_quit:
     
     /* Start deinitialization: */
 
+    /* Stop the multi-track recording */
+    toggle_multitrack(conf, NULL, 0, -1);
+
     /* Destroy conference bridge */
-    status = pjmedia_conf_destroy( conf );
+    status = confbridge_destroy( conf );
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
 
@@ -474,28 +605,100 @@ on_quit:
 /*
  * List the ports in conference bridge
  */
-static void conf_list(pjmedia_conf *conf, int detail)
+static void conf_list(confbridge *conf, int detail)
 {
-    enum { MAX_PORTS = 32 };
     unsigned i, count;
-    pjmedia_conf_port_info info[MAX_PORTS];
+    confbridge_port_info *info;
 
     printf("Conference ports:\n");
+    if (detail) {
+	confbridge_worker_info winfo[CONFBRIDGE_MAX_WORKERS];
+	unsigned wcount = PJ_ARRAY_SIZE(winfo);
+	confbridge_watchdog_info wd;
+
+	printf("Mixing kernels: %s\n", confbridge_get_mix_impl(conf));
+
+	confbridge_get_worker_info(conf, &wcount, winfo);
+	printf("Mixing workers: %u\n", wcount);
+	for (i=0; i<wcount; ++i) {
+	    printf("  Worker #%u: %3u ports, load %3u%%, busy per tick "
+		   "last/avg/max %u/%u/%u usec\n",
+		   winfo[i].index, winfo[i].port_cnt, winfo[i].load,
+		   winfo[i].last_usec, winfo[i].avg_usec, winfo[i].max_usec);
+	}
+
+	confbridge_get_watchdog_info(conf, &wd);
+	printf("Tick overruns: %u of %u ticks, late last/avg/max "
+	       "%u/%u/%u usec\n", wd.overrun_cnt, wd.ticks,
+	       wd.last_late_usec, wd.avg_late_usec, wd.max_late_usec);
+	if (wd.slow_slot >= 0) {
+	    printf("  Slowest port of last overrun: #%d, %u usec\n",
+		   wd.slow_slot, wd.slow_usec);
+	}
+	if (wd.degrade_cnt) {
+	    printf("  Degraded %u times, now:%s%s%s%s\n", wd.degrade_cnt,
+		   wd.degrade ? "" : " none",
+		   (wd.degrade & CONFBRIDGE_DEGRADE_LEVELS) ? " no metering" :"",
+		   (wd.degrade & CONFBRIDGE_DEGRADE_RESAMPLE) ?
+			" linear resampling" : "",
+		   (wd.degrade & CONFBRIDGE_DEGRADE_SPEAKERS) ?
+			" loudest speakers only" : "");
+	}
+	puts("");
+    }
+
+    /* The bridge may have thousands of ports, size the lists by what's
+     * actually there.
+     */
+    count = confbridge_get_port_count(conf);
+    info = (confbridge_port_info*) malloc(count * sizeof(info[0]));
+    if (!info) {
+	puts("Error: not enough memory");
+	return;
+    }
+    confbridge_get_ports_info(conf, &count, info);
+
+    /* Show who is being mixed in the active speaker mode */
+    {
+	unsigned spk_cnt = 0;
+
+	for (i=0; i<count; ++i) {
+	    if (info[i].active_speaker) {
+		if (spk_cnt++ == 0)
+		    printf("Active speakers:");
+		printf(" #%d", info[i].slot);
+	    }
+	}
+	if (spk_cnt)
+	    printf("\n\n");
+    }
 
-    count = PJ_ARRAY_SIZE(info);
-    pjmedia_conf_get_ports_info(conf, &count, info);
+    if (detail) {
+	unsigned silent_cnt = 0;
+
+	for (i=0; i<count; ++i) {
+	    if (info[i].rx_silent)
+		++silent_cnt;
+	}
+	printf("Silence level: %u, silent ports: %u of %u\n\n",
+	       confbridge_get_silence_level(conf), silent_cnt, count);
+    }
 
     for (i=0; i<count; ++i) {
-	char txlist[4*MAX_PORTS];
+	char *txlist, *p;
 	unsigned j;
-	pjmedia_conf_port_info *port_info = &info[i];	
+	confbridge_port_info *port_info = &info[i];	
 	
-	txlist[0] = '\0';
-	for (j=0; j<port_info->listener_cnt; ++j) {
-	    char s[10];
-	    pj_ansi_sprintf(s, "#%d ", port_info->listener_slots[j]);
-	    pj_ansi_strcat(txlist, s);
+	txlist = (char*) malloc(port_info->listener_cnt * 12 + 2);
+	if (!txlist) {
+	    puts("Error: not enough memory");
+	    break;
+	}
 
+	p = txlist;
+	*p = '\0';
+	for (j=0; j<port_info->listener_cnt; ++j) {
+	    p += pj_ansi_sprintf(p, "#%d ", port_info->listener_slots[j]);
 	}
 
 	if (txlist[0] == '\0') {
@@ -512,7 +715,7 @@ static void conf_list(pjmedia_conf *conf, int detail)
 	} else {
 	    unsigned tx_level, rx_level;
 
-	    pjmedia_conf_get_signal_level(conf, port_info->slot,
+	    confbridge_get_signal_level(conf, port_info->slot,
 					  &tx_level, &rx_level);
 
 	    printf("Port #%02d:\n"
@@ -522,6 +725,7 @@ static void conf_list(pjmedia_conf *conf, int detail)
 		   "  Frame time              : %d ms\n"
 		   "  Signal level adjustment : tx=%d, rx=%d\n"
 		   "  Current signal level    : tx=%u, rx=%u\n"
+		   "  Silent frames (skipped) : %u of %u read%s\n"
 		   "  Transmitting to ports   : %s\n\n",
 		   port_info->slot,
 		   (int)port_info->name.slen,
@@ -533,58 +737,331 @@ static void conf_list(pjmedia_conf *conf, int detail)
 		   port_info->rx_adj_level,
 		   tx_level,
 		   rx_level,
+		   port_info->rx_silent_cnt,
+		   port_info->rx_frame_cnt,
+		   port_info->rx_silent ? ", silent now" : "",
 		   txlist);
 	}
 
+	free(txlist);
+    }
+    free(info);
+    puts("");
+}
+
+
+/*
+ * Show per port latency statistics.
+ */
+static void show_stats(confbridge *conf)
+{
+    static const char *names[CONFBRIDGE_STAT_COUNT] =
+    {
+	"get_frame", "put_frame", "mix", "rx buffer"
+    };
+    confbridge_port_stats *stats;
+    unsigned i, t, count;
+    pj_status_t status;
+
+    count = confbridge_get_port_count(conf);
+    stats = (confbridge_port_stats*) malloc(count * sizeof(stats[0]));
+    if (!stats) {
+	puts("Error: not enough memory");
+	return;
+    }
+
+    status = confbridge_get_ports_stats(conf, &count, stats);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Error getting statistics", status);
+	free(stats);
+	return;
+    }
+
+    puts("Port latency in usec (p50/p99/max, number of samples):");
+    for (i=0; i<count; ++i) {
+	printf("Port #%02d:\n", stats[i].slot);
+	for (t=0; t<CONFBRIDGE_STAT_COUNT; ++t) {
+	    const confbridge_stat *st = &stats[i].stat[t];
+
+	    if (st->count == 0)
+		continue;
+	    printf("  %-10s: %9.1f %9.1f %9.1f  (%u)\n", names[t],
+		   st->p50 / 1000.0, st->p99 / 1000.0, st->max / 1000.0,
+		   st->count);
+	}
     }
     puts("");
+
+    free(stats);
+}
+
+
+/* The multi-track recording, and the pool it was created from */
+static conf_recorder *mt_rec;
+static pj_pool_t *mt_pool;
+
+/*
+ * Start or stop recording a track per port, skipping the slot of the
+ * WAV recorder. Called with a NULL pool factory, only stops it.
+ */
+static void toggle_multitrack(confbridge *conf, pj_pool_factory *pf,
+			      int port_count, int skip_slot)
+{
+    conf_recorder_param param;
+    conf_recorder_stat stat;
+    unsigned *slots;
+    char prefix[PJ_MAXPATH - 4], path[PJ_MAXPATH], tmp[10];
+    int i;
+    pj_status_t status;
+
+    if (mt_rec) {
+	conf_recorder_get_stat(mt_rec, &stat);
+	conf_recorder_destroy(mt_rec);
+	pj_pool_release(mt_pool);
+	mt_rec = NULL;
+	mt_pool = NULL;
+
+	printf("Recorded %u tracks for %u ticks: %u usec per tick "
+	       "(max %u), %u frames dropped\n",
+	       stat.track_cnt, stat.ticks, stat.avg_tick_usec,
+	       stat.max_tick_usec, stat.overruns);
+	printf("  %u writes, longest %u usec, %u failed\n",
+	       stat.batches, stat.max_write_usec, stat.write_errors);
+	return;
+    }
+
+    if (!pf)
+	return;
+
+    if (!input("Enter file name prefix", prefix, sizeof(prefix)))
+	return;
+    if (!input("One file per track (f) or one interleaved file (i)",
+	       tmp, sizeof(tmp)))
+	return;
+
+    conf_recorder_param_default(&param);
+    if (tmp[0] == 'i') {
+	param.layout = CONF_RECORDER_INTERLEAVED;
+	pj_ansi_snprintf(path, sizeof(path), "%s.wav", prefix);
+	param.path = path;
+    } else {
+	param.path = prefix;
+    }
+
+    mt_pool = pj_pool_create(pf, "multitrack", 1000, 1000, NULL);
+    if (!mt_pool) {
+	puts("Error: not enough memory");
+	return;
+    }
+
+    slots = (unsigned*) pj_pool_alloc(mt_pool, port_count * sizeof(slots[0]));
+    for (i=0; i<port_count; ++i) {
+	if (i != skip_slot)
+	    slots[param.slot_cnt++] = i;
+    }
+    param.slots = slots;
+
+    status = conf_recorder_create(conf, mt_pool, &param, &mt_rec);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Error starting the multi-track recording",
+		   status);
+	pj_pool_release(mt_pool);
+	mt_pool = NULL;
+	return;
+    }
+
+    printf("Recording %u ports and the mix to %s%s\n",
+	   param.slot_cnt, param.path,
+	   param.layout == CONF_RECORDER_FILES ? "-*.wav" : "");
+}
+
+/*
+ * Apply a script of connect/disconnect/level operations as one batch.
+ */
+static void run_script(confbridge *conf, const char *filename)
+{
+    enum { MAX_OPS = 1024 };
+    static confbridge_op ops[MAX_OPS];
+    unsigned count = 0, line_no = 0;
+    char line[128];
+    FILE *f;
+    pj_status_t status;
+
+    f = fopen(filename, "r");
+    if (!f) {
+	printf("Unable to open %s\n", filename);
+	return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+	char cmd;
+	int a, b, n;
+
+	++line_no;
+
+	n = sscanf(line, " %c %d %d", &cmd, &a, &b);
+	if (n < 1 || cmd == '#')
+	    continue;
+
+	if (n != 3 || a < 0 || (cmd != 'c' && cmd != 'd' && cmd != 't' &&
+				cmd != 'r'))
+	{
+	    printf("%s:%u: invalid line, script not applied\n",
+		   filename, line_no);
+	    fclose(f);
+	    return;
+	}
+
+	if (count == MAX_OPS) {
+	    printf("%s: too many operations (max %d), script not applied\n",
+		   filename, MAX_OPS);
+	    fclose(f);
+	    return;
+	}
+
+	pj_bzero(&ops[count], sizeof(ops[count]));
+	ops[count].slot = a;
+	switch (cmd) {
+	case 'c':
+	    ops[count].type = CONFBRIDGE_OP_CONNECT;
+	    ops[count].sink_slot = b;
+	    break;
+	case 'd':
+	    ops[count].type = CONFBRIDGE_OP_DISCONNECT;
+	    ops[count].sink_slot = b;
+	    break;
+	case 't':
+	    ops[count].type = CONFBRIDGE_OP_ADJUST_TX_LEVEL;
+	    ops[count].level = b;
+	    break;
+	case 'r':
+	    ops[count].type = CONFBRIDGE_OP_ADJUST_RX_LEVEL;
+	    ops[count].level = b;
+	    break;
+	}
+	++count;
+    }
+
+    fclose(f);
+
+    status = confbridge_update(conf, count, ops);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Error applying script, nothing was changed",
+		   status);
+	return;
+    }
+
+    printf("Applied %u operations from %s\n", count, filename);
 }
 
 
 /*
  * Display VU meter
  */
-static void monitor_level(pjmedia_conf *conf, int slot, int dir, int dur)
+/* Level subscription callback, called by the bridge every frame */
+static void on_levels(confbridge *conf, pj_uint32_t tick, void *user_data)
+{
+    PJ_UNUSED_ARG(conf);
+    PJ_UNUSED_ARG(tick);
+
+    pj_sem_post((pj_sem_t*)user_data);
+}
+
+static void monitor_level(confbridge *conf, pj_pool_t *pool, int slot,
+			  int dir, int dur)
 {
-    enum { SLEEP = 20, SAMP_CNT = 2};
+    enum { SAMP_CNT = 2, TICK_TIMEOUT_MS = 1000 };
+    pjmedia_port *master = confbridge_get_master_port(conf);
+    confbridge_port_info info;
+    pj_pool_t *sem_pool;
+    pj_sem_t *sem;
     pj_status_t status;
+    unsigned slot_id = slot;
     int i, total_count;
-    unsigned level, samp_cnt;
+    unsigned level, peak, rms, samp_cnt;
+
+    status = confbridge_get_port_info(conf, slot, &info);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to read level", status);
+	return;
+    }
 
+    /* The bridge posts the semaphore every frame, and the levels it
+     * published are read without locking the bridge. The semaphore lives
+     * in a pool of its own, released when we're done.
+     */
+    sem_pool = pj_pool_create(pool->factory, "vumeter", 256, 256, NULL);
+    if (!sem_pool) {
+	puts("Error: not enough memory");
+	return;
+    }
+    status = pj_sem_create(sem_pool, "vumeter", 0, 1000, &sem);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to create semaphore", status);
+	pj_pool_release(sem_pool);
+	return;
+    }
+
+    status = confbridge_subscribe_levels(conf, &on_levels, sem);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to subscribe to levels", status);
+	pj_sem_destroy(sem);
+	pj_pool_release(sem_pool);
+	return;
+    }
 
     puts("");
     printf("Displaying VU meter for port %d for about %d seconds\n",
 	   slot, dur);
 
-    total_count = dur * 1000 / SLEEP;
+    total_count = dur * PJMEDIA_PIA_SRATE(&master->info) /
+		  PJMEDIA_PIA_SPF(&master->info);
 
-    level = 0;
+    level = peak = rms = 0;
     samp_cnt = 0;
 
     for (i=0; i<total_count; ++i) {
-	unsigned tx_level, rx_level;
-	int j, length;
+	confbridge_level lvl;
+	int j, length, waited;
 	char meter[21];
 
-	/* Poll the volume every 20 msec */
-	status = pjmedia_conf_get_signal_level(conf, slot, 
-					       &tx_level, &rx_level);
-	if (status != PJ_SUCCESS) {
-	    app_perror(THIS_FILE, "Unable to read level", status);
-	    return;
+	/* Poll the semaphore for the next frame rather than block on it,
+	 * so we don't hang when the bridge clock has stopped (e.g. the
+	 * sound device is gone).
+	 */
+	for (waited=0; pj_sem_trywait(sem) != PJ_SUCCESS; ++waited) {
+	    if (waited == TICK_TIMEOUT_MS)
+		break;
+	    pj_thread_sleep(1);
 	}
+	if (waited == TICK_TIMEOUT_MS) {
+	    printf("\nNo frame from the bridge for %d ms, stopping\n",
+		   TICK_TIMEOUT_MS);
+	    break;
+	}
+
+	confbridge_get_levels(conf, 1, &slot_id, &lvl, NULL);
 
-	level += (dir=='r' ? rx_level : tx_level);
+	if (dir == 'r') {
+	    level += lvl.rx_level;
+	    if (lvl.rx_peak > peak)
+		peak = lvl.rx_peak;
+	    rms += lvl.rx_rms;
+	} else {
+	    level += lvl.tx_level;
+	    if (lvl.tx_peak > peak)
+		peak = lvl.tx_peak;
+	    rms += lvl.tx_rms;
+	}
 	++samp_cnt;
 
 	/* Accumulate until we have enough samples */
-	if (samp_cnt < SAMP_CNT) {
-	    pj_thread_sleep(SLEEP);
+	if (samp_cnt < SAMP_CNT)
 	    continue;
-	}
 
 	/* Get average */
 	level = level / samp_cnt;
+	rms = rms / samp_cnt;
 
 	/* Draw bar */
 	length = 20 * level / 255;
@@ -594,16 +1071,19 @@ static void monitor_level(pjmedia_conf *conf, int slot, int dir, int dur)
 	    meter[j] = ' ';
 	meter[20] = '\0';
 
-	printf("Port #%02d %cx level: [%s] %d  \r",
-	       slot, dir, meter, level);
+	printf("Port #%02d %cx level: [%s] %3d  peak %5u  rms %5u  \r",
+	       slot, dir, meter, level, peak, rms);
+	fflush(stdout);
 
 	/* Next.. */
 	samp_cnt = 0;
-	level = 0;
-
-	pj_thread_sleep(SLEEP);
+	level = peak = rms = 0;
     }
 
+    confbridge_unsubscribe_levels(conf, &on_levels, sem);
+    pj_sem_destroy(sem);
+    pj_pool_release(sem_pool);
+
     puts("");
 }
 
@@ -8,64 +8,14 @@
 #include <stdio.h>
 
 #include "util.h"
+#include "conf_device.h"
 
 /* For logging purpose. */
 #define THIS_FILE   "confsample_w.c"
 #define RECORDER 1
 
-/* 显示的声明pjmedia_conf，才能显示使用pjmeida_conf中的参数
- * Conference bridge.
- */
-struct pjmedia_conf
-{
-    unsigned		  options;	/**< Bitmask options.		    */
-    unsigned		  max_ports;	/**< Maximum ports.		    */
-    unsigned		  port_cnt;	/**< Current number of ports.	    */
-    unsigned		  connect_cnt;	/**< Total number of connections    */
-    pjmedia_snd_port	 *snd_dev_port;	/**< Sound device port.		    */
-    pjmedia_port	 *master_port;	/**< Port zero's port.		    */
-    char		  master_name_buf[80]; /**< Port0 name buffer.	    */
-    pj_mutex_t		 *mutex;	/**< Conference mutex.		    */
-    struct conf_port	**ports;	/**< Array of ports.		    */
-    unsigned		  clock_rate;	/**< Sampling rate.		    */
-    unsigned		  channel_count;/**< Number of channels (1=mono).   */
-    unsigned		  samples_per_frame;	/**< Samples per frame.	    */
-    unsigned		  bits_per_sample;	/**< Bits per sample.	    */
-};
-
-struct pjmedia_snd_port
-{
-    int			 rec_id;
-    int			 play_id;
-    pj_uint32_t		 aud_caps;
-    pjmedia_aud_param	 aud_param;
-    pjmedia_aud_stream	*aud_stream;
-    pjmedia_dir		 dir;
-    pjmedia_port	*port;
-
-    pjmedia_clock_src    cap_clocksrc,
-                         play_clocksrc;
-
-    unsigned		 clock_rate;
-    unsigned		 channel_count;
-    unsigned		 samples_per_frame;
-    unsigned		 bits_per_sample;
-    unsigned		 options;
-    unsigned		 prm_ec_options;
-
-    /* software ec */
-    pjmedia_echo_state	*ec_state;
-    unsigned		 ec_options;
-    unsigned		 ec_tail_len;
-    pj_bool_t		 ec_suspended;
-    unsigned		 ec_suspend_count;
-    unsigned		 ec_suspend_limit;
-
-    /* audio frame preview callbacks */
-    void		*user_data;
-    pjmedia_aud_play_cb  on_play_frame;
-    pjmedia_aud_rec_cb   on_rec_frame;
-};
+/* Maximum number of extra sound devices */
+#define MAX_DEVICES 8
 
 static const char *desc = 
  " FILE:								    \n"
@@ -107,33 +57,23 @@ static void conf_list(pjmedia_conf *conf, pj_bool_t detail);
 /* Display VU meter */
 static void monitor_level(pjmedia_conf *conf, int slot, int dir, int dur);
 
-pj_status_t spk_put_frame(pjmedia_port *this_port, 
-			     pjmedia_frame *frame)
-{
-    static int put_count = 0;
-    if (put_count > 2147483647)
-        put_count = 0;
-    ++put_count;
-    if (put_count % 1000 == 0)
-    {
-        PJ_LOG(3, (THIS_FILE, "spk_put_frame: %d", put_count));
-    }
-    return PJ_SUCCESS;
-}
+/* Add a sound device to the conference bridge */
+static pj_status_t add_device(pjmedia_conf *conf, pj_pool_t *pool,
+                              int dev_id, unsigned *p_slot);
 
-pj_status_t spk_get_frame (pjmedia_port *this_port, 
-			     pjmedia_frame *frame)
-{
-    static int get_count = 0;
-    if (get_count > 2147483647)
-        get_count = 0;
-    ++get_count;
-    if (get_count % 1000 == 0)
-    {
-        PJ_LOG(3, (THIS_FILE, "spk_get_frame: %d", get_count));
-    }
-    return PJ_SUCCESS;
-}
+/* Add every sound device but the one of slot zero */
+static void add_all_devices(pjmedia_conf *conf, pj_pool_t *pool);
+
+/* Show the state of the extra sound devices */
+static void device_list(void);
+
+/* Extra sound devices, and their slots */
+static conf_device *devices[MAX_DEVICES];
+static unsigned device_slots[MAX_DEVICES];
+static unsigned device_cnt;
+
+/* Sound device of slot zero, opened by us to set its echo canceller */
+static pjmedia_snd_port *snd_port;
 
 /* Show usage */
 static void usage(void)
@@ -222,11 +162,11 @@ int main(int argc, char *argv[])
 			   );
 
     file_count = argc - pj_optind;
-    port_count = file_count + 1 + RECORDER + 2;
+    port_count = file_count + 1 + RECORDER + MAX_DEVICES;
 
     /* Create the conference bridge. 
-     * With default options (zero), the bridge will create an instance of
-     * sound capture and playback device and connect them to slot zero.
+     * The sound device of slot zero is opened below, so that we have its
+     * port to set the echo canceller.
      */
     status = pjmedia_conf_create( pool, 
         port_count,
@@ -234,7 +174,7 @@ int main(int argc, char *argv[])
         channel_count,
         samples_per_frame,
         bits_per_sample,
-        0,
+        PJMEDIA_CONF_NO_DEVICE,
         &conf);
     
     if (status != PJ_SUCCESS) 
@@ -243,6 +183,25 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    status = pjmedia_snd_port_create(pool, dev_id, dev_id,
+                    clock_rate, channel_count,
+                    samples_per_frame, bits_per_sample, 0,
+                    &snd_port);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to open sound device", status);
+        return 1;
+    }
+
+    /* The sound device clocks the bridge */
+    status = pjmedia_snd_port_connect(snd_port,
+                    pjmedia_conf_get_master_port(conf));
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to connect sound device", status);
+        return 1;
+    }
+
 #if RECORDER
     status = pjmedia_wav_writer_port_create(pool, "confwrite.wav", 
                     clock_rate, channel_count,
@@ -299,75 +258,37 @@ int main(int argc, char *argv[])
     /* Sleep to allow log messages to flush */
     pj_thread_sleep(100);
 
-    // 创建一个扬声器snd
-    // 怎么识别扬声器与mic
-    int dev_count = 0;
-    dev_count = pjmedia_aud_dev_count();
-    if (dev_count == 0)
-    {
-        PJ_LOG(3,(THIS_FILE, "No devices found"));
-    }
-    int j = 0;
-    int speaker_id = 0;
-    int mic_id = 0;
-    for (; j < dev_count; ++j)
+    /* Play the bridge on a speaker too, the first playback only device
+     * other than slot zero's. It runs by its own clock, the device port
+     * absorbs the drift.
+     */
     {
-        pjmedia_aud_dev_info info;
-        status = pjmedia_aud_dev_get_info(j, &info);
-        if (status != PJ_SUCCESS)
-        {
-            PJ_LOG(3,(THIS_FILE, "failed to get the %dth dev info", j));
-            continue;
-        }
+        pjmedia_aud_param snd_param;
+        unsigned dev_count = pjmedia_aud_dev_count();
+        unsigned j;
 
-        PJ_LOG(3, (THIS_FILE, " %2d: %s [%s] (%d/%d) default_sp %d", 
-            j, info.driver, info.name, info.input_count, info.output_count, info.default_samples_per_sec));
-        
-        // 知道MacBook pro扬声器对应的index
-        if (info.input_count == 0 && info.name[0] == 'M')
-        {
-            speaker_id = j;
-            PJ_LOG(3, (THIS_FILE, "find MacBook Pro 扬声器 对应的index： %d", speaker_id));
-        }
+        pjmedia_aud_stream_get_param(pjmedia_snd_port_get_snd_stream(snd_port),
+                                     &snd_param);
 
-        if (info.input_count != 0 && info.name[0] == 'M')
+        for (j = 0; j < dev_count; ++j)
         {
-            mic_id = j;
-            PJ_LOG(3, (THIS_FILE, "find MacBook Pro 麦克风 对应的index： %d", mic_id));
-        }
-    }
+            pjmedia_aud_dev_info info;
 
-    // 创建一个speaker snd
-    struct conf_port *spk_conf_port;
-    pjmedia_snd_port *spk_snd;
-    pj_str_t spk_name = {"snd/speaker", 11};
+            if (pjmedia_aud_dev_get_info(j, &info) != PJ_SUCCESS)
+                continue;
 
-    status =pjmedia_snd_port_create_player(pool, speaker_id, conf->clock_rate, 
-            conf->channel_count, conf->samples_per_frame,
-            conf->bits_per_sample, 0,  &spk_snd);
-    if (status != PJ_SUCCESS)
-    {
-        PJ_LOG(3, (THIS_FILE, "failed to pjmedia_snd_port_create_player"));
-        return status;
-    }
+            PJ_LOG(3, (THIS_FILE, " %2d: %s [%s] (%d/%d) default_sp %d", 
+                j, info.driver, info.name, info.input_count,
+                info.output_count, info.default_samples_per_sec));
 
-    // snd缺少一个port去add
-    spk_snd->port = PJ_POOL_ZALLOC_T(pool, pjmedia_port);
-    pj_str_t spk_port_name = {"Snd", 3};
-    pjmedia_port_info_init(&spk_snd->port->info, 
-        &spk_port_name, 0, conf->clock_rate, 
-        conf->channel_count, conf->bits_per_sample, 
-        conf->samples_per_frame);
-    spk_snd->port->port_data.pdata = spk_snd;
-    spk_snd->port->port_data.ldata = 0;
-    // spk_snd->port->get_frame = spk_get_frame;
-    spk_snd->port->put_frame = spk_put_frame;
-    // 把snd 变为conf_port
-    pjmedia_conf_add_port(conf, pool, spk_snd->port, &spk_name, NULL);
-    if (status != PJ_SUCCESS)
-    {
-        PJ_LOG(3, (THIS_FILE, "failed to pjmedia_conf_add_port add snd"));
-        return status;
+            if (info.input_count == 0 && info.output_count != 0 &&
+                (int)j != snd_param.play_id && device_cnt == 0)
+            {
+                status = add_device(conf, pool, j, NULL);
+                if (status != PJ_SUCCESS)
+                    app_perror(THIS_FILE, "Unable to add the speaker", status);
+            }
+        }
     }
 
 
@@ -388,6 +309,9 @@ int main(int argc, char *argv[])
         puts("  s    Show ports details");
         puts("  c    Connect one port to another");
         puts("  d    Disconnect port connection");
+        puts("  a    Add a sound device as a port");
+        puts("  A    Add all other sound devices as ports");
+        puts("  e    Set echo canceller of the sound device");
         puts("  q    Quit");
 	    puts("");
 
@@ -401,6 +325,34 @@ int main(int argc, char *argv[])
             case 's': 
                 puts("");
                 conf_list(conf, 1);
+                device_list();
+                break;
+
+            case 'a':
+                puts("");
+                puts("Add a sound device as a port");
+                if (!input("Enter device id", tmp1, sizeof(tmp1)))
+                    continue;
+                src = strtol(tmp1, &err, 10);
+                if (*err || src < 0)
+                {
+                    puts("Invalid device id");
+                    continue;
+                }
+                {
+                    unsigned slot;
+
+                    status = add_device(conf, pool, src, &slot);
+                    if (status != PJ_SUCCESS)
+                        app_perror(THIS_FILE, "Error adding sound device",
+                                   status);
+                    else
+                        printf("Device %d added to slot %u\n", src, slot);
+                }
+                break;
+
+            case 'A':
+                add_all_devices(conf, pool);
                 break;
 
             case 'c': 
@@ -467,7 +419,7 @@ int main(int argc, char *argv[])
                     continue;
                 }
 
-                status = pjmedia_snd_port_set_ec(conf->snd_dev_port, pool, dst, src);
+                status = pjmedia_snd_port_set_ec(snd_port, pool, dst, src);
                 if (status != PJ_SUCCESS)
                 {
                     PJ_LOG(3, (THIS_FILE, "failed to set ec tail:%d options: %d", dst, src));
@@ -492,6 +444,14 @@ on_quit:
     
     /* Start deinitialization: */
 
+    /* Stop the clock, then the other devices */
+    pjmedia_snd_port_destroy(snd_port);
+    for (i = 0; i < (int)device_cnt; ++i)
+    {
+        pjmedia_conf_remove_port(conf, device_slots[i]);
+        conf_device_destroy(devices[i]);
+    }
+
     /* Destroy conference bridge */
     status = pjmedia_conf_destroy( conf );
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
@@ -517,28 +477,39 @@ on_quit:
  */
 static void conf_list(pjmedia_conf *conf, pj_bool_t detail)
 {
-    enum { MAX_PORTS = 32};
-
     unsigned i, count;
-    pjmedia_conf_port_info info[MAX_PORTS];
+    pjmedia_conf_port_info *info;
 
     printf("Conference ports:\n");
 
-    count = PJ_ARRAY_SIZE(info);
+    /* Size the lists by the ports actually in the bridge */
+    count = pjmedia_conf_get_port_count(conf);
+    info = (pjmedia_conf_port_info*) malloc(count * sizeof(info[0]));
+    if (!info)
+    {
+        puts("Error: not enough memory");
+        return;
+    }
     pjmedia_conf_get_ports_info(conf, &count, info);
 
     for (i = 0; i < count; i++)
     {
-        char txlist[4 * MAX_PORTS];
+        char *txlist, *p;
         unsigned j;
         pjmedia_conf_port_info *port_info = &info[i];
 
-        txlist[0] = '\0';
+        txlist = (char*) malloc(port_info->listener_cnt * 12 + 2);
+        if (!txlist)
+        {
+            puts("Error: not enough memory");
+            break;
+        }
+
+        p = txlist;
+        *p = '\0';
         for (j = 0; j < port_info->listener_cnt; ++j)
         {
-            char s[10];
-            pj_ansi_sprintf(s, "#%d ", port_info->listener_slots[j]);
-            pj_ansi_strcat(txlist, s);
+            p += pj_ansi_sprintf(p, "#%d ", port_info->listener_slots[j]);
         }
 
         if (txlist[0] == '\0')
@@ -580,7 +551,148 @@ static void conf_list(pjmedia_conf *conf, pj_bool_t detail)
                 rx_level,
                 txlist);
         }
-        
+
+        free(txlist);
     }
+    free(info);
     puts("");
-}
\ No newline at end of file
+}
+
+
+/*
+ * Add a sound device to the conference bridge, for capture, playback or
+ * both, as the device has. It runs by its own clock.
+ */
+static pj_status_t add_device(pjmedia_conf *conf, pj_pool_t *pool,
+                              int dev_id, unsigned *p_slot)
+{
+    pjmedia_port *master = pjmedia_conf_get_master_port(conf);
+    pjmedia_aud_dev_info info;
+    conf_device_param param;
+    pjmedia_dir dir = PJMEDIA_DIR_NONE;
+    conf_device *dev;
+    char *name;
+    unsigned slot;
+    pj_status_t status;
+
+    if (device_cnt == MAX_DEVICES)
+        return PJ_ETOOMANY;
+
+    status = pjmedia_aud_dev_get_info(dev_id, &info);
+    if (status != PJ_SUCCESS)
+        return status;
+    if (info.input_count)
+        dir |= PJMEDIA_DIR_CAPTURE;
+    if (info.output_count)
+        dir |= PJMEDIA_DIR_PLAYBACK;
+
+    conf_device_param_default(&param, dir, dev_id,
+                              PJMEDIA_PIA_SRATE(&master->info),
+                              PJMEDIA_PIA_CCNT(&master->info),
+                              PJMEDIA_PIA_SPF(&master->info));
+
+    name = (char*) pj_pool_alloc(pool, 32);
+    pj_ansi_snprintf(name, 32, "snd/dev%d", dev_id);
+    status = conf_device_create(pool, name, &param, &dev);
+    if (status != PJ_SUCCESS)
+        return status;
+
+    status = pjmedia_conf_add_port(conf, pool, conf_device_get_port(dev),
+                                   NULL, &slot);
+    if (status != PJ_SUCCESS)
+    {
+        conf_device_destroy(dev);
+        return status;
+    }
+
+    devices[device_cnt] = dev;
+    device_slots[device_cnt] = slot;
+    ++device_cnt;
+
+    if (p_slot)
+        *p_slot = slot;
+    return PJ_SUCCESS;
+}
+
+/*
+ * Add every sound device but the ones of slot zero and those already
+ * added.
+ */
+static void add_all_devices(pjmedia_conf *conf, pj_pool_t *pool)
+{
+    pjmedia_aud_param snd_param;
+    unsigned dev_count = pjmedia_aud_dev_count();
+    unsigned i, j;
+
+    pjmedia_aud_stream_get_param(pjmedia_snd_port_get_snd_stream(snd_port),
+                                 &snd_param);
+
+    for (i = 0; i < dev_count; ++i)
+    {
+        char name[32];
+        pj_status_t status;
+
+        if ((int)i == snd_param.rec_id || (int)i == snd_param.play_id)
+            continue;
+
+        pj_ansi_snprintf(name, sizeof(name), "snd/dev%d", i);
+        for (j = 0; j < device_cnt; ++j)
+        {
+            pjmedia_port *port = conf_device_get_port(devices[j]);
+
+            if (pj_strcmp2(&port->info.name, name) == 0)
+                break;
+        }
+        if (j < device_cnt)
+            continue;
+
+        status = add_device(conf, pool, i, NULL);
+        if (status != PJ_SUCCESS)
+        {
+            char title[80];
+            pj_ansi_snprintf(title, sizeof(title),
+                             "Unable to add device %d", i);
+            app_perror(THIS_FILE, title, status);
+        }
+    }
+}
+
+/*
+ * Show the state of the extra sound devices: the ring levels, the range
+ * they moved in and the drift of each direction.
+ */
+static void device_list(void)
+{
+    unsigned i;
+
+    for (i = 0; i < device_cnt; ++i)
+    {
+        pjmedia_port *port = conf_device_get_port(devices[i]);
+        conf_device_stat stat;
+        const conf_device_dir_stat *ds[2];
+        const char *dir_name[2] = { "capture", "playback" };
+        unsigned k;
+
+        conf_device_get_stat(devices[i], &stat);
+        ds[0] = &stat.rec;
+        ds[1] = &stat.play;
+
+        printf("Port #%02d %.*s:\n", device_slots[i],
+               (int)port->info.name.slen, port->info.name.ptr);
+        for (k = 0; k < 2; ++k)
+        {
+            if (ds[k]->target == 0)
+                continue;
+
+            printf("   %-8s: buffered %u (%u..%u) of %u samples, drift %d ppm"
+                   " (measured %d ppm over %us), %u frames, %u underruns, "
+                   "%u dropped\n", dir_name[k], ds[k]->level,
+                   ds[k]->level_min, ds[k]->level_max, ds[k]->target,
+                   ds[k]->drift_ppm, ds[k]->measured_ppm,
+                   ds[k]->measured_sec, ds[k]->frames, ds[k]->underruns,
+                   ds[k]->overflows);
+        }
+    }
+    if (device_cnt)
+        puts("");
+}
@@ -0,0 +1,407 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "mmap_player.h"
+
+#include <stdlib.h>	/* malloc() */
+#include <string.h>	/* strdup() */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define THIS_FILE	"mmap_player.c"
+
+#define SIGNATURE	PJMEDIA_SIG_CLASS_PORT_AUD('M','P')
+#define DEFAULT_PTIME	20	/* ms */
+
+
+/* A mapped file, shared by all the ports playing it */
+struct mmap_file
+{
+    struct mmap_file	*next;
+    dev_t		 dev;		/**< Key of the file.		    */
+    ino_t		 ino;
+    off_t		 size;		/**< Key too, so that a file
+					     rewritten in place is mapped
+					     again.			    */
+    time_t		 mtime;
+    unsigned		 ref_cnt;	/**< Ports playing it.		    */
+
+    void		*map;
+    pj_size_t		 map_len;
+    const pj_int16_t	*samples;	/**< The data chunk.		    */
+    pj_size_t		 sample_cnt;
+    pj_bool_t		 aligned;	/**< Samples can be pointed at.	    */
+    unsigned		 clock_rate;
+    unsigned		 channel_count;
+};
+
+/* The ports */
+struct mmap_player
+{
+    pjmedia_port	 base;
+    struct mmap_file	*file;
+    unsigned		 options;
+    pj_size_t		 pos;		/**< Next sample to play.	    */
+    pj_bool_t		 eof;
+    pj_uint64_t		 ts;		/**< Timestamp of the next frame.   */
+};
+
+/* The mapped files. Only touched when creating and destroying ports,
+ * under pjlib's critical section. Files are opened and mapped outside
+ * of it.
+ */
+static struct mmap_file *files;
+
+
+static pj_uint16_t le16(const pj_uint8_t *p)
+{
+    return (pj_uint16_t)(p[0] | (p[1] << 8));
+}
+
+static pj_uint32_t le32(const pj_uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((pj_uint32_t)p[3] << 24);
+}
+
+/* Find the format and the data of a mapped WAV file */
+static pj_status_t parse_wav(struct mmap_file *mf)
+{
+    const pj_uint8_t *p = (const pj_uint8_t*)mf->map;
+    const pj_uint8_t *end = p + mf->map_len;
+    pj_bool_t has_fmt = PJ_FALSE;
+
+    if (mf->map_len < 12 || pj_memcmp(p, "RIFF", 4) != 0 ||
+	pj_memcmp(p + 8, "WAVE", 4) != 0)
+    {
+	return PJMEDIA_ENOTVALIDWAVE;
+    }
+    p += 12;
+
+    /* Chunks are word aligned, the data chunk may say it's longer than
+     * the file when it was written as a stream.
+     */
+    while (end - p >= 8) {
+	pj_uint32_t len = le32(p + 4);
+	const pj_uint8_t *body = p + 8;
+
+	if (pj_memcmp(p, "fmt ", 4) == 0) {
+	    pj_uint16_t tag, bits;
+
+	    if (len < 16 || (pj_size_t)(end - body) < 16)
+		return PJMEDIA_ENOTVALIDWAVE;
+	    tag = le16(body);
+	    bits = le16(body + 14);
+	    if ((tag != 1 && tag != 0xFFFE) || bits != 16)
+		return PJMEDIA_EWAVEUNSUPP;
+	    mf->channel_count = le16(body + 2);
+	    mf->clock_rate = le32(body + 4);
+	    if (mf->channel_count == 0 || mf->clock_rate == 0)
+		return PJMEDIA_ENOTVALIDWAVE;
+	    has_fmt = PJ_TRUE;
+
+	} else if (pj_memcmp(p, "data", 4) == 0) {
+	    if (!has_fmt)
+		return PJMEDIA_ENOTVALIDWAVE;
+	    if (len > (pj_size_t)(end - body))
+		len = (pj_uint32_t)(end - body);
+	    mf->samples = (const pj_int16_t*)body;
+	    mf->sample_cnt = len / 2 / mf->channel_count * mf->channel_count;
+	    mf->aligned = (((pj_size_t)body & 1) == 0);
+	    return mf->sample_cnt ? PJ_SUCCESS : PJMEDIA_EWAVETOOSHORT;
+	}
+
+	if (len > (pj_size_t)(end - body))
+	    break;
+	p = body + len + (len & 1);
+    }
+
+    return PJMEDIA_ENOTVALIDWAVE;
+}
+
+/* Find the mapping of the file and take a reference to it. Called in
+ * the critical section.
+ */
+static struct mmap_file *file_find(const struct stat *st)
+{
+    struct mmap_file *mf;
+
+    for (mf = files; mf; mf = mf->next) {
+	if (mf->dev == st->st_dev && mf->ino == st->st_ino &&
+	    mf->size == st->st_size && mf->mtime == st->st_mtime)
+	{
+	    ++mf->ref_cnt;
+	    return mf;
+	}
+    }
+    return NULL;
+}
+
+static void file_unmap(struct mmap_file *mf)
+{
+    munmap(mf->map, mf->map_len);
+    free(mf);
+}
+
+/* Map a file, or find its mapping */
+static pj_status_t file_open(const char *filename, struct mmap_file **p_mf)
+{
+    struct mmap_file *mf, *other;
+    struct stat st;
+    pj_status_t status;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+	return PJ_RETURN_OS_ERROR(errno);
+    if (fstat(fd, &st) != 0) {
+	status = PJ_RETURN_OS_ERROR(errno);
+	close(fd);
+	return status;
+    }
+
+    /* Not even room for the RIFF header and a chunk header */
+    if (st.st_size < 20) {
+	close(fd);
+	return PJMEDIA_EWAVETOOSHORT;
+    }
+
+    pj_enter_critical_section();
+    mf = file_find(&st);
+    pj_leave_critical_section();
+    if (mf) {
+	close(fd);
+	*p_mf = mf;
+	return PJ_SUCCESS;
+    }
+
+    mf = (struct mmap_file*) calloc(1, sizeof(*mf));
+    if (!mf) {
+	close(fd);
+	return PJ_ENOMEM;
+    }
+    mf->dev = st.st_dev;
+    mf->ino = st.st_ino;
+    mf->size = st.st_size;
+    mf->mtime = st.st_mtime;
+    mf->ref_cnt = 1;
+    mf->map_len = (pj_size_t)st.st_size;
+
+    mf->map = mmap(NULL, mf->map_len, PROT_READ, MAP_SHARED, fd, 0);
+    status = (mf->map == MAP_FAILED) ? PJ_RETURN_OS_ERROR(errno) :
+				       PJ_SUCCESS;
+    close(fd);
+    if (status == PJ_SUCCESS)
+	status = parse_wav(mf);
+    if (status != PJ_SUCCESS) {
+	if (mf->map != MAP_FAILED)
+	    munmap(mf->map, mf->map_len);
+	free(mf);
+	return status;
+    }
+
+    /* Played from start to end, by every port */
+#if defined(MADV_SEQUENTIAL)
+    madvise(mf->map, mf->map_len, MADV_SEQUENTIAL);
+#endif
+
+    /* Another port may have mapped it meanwhile */
+    pj_enter_critical_section();
+    other = file_find(&st);
+    if (!other) {
+	mf->next = files;
+	files = mf;
+    }
+    pj_leave_critical_section();
+
+    if (other) {
+	file_unmap(mf);
+	mf = other;
+    } else {
+	PJ_LOG(5,(THIS_FILE, "Mapped %s, %u Hz, %u channel(s), %lu samples",
+		  filename, mf->clock_rate, mf->channel_count,
+		  (unsigned long)mf->sample_cnt));
+    }
+
+    *p_mf = mf;
+    return PJ_SUCCESS;
+}
+
+/* Release a file, unmapping it with its last port */
+static void file_close(struct mmap_file *mf)
+{
+    struct mmap_file **pp;
+    pj_bool_t last;
+
+    pj_enter_critical_section();
+    last = (--mf->ref_cnt == 0);
+    if (last) {
+	for (pp = &files; *pp != mf; pp = &(*pp)->next)
+	    ;
+	*pp = mf->next;
+    }
+    pj_leave_critical_section();
+
+    if (last)
+	file_unmap(mf);
+}
+
+
+/* Copy samples out of the file */
+static void copy_samples(pj_int16_t *dst, const pj_int16_t *src,
+			 pj_size_t cnt)
+{
+#if defined(PJ_IS_BIG_ENDIAN) && PJ_IS_BIG_ENDIAN != 0
+    const pj_uint8_t *p = (const pj_uint8_t*)src;
+    pj_size_t i;
+
+    for (i = 0; i < cnt; ++i, p += 2)
+	dst[i] = (pj_int16_t)le16(p);
+#else
+    pj_memcpy(dst, src, cnt * 2);
+#endif
+}
+
+/* Move past cnt samples, looping or stopping at the end */
+static void advance(struct mmap_player *mp, pj_size_t cnt)
+{
+    mp->pos += cnt;
+    if (mp->pos == mp->file->sample_cnt) {
+	if (mp->options & MMAP_PLAYER_NO_LOOP)
+	    mp->eof = PJ_TRUE;
+	else
+	    mp->pos = 0;
+    }
+}
+
+static pj_status_t mmap_get_frame(pjmedia_port *this_port,
+				  pjmedia_frame *frame)
+{
+    struct mmap_player *mp = (struct mmap_player*)this_port;
+    const struct mmap_file *mf = mp->file;
+    unsigned spf = PJMEDIA_PIA_SPF(&this_port->info);
+    pj_int16_t *dst = (pj_int16_t*)frame->buf;
+    pj_size_t cnt = 0, n;
+
+    if (mp->eof) {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_EEOF;
+    }
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = spf * 2;
+    frame->timestamp.u64 = mp->ts;
+    mp->ts += spf / mf->channel_count;
+
+#if !defined(PJ_IS_BIG_ENDIAN) || PJ_IS_BIG_ENDIAN == 0
+    /* A whole frame in the file: point at it */
+    if ((mp->options & MMAP_PLAYER_ZERO_COPY) && mf->aligned &&
+	mf->sample_cnt - mp->pos >= spf)
+    {
+	frame->buf = (void*)(mf->samples + mp->pos);
+	advance(mp, spf);
+	return PJ_SUCCESS;
+    }
+#endif
+
+    while (cnt < spf && !mp->eof) {
+	n = PJ_MIN(spf - cnt, mf->sample_cnt - mp->pos);
+	copy_samples(dst + cnt, mf->samples + mp->pos, n);
+	cnt += n;
+	advance(mp, n);
+    }
+    if (cnt < spf)
+	pj_bzero(dst + cnt, (spf - cnt) * 2);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t mmap_on_destroy(pjmedia_port *this_port)
+{
+    struct mmap_player *mp = (struct mmap_player*)this_port;
+
+    if (mp->file) {
+	file_close(mp->file);
+	mp->file = NULL;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t mmap_player_create(pj_pool_t *pool,
+			       const char *filename,
+			       unsigned ptime,
+			       unsigned options,
+			       pjmedia_port **p_port)
+{
+    struct mmap_player *mp;
+    struct mmap_file *mf = NULL;
+    pj_str_t name;
+    unsigned spf;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && filename && p_port, PJ_EINVAL);
+
+    if (ptime == 0)
+	ptime = DEFAULT_PTIME;
+
+    status = file_open(filename, &mf);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    mp = PJ_POOL_ZALLOC_T(pool, struct mmap_player);
+    mp->file = mf;
+    mp->options = options;
+
+    spf = mf->clock_rate * ptime / 1000 * mf->channel_count;
+    name = pj_str((char*)filename);
+    pjmedia_port_info_init(&mp->base.info, &name, SIGNATURE,
+			   mf->clock_rate, mf->channel_count, 16, spf);
+    mp->base.get_frame = &mmap_get_frame;
+    mp->base.on_destroy = &mmap_on_destroy;
+
+    *p_port = &mp->base;
+    return PJ_SUCCESS;
+}
+
+
+pj_ssize_t mmap_player_get_size(pjmedia_port *port)
+{
+    struct mmap_player *mp = (struct mmap_player*)port;
+
+    PJ_ASSERT_RETURN(port && port->info.signature == SIGNATURE, -PJ_EINVAL);
+    return (pj_ssize_t)mp->file->sample_cnt;
+}
+
+
+pj_status_t mmap_player_set_pos(pjmedia_port *port, pj_size_t pos)
+{
+    struct mmap_player *mp = (struct mmap_player*)port;
+
+    PJ_ASSERT_RETURN(port && port->info.signature == SIGNATURE, PJ_EINVAL);
+    PJ_ASSERT_RETURN(pos < mp->file->sample_cnt, PJ_EINVAL);
+
+    mp->pos = pos / mp->file->channel_count * mp->file->channel_count;
+    mp->eof = PJ_FALSE;
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,114 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __MMAP_PLAYER_H__
+#define __MMAP_PLAYER_H__
+
+/**
+ * @file mmap_player.h
+ * @brief WAV player port reading from a memory-mapped file.
+ *
+ * pjmedia_wav_player_port_create() reads the file in chunks into a
+ * buffer of its own, and copies each frame out of it. This port maps the
+ * file instead, with sequential read-ahead advice, and every port playing
+ * the same file shares one mapping: a port is only a cursor into it, so
+ * hundreds of them playing the same prompts cost no read calls and no
+ * buffers.
+ *
+ * Mappings are keyed by the file's inode, size and modification time, so
+ * a file rewritten in place is mapped afresh for the ports created after.
+ * Ports already playing it keep the old mapping, and would fault reading
+ * past its end if the file were truncated: replace a prompt that is
+ * playing by renaming a new file over it, not by rewriting it.
+ *
+ * Only 16 bit linear PCM files are played. On little-endian hosts the
+ * samples are used as they are in the file; with
+ * #MMAP_PLAYER_ZERO_COPY, get_frame() even points the frame at them
+ * instead of copying, for callers that take the frame from frame->buf
+ * after the call (such as confbridge).
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Player options.
+ */
+typedef enum mmap_player_option
+{
+    /**
+     * Stop at the end of the file instead of looping, as
+     * PJMEDIA_FILE_NO_LOOP: get_frame() returns PJ_EEOF from then on.
+     */
+    MMAP_PLAYER_NO_LOOP = 1,
+
+    /**
+     * Let get_frame() point frame->buf into the mapping instead of
+     * copying into it, when a whole frame is there to point at. The
+     * samples must not be written to. Only for callers which read the
+     * frame from frame->buf after the call.
+     */
+    MMAP_PLAYER_ZERO_COPY = 2
+
+} mmap_player_option;
+
+
+/**
+ * Create a player port for a WAV file.
+ *
+ * @param pool		    Pool to allocate the port.
+ * @param filename	    The WAV file, 16 bit linear PCM.
+ * @param ptime		    Frame time in ms, zero for the default of
+ *			    20 ms.
+ * @param options	    Bitmask of #mmap_player_option.
+ * @param p_port	    Pointer to receive the port.
+ *
+ * @return		    PJ_SUCCESS on success, PJMEDIA_EWAVEUNSUPP
+ *			    for files in other formats.
+ */
+pj_status_t mmap_player_create(pj_pool_t *pool,
+			       const char *filename,
+			       unsigned ptime,
+			       unsigned options,
+			       pjmedia_port **p_port);
+
+/**
+ * Get the length of the file's audio, in samples of all channels.
+ *
+ * @param port		    The player port.
+ *
+ * @return		    The length, or a negative error code.
+ */
+pj_ssize_t mmap_player_get_size(pjmedia_port *port);
+
+/**
+ * Move the playback to a position.
+ *
+ * @param port		    The player port.
+ * @param pos		    Position in samples of all channels, from the
+ *			    start of the audio.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t mmap_player_set_pos(pjmedia_port *port, pj_size_t pos);
+
+
+PJ_END_DECL
+
+#endif	/* __MMAP_PLAYER_H__ */
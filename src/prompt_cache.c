@@ -0,0 +1,474 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "prompt_cache.h"
+
+#include <stdlib.h>	/* malloc() */
+
+#define THIS_FILE	"prompt_cache.c"
+
+#define SIGNATURE	PJMEDIA_SIG_CLASS_PORT_AUD('P','C')
+#define DEFAULT_PTIME	20	/* ms */
+#define DECODE_PTIME	20	/* ms, frames to decode the file with */
+
+
+/* A decoded prompt */
+struct prompt
+{
+    PJ_DECL_LIST_MEMBER(struct prompt);	/**< In the LRU list, the least
+					     recently used first.	    */
+    char		*path;
+    pj_time_val		 mtime;		/**< Of the file, with its size,
+					     to tell a rewritten file.	    */
+    pj_off_t		 file_size;
+    unsigned		 key_rate;	/**< Rate asked for, zero for the
+					     file's.			    */
+    unsigned		 clock_rate;	/**< Rate of the samples.	    */
+    unsigned		 channel_count;
+    pj_int16_t		*samples;
+    pj_size_t		 sample_cnt;
+    unsigned		 ref_cnt;	/**< Ports playing it.		    */
+    pj_bool_t		 stale;		/**< Replaced by a newer file.	    */
+};
+
+struct prompt_cache
+{
+    pj_pool_t		*pool;
+    pj_mutex_t		*mutex;
+    struct prompt	 lru;		/**< All the prompts.		    */
+    pj_size_t		 max_size;
+    pj_size_t		 size;
+    unsigned		 count;
+    unsigned		 in_use;
+    pj_uint32_t		 hits;
+    pj_uint32_t		 misses;
+    pj_uint32_t		 evictions;
+};
+
+/* Player port, a cursor into a prompt */
+struct prompt_player
+{
+    pjmedia_port	 base;
+    prompt_cache	*cache;
+    struct prompt	*prompt;
+    unsigned		 options;
+    pj_size_t		 pos;		/**< Next sample to play.	    */
+    pj_bool_t		 eof;
+    pj_uint64_t		 ts;		/**< Timestamp of the next frame.   */
+};
+
+
+static void prompt_free(struct prompt *p)
+{
+    free(p->samples);
+    free(p->path);
+    free(p);
+}
+
+/* Remove a prompt from the cache. Called with the mutex held. */
+static void prompt_remove(prompt_cache *cache, struct prompt *p)
+{
+    pj_list_erase(p);
+    cache->size -= p->sample_cnt * 2;
+    --cache->count;
+    prompt_free(p);
+}
+
+/* Evict unused prompts, least recently used first, until the cache is
+ * under its cap. Called with the mutex held.
+ */
+static void evict(prompt_cache *cache)
+{
+    struct prompt *p = cache->lru.next;
+
+    while (cache->size > cache->max_size && p != &cache->lru) {
+	struct prompt *next = p->next;
+
+	if (p->ref_cnt == 0) {
+	    PJ_LOG(5,(THIS_FILE, "Evicting %s", p->path));
+	    prompt_remove(cache, p);
+	    ++cache->evictions;
+	}
+	p = next;
+    }
+}
+
+/* Find a prompt, and mark it most recently used. Called with the mutex
+ * held.
+ */
+static struct prompt *lookup(prompt_cache *cache, const char *path,
+			     const pj_file_stat *st, unsigned clock_rate)
+{
+    struct prompt *p;
+
+    for (p = cache->lru.next; p != &cache->lru; p = p->next) {
+	if (p->stale || p->key_rate != clock_rate ||
+	    pj_ansi_strcmp(p->path, path) != 0)
+	{
+	    continue;
+	}
+
+	/* The file was replaced: drop the old samples once unused. The
+	 * time has a one second resolution, the size tells most files
+	 * rewritten within the second apart.
+	 */
+	if (!PJ_TIME_VAL_EQ(p->mtime, st->mtime) ||
+	    p->file_size != st->size)
+	{
+	    if (p->ref_cnt)
+		p->stale = PJ_TRUE;
+	    else
+		prompt_remove(cache, p);
+	    return NULL;
+	}
+
+	pj_list_erase(p);
+	pj_list_insert_before(&cache->lru, p);
+	return p;
+    }
+
+    return NULL;
+}
+
+/* Append cnt samples to a growing buffer */
+static pj_status_t append(struct prompt *p, pj_size_t *cap,
+			  const pj_int16_t *samples, pj_size_t cnt)
+{
+    if (p->sample_cnt + cnt > *cap) {
+	pj_size_t new_cap = PJ_MAX(*cap * 2, p->sample_cnt + cnt);
+	pj_int16_t *buf;
+
+	buf = (pj_int16_t*) realloc(p->samples, new_cap * 2);
+	if (!buf)
+	    return PJ_ENOMEM;
+	p->samples = buf;
+	*cap = new_cap;
+    }
+
+    pj_memcpy(p->samples + p->sample_cnt, samples, cnt * 2);
+    p->sample_cnt += cnt;
+    return PJ_SUCCESS;
+}
+
+/* Decode a file, resampled to clock_rate if that's not zero */
+static pj_status_t decode(pj_pool_factory *pf, const char *path,
+			  unsigned clock_rate, struct prompt *p)
+{
+    pj_pool_t *pool;
+    pjmedia_port *port;
+    pjmedia_resample *resample = NULL;
+    pjmedia_frame frame;
+    pj_int16_t *in, *out;
+    unsigned spf, out_spf;
+    pj_size_t cap = 0;
+    pj_status_t status;
+
+    pool = pj_pool_create(pf, "prompt_decode", 4000, 4000, NULL);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    status = pjmedia_wav_player_port_create(pool, path, DECODE_PTIME,
+					    PJMEDIA_FILE_NO_LOOP, 0, &port);
+    if (status != PJ_SUCCESS)
+	goto on_return;
+
+    p->channel_count = PJMEDIA_PIA_CCNT(&port->info);
+    if (clock_rate == 0)
+	clock_rate = PJMEDIA_PIA_SRATE(&port->info);
+    spf = PJMEDIA_PIA_SPF(&port->info);
+    out_spf = spf;
+
+    if (clock_rate != PJMEDIA_PIA_SRATE(&port->info)) {
+	status = pjmedia_resample_create(pool, PJ_TRUE, PJ_FALSE,
+					 p->channel_count,
+					 PJMEDIA_PIA_SRATE(&port->info),
+					 clock_rate, spf, &resample);
+	if (status != PJ_SUCCESS)
+	    goto on_destroy;
+	out_spf = (unsigned)((pj_uint64_t)spf * clock_rate /
+			     PJMEDIA_PIA_SRATE(&port->info));
+    }
+
+    in = (pj_int16_t*) pj_pool_alloc(pool, spf * 2);
+    out = (pj_int16_t*) pj_pool_alloc(pool, out_spf * 2);
+
+    for (;;) {
+	frame.buf = in;
+	frame.size = spf * 2;
+	status = pjmedia_port_get_frame(port, &frame);
+	if (status != PJ_SUCCESS || frame.type != PJMEDIA_FRAME_TYPE_AUDIO)
+	    break;
+
+	/* The last frame of the file is padded with silence */
+	if (frame.size < spf * 2)
+	    pj_bzero((char*)in + frame.size, spf * 2 - frame.size);
+
+	if (resample) {
+	    pjmedia_resample_run(resample, in, out);
+	    status = append(p, &cap, out, out_spf);
+	} else {
+	    status = append(p, &cap, in, spf);
+	}
+	if (status != PJ_SUCCESS)
+	    break;
+    }
+    if (status == PJ_EEOF)
+	status = PJ_SUCCESS;
+    if (status == PJ_SUCCESS && p->sample_cnt == 0)
+	status = PJMEDIA_EWAVETOOSHORT;
+    p->clock_rate = clock_rate;
+
+on_destroy:
+    if (resample)
+	pjmedia_resample_destroy(resample);
+    pjmedia_port_destroy(port);
+
+on_return:
+    pj_pool_release(pool);
+    return status;
+}
+
+
+/* Move past cnt samples, looping or stopping at the end */
+static void advance(struct prompt_player *pp, pj_size_t cnt)
+{
+    pp->pos += cnt;
+    if (pp->pos == pp->prompt->sample_cnt) {
+	if (pp->options & PROMPT_CACHE_NO_LOOP)
+	    pp->eof = PJ_TRUE;
+	else
+	    pp->pos = 0;
+    }
+}
+
+static pj_status_t player_get_frame(pjmedia_port *this_port,
+				    pjmedia_frame *frame)
+{
+    struct prompt_player *pp = (struct prompt_player*)this_port;
+    const struct prompt *p = pp->prompt;
+    unsigned spf = PJMEDIA_PIA_SPF(&this_port->info);
+    pj_int16_t *dst = (pj_int16_t*)frame->buf;
+    pj_size_t cnt = 0, n;
+
+    if (pp->eof) {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_EEOF;
+    }
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = spf * 2;
+    frame->timestamp.u64 = pp->ts;
+    pp->ts += spf / p->channel_count;
+
+    /* A whole frame in the prompt: point at it */
+    if ((pp->options & PROMPT_CACHE_ZERO_COPY) &&
+	p->sample_cnt - pp->pos >= spf)
+    {
+	frame->buf = p->samples + pp->pos;
+	advance(pp, spf);
+	return PJ_SUCCESS;
+    }
+
+    while (cnt < spf && !pp->eof) {
+	n = PJ_MIN(spf - cnt, p->sample_cnt - pp->pos);
+	pj_memcpy(dst + cnt, p->samples + pp->pos, n * 2);
+	cnt += n;
+	advance(pp, n);
+    }
+    if (cnt < spf)
+	pj_bzero(dst + cnt, (spf - cnt) * 2);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t player_on_destroy(pjmedia_port *this_port)
+{
+    struct prompt_player *pp = (struct prompt_player*)this_port;
+    prompt_cache *cache = pp->cache;
+    struct prompt *p = pp->prompt;
+
+    if (!p)
+	return PJ_SUCCESS;
+    pp->prompt = NULL;
+
+    pj_mutex_lock(cache->mutex);
+    if (--p->ref_cnt == 0) {
+	--cache->in_use;
+	if (p->stale)
+	    prompt_remove(cache, p);
+	else
+	    evict(cache);
+    }
+    pj_mutex_unlock(cache->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t prompt_cache_create(pj_pool_factory *pf,
+				pj_size_t max_size,
+				prompt_cache **p_cache)
+{
+    pj_pool_t *pool;
+    prompt_cache *cache;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pf && p_cache, PJ_EINVAL);
+
+    pool = pj_pool_create(pf, "prompt_cache", 500, 500, NULL);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    cache = PJ_POOL_ZALLOC_T(pool, prompt_cache);
+    cache->pool = pool;
+    cache->max_size = max_size;
+    pj_list_init(&cache->lru);
+
+    status = pj_mutex_create_simple(pool, "prompt_cache", &cache->mutex);
+    if (status != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return status;
+    }
+
+    *p_cache = cache;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t prompt_cache_destroy(prompt_cache *cache)
+{
+    PJ_ASSERT_RETURN(cache, PJ_EINVAL);
+    PJ_ASSERT_RETURN(cache->in_use == 0, PJ_EBUSY);
+
+    while (!pj_list_empty(&cache->lru))
+	prompt_remove(cache, cache->lru.next);
+
+    pj_mutex_destroy(cache->mutex);
+    pj_pool_release(cache->pool);
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t prompt_cache_player_create(prompt_cache *cache,
+				       pj_pool_t *pool,
+				       const char *filename,
+				       unsigned clock_rate,
+				       unsigned ptime,
+				       unsigned options,
+				       pjmedia_port **p_port)
+{
+    struct prompt_player *pp;
+    struct prompt *p, *found;
+    pj_file_stat st;
+    pj_str_t name;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(cache && pool && filename && p_port, PJ_EINVAL);
+
+    if (ptime == 0)
+	ptime = DEFAULT_PTIME;
+
+    status = pj_file_getstat(filename, &st);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pj_mutex_lock(cache->mutex);
+    p = lookup(cache, filename, &st, clock_rate);
+    if (p) {
+	if (p->ref_cnt++ == 0)
+	    ++cache->in_use;
+	++cache->hits;
+    }
+    pj_mutex_unlock(cache->mutex);
+
+    if (!p) {
+	/* Decode it without holding the cache */
+	p = (struct prompt*) calloc(1, sizeof(*p));
+	if (!p)
+	    return PJ_ENOMEM;
+	p->path = (char*) malloc(pj_ansi_strlen(filename) + 1);
+	if (!p->path) {
+	    free(p);
+	    return PJ_ENOMEM;
+	}
+	pj_ansi_strcpy(p->path, filename);
+	p->mtime = st.mtime;
+	p->file_size = st.size;
+	p->key_rate = clock_rate;
+
+	status = decode(pool->factory, filename, clock_rate, p);
+	if (status != PJ_SUCCESS) {
+	    prompt_free(p);
+	    return status;
+	}
+	pj_mutex_lock(cache->mutex);
+	found = lookup(cache, filename, &st, clock_rate);
+	if (found) {
+	    /* Another port decoded it meanwhile */
+	    prompt_free(p);
+	    p = found;
+	    ++cache->hits;
+	} else {
+	    pj_list_insert_before(&cache->lru, p);
+	    cache->size += p->sample_cnt * 2;
+	    ++cache->count;
+	    ++cache->misses;
+	}
+	if (p->ref_cnt++ == 0)
+	    ++cache->in_use;
+	evict(cache);
+	pj_mutex_unlock(cache->mutex);
+    }
+
+    pp = PJ_POOL_ZALLOC_T(pool, struct prompt_player);
+    pp->cache = cache;
+    pp->prompt = p;
+    pp->options = options;
+
+    name = pj_str((char*)filename);
+    pjmedia_port_info_init(&pp->base.info, &name, SIGNATURE,
+			   p->clock_rate, p->channel_count, 16,
+			   p->clock_rate * ptime / 1000 * p->channel_count);
+    pp->base.get_frame = &player_get_frame;
+    pp->base.on_destroy = &player_on_destroy;
+
+    *p_port = &pp->base;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t prompt_cache_get_stat(prompt_cache *cache,
+				  prompt_cache_stat *stat)
+{
+    PJ_ASSERT_RETURN(cache && stat, PJ_EINVAL);
+
+    pj_mutex_lock(cache->mutex);
+    stat->count = cache->count;
+    stat->in_use = cache->in_use;
+    stat->size = cache->size;
+    stat->max_size = cache->max_size;
+    stat->hits = cache->hits;
+    stat->misses = cache->misses;
+    stat->evictions = cache->evictions;
+    pj_mutex_unlock(cache->mutex);
+
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PROMPT_CACHE_H__
+#define __PROMPT_CACHE_H__
+
+/**
+ * @file prompt_cache.h
+ * @brief Shared in-memory cache of decoded prompts.
+ *
+ * Every pjmedia_wav_player_port_create() opens and buffers its file
+ * again, so a prompt played by thousands of ports is read and decoded
+ * thousands of times. The cache decodes each file once, in any format
+ * the pjmedia WAV player reads, optionally resampled to the clock rate
+ * of the bridge, and serves any number of player ports from the same
+ * samples. A player port is only a cursor.
+ *
+ * Prompts are keyed by path, modification time, size and clock rate, so
+ * a file replaced on disk is decoded again for the ports created after.
+ * The time only has a one second resolution: a file rewritten within the
+ * same second with the same size, or restored with its old time and
+ * size, is not told apart.
+ * Prompts no port plays are kept until the cache goes over its memory
+ * cap, then evicted least recently used first.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque declaration of the cache.
+ */
+typedef struct prompt_cache prompt_cache;
+
+/**
+ * Player options.
+ */
+typedef enum prompt_cache_option
+{
+    /**
+     * Stop at the end of the prompt instead of looping, as
+     * PJMEDIA_FILE_NO_LOOP: get_frame() returns PJ_EEOF from then on.
+     */
+    PROMPT_CACHE_NO_LOOP = 1,
+
+    /**
+     * Let get_frame() point frame->buf into the cache instead of copying,
+     * as #MMAP_PLAYER_ZERO_COPY. Only for callers which read the frame
+     * from frame->buf after the call (such as confbridge).
+     */
+    PROMPT_CACHE_ZERO_COPY = 2
+
+} prompt_cache_option;
+
+/**
+ * Cache statistics.
+ */
+typedef struct prompt_cache_stat
+{
+    unsigned	    count;	    /**< Prompts held.			    */
+    unsigned	    in_use;	    /**< Prompts being played.		    */
+    pj_size_t	    size;	    /**< Bytes of samples held.		    */
+    pj_size_t	    max_size;	    /**< The memory cap.		    */
+    pj_uint32_t	    hits;	    /**< Players served from the cache.	    */
+    pj_uint32_t	    misses;	    /**< Players that decoded the file.	    */
+    pj_uint32_t	    evictions;	    /**< Prompts evicted for the cap.	    */
+} prompt_cache_stat;
+
+
+/**
+ * Create the cache.
+ *
+ * @param pf		    Pool factory.
+ * @param max_size	    Memory cap for the samples, in bytes. Prompts
+ *			    being played are never evicted, so the cache
+ *			    may go over it while they are.
+ * @param p_cache	    Pointer to receive the cache.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t prompt_cache_create(pj_pool_factory *pf,
+				pj_size_t max_size,
+				prompt_cache **p_cache);
+
+/**
+ * Destroy the cache. All its player ports must have been destroyed.
+ *
+ * @param cache		    The cache.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t prompt_cache_destroy(prompt_cache *cache);
+
+/**
+ * Create a player port for a file, decoding it into the cache unless it
+ * is there already.
+ *
+ * @param cache		    The cache.
+ * @param pool		    Pool to allocate the port.
+ * @param filename	    The WAV file.
+ * @param clock_rate	    Clock rate to resample the prompt to, zero to
+ *			    keep the file's.
+ * @param ptime		    Frame time in ms, zero for the default of
+ *			    20 ms.
+ * @param options	    Bitmask of #prompt_cache_option.
+ * @param p_port	    Pointer to receive the port.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t prompt_cache_player_create(prompt_cache *cache,
+				       pj_pool_t *pool,
+				       const char *filename,
+				       unsigned clock_rate,
+				       unsigned ptime,
+				       unsigned options,
+				       pjmedia_port **p_port);
+
+/**
+ * Get the statistics.
+ *
+ * @param cache		    The cache.
+ * @param stat		    The statistics.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t prompt_cache_get_stat(prompt_cache *cache,
+				  prompt_cache_stat *stat);
+
+
+PJ_END_DECL
+
+#endif	/* __PROMPT_CACHE_H__ */
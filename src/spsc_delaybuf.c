@@ -0,0 +1,387 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "spsc_delaybuf.h"
+
+#define THIS_FILE	"spsc_delaybuf.c"
+
+/* Default maximum delay, in ms, as pjmedia_delay_buf */
+#define DEFAULT_MAX_DELAY	400
+
+/* Interval to learn the level over, in ms, as pjmedia_delay_buf */
+#define RECALC_TIME		2000
+
+/* Ring positions, written by one side and read by the other */
+#if defined(__GNUC__)
+#   define RING_LOAD(p)		    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#   define RING_STORE(p, v)	    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#   include <windows.h>
+#   define RING_LOAD(p)		    ((unsigned)InterlockedCompareExchange( \
+					(LONG volatile*)(p), 0, 0))
+#   define RING_STORE(p, v)	    InterlockedExchange((LONG volatile*)(p), \
+						(LONG)(v))
+#else
+#   error "Atomic operations are not available for this compiler"
+#endif
+
+
+struct spsc_delay_buf
+{
+    char		 obj_name[PJ_MAX_OBJ_NAME];
+    unsigned		 samples_per_frame; /**< Of all channels.	    */
+    unsigned		 max_cnt;	/**< Maximum delay, in samples.	    */
+    unsigned		 mask;		/**< Ring capacity - 1, the capacity
+					     is a power of two.		    */
+    pj_int16_t		*ring;		/**< The samples.		    */
+    pjmedia_wsola	*wsola;		/**< NULL for a simple FIFO.	    */
+
+    /* Written by the producer only */
+    unsigned		 write_pos;	/**< Samples put.		    */
+    pj_uint32_t		 frames_put;	/**< Frames put.		    */
+    pj_uint32_t		 put_dropped;	/**< Samples dropped on put.	    */
+
+    /* Written by any thread, cleared by the consumer */
+    unsigned		 reset_req;	/**< Reset requested.		    */
+
+    /* Written by any thread, read by the consumer */
+    unsigned		 min_cnt;	/**< Level not to shrink below.	    */
+
+    /* Written by the consumer only */
+    unsigned		 read_pos;	/**< Samples taken from the ring.   */
+    pj_int16_t		*work;		/**< Samples taken out of the ring
+					     to shrink, not returned yet.   */
+    unsigned		 work_pos;	/**< First of them.		    */
+    unsigned		 work_cnt;	/**< Number of them.		    */
+    pj_bool_t		 prev_lost;	/**< Last frame was made up.	    */
+    unsigned		 level;		/**< Level at the last get.	    */
+    unsigned		 eff_cnt;	/**< Learnt level.		    */
+    unsigned		 recalc_frames;	/**< Frames per learning interval.  */
+    unsigned		 recalc_cnt;	/**< Frames in this interval.	    */
+    unsigned		 min_level;	/**< Lowest level in the interval.  */
+    unsigned		 max_level;	/**< Highest level in the interval. */
+    unsigned		 excess;	/**< Samples left to shrink by.	    */
+    pj_uint32_t		 frames_get;	/**< Frames taken.		    */
+    pj_uint32_t		 frames_expanded;/**< Frames made up.		    */
+    pj_uint32_t		 shrunk;	/**< Samples removed by WSOLA.	    */
+    pj_uint32_t		 get_dropped;	/**< Samples dropped on get.	    */
+};
+
+
+pj_status_t spsc_delay_buf_create(pj_pool_t *pool,
+				  const char *name,
+				  unsigned clock_rate,
+				  unsigned samples_per_frame,
+				  unsigned channel_count,
+				  unsigned max_delay,
+				  unsigned options,
+				  spsc_delay_buf **p_b)
+{
+    spsc_delay_buf *b;
+    unsigned frame_usec, cap;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && clock_rate && samples_per_frame &&
+		     channel_count && p_b, PJ_EINVAL);
+
+    if (!name)
+	name = "spscbuf%p";
+
+    b = PJ_POOL_ZALLOC_T(pool, spsc_delay_buf);
+    pj_ansi_snprintf(b->obj_name, PJ_MAX_OBJ_NAME, name, b);
+    b->samples_per_frame = samples_per_frame;
+
+    /* Frames may be shorter than a millisecond apart from an integer */
+    frame_usec = (unsigned)((pj_uint64_t)samples_per_frame * 1000000 /
+			    clock_rate / channel_count);
+    if (max_delay * 1000 < frame_usec)
+	max_delay = PJ_MAX(DEFAULT_MAX_DELAY, frame_usec / 1000);
+
+    /* Whole frames, two at least */
+    b->max_cnt = (unsigned)((pj_uint64_t)max_delay * 1000 / frame_usec) *
+		 samples_per_frame;
+    b->max_cnt = PJ_MAX(b->max_cnt, 2 * samples_per_frame);
+    b->eff_cnt = b->max_cnt;
+
+    /* Room for the consumer to be late by the maximum delay again */
+    for (cap = 1; cap < 2 * b->max_cnt; cap <<= 1)
+	;
+    b->mask = cap - 1;
+    b->ring = (pj_int16_t*) pj_pool_zalloc(pool, cap * sizeof(pj_int16_t));
+    b->work = (pj_int16_t*) pj_pool_zalloc(pool, (b->max_cnt +
+					   samples_per_frame) *
+					   sizeof(pj_int16_t));
+
+    b->recalc_frames = PJ_MAX(RECALC_TIME * 1000 / frame_usec, 1);
+    b->min_level = (unsigned)-1;
+
+    if ((options & SPSC_DELAY_BUF_SIMPLE_FIFO) == 0) {
+	status = pjmedia_wsola_create(pool, clock_rate, samples_per_frame,
+				      channel_count, PJMEDIA_WSOLA_NO_FADING,
+				      &b->wsola);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    PJ_LOG(5,(b->obj_name, "SPSC delay buffer created, max %u samples",
+	      b->max_cnt));
+
+    *p_b = b;
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t spsc_delay_buf_put(spsc_delay_buf *b, pj_int16_t frame[])
+{
+    unsigned n = b->samples_per_frame;
+    unsigned w = b->write_pos, pos, cnt;
+
+    if (b->mask + 1 - (w - RING_LOAD(&b->read_pos)) < n) {
+	b->put_dropped += n;
+	return PJ_ETOOMANY;
+    }
+
+    /* Copy in up to two parts around the end of the ring */
+    pos = w & b->mask;
+    cnt = PJ_MIN(n, b->mask + 1 - pos);
+    pj_memcpy(b->ring + pos, frame, cnt * sizeof(pj_int16_t));
+    pj_memcpy(b->ring, frame + cnt, (n - cnt) * sizeof(pj_int16_t));
+
+    ++b->frames_put;
+    RING_STORE(&b->write_pos, w + n);
+
+    return PJ_SUCCESS;
+}
+
+
+/* Copy cnt samples from the ring */
+static void ring_read(spsc_delay_buf *b, pj_int16_t *dst, unsigned cnt)
+{
+    unsigned r = b->read_pos, pos, part;
+
+    pos = r & b->mask;
+    part = PJ_MIN(cnt, b->mask + 1 - pos);
+    pj_memcpy(dst, b->ring + pos, part * sizeof(pj_int16_t));
+    pj_memcpy(dst + part, b->ring, (cnt - part) * sizeof(pj_int16_t));
+
+    RING_STORE(&b->read_pos, r + cnt);
+}
+
+
+/* Move up to cnt samples from the ring to the end of the work buffer */
+static void ring_to_work(spsc_delay_buf *b, unsigned w, unsigned cnt)
+{
+    if (b->work_pos) {
+	pj_memmove(b->work, b->work + b->work_pos,
+		   b->work_cnt * sizeof(pj_int16_t));
+	b->work_pos = 0;
+    }
+
+    cnt = PJ_MIN(cnt, w - b->read_pos);
+    ring_read(b, b->work + b->work_cnt, cnt);
+    b->work_cnt += cnt;
+}
+
+
+/* Remove erase_cnt samples from the buffered ones, with WSOLA as far as
+ * it can, dropping the oldest ones for the rest.
+ */
+static void shrink(spsc_delay_buf *b, unsigned w, unsigned erase_cnt)
+{
+    unsigned cnt;
+
+    /* WSOLA works on contiguous samples, take them all out of the ring */
+    ring_to_work(b, w, b->max_cnt + b->samples_per_frame - b->work_cnt);
+
+    if (b->wsola && b->work_cnt > erase_cnt) {
+	cnt = erase_cnt;
+	if (pjmedia_wsola_discard(b->wsola, b->work, b->work_cnt, NULL, 0,
+				  &cnt) == PJ_SUCCESS)
+	{
+	    b->work_cnt -= cnt;
+	    b->shrunk += cnt;
+	    erase_cnt -= cnt;
+	}
+    }
+
+    if (erase_cnt) {
+	erase_cnt = PJ_MIN(erase_cnt, b->work_cnt);
+	b->work_pos += erase_cnt;
+	b->work_cnt -= erase_cnt;
+	b->get_dropped += erase_cnt;
+
+	PJ_LOG(5,(b->obj_name, "Dropped %u eldest samples", erase_cnt));
+    }
+}
+
+
+/* Learn the level the buffer can run at. Over each interval, the lowest
+ * level seen by get should be one frame, or the minimum delay if that is
+ * more; the rest is latency to shrink.
+ */
+static void learn(spsc_delay_buf *b, unsigned level)
+{
+    unsigned n = PJ_MAX(b->samples_per_frame, RING_LOAD(&b->min_cnt));
+
+    b->min_level = PJ_MIN(b->min_level, level);
+    b->max_level = PJ_MAX(b->max_level, level);
+
+    if (++b->recalc_cnt < b->recalc_frames)
+	return;
+
+    if (b->min_level > n) {
+	b->excess = b->min_level - n;
+	b->eff_cnt = b->max_level - b->excess;
+    } else {
+	b->eff_cnt = b->max_level;
+    }
+    b->recalc_cnt = 0;
+    b->min_level = (unsigned)-1;
+    b->max_level = 0;
+}
+
+
+pj_status_t spsc_delay_buf_get(spsc_delay_buf *b, pj_int16_t frame[])
+{
+    unsigned n = b->samples_per_frame;
+    unsigned w = RING_LOAD(&b->write_pos);
+    unsigned level, erase_cnt, cnt;
+
+    if (RING_LOAD(&b->reset_req)) {
+	RING_STORE(&b->reset_req, 0);
+	RING_STORE(&b->read_pos, w);
+	b->work_pos = b->work_cnt = 0;
+	b->excess = 0;
+	if (b->wsola)
+	    pjmedia_wsola_reset(b->wsola, 0);
+    }
+
+    level = w - b->read_pos + b->work_cnt;
+    b->level = level;
+    ++b->frames_get;
+
+    if (b->wsola)
+	learn(b, level);
+
+    /* Over the maximum, or latency learnt to be useless: shrink. The
+     * learnt excess goes by a frame at most per get, never below a frame.
+     */
+    erase_cnt = 0;
+    if (level > b->max_cnt)
+	erase_cnt = level - b->max_cnt;
+    if (b->excess && level > n) {
+	cnt = PJ_MIN(b->excess, PJ_MIN(n, level - n));
+	b->excess -= cnt;
+	erase_cnt = PJ_MAX(erase_cnt, cnt);
+    }
+    if (erase_cnt) {
+	shrink(b, w, erase_cnt);
+	level = w - b->read_pos + b->work_cnt;
+    }
+
+    /* Under a frame: make one up and keep what we have for the next */
+    if (level < n) {
+	++b->frames_expanded;
+	if (b->wsola && pjmedia_wsola_generate(b->wsola, frame) ==
+			PJ_SUCCESS)
+	{
+	    b->prev_lost = PJ_TRUE;
+	    return PJ_SUCCESS;
+	}
+
+	/* Give what there is, then silence */
+	pj_memcpy(frame, b->work + b->work_pos,
+		  b->work_cnt * sizeof(pj_int16_t));
+	ring_read(b, frame + b->work_cnt, level - b->work_cnt);
+	pj_bzero(frame + level, (n - level) * sizeof(pj_int16_t));
+	b->work_pos = b->work_cnt = 0;
+	return PJ_SUCCESS;
+    }
+
+    /* The work buffer first, then the ring */
+    cnt = PJ_MIN(b->work_cnt, n);
+    pj_memcpy(frame, b->work + b->work_pos, cnt * sizeof(pj_int16_t));
+    b->work_pos += cnt;
+    b->work_cnt -= cnt;
+    if (cnt < n)
+	ring_read(b, frame + cnt, n - cnt);
+
+    /* WSOLA learns from what is played, to make up frames from it */
+    if (b->wsola) {
+	pjmedia_wsola_save(b->wsola, frame, b->prev_lost);
+	b->prev_lost = PJ_FALSE;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t spsc_delay_buf_reset(spsc_delay_buf *b)
+{
+    PJ_ASSERT_RETURN(b, PJ_EINVAL);
+
+    RING_STORE(&b->reset_req, 1);
+    PJ_LOG(5,(b->obj_name, "Delay buffer reset requested"));
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t spsc_delay_buf_set_min_delay(spsc_delay_buf *b, unsigned cnt)
+{
+    PJ_ASSERT_RETURN(b, PJ_EINVAL);
+
+    RING_STORE(&b->min_cnt, PJ_MIN(cnt, b->max_cnt));
+    PJ_LOG(5,(b->obj_name, "Minimum delay set to %u samples",
+	      PJ_MIN(cnt, b->max_cnt)));
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t spsc_delay_buf_get_stat(spsc_delay_buf *b,
+				    spsc_delay_buf_stat *stat)
+{
+    PJ_ASSERT_RETURN(b && stat, PJ_EINVAL);
+
+    stat->level = b->level;
+    stat->max_level = b->max_cnt;
+    stat->eff_level = b->eff_cnt;
+    stat->min_level = RING_LOAD(&b->min_cnt);
+    stat->frames_put = b->frames_put;
+    stat->frames_get = b->frames_get;
+    stat->frames_expanded = b->frames_expanded;
+    stat->shrunk = b->shrunk;
+    stat->dropped = b->put_dropped + b->get_dropped;
+
+    return PJ_SUCCESS;
+}
+
+
+pj_status_t spsc_delay_buf_destroy(spsc_delay_buf *b)
+{
+    PJ_ASSERT_RETURN(b, PJ_EINVAL);
+
+    if (b->wsola) {
+	pjmedia_wsola_destroy(b->wsola);
+	b->wsola = NULL;
+    }
+
+    return PJ_SUCCESS;
+}
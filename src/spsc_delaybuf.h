@@ -0,0 +1,186 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __SPSC_DELAYBUF_H__
+#define __SPSC_DELAYBUF_H__
+
+/**
+ * @file spsc_delaybuf.h
+ * @brief Lock-free delay buffer for one producer and one consumer.
+ *
+ * A replacement for pjmedia_delay_buf when frames are put by exactly one
+ * thread and taken by exactly one other, typically the capture and the
+ * playback callbacks of a sound device. The frames go through a ring
+ * whose positions are published with atomic loads and stores, so neither
+ * side ever takes a lock or waits for the other.
+ *
+ * The functions and their semantics follow pjmedia_delay_buf: frames are
+ * of a fixed size, a get from an empty buffer returns a frame made up by
+ * WSOLA from the previous ones, and a buffer over its maximum delay is
+ * shrunk with WSOLA. The difference is where the work is done: WSOLA
+ * state is owned by the consumer, so expanding and shrinking both happen
+ * in get, and put only copies. A put into a full ring (the consumer
+ * stalled for longer than twice the maximum delay) drops the new frame
+ * instead of the oldest one.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Opaque declaration of the buffer.
+ */
+typedef struct spsc_delay_buf spsc_delay_buf;
+
+/**
+ * Buffer options.
+ */
+typedef enum spsc_delay_buf_flag
+{
+    /**
+     * Use a plain FIFO: pad with silence when empty and drop the oldest
+     * samples when over the maximum delay, like
+     * PJMEDIA_DELAY_BUF_SIMPLE_FIFO.
+     */
+    SPSC_DELAY_BUF_SIMPLE_FIFO = 1
+
+} spsc_delay_buf_flag;
+
+/**
+ * Buffer statistics. The counts are in samples of all channels.
+ */
+typedef struct spsc_delay_buf_stat
+{
+    unsigned		level;		    /**< Samples buffered at the
+						 last get.		    */
+    unsigned		max_level;	    /**< Maximum delay.		    */
+    unsigned		eff_level;	    /**< Level the buffer shrinks
+						 to, learnt from the bursts
+						 of the producer.	    */
+    unsigned		min_level;	    /**< Level not to shrink below,
+						 the minimum delay.	    */
+    pj_uint32_t		frames_put;	    /**< Frames put.		    */
+    pj_uint32_t		frames_get;	    /**< Frames taken.		    */
+    pj_uint32_t		frames_expanded;    /**< Frames made up by WSOLA, or
+						 padded with silence.	    */
+    pj_uint32_t		shrunk;		    /**< Samples removed by WSOLA.  */
+    pj_uint32_t		dropped;	    /**< Samples dropped, by the
+						 producer on a full ring or
+						 by the consumer when WSOLA
+						 could not shrink enough.   */
+} spsc_delay_buf_stat;
+
+
+/**
+ * Create the buffer. The arguments are those of
+ * pjmedia_delay_buf_create().
+ *
+ * @param pool		    Pool to allocate the buffer.
+ * @param name		    Optional name, for logging.
+ * @param clock_rate	    Clock rate.
+ * @param samples_per_frame Samples per frame, of all channels.
+ * @param channel_count	    Number of channels.
+ * @param max_delay	    Maximum delay to accommodate, in ms. Less than
+ *			    a frame means the default of 400 ms.
+ * @param options	    Bitmask of #spsc_delay_buf_flag.
+ * @param p_b		    Pointer to receive the buffer.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_create(pj_pool_t *pool,
+				  const char *name,
+				  unsigned clock_rate,
+				  unsigned samples_per_frame,
+				  unsigned channel_count,
+				  unsigned max_delay,
+				  unsigned options,
+				  spsc_delay_buf **p_b);
+
+/**
+ * Put a frame. Only the producer thread may call this.
+ *
+ * @param b		    The buffer.
+ * @param frame		    Frame of samples_per_frame samples.
+ *
+ * @return		    PJ_SUCCESS, or PJ_ETOOMANY if the ring was full
+ *			    and the frame was dropped.
+ */
+pj_status_t spsc_delay_buf_put(spsc_delay_buf *b, pj_int16_t frame[]);
+
+/**
+ * Get a frame. Only the consumer thread may call this. When the buffer
+ * runs out, the frame is made up from the previous ones.
+ *
+ * @param b		    The buffer.
+ * @param frame		    Buffer to receive samples_per_frame samples.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_get(spsc_delay_buf *b, pj_int16_t frame[]);
+
+/**
+ * Empty the buffer. May be called from any thread; the samples are
+ * discarded by the consumer on its next get.
+ *
+ * @param b		    The buffer.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_reset(spsc_delay_buf *b);
+
+/**
+ * Set the level the buffer may not be shrunk below once it has grown to
+ * it, zero by default. The buffer grows when it runs out, as a made up
+ * frame delays the rest by a frame; this keeps the growth instead of
+ * learning it away, for callers that adapt the latency to the underruns
+ * they see. May be called from any thread.
+ *
+ * @param b		    The buffer.
+ * @param cnt		    Level in samples of all channels, capped at
+ *			    the maximum delay.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_set_min_delay(spsc_delay_buf *b, unsigned cnt);
+
+/**
+ * Get the statistics. May be called from any thread, the figures of the
+ * other threads may be one frame old.
+ *
+ * @param b		    The buffer.
+ * @param stat		    The statistics.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_get_stat(spsc_delay_buf *b,
+				    spsc_delay_buf_stat *stat);
+
+/**
+ * Destroy the buffer.
+ *
+ * @param b		    The buffer.
+ *
+ * @return		    PJ_SUCCESS on success.
+ */
+pj_status_t spsc_delay_buf_destroy(spsc_delay_buf *b);
+
+
+PJ_END_DECL
+
+#endif	/* __SPSC_DELAYBUF_H__ */
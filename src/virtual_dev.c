@@ -0,0 +1,699 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "virtual_dev.h"
+#include <pjmedia-audiodev/audiodev_imp.h>
+#include <pjlib-util.h>	/* pj_getopt */
+#include <pjlib.h>
+
+#include <stdlib.h>	/* strtol() */
+#include <math.h>	/* sin() */
+
+#define THIS_FILE	"virtual_dev.c"
+
+#define DRIVER_NAME	"Virtual"
+#define DEFAULT_CLOCK_RATE  16000
+#define DEFAULT_PTIME	    20	    /* ms */
+
+/* Index of the devices */
+enum
+{
+    DEV_VIRTUAL,
+    DEV_LOOPBACK,
+    DEV_COUNT
+};
+
+static const char *dev_names[DEV_COUNT] =
+{
+    "Virtual device",
+    "Virtual loopback"
+};
+
+/* Settings of the factory, set by virtual_aud_register() */
+static virtual_aud_param vparam;
+
+
+/* Factory */
+struct virtual_factory
+{
+    pjmedia_aud_dev_factory	 base;
+    pj_pool_factory		*pf;
+    pj_pool_t			*pool;
+};
+
+/* Stream, both directions running from one thread */
+struct virtual_stream
+{
+    pjmedia_aud_stream		 base;
+    pj_pool_t			*pool;
+    pjmedia_aud_param		 param;
+    pjmedia_aud_rec_cb		 rec_cb;
+    pjmedia_aud_play_cb		 play_cb;
+    void			*user_data;
+
+    unsigned			 spf;	    /**< Samples per frame, of all
+						 channels.		    */
+    pj_int16_t			*rec_buf;
+    pj_int16_t			*play_buf;
+    pj_timestamp		 rec_ts;
+    pj_timestamp		 play_ts;
+
+    pjmedia_port		*src_port;  /**< Capture file, if any.	    */
+    pj_int16_t			*src_buf;   /**< Frame read from src_port,
+						 of src_spf samples.	    */
+    unsigned			 src_spf;
+    unsigned			 src_pos;   /**< Samples of it used.	    */
+    double			 phase;	    /**< Of the capture tone.	    */
+    double			 phase_inc;
+    pjmedia_port		*sink_port; /**< Playback file, if any.	    */
+    pj_int16_t			*loop_buf;  /**< Loopback delay line, of
+						 loop_cnt + spf samples.    */
+    unsigned			 loop_cnt;
+
+    pj_thread_t			*thread;
+    volatile pj_bool_t		 quit;
+};
+
+
+/* Prototypes */
+static pj_status_t factory_init(pjmedia_aud_dev_factory *f);
+static pj_status_t factory_destroy(pjmedia_aud_dev_factory *f);
+static unsigned    factory_get_dev_count(pjmedia_aud_dev_factory *f);
+static pj_status_t factory_get_dev_info(pjmedia_aud_dev_factory *f,
+					unsigned index,
+					pjmedia_aud_dev_info *info);
+static pj_status_t factory_default_param(pjmedia_aud_dev_factory *f,
+					 unsigned index,
+					 pjmedia_aud_param *param);
+static pj_status_t factory_create_stream(pjmedia_aud_dev_factory *f,
+					 const pjmedia_aud_param *param,
+					 pjmedia_aud_rec_cb rec_cb,
+					 pjmedia_aud_play_cb play_cb,
+					 void *user_data,
+					 pjmedia_aud_stream **p_aud_strm);
+static pj_status_t factory_refresh(pjmedia_aud_dev_factory *f);
+
+static pj_status_t strm_get_param(pjmedia_aud_stream *strm,
+				  pjmedia_aud_param *param);
+static pj_status_t strm_get_cap(pjmedia_aud_stream *strm,
+				pjmedia_aud_dev_cap cap,
+				void *value);
+static pj_status_t strm_set_cap(pjmedia_aud_stream *strm,
+				pjmedia_aud_dev_cap cap,
+				const void *value);
+static pj_status_t strm_start(pjmedia_aud_stream *strm);
+static pj_status_t strm_stop(pjmedia_aud_stream *strm);
+static pj_status_t strm_destroy(pjmedia_aud_stream *strm);
+
+
+/* Operations */
+static pjmedia_aud_dev_factory_op factory_op =
+{
+    &factory_init,
+    &factory_destroy,
+    &factory_get_dev_count,
+    &factory_get_dev_info,
+    &factory_default_param,
+    &factory_create_stream,
+    &factory_refresh
+};
+
+static pjmedia_aud_stream_op stream_op =
+{
+    &strm_get_param,
+    &strm_get_cap,
+    &strm_set_cap,
+    &strm_start,
+    &strm_stop,
+    &strm_destroy
+};
+
+
+/****************************************************************************
+ * Factory operations
+ */
+
+/* Create the factory, called by pjmedia_aud_register_factory() */
+static pjmedia_aud_dev_factory* virtual_factory_create(pj_pool_factory *pf)
+{
+    struct virtual_factory *f;
+    pj_pool_t *pool;
+
+    pool = pj_pool_create(pf, "virtual_aud", 1000, 1000, NULL);
+    f = PJ_POOL_ZALLOC_T(pool, struct virtual_factory);
+    f->pf = pf;
+    f->pool = pool;
+    f->base.op = &factory_op;
+
+    return &f->base;
+}
+
+static pj_status_t factory_init(pjmedia_aud_dev_factory *f)
+{
+    PJ_UNUSED_ARG(f);
+
+    PJ_LOG(4,(THIS_FILE, "Virtual sound devices initialized, %s clock",
+	      vparam.fast ? "fast" : "real time"));
+    return PJ_SUCCESS;
+}
+
+static pj_status_t factory_destroy(pjmedia_aud_dev_factory *f)
+{
+    struct virtual_factory *vf = (struct virtual_factory*)f;
+    pj_pool_t *pool = vf->pool;
+
+    vf->pool = NULL;
+    pj_pool_release(pool);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t factory_refresh(pjmedia_aud_dev_factory *f)
+{
+    PJ_UNUSED_ARG(f);
+    return PJ_SUCCESS;
+}
+
+static unsigned factory_get_dev_count(pjmedia_aud_dev_factory *f)
+{
+    PJ_UNUSED_ARG(f);
+    return DEV_COUNT;
+}
+
+static pj_status_t factory_get_dev_info(pjmedia_aud_dev_factory *f,
+					unsigned index,
+					pjmedia_aud_dev_info *info)
+{
+    PJ_UNUSED_ARG(f);
+    PJ_ASSERT_RETURN(index < DEV_COUNT, PJMEDIA_EAUD_INVDEV);
+
+    pj_bzero(info, sizeof(*info));
+    pj_ansi_strcpy(info->name, dev_names[index]);
+    pj_ansi_strcpy(info->driver, DRIVER_NAME);
+    info->default_samples_per_sec = DEFAULT_CLOCK_RATE;
+    info->input_count = 2;
+    info->output_count = 2;
+    info->caps = PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY |
+		 PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY;
+    info->routes = 0;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t factory_default_param(pjmedia_aud_dev_factory *f,
+					 unsigned index,
+					 pjmedia_aud_param *param)
+{
+    pjmedia_aud_dev_info di;
+    pj_status_t status;
+
+    status = factory_get_dev_info(f, index, &di);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pj_bzero(param, sizeof(*param));
+    param->dir = PJMEDIA_DIR_CAPTURE_PLAYBACK;
+    param->rec_id = index;
+    param->play_id = index;
+    param->clock_rate = di.default_samples_per_sec;
+    param->channel_count = 1;
+    param->samples_per_frame = di.default_samples_per_sec *
+			       DEFAULT_PTIME / 1000;
+    param->bits_per_sample = 16;
+    param->flags = di.caps;
+    param->input_latency_ms = PJMEDIA_SND_DEFAULT_REC_LATENCY;
+    param->output_latency_ms = PJMEDIA_SND_DEFAULT_PLAY_LATENCY;
+
+    return PJ_SUCCESS;
+}
+
+
+/* Open the capture file, converting its clock rate to the stream's. The
+ * file is read in frames of the default ptime: the stream's frames may
+ * not be a whole number of milliseconds, see capture().
+ */
+static pj_status_t open_capture_file(struct virtual_stream *strm)
+{
+    pjmedia_port *port;
+    pj_status_t status;
+
+    status = pjmedia_wav_player_port_create(strm->pool, vparam.capture_file,
+					    0, 0, 0, &port);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (PJMEDIA_PIA_CCNT(&port->info) != strm->param.channel_count) {
+	pjmedia_port_destroy(port);
+	return PJMEDIA_ENCCHANNEL;
+    }
+
+    if (PJMEDIA_PIA_SRATE(&port->info) != strm->param.clock_rate) {
+	pjmedia_port *rport;
+
+	status = pjmedia_resample_port_create(strm->pool, port,
+					      strm->param.clock_rate, 0,
+					      &rport);
+	if (status != PJ_SUCCESS) {
+	    pjmedia_port_destroy(port);
+	    return status;
+	}
+	port = rport;
+    }
+
+    strm->src_port = port;
+    strm->src_spf = PJMEDIA_PIA_SPF(&port->info);
+    strm->src_buf = (pj_int16_t*)
+		    pj_pool_zalloc(strm->pool,
+				   strm->src_spf * sizeof(pj_int16_t));
+    strm->src_pos = strm->src_spf;
+    return PJ_SUCCESS;
+}
+
+static pj_status_t factory_create_stream(pjmedia_aud_dev_factory *f,
+					 const pjmedia_aud_param *param,
+					 pjmedia_aud_rec_cb rec_cb,
+					 pjmedia_aud_play_cb play_cb,
+					 void *user_data,
+					 pjmedia_aud_stream **p_aud_strm)
+{
+    struct virtual_factory *vf = (struct virtual_factory*)f;
+    struct virtual_stream *strm;
+    pj_pool_t *pool;
+    unsigned dev_id;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(param->bits_per_sample == 16, PJMEDIA_EAUD_SAMPFORMAT);
+    PJ_ASSERT_RETURN(param->ext_fmt.id == PJMEDIA_FORMAT_L16 ||
+		     param->ext_fmt.id == 0, PJMEDIA_EAUD_BADFORMAT);
+
+    dev_id = (param->dir & PJMEDIA_DIR_CAPTURE) ? param->rec_id :
+						  param->play_id;
+    PJ_ASSERT_RETURN(dev_id < DEV_COUNT, PJMEDIA_EAUD_INVDEV);
+
+    pool = pj_pool_create(vf->pf, "vaud%p", 1000, 1000, NULL);
+    PJ_ASSERT_RETURN(pool != NULL, PJ_ENOMEM);
+
+    strm = PJ_POOL_ZALLOC_T(pool, struct virtual_stream);
+    pj_memcpy(&strm->param, param, sizeof(*param));
+    strm->pool = pool;
+    strm->rec_cb = rec_cb;
+    strm->play_cb = play_cb;
+    strm->user_data = user_data;
+    strm->spf = param->samples_per_frame;
+    strm->rec_buf = (pj_int16_t*)
+		    pj_pool_zalloc(pool, strm->spf * sizeof(pj_int16_t));
+    strm->play_buf = (pj_int16_t*)
+		     pj_pool_zalloc(pool, strm->spf * sizeof(pj_int16_t));
+
+    /* Where the capture comes from */
+    if (dev_id == DEV_LOOPBACK) {
+	strm->loop_cnt = param->clock_rate * vparam.loop_delay_ms / 1000 *
+			 param->channel_count;
+	strm->loop_buf = (pj_int16_t*)
+			 pj_pool_zalloc(pool, (strm->loop_cnt + strm->spf) *
+					sizeof(pj_int16_t));
+    } else if ((param->dir & PJMEDIA_DIR_CAPTURE) && vparam.capture_file) {
+	status = open_capture_file(strm);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    } else {
+	strm->phase_inc = 2 * 3.14159265358979323846 * vparam.tone_freq /
+			  param->clock_rate;
+    }
+
+    /* Where the playback goes */
+    if (dev_id == DEV_VIRTUAL && (param->dir & PJMEDIA_DIR_PLAYBACK) &&
+	vparam.playback_file)
+    {
+	status = pjmedia_wav_writer_port_create(pool, vparam.playback_file,
+						param->clock_rate,
+						param->channel_count,
+						strm->spf, 16, 0, 0,
+						&strm->sink_port);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    /* The latencies are a frame, the callbacks being in lockstep */
+    strm->param.flags |= PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY |
+			 PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY;
+    strm->param.input_latency_ms = strm->spf * 1000 / param->clock_rate /
+				   param->channel_count;
+    strm->param.output_latency_ms = strm->param.input_latency_ms;
+
+    strm->base.op = &stream_op;
+    *p_aud_strm = &strm->base;
+
+    PJ_LOG(4,(THIS_FILE, "%s stream created, %u Hz, %u samples per frame",
+	      dev_names[dev_id], param->clock_rate, strm->spf));
+    return PJ_SUCCESS;
+
+on_error:
+    if (strm->src_port)
+	pjmedia_port_destroy(strm->src_port);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+/****************************************************************************
+ * Stream operations
+ */
+
+static pj_status_t strm_get_param(pjmedia_aud_stream *s,
+				  pjmedia_aud_param *pi)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)s;
+
+    PJ_ASSERT_RETURN(strm && pi, PJ_EINVAL);
+    pj_memcpy(pi, &strm->param, sizeof(*pi));
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t strm_get_cap(pjmedia_aud_stream *s,
+				pjmedia_aud_dev_cap cap,
+				void *pval)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)s;
+
+    PJ_ASSERT_RETURN(s && pval, PJ_EINVAL);
+
+    switch (cap) {
+    case PJMEDIA_AUD_DEV_CAP_INPUT_LATENCY:
+	*(unsigned*)pval = strm->param.input_latency_ms;
+	return PJ_SUCCESS;
+    case PJMEDIA_AUD_DEV_CAP_OUTPUT_LATENCY:
+	*(unsigned*)pval = strm->param.output_latency_ms;
+	return PJ_SUCCESS;
+    default:
+	return PJMEDIA_EAUD_INVCAP;
+    }
+}
+
+static pj_status_t strm_set_cap(pjmedia_aud_stream *s,
+				pjmedia_aud_dev_cap cap,
+				const void *pval)
+{
+    PJ_UNUSED_ARG(s);
+    PJ_UNUSED_ARG(cap);
+    PJ_UNUSED_ARG(pval);
+
+    return PJMEDIA_EAUD_INVCAP;
+}
+
+
+/* Fill the capture frame */
+static void capture(struct virtual_stream *strm)
+{
+    unsigned ch = strm->param.channel_count, i, c;
+
+    if (strm->loop_buf) {
+	/* The eldest samples of the delay line */
+	pj_memcpy(strm->rec_buf, strm->loop_buf,
+		  strm->spf * sizeof(pj_int16_t));
+	pj_memmove(strm->loop_buf, strm->loop_buf + strm->spf,
+		   strm->loop_cnt * sizeof(pj_int16_t));
+    } else if (strm->src_port) {
+	/* Copy out of the file's frames, reading the next as needed */
+	for (i = 0; i < strm->spf; ) {
+	    unsigned cnt;
+
+	    if (strm->src_pos == strm->src_spf) {
+		pjmedia_frame f;
+
+		f.type = PJMEDIA_FRAME_TYPE_AUDIO;
+		f.buf = strm->src_buf;
+		f.size = strm->src_spf * 2;
+		if (pjmedia_port_get_frame(strm->src_port, &f) != PJ_SUCCESS ||
+		    f.type != PJMEDIA_FRAME_TYPE_AUDIO)
+		{
+		    pj_bzero(strm->src_buf,
+			     strm->src_spf * sizeof(pj_int16_t));
+		}
+		strm->src_pos = 0;
+	    }
+
+	    cnt = PJ_MIN(strm->spf - i, strm->src_spf - strm->src_pos);
+	    pj_memcpy(strm->rec_buf + i, strm->src_buf + strm->src_pos,
+		      cnt * sizeof(pj_int16_t));
+	    strm->src_pos += cnt;
+	    i += cnt;
+	}
+    } else {
+	for (i = 0; i < strm->spf; i += ch) {
+	    pj_int16_t v = (pj_int16_t)(8192 * sin(strm->phase));
+	    for (c = 0; c < ch; ++c)
+		strm->rec_buf[i + c] = v;
+	    strm->phase += strm->phase_inc;
+	}
+	strm->phase = fmod(strm->phase, 2 * 3.14159265358979323846);
+    }
+}
+
+/* Take the playback frame */
+static void playback(struct virtual_stream *strm, pjmedia_frame *f)
+{
+    if (f->type != PJMEDIA_FRAME_TYPE_AUDIO)
+	pj_bzero(strm->play_buf, strm->spf * sizeof(pj_int16_t));
+
+    if (strm->loop_buf) {
+	pj_memcpy(strm->loop_buf + strm->loop_cnt, strm->play_buf,
+		  strm->spf * sizeof(pj_int16_t));
+    } else if (strm->sink_port) {
+	f->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	f->size = strm->spf * 2;
+	pjmedia_port_put_frame(strm->sink_port, f);
+    }
+}
+
+/* The device clock */
+static int PJ_THREAD_FUNC clock_thread(void *arg)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)arg;
+    unsigned samples = strm->spf / strm->param.channel_count;
+    pj_timestamp freq, start, now;
+    pj_uint64_t frame_ticks, ticks = 0;
+    pjmedia_frame f;
+
+    /* Ticks of the system clock per frame, with the drift */
+    pj_get_timestamp_freq(&freq);
+    frame_ticks = (pj_uint64_t)((double)freq.u64 * samples /
+				strm->param.clock_rate * 1000000.0 /
+				(1000000.0 + vparam.drift_ppm));
+    pj_get_timestamp(&start);
+
+    while (!strm->quit) {
+	if (!vparam.fast) {
+	    pj_uint64_t due = start.u64 + ticks;
+
+	    /* Late by the jitter, without moving the next ones */
+	    if (vparam.jitter_ms)
+		due += freq.u64 * (pj_rand() % (vparam.jitter_ms + 1)) / 1000;
+
+	    pj_get_timestamp(&now);
+	    while (now.u64 < due && !strm->quit) {
+		pj_thread_sleep((unsigned)((due - now.u64) * 1000 / freq.u64));
+		pj_get_timestamp(&now);
+	    }
+	    ticks += frame_ticks;
+	}
+
+	/* Playback first, so a loopback without delay hears this frame */
+	if (strm->param.dir & PJMEDIA_DIR_PLAYBACK) {
+	    f.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	    f.buf = strm->play_buf;
+	    f.size = strm->spf * 2;
+	    f.timestamp.u64 = strm->play_ts.u64;
+	    f.bit_info = 0;
+	    if ((*strm->play_cb)(strm->user_data, &f) != PJ_SUCCESS)
+		break;
+	    playback(strm, &f);
+	    strm->play_ts.u64 += samples;
+	}
+
+	if (strm->param.dir & PJMEDIA_DIR_CAPTURE) {
+	    capture(strm);
+	    f.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	    f.buf = strm->rec_buf;
+	    f.size = strm->spf * 2;
+	    f.timestamp.u64 = strm->rec_ts.u64;
+	    f.bit_info = 0;
+	    if ((*strm->rec_cb)(strm->user_data, &f) != PJ_SUCCESS)
+		break;
+	    strm->rec_ts.u64 += samples;
+	}
+
+	/* Let the application's threads run */
+	if (vparam.fast)
+	    pj_thread_sleep(0);
+    }
+
+    return 0;
+}
+
+static pj_status_t strm_start(pjmedia_aud_stream *s)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)s;
+    pj_status_t status;
+
+    if (strm->thread)
+	return PJ_SUCCESS;
+
+    strm->quit = PJ_FALSE;
+    status = pj_thread_create(strm->pool, "vaudio", &clock_thread, strm,
+			      0, 0, &strm->thread);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    PJ_LOG(4,(THIS_FILE, "Virtual stream started"));
+    return PJ_SUCCESS;
+}
+
+static pj_status_t strm_stop(pjmedia_aud_stream *s)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)s;
+
+    if (!strm->thread)
+	return PJ_SUCCESS;
+
+    strm->quit = PJ_TRUE;
+    pj_thread_join(strm->thread);
+    pj_thread_destroy(strm->thread);
+    strm->thread = NULL;
+
+    PJ_LOG(4,(THIS_FILE, "Virtual stream stopped"));
+    return PJ_SUCCESS;
+}
+
+static pj_status_t strm_destroy(pjmedia_aud_stream *s)
+{
+    struct virtual_stream *strm = (struct virtual_stream*)s;
+
+    strm_stop(s);
+
+    if (strm->src_port)
+	pjmedia_port_destroy(strm->src_port);
+    if (strm->sink_port)
+	pjmedia_port_destroy(strm->sink_port);
+    pj_pool_release(strm->pool);
+
+    return PJ_SUCCESS;
+}
+
+
+/****************************************************************************
+ * API
+ */
+
+void virtual_aud_param_default(virtual_aud_param *prm)
+{
+    pj_bzero(prm, sizeof(*prm));
+    prm->tone_freq = 440;
+}
+
+pj_status_t virtual_aud_get_options(const char *app_name,
+				    int argc, char *argv[],
+				    virtual_aud_param *prm,
+				    pj_bool_t *enabled)
+{
+    enum { OPT_TONE = 1, OPT_IN, OPT_OUT, OPT_FAST, OPT_JITTER, OPT_DRIFT,
+	   OPT_LOOP };
+    struct pj_getopt_option long_options[] = {
+	{ "virtual",	0, 0, 'V' },
+	{ "vtone",	1, 0, OPT_TONE },
+	{ "vin",	1, 0, OPT_IN },
+	{ "vout",	1, 0, OPT_OUT },
+	{ "vfast",	0, 0, OPT_FAST },
+	{ "vjitter",	1, 0, OPT_JITTER },
+	{ "vdrift",	1, 0, OPT_DRIFT },
+	{ "vloop",	1, 0, OPT_LOOP },
+	{ NULL, 0, 0, 0 },
+    };
+    int c;
+    int option_index;
+    long val = 0;
+    char *err = "";
+
+    *enabled = PJ_FALSE;
+
+    pj_optind = 0;
+    while((c=pj_getopt_long(argc,argv, "V", long_options,
+			    &option_index))!=-1)
+    {
+	if (c == OPT_TONE || c == OPT_JITTER || c == OPT_DRIFT ||
+	    c == OPT_LOOP)
+	{
+	    val = strtol(pj_optarg, &err, 10);
+	    if (*err || (val < 0 && c != OPT_DRIFT)) {
+		PJ_LOG(3,(app_name, "Error: invalid value for --%s",
+			  long_options[option_index].name));
+		return PJ_EINVAL;
+	    }
+	}
+
+	switch (c) {
+	case 'V':
+	    *enabled = PJ_TRUE;
+	    break;
+	case OPT_TONE:
+	    prm->tone_freq = (unsigned)val;
+	    break;
+	case OPT_IN:
+	    prm->capture_file = pj_optarg;
+	    break;
+	case OPT_OUT:
+	    prm->playback_file = pj_optarg;
+	    break;
+	case OPT_FAST:
+	    prm->fast = PJ_TRUE;
+	    break;
+	case OPT_JITTER:
+	    prm->jitter_ms = (unsigned)val;
+	    break;
+	case OPT_DRIFT:
+	    prm->drift_ppm = (int)val;
+	    break;
+	case OPT_LOOP:
+	    prm->loop_delay_ms = (unsigned)val;
+	    break;
+	default:
+	    /* Unknown options */
+	    PJ_LOG(3,(app_name, "Error: unknown options '%c'", pj_optopt));
+	    return PJ_EINVAL;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+pj_status_t virtual_aud_register(const virtual_aud_param *prm)
+{
+    if (prm)
+	pj_memcpy(&vparam, prm, sizeof(vparam));
+    else
+	virtual_aud_param_default(&vparam);
+
+    return pjmedia_aud_register_factory(&virtual_factory_create);
+}
+
+pj_status_t virtual_aud_unregister(void)
+{
+    return pjmedia_aud_unregister_factory(&virtual_factory_create);
+}
@@ -0,0 +1,160 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __VIRTUAL_DEV_H__
+#define __VIRTUAL_DEV_H__
+
+/**
+ * @file virtual_dev.h
+ * @brief Virtual sound devices, for running the samples without audio
+ * hardware.
+ *
+ * The factory adds two devices to the audio subsystem:
+ *  - "Virtual device": captures a looped WAV file or a tone, and plays
+ *    into a WAV file or nowhere.
+ *  - "Virtual loopback": captures what it played, after a delay.
+ *
+ * Each stream runs its callbacks from a thread of its own, either paced
+ * by the system clock or as fast as possible. The clock can be made to
+ * drift by some ppm, and each callback to be late by a random amount, to
+ * exercise the buffering of the application the way real devices do.
+ */
+#include <pjmedia.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * Settings of the virtual devices, shared by all their streams.
+ */
+typedef struct virtual_aud_param
+{
+    /**
+     * WAV file to capture from, played in a loop. Its clock rate is
+     * converted to the stream's, its channel count has to match. NULL
+     * to capture a tone.
+     */
+    const char	*capture_file;
+
+    /**
+     * Frequency of the tone to capture, in Hz, zero for silence.
+     *
+     * Default: 440
+     */
+    unsigned	 tone_freq;
+
+    /**
+     * WAV file to write the playback to, NULL to discard it. Only one
+     * stream at a time should play into it.
+     */
+    const char	*playback_file;
+
+    /**
+     * Call back as fast as possible instead of in real time.
+     *
+     * Default: PJ_FALSE
+     */
+    pj_bool_t	 fast;
+
+    /**
+     * Make each callback late by a random time up to this, in ms. The
+     * callbacks after it are not delayed by it.
+     *
+     * Default: 0
+     */
+    unsigned	 jitter_ms;
+
+    /**
+     * Run the clock this many ppm faster than the system's, or slower
+     * when negative.
+     *
+     * Default: 0
+     */
+    int		 drift_ppm;
+
+    /**
+     * Delay from playback to capture of the loopback device, in ms.
+     *
+     * Default: 0
+     */
+    unsigned	 loop_delay_ms;
+
+} virtual_aud_param;
+
+
+/**
+ * Usage text of the options read by virtual_aud_get_options().
+ */
+#define VIRTUAL_AUD_USAGE \
+"  -V, --virtual        Add the virtual sound devices, to run without audio \n"\
+"                       hardware					    \n"\
+"      --vtone=HZ       Tone to capture (default=440, 0 for silence)	    \n"\
+"      --vin=FILE       Capture WAV FILE, in a loop, instead of the tone    \n"\
+"      --vout=FILE      Write the playback to WAV FILE (default=discard)    \n"\
+"      --vfast          Call back as fast as possible, not in real time	    \n"\
+"      --vjitter=MS     Make each callback up to MS late (default=0)	    \n"\
+"      --vdrift=PPM     Drift of the clock, may be negative (default=0)    \n"\
+"      --vloop=MS       Delay of the loopback device (default=0)	    \n"
+
+
+/**
+ * Initialize the settings with the defaults.
+ *
+ * @param prm		The settings.
+ */
+void virtual_aud_param_default(virtual_aud_param *prm);
+
+/**
+ * Parse the options of #VIRTUAL_AUD_USAGE from the command line, as
+ * get_snd_options() does for the sound options.
+ *
+ * @param app_name	Name for logging.
+ * @param argc		Argument count.
+ * @param argv		Arguments.
+ * @param prm		Settings to update, initialized by the caller.
+ * @param enabled	Set to PJ_TRUE if the devices were asked for.
+ *
+ * @return		PJ_SUCCESS, or PJ_EINVAL on an invalid option.
+ */
+pj_status_t virtual_aud_get_options(const char *app_name,
+				    int argc, char *argv[],
+				    virtual_aud_param *prm,
+				    pj_bool_t *enabled);
+
+/**
+ * Add the virtual devices to the audio subsystem, after the devices
+ * found by pjmedia_aud_subsys_init(). The settings are copied, the file
+ * names are not.
+ *
+ * @param prm		The settings, or NULL for the defaults.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t virtual_aud_register(const virtual_aud_param *prm);
+
+/**
+ * Remove the virtual devices from the audio subsystem.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+pj_status_t virtual_aud_unregister(void);
+
+
+PJ_END_DECL
+
+#endif	/* __VIRTUAL_DEV_H__ */